@@ -71,12 +71,15 @@ if __name__=='__main__':
 		exit(1)
 
 	binary = []
-	width = len(data)
-	height = len(data[0])
+	width = len(data[0])
+	height = len(data)
 	if width > CHUNKSIZE or height > CHUNKSIZE:
 		for zz in range(0, height, CHUNKSIZE):
 			for xx in range(0, width, CHUNKSIZE):
-				writeTileSection(binary, data, CHUNKSIZE, CHUNKSIZE, x+xx, y, z+zz, xx, zz, min(xx+CHUNKSIZE, width), min(zz+CHUNKSIZE, height))
+				# chunks on the far edges are clipped to the map, and their header has to say so
+				ex = min(xx+CHUNKSIZE, width)
+				ez = min(zz+CHUNKSIZE, height)
+				writeTileSection(binary, data, ex-xx, ez-zz, x+xx, y, z+zz, xx, zz, ex, ez)
 	else:
 		writeTileSection(binary, data, width, height, x, y, z)
 
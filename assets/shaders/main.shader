@@ -1,6 +1,7 @@
 VERTPROGRAM
     // Input vertex attributes
-    in uint vertexInfo1;
+    layout(location = 0) in uint vertexInfo1;
+    layout(location = 1) in uint vertexInfo2;
 
     // Uniform values
     uniform mat4 mvp;
@@ -8,6 +9,7 @@ VERTPROGRAM
 
     // Output vertex attributes (to fragment shader)
     out vec2 fragTexCoord;
+    flat out vec2 fragTileBase;
     out vec2 lightTexCoord;
 
     void main()
@@ -26,19 +28,22 @@ VERTPROGRAM
         z += drawPosition.z;
         uint vno = (vertexInfo1 >> 30u) & 3u;
 
+        // merged faces repeat the tile texture across the quad
         uint tno = vertexInfo1 & 0xFFFu;
-        float tx = float((tno & 0x3Fu) + (vno & 1u)) / 64.0;
-        float ty = float(((tno >> 6u) & 0x3Fu) + (vno >> 1u)) / 64.0;
+        float tx = float(vertexInfo2 & 0xFFu);
+        float ty = float((vertexInfo2 >> 8u) & 0xFFu);
         // Calculate final vertex position
         gl_Position = mvp*vec4(x, y, z, 1.0);
 
         // Send vertex attributes to fragment shader
         fragTexCoord = vec2(tx, ty);
+        fragTileBase = vec2(float(tno & 0x3Fu), float((tno >> 6u) & 0x3Fu));
     }
 ENDPROGRAM
 FRAGPROGRAM
     // Input vertex attributes (from vertex shader)
     in vec2 fragTexCoord;
+    flat in vec2 fragTileBase;
     in vec2 lightTexCoord;
 
     // Input uniform values
@@ -65,7 +70,8 @@ FRAGPROGRAM
         float x = (gl_FragCoord.x / renderwidth) * 3.141;
         float d = gl_FragCoord.z / gl_FragCoord.w - sin(x);
         float alpha = getFogFactor(d);
-        vec4 texelColor = texture(texture0, fragTexCoord);
+        vec2 tileCoord = min(fract(fragTexCoord), 63.5 / 64.0);
+        vec4 texelColor = textureGrad(texture0, (fragTileBase + tileCoord) / 64.0, dFdx(fragTexCoord) / 64.0, dFdy(fragTexCoord) / 64.0);
         // vec3 light = texture(texture1, lightTexCoord).rgb * LightLevel;
         vec4 fogColor = vec4(FogColor.rgb, 1.0f);
         finalColor = mix(texelColor*vec4(LightLevel, LightLevel, LightLevel, 1.0), fogColor, alpha);
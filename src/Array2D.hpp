@@ -48,10 +48,10 @@ class Array2D {
         w = width;
         h = height;
         l = w * h;
+        if (values != nullptr) {
+            delete [] values;
+        }
         if (l > 0) {
-			if (values != nullptr) {
-				delete values;
-			}
             values = new T[l];
         } else {
             values = nullptr;
@@ -11,6 +11,7 @@ static const char *assetPathObjects = "assets/objects/";
 static const char *assetPathLevels = "assets/levels/";
 static const char *assetPathMaps = "assets/maps/";
 static const char *assetPathShaders = "assets/shaders/";
+static const char *assetPathScripts = "assets/scripts/";
 static const char *assetPathRoot = "assets/";
 static char assetPathBuffer[512] = {0};
 
@@ -0,0 +1,1650 @@
+#include "Benchmark.hpp"
+#include "AssetPath.hpp"
+#include "Entity.hpp"
+#include "Helpers.hpp"
+#include "JobSystem.hpp"
+#include "LevelFormat.hpp"
+#include "LevelLoader.hpp"
+#include "MappedFile.hpp"
+#include "ScriptCache.hpp"
+#include "ScriptEngine/ScriptAssemblyCompiler.hpp"
+#include "ScriptEngine/ScriptExpressionCompiler.hpp"
+#include "ScriptEngine/ScriptJit.hpp"
+#include "ScriptEngine/ScriptProfiler.hpp"
+#include "raylib.h"
+#include "raymath.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#define BENCHMARK_LOOKUPS 2000000
+#define BENCHMARK_LOAD_REPEATS 5
+#define BENCHMARK_TILE_EDITS 200
+#define BENCHMARK_RAYS 200000
+#define BENCHMARK_RAY_CHECKS 2000
+#define BENCHMARK_RAY_CHECK_STEP (1.0f/512)
+#define BENCHMARK_LOS_MAX 4096
+#define BENCHMARK_LIGHT_EDITS 64
+#define BENCHMARK_LIGHT_CHECKS 8
+#define BENCHMARK_CULL_VIEWS 500
+#define BENCHMARK_CULL_RAYS 200
+#define BENCHMARK_CULL_FOVY 60.0f
+#define BENCHMARK_CULL_ASPECT (16.0f/9.0f)
+#define BENCHMARK_SCRIPT_RUNS 200000
+#define BENCHMARK_SCRIPT_ENTITIES 4096
+#define BENCHMARK_SCRIPT_FRAMES 30
+#define BENCHMARK_SCRIPT_PROGRAMS 500
+#define BENCHMARK_SCRIPT_TIMED_RUNS 200
+#define BENCHMARK_SCRIPT_LOADS 200
+#define BENCHMARK_TILE_QUERIES 20000
+#define BENCHMARK_LOAD_RADIUS 24.0f
+#define BENCHMARK_STREAM_RADIUS 32.0f
+#define BENCHMARK_STREAM_STEP 0.5f
+#define BENCHMARK_STREAM_CHECK_EVERY 32
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// random position at player height in a non-solid tile
+static Vector3 randomOpenPosition(MapData* map) {
+    Vector3 p = {0, 0, 0};
+    for (int tries=0; tries<100; tries++) {
+        size_t c = rand() % map->chunkCount();
+        Vec3I cp = map->chunkPosition(c);
+        TileArray* chunk = map->chunk(c);
+        if (chunk->width() == 0 || chunk->height() == 0) {
+            continue;
+        }
+        p = {(float)(cp.x + rand() % chunk->width()), (float)cp.y, (float)(cp.z + rand() % chunk->height())};
+        MapTile* tile = GlobalMapTileRegistry->of(map->get(p.x, p.y, p.z));
+        if (tile == nullptr || !tile->isSolid) {
+            break;
+        }
+    }
+    return {p.x + (rand() % 1000) / 1000.0f, p.y + PLAYER_HEIGHT, p.z + (rand() % 1000) / 1000.0f};
+}
+
+// copy every light map texel into out, in chunk order, and return how many differ from the previous contents
+static size_t snapshotLights(MapData* map, Color* out) {
+    size_t t = 0, changed = 0;
+    for (size_t c=0; c<map->chunkCount(); c++) {
+        Vec3I p = map->chunkPosition(c);
+        TileArray* chunk = map->chunk(c);
+        for (int z=0; z<chunk->height(); z++) {
+            for (int x=0; x<chunk->width(); x++, t++) {
+                Color v = *map->getLight(p.x + x, p.y, p.z + z);
+                if (v.r != out[t].r || v.g != out[t].g || v.b != out[t].b) {
+                    changed++;
+                }
+                out[t] = v;
+            }
+        }
+    }
+    return changed;
+}
+
+// hash of every chunk's position, size and tiles
+static unsigned long long chunkChecksum(MapData* map) {
+    unsigned long long checksum = 0;
+    for (size_t c=0; c<map->chunkCount(); c++) {
+        Vec3I p = map->chunkPosition(c);
+        TileArray* chunk = map->chunk(c);
+        checksum = checksum * 31 + p.x * 7 + p.y * 5 + p.z * 3 + chunk->width() + chunk->height();
+        for (int k=0; k<chunk->size(); k++) {
+            checksum = checksum * 31 + ((unsigned short*)*chunk)[k];
+        }
+    }
+    return checksum;
+}
+
+/* Count the chunks of full lying wholly within radius tiles of pos (ignoring height) that streamed doesn't hold
+   exactly the same: tiles, light maps and meshes. checked is increased by the number of chunks compared. */
+static size_t compareStreamed(MapData* full, MapData* streamed, Vector3 pos, float radius, size_t& checked) {
+    size_t mismatches = 0;
+    for (size_t c=0; c<full->chunkCount(); c++) {
+        Vec3I p = full->chunkPosition(c);
+        TileArray* a = full->chunk(c);
+        float dx = fmaxf(fabsf(pos.x - p.x), fabsf(pos.x - (p.x + a->width())));
+        float dz = fmaxf(fabsf(pos.z - p.z), fabsf(pos.z - (p.z + a->height())));
+        if (sqrtf(dx*dx + dz*dz) > radius) {
+            continue;
+        }
+        checked++;
+        int s = streamed->findChunk(p.x, p.y, p.z);
+        if (s == -1) {
+            mismatches++;
+            continue;
+        }
+        Vec3I q = streamed->chunkPosition(s);
+        TileArray* b = streamed->chunk(s);
+        MapIntMesh* ma = full->chunkMesh(c);
+        MapIntMesh* mb = streamed->chunkMesh(s);
+        bool same = q.x == p.x && q.y == p.y && q.z == p.z && a->width() == b->width() && a->height() == b->height() &&
+            ma->vertexCount == mb->vertexCount && ma->triangleCount == mb->triangleCount;
+        if (same && a->size() > 0) {
+            same = !memcmp((unsigned short*)*a, (unsigned short*)*b, a->size()*sizeof(unsigned short));
+        }
+        if (same && ma->vertexCount > 0) {
+            same = !memcmp(ma->verts, mb->verts, ma->vertexCount*2*sizeof(unsigned int)) &&
+                !memcmp(ma->indices, mb->indices, ma->triangleCount*3*sizeof(unsigned short));
+        }
+        for (int z=0; same && z<a->height(); z++) {
+            for (int x=0; same && x<a->width(); x++) {
+                Color la = *full->getLight(p.x + x, p.y, p.z + z), lb = *streamed->getLight(p.x + x, p.y, p.z + z);
+                same = la.r == lb.r && la.g == lb.g && la.b == lb.b;
+            }
+        }
+        mismatches += !same;
+    }
+    return mismatches;
+}
+
+// first registered tile matching the light flags, or 0
+static unsigned short findTile(bool blocksLight) {
+    for (unsigned short id=1; GlobalMapTileRegistry->has(id); id++) {
+        MapTile* tile = GlobalMapTileRegistry->of(id);
+        if (tile->light == 0 && tile->blocksLight == blocksLight && tile->isSolid == blocksLight) {
+            return id;
+        }
+    }
+    return 0;
+}
+
+#pragma region Run
+bool Benchmark::Run(const char* level) {
+    FilePathList files = {0};
+    if (level == nullptr) {
+        files = LoadDirectoryFilesEx(assetPathLevels, ".dat", false);
+    } else {
+        files.count = 1;
+        files.paths = (char**)&level;
+    }
+    bool success = true;
+    Scripts("enemy_smoke_cloud_script");
+    ScriptProfiling("enemy_smoke_cloud_script");
+    NativeScripts();
+    ScriptOptimizer();
+    ScriptLoading();
+    for (unsigned int i=0; i<files.count; i++) {
+        printf("== %s ==\n", files.paths[i]);
+        LevelRead(files.paths[i]);
+        LevelLoad(files.paths[i]);
+        LevelSwitch(files.paths[i]);
+        LevelFormats(files.paths[i]);
+        Streaming(files.paths[i]);
+        if (!LoadLevelHeadless(files.paths[i])) {
+            printf("Failed to load level \"%s\"\n", files.paths[i]);
+            success = false;
+            continue;
+        }
+        ChunkLookups(GlobalMapData);
+        Meshing(GlobalMapData);
+        TileEdits(GlobalMapData);
+        RayCasts(GlobalMapData);
+        LineOfSight(GlobalMapData);
+        Lighting(GlobalMapData);
+        FloodLighting(GlobalMapData);
+        Culling(GlobalMapData);
+        EntityScripts(GlobalMapData);
+        ScriptVariants(GlobalMapData);
+        TileQueries(GlobalMapData);
+    }
+    if (level == nullptr) {
+        UnloadDirectoryFiles(files);
+    }
+    return success;
+}
+#pragma endregion
+
+#pragma region LoadLevelHeadless
+bool Benchmark::LoadLevelHeadless(const char* fname) {
+    GlobalMapData->ClearMap();
+    GlobalEntityRenderer->clear();
+    MappedFile file;
+    if (!file.open(fname)) {
+        MissingAssetError(fname);
+        return false;
+    }
+    RBuffer readbuf(file.data(), file.length());
+    if (!GlobalMapData->LoadMap(readbuf)) {
+        AssetFormatError(fname);
+        return false;
+    }
+    GloablScriptInterface->loadTileTable(GlobalMapTileRegistry);
+    return true;
+}
+#pragma endregion
+
+#pragma region LevelRead
+/* Time reading and parsing a level, without meshing, from a copy of the whole file read through a stream (the way
+   levels used to be loaded) and straight from a memory mapping. Both have to produce the same chunks. */
+void Benchmark::LevelRead(const char* fname) {
+    static const char* modes[] = {"copied", "mapped"};
+    double seconds[2];
+    unsigned long long checksum[2];
+    for (int mode=0; mode<2; mode++) {
+        seconds[mode] = 1e30;
+        for (int i=0; i<BENCHMARK_LOAD_REPEATS; i++) {
+            GlobalMapData->ClearMap();
+            GlobalEntityRenderer->clear();
+            bool loaded = false;
+            auto start = std::chrono::steady_clock::now();
+            if (mode == 0) {
+                std::ifstream fd(fname, std::ios::binary);
+                if (fd.is_open()) {
+                    std::vector<unsigned char> bytes(fstreamlen(fd));
+                    fd.read((char*)bytes.data(), bytes.size());
+                    RBuffer readbuf(bytes.data(), bytes.size());
+                    loaded = bytes.size() > 0 && GlobalMapData->LoadMap(readbuf);
+                }
+            } else {
+                MappedFile file;
+                if (file.open(fname)) {
+                    RBuffer readbuf(file.data(), file.length());
+                    loaded = GlobalMapData->LoadMap(readbuf);
+                }
+            }
+            double t = secondsSince(start);
+            if (!loaded) {
+                return;
+            }
+            if (t < seconds[mode]) {
+                seconds[mode] = t;
+            }
+        }
+        checksum[mode] = chunkChecksum(GlobalMapData);
+    }
+    printf("Level read (%llu chunks): %s %.3f ms, %s %.3f ms, speedup %.1fx, %s\n",
+        (unsigned long long)GlobalMapData->chunkCount(), modes[0], seconds[0]*1000.0, modes[1], seconds[1]*1000.0,
+        seconds[0] / seconds[1], checksum[0] == checksum[1] ? "0 mismatches" : "chunks differ");
+}
+#pragma endregion
+
+#pragma region LevelLoad
+/* Time loading and meshing a level on a single worker and on the full job system. */
+void Benchmark::LevelLoad(const char* fname) {
+    JobSystem* pool = GlobalJobSystem;
+    JobSystem single(1);
+    double seconds[2];
+    for (int mode=0; mode<2; mode++) {
+        GlobalJobSystem = mode == 0 ? &single : pool;
+        seconds[mode] = 1e30;
+        for (int i=0; i<BENCHMARK_LOAD_REPEATS; i++) {
+            auto start = std::chrono::steady_clock::now();
+            if (!LoadLevelHeadless(fname)) {
+                GlobalJobSystem = pool;
+                return;
+            }
+            GlobalMapData->GenerateMesh();
+            double t = secondsSince(start);
+            if (t < seconds[mode]) {
+                seconds[mode] = t;
+            }
+        }
+    }
+    GlobalJobSystem = pool;
+    printf("Level load + mesh (%llu chunks): 1 worker %.2f ms, %llu workers %.2f ms, speedup %.1fx\n",
+        (unsigned long long)GlobalMapData->chunkCount(), seconds[0]*1000.0,
+        (unsigned long long)pool->workerCount(), seconds[1]*1000.0, seconds[0] / seconds[1]);
+}
+#pragma endregion
+
+#pragma region LevelSwitch
+/* Time how long switching levels holds up the main thread: loading and meshing in place, against starting a
+   LevelLoader and taking the staged level once it is ready (GL uploads aside, which need a window). Both have to
+   produce the same chunks, meshes and entities. */
+void Benchmark::LevelSwitch(const char* fname) {
+    LevelLoader loader;
+    double blocked[2], background = 1e30;
+    unsigned long long checksum[2];
+    size_t triangles[2], entities[2];
+    for (int mode=0; mode<2; mode++) {
+        blocked[mode] = 1e30;
+        for (int i=0; i<BENCHMARK_LOAD_REPEATS; i++) {
+            double t;
+            if (mode == 0) {
+                auto start = std::chrono::steady_clock::now();
+                GlobalMapData->ClearMap();
+                GlobalEntityRenderer->clear();
+                if (!LevelLoader::read(GlobalMapData, fname, false, false)) {
+                    return;
+                }
+                t = secondsSince(start);
+            } else {
+                auto start = std::chrono::steady_clock::now();
+                loader.start(fname, false, false);
+                t = secondsSince(start);
+                // the game keeps running frames meanwhile
+                while (loader.loading()) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+                double b = secondsSince(start);
+                if (b < background) {
+                    background = b;
+                }
+                start = std::chrono::steady_clock::now();
+                GlobalEntityRenderer->clear();
+                if (!loader.take(GlobalMapData)) {
+                    printf("Level switch: background load failed\n");
+                    return;
+                }
+                t += secondsSince(start);
+            }
+            if (t < blocked[mode]) {
+                blocked[mode] = t;
+            }
+        }
+        checksum[mode] = chunkChecksum(GlobalMapData);
+        triangles[mode] = GlobalMapData->meshTriangleCount;
+        entities[mode] = GlobalEntityRenderer->length();
+    }
+    bool same = checksum[0] == checksum[1] && triangles[0] == triangles[1] && entities[0] == entities[1];
+    printf("Level switch (%llu chunks, %llu entities): main thread blocked %.3f ms in place, %.3f ms staged "
+        "(%.2f ms in the background), %s\n",
+        (unsigned long long)GlobalMapData->chunkCount(), (unsigned long long)entities[1], blocked[0]*1000.0,
+        blocked[1]*1000.0, background*1000.0, same ? "0 mismatches" : "levels differ");
+}
+#pragma endregion
+
+#pragma region LevelFormats
+/* Convert a level to v2 and compare it with the source file: file size, load time, and that both load the same
+   chunks, light maps and entities. Converting the v2 file again has to give the same bytes. Then time loading only
+   the chunks within BENCHMARK_LOAD_RADIUS of the middle of the level. */
+void Benchmark::LevelFormats(const char* fname) {
+    std::string files[2];
+    {
+        MappedFile file;
+        if (!file.open(fname)) {
+            return;
+        }
+        files[0].assign((const char*)file.data(), file.length());
+    }
+    std::ostringstream out(std::ios::binary|std::ios::out), again(std::ios::binary|std::ios::out);
+    RBuffer v1((const unsigned char*)files[0].data(), files[0].size());
+    if (!LevelFormat::convert(GlobalMapData, v1, out)) {
+        printf("Level formats: conversion failed\n");
+        return;
+    }
+    files[1] = out.str();
+    RBuffer v2((const unsigned char*)files[1].data(), files[1].size());
+    bool stable = LevelFormat::convert(GlobalMapData, v2, again) && again.str() == files[1];
+    double seconds[2];
+    unsigned long long checksum[2];
+    size_t entities[2];
+    std::vector<Color> lights[2];
+    for (int mode=0; mode<2; mode++) {
+        seconds[mode] = 1e30;
+        for (int i=0; i<BENCHMARK_LOAD_REPEATS; i++) {
+            GlobalMapData->ClearMap();
+            GlobalEntityRenderer->clear();
+            RBuffer readbuf((const unsigned char*)files[mode].data(), files[mode].size());
+            auto start = std::chrono::steady_clock::now();
+            if (!GlobalMapData->LoadMap(readbuf)) {
+                printf("Level formats: %s load failed\n", mode == 0 ? "source" : "v2");
+                return;
+            }
+            double t = secondsSince(start);
+            if (t < seconds[mode]) {
+                seconds[mode] = t;
+            }
+        }
+        checksum[mode] = chunkChecksum(GlobalMapData);
+        entities[mode] = GlobalEntityRenderer->length();
+        size_t texels = 0;
+        for (size_t c=0; c<GlobalMapData->chunkCount(); c++) {
+            texels += GlobalMapData->chunk(c)->size();
+        }
+        lights[mode].resize(texels);
+        snapshotLights(GlobalMapData, lights[mode].data());
+    }
+    size_t mismatches = (checksum[0] != checksum[1]) + (entities[0] != entities[1]) + !stable;
+    if (lights[0].size() != lights[1].size()) {
+        mismatches++;
+    } else {
+        for (size_t t=0; t<lights[0].size(); t++) {
+            Color a = lights[0][t], b = lights[1][t];
+            mismatches += a.r != b.r || a.g != b.g || a.b != b.b;
+        }
+    }
+    // centre of the level's bounds
+    size_t total = GlobalMapData->chunkCount();
+    int x1 = INT_MAX, z1 = INT_MAX, x2 = INT_MIN, z2 = INT_MIN;
+    for (size_t c=0; c<total; c++) {
+        Vec3I p = GlobalMapData->chunkPosition(c);
+        TileArray* chunk = GlobalMapData->chunk(c);
+        x1 = std::min(x1, p.x);
+        z1 = std::min(z1, p.z);
+        x2 = std::max(x2, p.x + chunk->width());
+        z2 = std::max(z2, p.z + chunk->height());
+    }
+    GlobalMapData->loadCenter = {(x1 + x2) * 0.5f, 0, (z1 + z2) * 0.5f};
+    GlobalMapData->loadRadius = BENCHMARK_LOAD_RADIUS;
+    double near = 1e30;
+    for (int i=0; i<BENCHMARK_LOAD_REPEATS; i++) {
+        GlobalMapData->ClearMap();
+        GlobalEntityRenderer->clear();
+        auto start = std::chrono::steady_clock::now();
+        if (!GlobalMapData->LoadMap(v2)) {
+            GlobalMapData->loadRadius = 0;
+            printf("Level formats: v2 load within %.0f tiles failed\n", BENCHMARK_LOAD_RADIUS);
+            return;
+        }
+        double t = secondsSince(start);
+        if (t < near) {
+            near = t;
+        }
+    }
+    size_t loaded = GlobalMapData->chunkCount();
+    GlobalMapData->loadRadius = 0;
+    GlobalMapData->loadCenter = {0, 0, 0};
+    printf("Level formats (%llu chunks): source %llu bytes %.3f ms, v2 %llu bytes (%.1f%%) %.3f ms, "
+        "v2 within %.0f tiles %llu chunks %.3f ms, %llu mismatches\n",
+        (unsigned long long)total, (unsigned long long)files[0].size(), seconds[0]*1000.0,
+        (unsigned long long)files[1].size(), files[1].size() * 100.0 / files[0].size(), seconds[1]*1000.0,
+        BENCHMARK_LOAD_RADIUS, (unsigned long long)loaded, near*1000.0, (unsigned long long)mismatches);
+}
+#pragma endregion
+
+#pragma region Streaming
+/* Walk a camera corner to corner across a level streamed from a v2 copy of it without light maps, so streamed chunks
+   are baked as they come in, one batch per frame. Every BENCHMARK_STREAM_CHECK_EVERY frames the queue is drained and
+   the chunks well inside the streaming radius have to match a full load of the level: tiles, light and meshes. */
+void Benchmark::Streaming(const char* fname) {
+    std::string tmp = std::string(fname) + ".stream";
+    MapData full;
+    full.SetTileRegistry(GlobalMapTileRegistry);
+    full.SetTextureRegistry(GlobalTextureRegistry);
+    full.greedyMeshing = GlobalMapData->greedyMeshing;
+    full.deferEntities = true;
+    {
+        MappedFile file;
+        if (!file.open(fname)) {
+            return;
+        }
+        RBuffer data(file.data(), file.length());
+        std::string sections;
+        std::ofstream out(tmp, std::ios::binary|std::ios::out);
+        bool ok = LevelFormat::copySections(data, sections);
+        data.seek(0);
+        ok = ok && full.LoadMap(data) && full.SaveMapV2(out, sections, false);
+        out.close();
+        if (!ok || !out.good() || full.chunkCount() == 0) {
+            printf("Streaming: writing the v2 copy failed\n");
+            full.ClearMap();
+            std::remove(tmp.c_str());
+            return;
+        }
+    }
+    full.BuildLighting();
+    full.GenerateMesh();
+    int x1 = INT_MAX, z1 = INT_MAX, x2 = INT_MIN, z2 = INT_MIN;
+    for (size_t c=0; c<full.chunkCount(); c++) {
+        Vec3I p = full.chunkPosition(c);
+        x1 = std::min(x1, p.x);
+        z1 = std::min(z1, p.z);
+        x2 = std::max(x2, p.x + full.chunk(c)->width());
+        z2 = std::max(z2, p.z + full.chunk(c)->height());
+    }
+    Vector3 from = {x1 + 0.5f, PLAYER_HEIGHT, z1 + 0.5f}, to = {x2 - 0.5f, PLAYER_HEIGHT, z2 - 0.5f};
+    MapData* map = GlobalMapData;
+    bool streaming = map->streaming, flood = map->floodLighting, defer = map->deferEntities;
+    float radius = map->loadRadius;
+    Vector3 center = map->loadCenter;
+    map->ClearMap();
+    GlobalEntityRenderer->clear();
+    map->streaming = true;
+    map->floodLighting = false;
+    map->deferEntities = true;
+    map->loadRadius = BENCHMARK_STREAM_RADIUS;
+    map->loadCenter = from;
+    auto start = std::chrono::steady_clock::now();
+    bool loaded = LevelLoader::read(map, tmp.c_str(), true, false) && map->isStreaming();
+    double load = secondsSince(start);
+    size_t frames = 0, checked = 0, mismatches = 0, maxResident = 0;
+    double total = 0, worst = 0;
+    if (loaded) {
+        int steps = (int)(Vector3Distance(from, to) / BENCHMARK_STREAM_STEP);
+        for (int s=0; s<=steps; s++) {
+            Vector3 pos = Vector3Lerp(from, to, steps > 0 ? (float)s / steps : 0);
+            start = std::chrono::steady_clock::now();
+            map->UpdateStreaming(pos, 0, false);
+            map->UpdateDirty(false);
+            double t = secondsSince(start);
+            total += t;
+            worst = std::max(worst, t);
+            frames++;
+            maxResident = std::max(maxResident, map->chunksResident);
+            if (s % BENCHMARK_STREAM_CHECK_EVERY == 0 || s == steps) {
+                while (map->UpdateStreaming(pos, 0, false) > 0) {}
+                map->UpdateDirty(false);
+                mismatches += compareStreamed(&full, map, pos, BENCHMARK_STREAM_RADIUS - 2*LIGHT_RANGE, checked);
+            }
+        }
+    } else {
+        printf("Streaming: loading the v2 copy failed\n");
+    }
+    size_t count = full.chunkCount(), slots = map->chunkCount();
+    size_t streamed = map->chunksStreamedIn, evicted = map->chunksEvicted;
+    map->ClearMap();
+    GlobalEntityRenderer->clear();
+    map->streaming = streaming;
+    map->floodLighting = flood;
+    map->deferEntities = defer;
+    map->loadRadius = radius;
+    map->loadCenter = center;
+    full.ClearMap();
+    std::remove(tmp.c_str());
+    if (!loaded) {
+        return;
+    }
+    printf("Streaming (%llu chunks, %.0f tiles): load %.3f ms, at most %llu resident (%.1f%%) in %llu slots, "
+        "%llu streamed in, %llu evicted, frame avg %.3f ms max %.3f ms, %llu chunks checked, %llu mismatches\n",
+        (unsigned long long)count, BENCHMARK_STREAM_RADIUS, load*1000.0, (unsigned long long)maxResident,
+        maxResident * 100.0 / count, (unsigned long long)slots, (unsigned long long)streamed,
+        (unsigned long long)evicted, frames > 0 ? total / frames * 1000.0 : 0.0, worst*1000.0,
+        (unsigned long long)checked, (unsigned long long)mismatches);
+}
+#pragma endregion
+
+#pragma region ChunkLookups
+void Benchmark::ChunkLookups(MapData* map) {
+    if (map->chunkCount() == 0) {
+        return;
+    }
+    Vec3I lo = map->chunkPosition(0);
+    Vec3I hi = lo;
+    for (size_t i=0; i<map->chunkCount(); i++) {
+        Vec3I p = map->chunkPosition(i);
+        TileArray* chunk = map->chunk(i);
+        lo = lo.min(p);
+        hi = hi.max(Vec3I(p.x + chunk->width(), p.y + 1, p.z + chunk->height()));
+    }
+    int* points = new int[BENCHMARK_LOOKUPS*3];
+    srand(1992);
+    for (size_t i=0; i<BENCHMARK_LOOKUPS; i++) {
+        points[i*3+0] = lo.x + rand() % (hi.x - lo.x);
+        points[i*3+1] = lo.y + rand() % (hi.y - lo.y);
+        points[i*3+2] = lo.z + rand() % (hi.z - lo.z);
+    }
+    size_t mismatches = 0;
+    long long checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i=0; i<BENCHMARK_LOOKUPS; i++) {
+        checksum += map->findChunk(points[i*3+0], points[i*3+1], points[i*3+2]);
+    }
+    double indexed = secondsSince(start);
+    // the linear scan is much slower, so only time a slice of the samples
+    size_t linearcount = BENCHMARK_LOOKUPS / 20;
+    start = std::chrono::steady_clock::now();
+    for (size_t i=0; i<linearcount; i++) {
+        checksum += map->findChunkLinear(points[i*3+0], points[i*3+1], points[i*3+2]);
+    }
+    double linear = secondsSince(start);
+    for (size_t i=0; i<linearcount; i++) {
+        int x = points[i*3+0], y = points[i*3+1], z = points[i*3+2];
+        if (map->findChunk(x, y, z) != map->findChunkLinear(x, y, z)) {
+            mismatches++;
+        }
+    }
+    delete [] points;
+    double indexedns = indexed * 1e9 / BENCHMARK_LOOKUPS;
+    double linearns = linear * 1e9 / linearcount;
+    printf("Chunk lookups (%llu chunks): indexed %.1f ns, linear %.1f ns, speedup %.1fx, %llu mismatches (checksum %lld)\n",
+        (unsigned long long)map->chunkCount(), indexedns, linearns, linearns / indexedns,
+        (unsigned long long)mismatches, checksum);
+}
+#pragma endregion
+
+#pragma region Meshing
+void Benchmark::Meshing(MapData* map) {
+    bool greedy = map->greedyMeshing;
+    size_t verts[2], triangles[2];
+    double seconds[2];
+    for (int mode=0; mode<2; mode++) {
+        map->greedyMeshing = mode == 1;
+        auto start = std::chrono::steady_clock::now();
+        map->GenerateMesh();
+        seconds[mode] = secondsSince(start);
+        verts[mode] = map->meshVertexCount;
+        triangles[mode] = map->meshTriangleCount;
+    }
+    map->greedyMeshing = greedy;
+    printf("Meshing: per-tile %llu verts / %llu indices in %.2f ms, greedy %llu verts / %llu indices in %.2f ms (%.1f%% of per-tile)\n",
+        (unsigned long long)verts[0], (unsigned long long)triangles[0]*3, seconds[0]*1000.0,
+        (unsigned long long)verts[1], (unsigned long long)triangles[1]*3, seconds[1]*1000.0,
+        verts[0] > 0 ? verts[1] * 100.0 / verts[0] : 0.0);
+}
+#pragma endregion
+
+#pragma region TileEdits
+/* Time single tile edits followed by a dirty chunk remesh, against remeshing the whole level. */
+void Benchmark::TileEdits(MapData* map) {
+    if (map->chunkCount() == 0) {
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    map->GenerateMesh();
+    double full = secondsSince(start);
+    srand(1992);
+    size_t chunks = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t i=0; i<BENCHMARK_TILE_EDITS; i++) {
+        size_t c = rand() % map->chunkCount();
+        Vec3I p = map->chunkPosition(c);
+        TileArray* chunk = map->chunk(c);
+        if (chunk->width() == 0 || chunk->height() == 0) {
+            continue;
+        }
+        int x = p.x + rand() % chunk->width();
+        int z = p.z + rand() % chunk->height();
+        // write the tile back unchanged so the level stays the same
+        map->setTile(x, p.y, z, map->get(x, p.y, z));
+        chunks += map->UpdateDirty(false);
+    }
+    double edits = secondsSince(start);
+    printf("Tile edits: %.3f ms per edit (%.1f chunks remeshed), full remesh %.2f ms\n",
+        edits * 1000.0 / BENCHMARK_TILE_EDITS, (double)chunks / BENCHMARK_TILE_EDITS, full * 1000.0);
+}
+#pragma endregion
+
+#pragma region RayCasts
+/* Measure horizontal rays per second from random open tiles, and check their distances
+   against a fine fixed-step march. */
+void Benchmark::RayCasts(MapData* map) {
+    if (map->chunkCount() == 0) {
+        return;
+    }
+    Vector3* origins = new Vector3[BENCHMARK_RAYS];
+    Vector3* dirs = new Vector3[BENCHMARK_RAYS];
+    srand(1992);
+    for (size_t i=0; i<BENCHMARK_RAYS; i++) {
+        float a = (rand() % 36000) * (PI / 18000.0f);
+        origins[i] = randomOpenPosition(map);
+        dirs[i] = {cosf(a), 0, sinf(a)};
+    }
+    HitInfo hit;
+    double total = 0;
+    size_t hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i=0; i<BENCHMARK_RAYS; i++) {
+        map->RayCast(origins[i], dirs[i], hit);
+        if (hit.distance != INFINITY) {
+            total += hit.distance;
+            hits++;
+        }
+    }
+    double seconds = secondsSince(start);
+    float maxerror = 0;
+    size_t mismatches = 0;
+    for (size_t i=0; i<BENCHMARK_RAY_CHECKS; i++) {
+        map->RayCast(origins[i], dirs[i], hit);
+        float t = 0;
+        float reference = INFINITY;
+        while (t < 100) {
+            Vector3 p = Vector3Add(origins[i], Vector3Scale(dirs[i], t));
+            MapTile* tile = GlobalMapTileRegistry->of(map->get(p));
+            if (tile != nullptr && tile->isSolid) {
+                reference = t;
+                break;
+            }
+            t += BENCHMARK_RAY_CHECK_STEP;
+        }
+        if ((reference == INFINITY) != (hit.distance == INFINITY)) {
+            mismatches++;
+        } else if (reference != INFINITY) {
+            float error = fabsf(reference - hit.distance);
+            if (error > BENCHMARK_RAY_CHECK_STEP * 2) {
+                mismatches++;
+            }
+            maxerror = std::max(maxerror, error);
+        }
+    }
+    delete [] origins;
+    delete [] dirs;
+    printf("Ray casts: %.2f M rays/s, %.1f%% hit, mean distance %.2f, max error vs reference %.4f, %llu mismatches\n",
+        BENCHMARK_RAYS / seconds / 1e6, hits * 100.0 / BENCHMARK_RAYS, hits > 0 ? total / hits : 0.0,
+        maxerror, (unsigned long long)mismatches);
+}
+#pragma endregion
+
+#pragma region LineOfSight
+/* Compare per-entity line of sight rays against one batched call, for growing entity counts. */
+void Benchmark::LineOfSight(MapData* map) {
+    if (map->chunkCount() == 0) {
+        return;
+    }
+    srand(1992);
+    Vector3 camera = randomOpenPosition(map);
+    Vector3* origins = new Vector3[BENCHMARK_LOS_MAX];
+    Vector3* dirs = new Vector3[BENCHMARK_LOS_MAX];
+    float* dists = new float[BENCHMARK_LOS_MAX];
+    HitInfo* hits = new HitInfo[BENCHMARK_LOS_MAX];
+    for (size_t i=0; i<BENCHMARK_LOS_MAX; i++) {
+        origins[i] = randomOpenPosition(map);
+        dirs[i] = Vector3Subtract(camera, origins[i]);
+        dists[i] = Vector3Length(dirs[i]);
+    }
+    printf("Line of sight:");
+    size_t mismatches = 0;
+    for (size_t count=16; count<=BENCHMARK_LOS_MAX; count*=16) {
+        size_t repeats = BENCHMARK_LOS_MAX * 4 / count;
+        HitInfo hit;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t r=0; r<repeats; r++) {
+            for (size_t i=0; i<count; i++) {
+                map->RayCast(origins[i], dirs[i], dists[i], hit);
+            }
+        }
+        double single = secondsSince(start) / repeats;
+        start = std::chrono::steady_clock::now();
+        for (size_t r=0; r<repeats; r++) {
+            map->RayCastBatch(origins, dirs, dists, hits, count);
+        }
+        double batch = secondsSince(start) / repeats;
+        for (size_t i=0; i<count; i++) {
+            map->RayCast(origins[i], dirs[i], dists[i], hit);
+            if (hit.distance != hits[i].distance || hit.face != hits[i].face || hit.tileid != hits[i].tileid) {
+                mismatches++;
+            }
+        }
+        printf(" %llu entities %.1f/%.1f ns per ray (single/batch),", (unsigned long long)count,
+            single * 1e9 / count, batch * 1e9 / count);
+    }
+    printf(" %llu mismatches\n", (unsigned long long)mismatches);
+    delete [] origins;
+    delete [] dirs;
+    delete [] dists;
+    delete [] hits;
+}
+#pragma endregion
+
+#pragma region Lighting
+/* Time baking the light maps on a single worker and on the full job system, and check both agree. */
+void Benchmark::Lighting(MapData* map) {
+    if (map->chunkCount() == 0) {
+        return;
+    }
+    JobSystem* pool = GlobalJobSystem;
+    JobSystem single(1);
+    double seconds[2];
+    size_t texels = 0, lit = 0, mismatches = 0;
+    for (size_t c=0; c<map->chunkCount(); c++) {
+        texels += map->chunk(c)->width() * map->chunk(c)->height();
+    }
+    Color* first = new Color[texels];
+    for (int mode=0; mode<2; mode++) {
+        GlobalJobSystem = mode == 0 ? &single : pool;
+        auto start = std::chrono::steady_clock::now();
+        map->BuildLighting();
+        seconds[mode] = secondsSince(start);
+        size_t t = 0;
+        for (size_t c=0; c<map->chunkCount(); c++) {
+            Vec3I p = map->chunkPosition(c);
+            TileArray* chunk = map->chunk(c);
+            for (int z=0; z<chunk->height(); z++) {
+                for (int x=0; x<chunk->width(); x++, t++) {
+                    Color* l = map->getLight(p.x + x, p.y, p.z + z);
+                    Color v = l != nullptr ? *l : Color{0, 0, 0, 0};
+                    if (mode == 0) {
+                        first[t] = v;
+                        lit += v.r > 0 || v.g > 0 || v.b > 0;
+                    } else if (v.r != first[t].r || v.g != first[t].g || v.b != first[t].b) {
+                        mismatches++;
+                    }
+                }
+            }
+        }
+    }
+    GlobalJobSystem = pool;
+    delete [] first;
+    printf("Light bake (%llu texels, %.1f%% lit): 1 worker %.2f ms, %llu workers %.2f ms, %llu mismatches\n",
+        (unsigned long long)texels, texels > 0 ? lit * 100.0 / texels : 0.0, seconds[0]*1000.0,
+        (unsigned long long)pool->workerCount(), seconds[1]*1000.0, (unsigned long long)mismatches);
+}
+#pragma endregion
+
+#pragma region FloodLighting
+/* Time flood filling a whole level against relighting after single tile edits, and check that
+   incremental updates match a full rebuild. Edits turn lights off and block open tiles. */
+void Benchmark::FloodLighting(MapData* map) {
+    if (map->chunkCount() == 0) {
+        return;
+    }
+    unsigned short dark = findTile(false), wall = findTile(true);
+    size_t texels = 0;
+    for (size_t c=0; c<map->chunkCount(); c++) {
+        texels += map->chunk(c)->width() * map->chunk(c)->height();
+    }
+    Color* incremental = new Color[texels]();
+    map->floodLighting = true;
+    auto start = std::chrono::steady_clock::now();
+    map->BuildLighting();
+    double build = secondsSince(start);
+    // pick tiles to edit: lights first, then random open tiles
+    int edits[BENCHMARK_LIGHT_EDITS][3];
+    size_t nedits = 0;
+    for (size_t c=0; c<map->chunkCount() && nedits < BENCHMARK_LIGHT_EDITS/2; c++) {
+        Vec3I p = map->chunkPosition(c);
+        TileArray* chunk = map->chunk(c);
+        for (int z=0; z<chunk->height() && nedits < BENCHMARK_LIGHT_EDITS/2; z++) {
+            for (int x=0; x<chunk->width() && nedits < BENCHMARK_LIGHT_EDITS/2; x++) {
+                MapTile* tile = GlobalMapTileRegistry->of(chunk->get({x, z}));
+                if (tile != nullptr && tile->light > 0) {
+                    edits[nedits][0] = p.x + x;
+                    edits[nedits][1] = p.y;
+                    edits[nedits][2] = p.z + z;
+                    nedits++;
+                }
+            }
+        }
+    }
+    srand(1992);
+    while (nedits < BENCHMARK_LIGHT_EDITS) {
+        Vector3 pos = randomOpenPosition(map);
+        edits[nedits][0] = floorf(pos.x);
+        edits[nedits][1] = floorf(pos.y);
+        edits[nedits][2] = floorf(pos.z);
+        nedits++;
+    }
+    start = std::chrono::steady_clock::now();
+    for (size_t i=0; i<nedits; i++) {
+        int x = edits[i][0], y = edits[i][1], z = edits[i][2];
+        unsigned short tid = map->get(x, y, z);
+        MapTile* tile = GlobalMapTileRegistry->of(tid);
+        map->setTile(x, y, z, tile != nullptr && tile->light > 0 ? dark : wall);
+        map->setTile(x, y, z, tid);
+    }
+    double edit = secondsSince(start);
+    // compare the light after some of the edits, and after undoing them, with a full rebuild
+    size_t mismatches = 0;
+    for (size_t i=0; i<nedits; i+=nedits/BENCHMARK_LIGHT_CHECKS) {
+        int x = edits[i][0], y = edits[i][1], z = edits[i][2];
+        unsigned short tid = map->get(x, y, z);
+        MapTile* tile = GlobalMapTileRegistry->of(tid);
+        map->setTile(x, y, z, tile != nullptr && tile->light > 0 ? dark : wall);
+        snapshotLights(map, incremental);
+        map->BuildFloodLighting();
+        mismatches += snapshotLights(map, incremental);
+        map->setTile(x, y, z, tid);
+        snapshotLights(map, incremental);
+        map->BuildFloodLighting();
+        mismatches += snapshotLights(map, incremental);
+    }
+    map->UpdateDirty(false);
+    map->floodLighting = false;
+    delete [] incremental;
+    printf("Flood lighting: full %.2f ms, %.3f ms per tile edit, %llu mismatches\n",
+        build*1000.0, edit * 1000.0 / (nedits*2), (unsigned long long)mismatches);
+}
+#pragma endregion
+
+#pragma region Culling
+/* Cull from random views with and without occlusion culling. Rays cast through each view must only
+   hit tiles in chunks that were kept, or the culling would have hidden something visible. */
+void Benchmark::Culling(MapData* map) {
+    if (map->chunkCount() == 0) {
+        return;
+    }
+    srand(1992);
+    bool occlusion = map->occlusionCulling;
+    double seconds[2] = {0, 0};
+    size_t drawn[2] = {0, 0}, frustum = 0, occluded = 0, missing = 0;
+    float th = tanf(BENCHMARK_CULL_FOVY * 0.5f * DEG2RAD), tw = th * BENCHMARK_CULL_ASPECT;
+    Matrix projection = MatrixPerspective(BENCHMARK_CULL_FOVY * DEG2RAD, BENCHMARK_CULL_ASPECT, 0.01, 1000.0);
+    for (size_t v=0; v<BENCHMARK_CULL_VIEWS; v++) {
+        Vector3 pos = randomOpenPosition(map);
+        float yaw = (rand() % 3600) * 0.1f * DEG2RAD;
+        Vector3 forward = {cosf(yaw), 0, sinf(yaw)}, up = {0, 1, 0};
+        Vector3 right = Vector3CrossProduct(forward, up);
+        Matrix mvp = MatrixMultiply(MatrixLookAt(pos, Vector3Add(pos, forward), up), projection);
+        for (int mode=0; mode<2; mode++) {
+            map->occlusionCulling = mode == 1;
+            auto start = std::chrono::steady_clock::now();
+            drawn[mode] += map->CullChunks(pos, mvp);
+            seconds[mode] += secondsSince(start);
+        }
+        frustum += map->chunksCulledFrustum;
+        occluded += map->chunksCulledOcclusion;
+        for (size_t i=0; i<BENCHMARK_CULL_RAYS; i++) {
+            float sx = ((rand() % 2001) / 1000.0f - 1.0f) * 0.98f * tw;
+            float sy = ((rand() % 2001) / 1000.0f - 1.0f) * 0.98f * th;
+            Vector3 dir = Vector3Add(forward, Vector3Add(Vector3Scale(right, sx), Vector3Scale(up, sy)));
+            HitInfo hit;
+            map->RayCast(pos, dir, map->renderDistance, hit);
+            if (hit.distance == INFINITY) {
+                continue;
+            }
+            // step into the wall that was hit, or stay in the tile whose floor or ceiling was hit
+            dir = Vector3Normalize(dir);
+            Vector3 p = Vector3Add(pos, Vector3Scale(dir, hit.distance + (hit.hitWall ? 1e-3f : -1e-3f)));
+            int c = map->findChunk(floorf(p.x), floorf(p.y), floorf(p.z));
+            if (c != -1 && map->ShouldRenderMap(pos, c) && !map->isChunkVisible(c)) {
+                missing++;
+            }
+        }
+    }
+    map->occlusionCulling = occlusion;
+    printf("Culling (%llu chunks): frustum only %.1f drawn in %.1f us, with occlusion %.1f drawn in %.1f us "
+        "(%.1f culled by frustum, %.1f by occlusion), %llu visible hits culled\n",
+        (unsigned long long)map->chunkCount(), (double)drawn[0] / BENCHMARK_CULL_VIEWS, seconds[0] * 1e6 / BENCHMARK_CULL_VIEWS,
+        (double)drawn[1] / BENCHMARK_CULL_VIEWS, seconds[1] * 1e6 / BENCHMARK_CULL_VIEWS,
+        (double)frustum / BENCHMARK_CULL_VIEWS, (double)occluded / BENCHMARK_CULL_VIEWS, (unsigned long long)missing);
+}
+#pragma endregion
+
+#pragma region Scripts
+/* Run a script with the byte-by-byte interpreter, the decoded instructions and the native code. Every run must
+   agree on the result, return values and instruction count. The entity id is out of range so entity calls stay
+   cheap. */
+void Benchmark::Scripts(const char* id) {
+    Script* script = GlobalScriptRegistry->of(id);
+    if (script == nullptr) {
+        return;
+    }
+    ScriptBytecode& code = script->code;
+    ScriptBytecode::Context ctx;
+    bool useDecoded = code.useDecoded;
+    bool useJit = ScriptBytecode::useJit;
+    double seconds[3];
+    size_t instructions[3], mismatches = 0;
+    long long argv[2] = {-1, 0};
+    long long rval[3][8];
+    for (int mode=0; mode<3; mode++) {
+        code.useDecoded = mode > 0;
+        ScriptBytecode::useJit = mode == 2;
+        instructions[mode] = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i=0; i<BENCHMARK_SCRIPT_RUNS; i++) {
+            code.run(ctx, 2, argv, rval[mode]);
+            instructions[mode] += ctx.executed;
+        }
+        seconds[mode] = secondsSince(start);
+    }
+    for (int frame=0; frame<8; frame++) {
+        argv[1] = frame;
+        int res[3];
+        size_t executed[3];
+        for (int mode=0; mode<3; mode++) {
+            code.useDecoded = mode > 0;
+            ScriptBytecode::useJit = mode == 2;
+            ctx.reset();
+            res[mode] = code.run(ctx, 2, argv, rval[mode]);
+            executed[mode] = ctx.executed;
+        }
+        for (int mode=1; mode<3; mode++) {
+            if (res[0] != res[mode] || executed[0] != executed[mode] || memcmp(rval[0], rval[mode], sizeof(rval[0]))) {
+                mismatches++;
+            }
+        }
+    }
+    code.useDecoded = useDecoded;
+    ScriptBytecode::useJit = useJit;
+    double rate[3];
+    for (int mode=0; mode<3; mode++) {
+        rate[mode] = instructions[mode] / seconds[mode];
+    }
+    printf("Script %s (%s, %s): interpreted %.1f M instructions/s, decoded %.1f M instructions/s (%.1fx), "
+        "native %.1f M instructions/s (%.1fx), %llu mismatches\n", id, code.decoded ? "decoded" : "not decoded",
+        code.jit != nullptr ? "compiled" : "not compiled", rate[0] * 1e-6, rate[1] * 1e-6, rate[1] / rate[0],
+        rate[2] * 1e-6, rate[2] / rate[0], (unsigned long long)mismatches);
+}
+#pragma endregion
+
+#pragma region ScriptProfiling
+/* Time a script with the profiler off and on, and check the profiler's cycle total against the instruction
+   counts of the runs. With opcode counting built in, the decoded runs' opcode counts must add up too. */
+void Benchmark::ScriptProfiling(const char* id) {
+    Script* script = GlobalScriptRegistry->of(id);
+    if (script == nullptr || script->code.profile == nullptr) {
+        return;
+    }
+    ScriptBytecode& code = script->code;
+    ScriptBytecode::Context ctx;
+    bool enabled = ScriptProfiler::enabled;
+    bool useJit = ScriptBytecode::useJit;
+    ScriptBytecode::useJit = false;
+    long long argv[2] = {-1, 0};
+    long long rval[8];
+    double seconds[2];
+    size_t executed = 0;
+    for (int mode=0; mode<2; mode++) {
+        ScriptProfiler::enabled = mode == 1;
+        ScriptProfiler::reset();
+        executed = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i=0; i<BENCHMARK_SCRIPT_RUNS; i++) {
+            code.run(ctx, 2, argv, rval);
+            executed += ctx.executed;
+        }
+        seconds[mode] = secondsSince(start);
+    }
+    ScriptProfiler::Counters totals;
+    ScriptProfiler::total(totals);
+    size_t counted = 0;
+    for (size_t i=0; i<ScriptProfiler::MAX_OPCODES; i++) {
+        counted += totals.opcodes[i];
+    }
+    size_t calls = 0;
+    for (size_t i=0; i<ScriptProfiler::NumCalls; i++) {
+        calls += totals.calls[i];
+    }
+    bool match = code.profile->cycles.load() == executed && code.profile->runs.load() == BENCHMARK_SCRIPT_RUNS;
+#ifdef SCRIPT_PROFILE_OPCODES
+    match = match && counted == executed;
+#endif
+    printf("Script profiler (%s, decoded): off %.1f ns, on %.1f ns per run (%.2fx), %llu cycles, %llu opcodes counted, "
+        "%llu interface calls, %s\n", id, seconds[0] * 1e9 / BENCHMARK_SCRIPT_RUNS, seconds[1] * 1e9 / BENCHMARK_SCRIPT_RUNS,
+        seconds[1] / seconds[0], (unsigned long long)executed, (unsigned long long)counted, (unsigned long long)calls,
+        match ? "totals match" : "totals MISMATCH");
+    ScriptProfiler::reset();
+    ScriptProfiler::enabled = enabled;
+    ScriptBytecode::useJit = useJit;
+}
+#pragma endregion
+
+#pragma region NativeScripts
+/* Write a random program that never fails: straight-line arithmetic, float and variable ops, three-address ops on
+   the first variables, balanced pushes and pops, forward branches and subroutine calls. Nothing is pushed or
+   popped while a branch could skip it. */
+static void randomScriptSource(char* out, size_t len) {
+    static const char* ops[] = {
+        "add", "sub", "mul", "and", "or", "xor", "lor", "land", "inc", "dec", "ex",
+        "eq", "neq", "gt", "lt", "gteq", "lteq", "abs", "sqrt", "itof", "ftoi", "nop",
+        "addf", "subf", "mulf", "divf", "modf", "powf", "nanf", "inff", "absf", "sqrtf",
+        "eqf", "neqf", "gtf", "ltf", "gteqf", "lteqf", "yield",
+    };
+    // no vdiv/vmod, the operands could be the minimum integer and -1
+    static const char* vops[] = {
+        "vadd", "vsub", "vmul", "vand", "vor", "vxor", "vaddf", "vsubf", "vmulf", "vdivf", "vmodf",
+        "veq", "vneq", "vgt", "vlt", "vgteq", "vlteq", "veqf", "vneqf", "vgtf", "vltf", "vgteqf", "vlteqf",
+    };
+    static const char* vunary[] = {"vmov", "vabs", "vabsf", "vsqrtf", "vitof", "vftoi"};
+    static const char* vars[] = {"_va", "_vb", "_vc", "_vd"};
+    size_t pos = 0;
+    #define EMIT(...) pos += snprintf(out + pos, pos < len ? len - pos : 0, __VA_ARGS__)
+    int steps = 16 + rand() % 48, depth = 0, labels = 0;
+    int pending[4], npending = 0;
+    for (int i=0; i<steps; i++) {
+        // define the labels of earlier branches as we go, so every branch is forward
+        while (npending > 0 && rand() % 3 == 0) {
+            EMIT(":l%d\n", pending[--npending]);
+        }
+        int kind = rand() % 14;
+        if (kind < 4) {
+            EMIT("%s\n", ops[rand() % (sizeof(ops) / sizeof(ops[0]))]);
+        } else if (kind == 4) {
+            EMIT(rand() % 2 ? "i16 %d\n" : "i16 %d\nitof\n", rand() % 2000 - 1000);
+        } else if (kind == 5) {
+            EMIT("u64b %d.%df\n", rand() % 100, rand() % 100);
+        } else if (kind == 6) {
+            EMIT(rand() % 2 ? "sv %s\n" : "v %s\n", vars[rand() % 4]);
+        } else if (kind == 7 && npending == 0 && depth < 8 && rand() % 2) {
+            EMIT(rand() % 2 ? "push\n" : rand() % 2 ? "pushb\n" : "pushvar %s\n", vars[rand() % 4]);
+            depth++;
+        } else if (kind == 7 && npending == 0 && depth > 0) {
+            EMIT(rand() % 2 ? "pop\n" : "popb\n");
+            depth--;
+        } else if (kind == 8 && npending < 4) {
+            static const char* branches[] = {"ba", "bz", "bnz", "bzset32 7", "bnzset32 -3", "vbz 2", "vbnz 3"};
+            pending[npending] = labels++;
+            EMIT("%s @l%d\n", branches[rand() % 7], pending[npending++]);
+        } else if (kind == 9) {
+            EMIT("%s @s%d\n", rand() % 2 ? "jsr" : rand() % 2 ? "jsrz" : "jsrnz", rand() % 2);
+        } else if (kind == 10) {
+            EMIT("rv %d %s\n", rand() % 8, vars[rand() % 4]);
+        } else if (kind == 11) {
+            // never divide by -1, the minimum integer would trap
+            EMIT("i16b %d\n%s\n", rand() % 50, rand() % 2 ? "div" : "mod");
+        } else if (kind == 12) {
+            // variable 0 reads as 0, but is never a destination
+            if (rand() % 2) {
+                EMIT("%s %d %d %d\n", vops[rand() % (sizeof(vops) / sizeof(vops[0]))], 1 + rand() % 4, rand() % 5, rand() % 5);
+            } else {
+                EMIT("%s %d %d\n", vunary[rand() % (sizeof(vunary) / sizeof(vunary[0]))], 1 + rand() % 4, rand() % 5);
+            }
+        } else if (kind == 13) {
+            int d = 1 + rand() % 4;
+            // no vrandom, each mode would draw different numbers
+            switch (rand() % 3) {
+                case 0: EMIT("vset32 %d %d\n", d, rand() % 2000 - 1000); break;
+                case 1: EMIT("vset64 %d %d.%df\n", d, rand() % 100, rand() % 100); break;
+                default: EMIT("varg %d %d\n", d, rand() % 2); break;
+            }
+        } else {
+            EMIT("arg %d\n", rand() % 2);
+        }
+    }
+    while (npending > 0) {
+        EMIT(":l%d\n", pending[--npending]);
+    }
+    EMIT("end\n:s0\ninc\nsv _va\nrts\n:s1\nmulf\nrtsnz\nitof\nrts\n");
+    #undef EMIT
+}
+
+/* Differential test of the native code: run every registered script and a set of generated programs with the
+   interpreter, the decoded instructions and the native code, and compare results, return values, instruction
+   counts and variables. Runs that fail would print the same report three times, so generated programs never do. */
+void Benchmark::NativeScripts() {
+    ScriptBytecode::Context ctx[3];
+    long long rval[3][8];
+    int res[3];
+    size_t scripts = 0, compiled = 0, bytes = 0, runs = 0, mismatches = 0;
+    size_t instructions[3] = {0, 0, 0};
+    double seconds[3] = {0, 0, 0};
+    bool useJit = ScriptBytecode::useJit;
+    char* source = new char[4096];
+    unsigned short registered = 0;
+    while (GlobalScriptRegistry->has(registered)) {
+        registered++;
+    }
+    srand(1992);
+    for (unsigned short id=0; id<registered + BENCHMARK_SCRIPT_PROGRAMS; id++) {
+        ScriptBytecode generated;
+        ScriptBytecode* code;
+        if (id < registered) {
+            code = &GlobalScriptRegistry->of(id)->code;
+        } else {
+            randomScriptSource(source, 4096);
+            ScriptAssemblyCompiler compiler;
+            unsigned char* binary;
+            size_t binlen = compiler.compile(source, strlen(source), &binary);
+            generated = ScriptBytecode(binary, binlen);
+            generated.setInterface(GloablScriptInterface);
+            ScriptJit::compile(generated);
+            code = &generated;
+        }
+        scripts++;
+        if (code->jit != nullptr) {
+            compiled++;
+            bytes += code->jit->size();
+        }
+        bool useDecoded = code->useDecoded;
+        for (int mode=0; mode<3; mode++) {
+            ctx[mode].reset();
+        }
+        // each context keeps its variables across runs, like an entity does across frames
+        for (int frame=0; frame<4; frame++) {
+            long long argv[2] = {frame % 2 ? -1 : 0x7FFFFFFF, frame};
+            for (int mode=0; mode<3; mode++) {
+                code->useDecoded = mode > 0;
+                ScriptBytecode::useJit = mode == 2;
+                res[mode] = code->run(ctx[mode], 2, argv, rval[mode]);
+            }
+            for (int mode=1; mode<3; mode++) {
+                if (res[0] != res[mode] || ctx[0].executed != ctx[mode].executed ||
+                    memcmp(rval[0], rval[mode], sizeof(rval[0])) || memcmp(ctx[0].vars, ctx[mode].vars, sizeof(ctx[0].vars))) {
+                    mismatches++;
+                }
+            }
+            runs++;
+        }
+        for (int mode=0; mode<3; mode++) {
+            code->useDecoded = mode > 0;
+            ScriptBytecode::useJit = mode == 2;
+            long long argv[2] = {-1, 0};
+            auto start = std::chrono::steady_clock::now();
+            for (int i=0; i<BENCHMARK_SCRIPT_TIMED_RUNS; i++) {
+                code->run(ctx[mode], 2, argv, rval[mode]);
+                instructions[mode] += ctx[mode].executed;
+            }
+            seconds[mode] += secondsSince(start);
+        }
+        code->useDecoded = useDecoded;
+        if (code == &generated) {
+            generated.unload();
+            char* binary;
+            generated.dump(&binary);
+            delete [] binary;
+        }
+    }
+    delete [] source;
+    ScriptBytecode::useJit = useJit;
+    double rate[3];
+    for (int mode=0; mode<3; mode++) {
+        rate[mode] = instructions[mode] / seconds[mode];
+    }
+    printf("Native scripts: %llu scripts (%llu registered), %llu compiled to %llu bytes, interpreted %.1f, decoded %.1f, "
+        "native %.1f M instructions/s (%.1fx decoded), %llu runs, %llu mismatches\n", (unsigned long long)scripts,
+        (unsigned long long)registered, (unsigned long long)compiled, (unsigned long long)bytes, rate[0] * 1e-6,
+        rate[1] * 1e-6, rate[2] * 1e-6, rate[2] / rate[1], (unsigned long long)runs, (unsigned long long)mismatches);
+}
+#pragma endregion
+
+#pragma region ScriptOptimizer
+/* Run the unoptimized and the optimized bytecode of a script for a few frames and count the frames where the
+   results, return values or variables differ. Instruction counts are added to cycles, they are meant to differ. */
+static size_t compareOptimized(ScriptBytecode& raw, ScriptBytecode& optimized, size_t cycles[2]) {
+    ScriptBytecode* code[2] = {&raw, &optimized};
+    ScriptBytecode::Context ctx[2];
+    long long rval[2][8];
+    int res[2];
+    size_t mismatches = 0;
+    for (int frame=0; frame<4; frame++) {
+        long long argv[2] = {frame % 2 ? -1 : 0x7FFFFFFF, frame};
+        for (int i=0; i<2; i++) {
+            res[i] = code[i]->run(ctx[i], 2, argv, rval[i]);
+            cycles[i] += ctx[i].executed;
+        }
+        if (res[0] != res[1] || memcmp(rval[0], rval[1], sizeof(rval[0])) ||
+            memcmp(ctx[0].vars, ctx[1].vars, sizeof(ctx[0].vars))) {
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+/* Optimize every script source and a set of generated programs, report the size and cycle savings per script and
+   check that the optimized bytecode behaves like the original. Both versions run decoded. */
+void Benchmark::ScriptOptimizer() {
+    FilePathList files = LoadDirectoryFilesEx(assetPathScripts, ".txt;.scr", false);
+    char* source = new char[4096];
+    size_t total[3][2] = {{0, 0}, {0, 0}, {0, 0}};
+    size_t mismatches = 0;
+    srand(1992);
+    for (unsigned int i=0; i<files.count + BENCHMARK_SCRIPT_PROGRAMS; i++) {
+        char* text = i < files.count ? LoadFileText(files.paths[i]) : source;
+        if (text == nullptr) {
+            continue;
+        }
+        if (i >= files.count) {
+            randomScriptSource(source, 4096);
+        }
+        char* assembly = nullptr;
+        if (i < files.count && IsFileExtension(files.paths[i], ".scr")) {
+            ScriptExpressionCompiler front;
+            if (front.compile(text, strlen(text), &assembly) == 0) {
+                UnloadFileText(text);
+                continue;
+            }
+        }
+        ScriptAssemblyCompiler compiler;
+        unsigned char *binary, *optimized;
+        size_t binlen = assembly != nullptr ? compiler.compile(assembly, strlen(assembly), &binary) :
+            compiler.compile(text, strlen(text), &binary);
+        delete [] assembly;
+        size_t optlen = compiler.optimize(binary, binlen, &optimized);
+        ScriptBytecode raw(binary, binlen), opt(optimized, optlen);
+        raw.setInterface(GloablScriptInterface);
+        opt.setInterface(GloablScriptInterface);
+        size_t cycles[2] = {0, 0};
+        size_t differ = compareOptimized(raw, opt, cycles);
+        mismatches += differ;
+        ScriptAssemblyCompiler::Stats& stats = compiler.stats;
+        if (i < files.count) {
+            printf("Optimized %s: %llu -> %llu bytes, %llu -> %llu instructions, %llu -> %llu cycles over 4 frames, "
+                "%llu mismatches\n", GetFileName(files.paths[i]), (unsigned long long)stats.bytesIn,
+                (unsigned long long)stats.bytesOut, (unsigned long long)stats.instructionsIn,
+                (unsigned long long)stats.instructionsOut, (unsigned long long)cycles[0], (unsigned long long)cycles[1],
+                (unsigned long long)differ);
+            UnloadFileText(text);
+        }
+        total[0][0] += stats.bytesIn;
+        total[0][1] += stats.bytesOut;
+        total[1][0] += stats.instructionsIn;
+        total[1][1] += stats.instructionsOut;
+        total[2][0] += cycles[0];
+        total[2][1] += cycles[1];
+        raw.unload();
+        opt.unload();
+        delete [] binary;
+        delete [] optimized;
+    }
+    delete [] source;
+    printf("Script optimizer: %u scripts (%u sources), %llu -> %llu bytes, %llu -> %llu instructions, "
+        "%llu -> %llu cycles (%.1f%% fewer), %llu mismatches\n", files.count + BENCHMARK_SCRIPT_PROGRAMS, files.count,
+        (unsigned long long)total[0][0], (unsigned long long)total[0][1], (unsigned long long)total[1][0],
+        (unsigned long long)total[1][1], (unsigned long long)total[2][0], (unsigned long long)total[2][1],
+        total[2][0] ? 100.0 * (total[2][0] - total[2][1]) / total[2][0] : 0.0, (unsigned long long)mismatches);
+    UnloadDirectoryFiles(files);
+}
+#pragma endregion
+
+#pragma region ScriptLoading
+/* Time loading every script source from its bytecode cache against compiling it, and check that the cached
+   bytecode is the same as freshly compiled and optimized bytecode. */
+void Benchmark::ScriptLoading() {
+    FilePathList files = LoadDirectoryFilesEx(assetPathScripts, ".txt;.scr", false);
+    double seconds[2] = {0, 0};
+    size_t cached = 0, mismatches = 0;
+    for (unsigned int i=0; i<files.count; i++) {
+        char* text = LoadFileText(files.paths[i]);
+        if (text == nullptr) {
+            continue;
+        }
+        size_t len = strlen(text);
+        // the first load writes the cache if it is missing or stale
+        Script* script = new Script();
+        script->load(files.paths[i]);
+        delete script;
+        char* cachename = ScriptCache::path(files.paths[i]);
+        auto start = std::chrono::steady_clock::now();
+        for (int j=0; j<BENCHMARK_SCRIPT_LOADS; j++) {
+            script = new Script();
+            script->load(files.paths[i]);
+            if (j == 0) {
+                cached += script->cache.isOpen();
+            }
+            script->code.unload();
+            delete script;
+        }
+        seconds[0] += secondsSince(start);
+        unsigned char* optimized;
+        size_t optlen = 0;
+        start = std::chrono::steady_clock::now();
+        for (int j=0; j<BENCHMARK_SCRIPT_LOADS; j++) {
+            ScriptAssemblyCompiler compiler;
+            optlen = Script::compile(files.paths[i], text, len, compiler, &optimized);
+            if (j < BENCHMARK_SCRIPT_LOADS - 1) {
+                delete [] optimized;
+            }
+        }
+        seconds[1] += secondsSince(start);
+        MappedFile file;
+        const unsigned char* code;
+        size_t codelen;
+        if (!ScriptCache::load(cachename, text, len, file, &code, &codelen) || codelen != optlen ||
+            memcmp(code, optimized, optlen)) {
+            mismatches++;
+        }
+        delete [] optimized;
+        delete [] cachename;
+        UnloadFileText(text);
+    }
+    printf("Script loading (%u scripts, %llu cached): cached %.1f us, compiled %.1f us per script, %llu mismatches\n",
+        files.count, (unsigned long long)cached, seconds[0] * 1e6 / BENCHMARK_SCRIPT_LOADS / files.count,
+        seconds[1] * 1e6 / BENCHMARK_SCRIPT_LOADS / files.count, (unsigned long long)mismatches);
+    UnloadDirectoryFiles(files);
+}
+#pragma endregion
+
+#pragma region EntityScripts
+/* Update a crowd of scripted entities serially and in parallel from the same starting state, and check that
+   both end up with the same positions and timers. The parallel run always uses at least two workers so the
+   deferred command buffers are exercised. Init scripts are skipped, their random teleports can loop for a
+   long time on levels with few spawnable spaces. */
+void Benchmark::EntityScripts(MapData* map) {
+    EntityType* type = GlobalEntityRegistry->of("enemy_smoke_cloud");
+    if (map->chunkCount() == 0 || type == nullptr) {
+        return;
+    }
+    srand(1992);
+    EntityRenderer* entities = GlobalEntityRenderer;
+    entities->clear();
+    Vector3 camera = randomOpenPosition(map);
+    for (size_t i=0; i<BENCHMARK_SCRIPT_ENTITIES; i++) {
+        Vector3 p = randomOpenPosition(map);
+        entities->Add(type->id, {p.x, p.y - PLAYER_HEIGHT + 0.5f, p.z});
+    }
+    size_t count = entities->length();
+    std::vector<Entity> start, serial;
+    for (size_t i=0; i<count; i++) {
+        start.push_back(*entities->get(i));
+    }
+    Vector3 oldcamera = GlobalEngine->camera.position;
+    float olddt = GlobalEngine->deltatime;
+    bool parallel = entities->parallelScripts;
+    float budget = entities->scriptBudget;
+    // every script runs every frame, or the modes would defer different entities
+    entities->scriptBudget = 0;
+    GlobalEngine->camera.position = camera;
+    GlobalEngine->deltatime = 1.0f / 60;
+    JobSystem* pool = GlobalJobSystem;
+    JobSystem workers(2);
+    double seconds[2];
+    size_t mismatches = 0;
+    for (int mode=0; mode<2; mode++) {
+        for (size_t i=0; i<count; i++) {
+            Entity* ent = entities->get(i);
+            ScriptBytecode::Context* context = ent->context;
+            *ent = start[i];
+            ent->context = context;
+            context->reset();
+            context->seed(i);
+        }
+        entities->parallelScripts = mode == 1;
+        if (mode == 1 && pool->workerCount() < 2) {
+            GlobalJobSystem = &workers;
+        }
+        srand(1992);
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t f=0; f<BENCHMARK_SCRIPT_FRAMES; f++) {
+            entities->Update(map, camera, GlobalEngine->deltatime);
+        }
+        seconds[mode] = secondsSince(begin);
+        GlobalJobSystem = pool;
+        for (size_t i=0; i<count; i++) {
+            Entity* ent = entities->get(i);
+            if (mode == 0) {
+                serial.push_back(*ent);
+            } else if (ent->pos.x != serial[i].pos.x || ent->pos.z != serial[i].pos.z || ent->timer != serial[i].timer) {
+                mismatches++;
+            }
+        }
+    }
+    printf("Entity scripts (%llu entities, %d frames): serial %.3f ms, parallel %.3f ms per frame (%llu workers), "
+        "speedup %.1fx, %llu mismatches\n", (unsigned long long)count, BENCHMARK_SCRIPT_FRAMES,
+        seconds[0] * 1000.0 / BENCHMARK_SCRIPT_FRAMES, seconds[1] * 1000.0 / BENCHMARK_SCRIPT_FRAMES,
+        (unsigned long long)std::max(pool->workerCount(), (size_t)2), seconds[0] / seconds[1], (unsigned long long)mismatches);
+    // the same frames under a budget of a tenth of the serial frame time
+    entities->scriptBudget = (float)(seconds[0] * 100.0 / BENCHMARK_SCRIPT_FRAMES);
+    entities->parallelScripts = false;
+    size_t ran = 0, deferred = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t f=0; f<BENCHMARK_SCRIPT_FRAMES; f++) {
+        entities->Update(map, camera, GlobalEngine->deltatime);
+        ran += entities->scriptsRun;
+        deferred += entities->scriptsDeferred;
+    }
+    double budgeted = secondsSince(begin);
+    printf("Entity scripts (budget %.3f ms): %.3f ms per frame, %.1f run, %.1f deferred per frame\n",
+        entities->scriptBudget, budgeted * 1000.0 / BENCHMARK_SCRIPT_FRAMES, (double)ran / BENCHMARK_SCRIPT_FRAMES,
+        (double)deferred / BENCHMARK_SCRIPT_FRAMES);
+    entities->scriptBudget = budget;
+    entities->parallelScripts = parallel;
+    GlobalEngine->camera.position = oldcamera;
+    GlobalEngine->deltatime = olddt;
+    entities->clear();
+}
+#pragma endregion
+
+#pragma region ScriptVariants
+/* Run the smoke cloud AI compiled from its assembly and from its expression language source on the same crowd,
+   interpreted, decoded and native, each from the same starting state. All six runs have to end with the same
+   positions and timers. Line of sight is resolved outside the timed part of each frame. */
+void Benchmark::ScriptVariants(MapData* map) {
+    static const char* variants[] = {"enemy_smoke_cloud_script.txt", "enemy_smoke_cloud_script.scr"};
+    static const char* modes[] = {"interpreted", "decoded", "native"};
+    EntityType* type = GlobalEntityRegistry->of("enemy_smoke_cloud");
+    if (map->chunkCount() == 0 || type == nullptr) {
+        return;
+    }
+    ScriptBytecode code[2];
+    unsigned char* bytecode[2] = {nullptr, nullptr};
+    size_t bytes[2] = {0, 0};
+    for (int v=0; v<2; v++) {
+        const char* fname = TextFormat("%s%s", assetPathScripts, variants[v]);
+        char* text = LoadFileText(fname);
+        if (text != nullptr) {
+            ScriptAssemblyCompiler compiler;
+            bytes[v] = Script::compile(fname, text, strlen(text), compiler, &bytecode[v]);
+            UnloadFileText(text);
+        }
+        if (bytes[v] == 0) {
+            delete [] bytecode[0];
+            return;
+        }
+        code[v] = ScriptBytecode(bytecode[v], bytes[v]);
+        code[v].setInterface(GloablScriptInterface);
+        ScriptJit::compile(code[v]);
+    }
+    srand(1992);
+    EntityRenderer* entities = GlobalEntityRenderer;
+    entities->clear();
+    Vector3 camera = randomOpenPosition(map);
+    for (size_t i=0; i<BENCHMARK_SCRIPT_ENTITIES; i++) {
+        Vector3 p = randomOpenPosition(map);
+        entities->Add(type->id, {p.x, p.y - PLAYER_HEIGHT + 0.5f, p.z});
+    }
+    size_t count = entities->length();
+    std::vector<Entity> start, reference;
+    for (size_t i=0; i<count; i++) {
+        start.push_back(*entities->get(i));
+    }
+    Vector3 oldcamera = GlobalEngine->camera.position;
+    float olddt = GlobalEngine->deltatime;
+    bool useJit = ScriptBytecode::useJit;
+    GlobalEngine->camera.position = camera;
+    GlobalEngine->deltatime = 1.0f / 60;
+    size_t mismatches = 0;
+    for (int v=0; v<2; v++) {
+        double ns[3];
+        size_t instructions = 0, runs = 0;
+        for (int mode=0; mode<3; mode++) {
+            for (size_t i=0; i<count; i++) {
+                Entity* ent = entities->get(i);
+                ScriptBytecode::Context* context = ent->context;
+                *ent = start[i];
+                ent->context = context;
+                context->reset();
+                context->seed(i);
+            }
+            code[v].useDecoded = mode > 0;
+            ScriptBytecode::useJit = mode == 2;
+            srand(1992);
+            double seconds = 0;
+            instructions = runs = 0;
+            for (size_t f=0; f<BENCHMARK_SCRIPT_FRAMES; f++) {
+                entities->UpdateLineOfSight(map, camera);
+                auto begin = std::chrono::steady_clock::now();
+                for (size_t i=0; i<count; i++) {
+                    Entity* ent = entities->get(i);
+                    if (ent->context == nullptr) {
+                        continue;
+                    }
+                    long long rval[8];
+                    long long argv[2] = {(signed)i, ent->frameno};
+                    code[v].run(*ent->context, 2, argv, rval);
+                    instructions += ent->context->executed;
+                    runs++;
+                }
+                seconds += secondsSince(begin);
+            }
+            ns[mode] = runs ? seconds * 1e9 / runs : 0;
+            for (size_t i=0; i<count; i++) {
+                Entity* ent = entities->get(i);
+                if (v == 0 && mode == 0) {
+                    reference.push_back(*ent);
+                } else if (ent->pos.x != reference[i].pos.x || ent->pos.z != reference[i].pos.z ||
+                    ent->timer != reference[i].timer) {
+                    mismatches++;
+                }
+            }
+        }
+        printf("Script variant %s (%llu bytes%s): %.1f instructions per run, %s %.1f ns, %s %.1f ns, %s %.1f ns per run\n",
+            variants[v], (unsigned long long)bytes[v], code[v].jit != nullptr ? ", compiled" : "",
+            runs ? (double)instructions / runs : 0.0, modes[0], ns[0], modes[1], ns[1], modes[2], ns[2]);
+        code[v].unload();
+        delete [] bytecode[v];
+    }
+    printf("Script variants (%llu entities, %d frames): %llu mismatches\n", (unsigned long long)count,
+        BENCHMARK_SCRIPT_FRAMES, (unsigned long long)mismatches);
+    ScriptBytecode::useJit = useJit;
+    GlobalEngine->camera.position = oldcamera;
+    GlobalEngine->deltatime = olddt;
+    entities->clear();
+}
+#pragma endregion
+
+#pragma region TileQueries
+/* Count the solid tiles around random open tiles with scripts that look at each tile through gettile and
+   tileissolid, through tileflags, and with a single areacount, and OR their flags with areaflags. Each query is
+   checked against the registry, decoded and native. */
+void Benchmark::TileQueries(MapData* map) {
+    static const char* names[] = {"gettile+tileissolid", "tileflags", "areacount", "areaflags"};
+    static const char* sources[] = {
+        "int n = 0\nint dz = -2\nwhile dz <= 2 {\n    int dx = -2\n    while dx <= 2 {\n"
+        "        if tileissolid(gettile(arg0 + dx, arg1, arg2 + dz)) {\n            n = n + 1\n        }\n"
+        "        dx = dx + 1\n    }\n    dz = dz + 1\n}\nreturn n\n",
+        "int n = 0\nint dz = -2\nwhile dz <= 2 {\n    int dx = -2\n    while dx <= 2 {\n"
+        "        n = n + (tileflags(arg0 + dx, arg1, arg2 + dz) & 1)\n        dx = dx + 1\n    }\n"
+        "    dz = dz + 1\n}\nreturn n\n",
+        "return areacount(arg0, arg1, arg2, 2, 1)\n",
+        "return areaflags(arg0 - 2, arg1, arg2 - 2, 5, 5)\n",
+    };
+    static const int count = sizeof(sources) / sizeof(sources[0]);
+    if (map->chunkCount() == 0) {
+        return;
+    }
+    long long* queries = new long long[BENCHMARK_TILE_QUERIES*3];
+    long long* expected = new long long[BENCHMARK_TILE_QUERIES*2];
+    srand(1992);
+    for (size_t i=0; i<BENCHMARK_TILE_QUERIES; i++) {
+        Vector3 p = randomOpenPosition(map);
+        long long* q = &queries[i*3];
+        q[0] = floorf(p.x);
+        q[1] = floorf(p.y);
+        q[2] = floorf(p.z);
+        long long solid = 0, flags = 0;
+        for (int dz=-2; dz<=2; dz++) {
+            for (int dx=-2; dx<=2; dx++) {
+                MapTile* tile = GlobalMapTileRegistry->of(map->get(q[0] + dx, q[1], q[2] + dz));
+                if (tile != nullptr) {
+                    solid += tile->isSolid;
+                    flags |= tile->flags & 0xFF;
+                }
+            }
+        }
+        expected[i*2] = solid;
+        expected[i*2+1] = flags;
+    }
+    bool useJit = ScriptBytecode::useJit;
+    size_t mismatches = 0;
+    for (int s=0; s<count; s++) {
+        ScriptAssemblyCompiler compiler;
+        unsigned char* bytecode;
+        size_t bytes = Script::compile("query.scr", sources[s], strlen(sources[s]), compiler, &bytecode);
+        if (bytes == 0) {
+            continue;
+        }
+        ScriptBytecode code(bytecode, bytes);
+        code.setInterface(GloablScriptInterface);
+        code.useDecoded = true;
+        ScriptJit::compile(code);
+        ScriptBytecode::Context ctx;
+        double ns[2];
+        size_t instructions = 0;
+        for (int mode=0; mode<2; mode++) {
+            ScriptBytecode::useJit = mode == 1;
+            instructions = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i=0; i<BENCHMARK_TILE_QUERIES; i++) {
+                long long rval[8] = {0};
+                code.run(ctx, 3, &queries[i*3], rval);
+                instructions += ctx.executed;
+                if (rval[0] != expected[i*2 + (s == 3)]) {
+                    mismatches++;
+                }
+            }
+            ns[mode] = secondsSince(start) * 1e9 / BENCHMARK_TILE_QUERIES;
+        }
+        printf("Tile query %s: %.1f instructions, decoded %.1f ns, native %.1f ns per query\n", names[s],
+            (double)instructions / BENCHMARK_TILE_QUERIES, ns[0], ns[1]);
+        code.unload();
+        delete [] bytecode;
+    }
+    ScriptBytecode::useJit = useJit;
+    printf("Tile queries (%d queries, 5x5 tiles): %llu mismatches\n", BENCHMARK_TILE_QUERIES,
+        (unsigned long long)mismatches);
+    delete [] queries;
+    delete [] expected;
+}
+#pragma endregion
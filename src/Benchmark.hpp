@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Engine.hpp"
+#include "MapData.hpp"
+
+/* Headless micro-benchmarks, run with `BR92Engine --benchmark [level.dat]`.
+ * Benchmarks use the loaded registries and level data but never open a window,
+ * so only CPU-side code paths are measured. */
+class Benchmark {
+    public:
+    static bool Run(const char* level=nullptr);
+    static bool LoadLevelHeadless(const char* fname);
+    static void LevelRead(const char* fname);
+    static void LevelLoad(const char* fname);
+    static void LevelSwitch(const char* fname);
+    static void LevelFormats(const char* fname);
+    static void Streaming(const char* fname);
+    static void ChunkLookups(MapData* map);
+    static void Meshing(MapData* map);
+    static void TileEdits(MapData* map);
+    static void RayCasts(MapData* map);
+    static void LineOfSight(MapData* map);
+    static void Lighting(MapData* map);
+    static void FloodLighting(MapData* map);
+    static void Culling(MapData* map);
+    static void Scripts(const char* id);
+    static void ScriptProfiling(const char* id);
+    static void NativeScripts();
+    static void ScriptOptimizer();
+    static void ScriptLoading();
+    static void EntityScripts(MapData* map);
+    static void ScriptVariants(MapData* map);
+    static void TileQueries(MapData* map);
+};
@@ -23,8 +23,7 @@ class RWBuffer {
         fd.read((char*)_data, count);
     }
     void open(const char* f) {
-        std::ifstream fd(f);
-        RWBuffer buf;
+        std::ifstream fd(f, std::ios::binary);
         if (fd.is_open()) {
             open(fd);
         }
@@ -88,6 +87,10 @@ class RWBuffer {
 	inline size_t tell() {
 		return this->_offset;
 	}
+	/* Return a pointer to the data at offset, for reading it in bulk. */
+	inline const unsigned char* pointer(size_t offset) {
+		return _data + offset;
+	}
 	inline void seek(size_t offset) {
 		this->_offset = offset;
 	}
@@ -186,6 +189,10 @@ class RBuffer : public RWBuffer {
     inline bool writeable() {
         return false;
     }
+    public:
+    RBuffer() {}
+    /* Read memory owned by someone else, such as a MappedFile, in place. It must outlive the buffer. */
+    RBuffer(const unsigned char* ptr, size_t len) : RWBuffer((unsigned char*)ptr, len) {}
 };
 
 class WBuffer : public RWBuffer {
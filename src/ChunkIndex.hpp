@@ -0,0 +1,219 @@
+/* Spatial hash of map chunks, keyed by region coordinate.
+ * Each chunk is registered in every fixed-size region it overlaps, so a tile lookup
+ * only has to check the handful of chunks linked to one region instead of every chunk.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <utility>
+
+#define CHUNK_INDEX_REGION_SHIFT 4
+#define CHUNK_INDEX_MIN_CAPACITY 64
+
+class ChunkIndex {
+    struct Entry {
+        int chunk;
+        int next;
+        int x1, z1, x2, z2;
+    };
+    static const constexpr unsigned long long EMPTY_KEY = ~0ULL;
+    unsigned long long* keys = nullptr;
+    int* heads = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+    Entry* entries = nullptr;
+    size_t nentries = 0;
+    size_t allocentries = 0;
+    int freeentry = -1;
+
+    static inline unsigned long long _key(int rx, int y, int rz) {
+        return (((unsigned long long)rx & 0x1FFFFF) << 42) |
+               (((unsigned long long)y & 0x1FFFFF) << 21) |
+               ((unsigned long long)rz & 0x1FFFFF);
+    }
+    static inline size_t _hash(unsigned long long key) {
+        key *= 0x9E3779B97F4A7C15ULL;
+        return (size_t)(key ^ (key >> 29));
+    }
+    /* Return the slot for a region key, creating it if requested. Returns -1 if missing. */
+    long long _slot(unsigned long long key, bool create) {
+        if (capacity == 0) {
+            if (!create) {
+                return -1;
+            }
+            _rehash(CHUNK_INDEX_MIN_CAPACITY);
+        } else if (create && (used + 1) * 2 > capacity) {
+            _rehash(capacity * 2);
+        }
+        size_t slot = _hash(key) & (capacity - 1);
+        while (keys[slot] != EMPTY_KEY) {
+            if (keys[slot] == key) {
+                return slot;
+            }
+            slot = (slot + 1) & (capacity - 1);
+        }
+        if (!create) {
+            return -1;
+        }
+        keys[slot] = key;
+        heads[slot] = -1;
+        used++;
+        return slot;
+    }
+    void _rehash(size_t newcapacity) {
+        unsigned long long* oldkeys = keys;
+        int* oldheads = heads;
+        size_t oldcapacity = capacity;
+        keys = new unsigned long long[newcapacity];
+        heads = new int[newcapacity];
+        memset(keys, 0xFF, newcapacity * sizeof(unsigned long long));
+        capacity = newcapacity;
+        for (size_t i=0; i<oldcapacity; i++) {
+            if (oldkeys[i] != EMPTY_KEY) {
+                size_t slot = _hash(oldkeys[i]) & (capacity - 1);
+                while (keys[slot] != EMPTY_KEY) {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                keys[slot] = oldkeys[i];
+                heads[slot] = oldheads[i];
+            }
+        }
+        if (oldkeys != nullptr) {
+            delete [] oldkeys;
+            delete [] oldheads;
+        }
+    }
+    int _allocentry() {
+        if (freeentry != -1) {
+            int e = freeentry;
+            freeentry = entries[e].next;
+            return e;
+        }
+        if (nentries >= allocentries) {
+            size_t newalloc = allocentries == 0 ? CHUNK_INDEX_MIN_CAPACITY : allocentries * 2;
+            Entry* newentries = new Entry[newalloc];
+            if (entries != nullptr) {
+                memcpy(newentries, entries, nentries * sizeof(Entry));
+                delete [] entries;
+            }
+            entries = newentries;
+            allocentries = newalloc;
+        }
+        return nentries++;
+    }
+
+    public:
+    ChunkIndex() {}
+    ChunkIndex(const ChunkIndex&) = delete;
+    ChunkIndex& operator=(const ChunkIndex&) = delete;
+    ~ChunkIndex() {
+        clear();
+    }
+    /* Remove every chunk and free the table. */
+    void clear() {
+        if (keys != nullptr) {
+            delete [] keys;
+            delete [] heads;
+        }
+        if (entries != nullptr) {
+            delete [] entries;
+        }
+        keys = nullptr;
+        heads = nullptr;
+        entries = nullptr;
+        capacity = used = nentries = allocentries = 0;
+        freeentry = -1;
+    }
+    /* Exchange tables with other. */
+    void swap(ChunkIndex& other) {
+        std::swap(keys, other.keys);
+        std::swap(heads, other.heads);
+        std::swap(capacity, other.capacity);
+        std::swap(used, other.used);
+        std::swap(entries, other.entries);
+        std::swap(nentries, other.nentries);
+        std::swap(allocentries, other.allocentries);
+        std::swap(freeentry, other.freeentry);
+    }
+    /* Register chunk number `chunk` covering x..x+w-1, z..z+h-1 on level y. */
+    void insert(int chunk, int x, int y, int z, int w, int h) {
+        if (w <= 0 || h <= 0) {
+            return;
+        }
+        int rx1 = x >> CHUNK_INDEX_REGION_SHIFT;
+        int rz1 = z >> CHUNK_INDEX_REGION_SHIFT;
+        int rx2 = (x + w - 1) >> CHUNK_INDEX_REGION_SHIFT;
+        int rz2 = (z + h - 1) >> CHUNK_INDEX_REGION_SHIFT;
+        for (int rz=rz1; rz<=rz2; rz++) {
+            for (int rx=rx1; rx<=rx2; rx++) {
+                size_t slot = _slot(_key(rx, y, rz), true);
+                int e = _allocentry();
+                entries[e] = {chunk, -1, x, z, x + w, z + h};
+                // keep each region list ordered by insertion so the first chunk loaded wins on overlap
+                if (heads[slot] == -1) {
+                    heads[slot] = e;
+                } else {
+                    int last = heads[slot];
+                    while (entries[last].next != -1) {
+                        last = entries[last].next;
+                    }
+                    entries[last].next = e;
+                }
+            }
+        }
+    }
+    /* Unregister chunk number `chunk`. The bounds must match those passed to insert(). */
+    void remove(int chunk, int x, int y, int z, int w, int h) {
+        if (w <= 0 || h <= 0) {
+            return;
+        }
+        int rx1 = x >> CHUNK_INDEX_REGION_SHIFT;
+        int rz1 = z >> CHUNK_INDEX_REGION_SHIFT;
+        int rx2 = (x + w - 1) >> CHUNK_INDEX_REGION_SHIFT;
+        int rz2 = (z + h - 1) >> CHUNK_INDEX_REGION_SHIFT;
+        for (int rz=rz1; rz<=rz2; rz++) {
+            for (int rx=rx1; rx<=rx2; rx++) {
+                long long slot = _slot(_key(rx, y, rz), false);
+                if (slot == -1) {
+                    continue;
+                }
+                int prev = -1;
+                for (int e=heads[slot]; e!=-1; e=entries[e].next) {
+                    if (entries[e].chunk == chunk) {
+                        if (prev == -1) {
+                            heads[slot] = entries[e].next;
+                        } else {
+                            entries[prev].next = entries[e].next;
+                        }
+                        entries[e].next = freeentry;
+                        freeentry = e;
+                        break;
+                    }
+                    prev = e;
+                }
+            }
+        }
+    }
+    /* Return the number of the chunk containing tile x,y,z, or -1 if there is none. */
+    inline int find(int x, int y, int z) const {
+        if (capacity == 0) {
+            return -1;
+        }
+        unsigned long long key = _key(x >> CHUNK_INDEX_REGION_SHIFT, y, z >> CHUNK_INDEX_REGION_SHIFT);
+        size_t slot = _hash(key) & (capacity - 1);
+        while (keys[slot] != EMPTY_KEY) {
+            if (keys[slot] == key) {
+                for (int e=heads[slot]; e!=-1; e=entries[e].next) {
+                    const Entry& en = entries[e];
+                    if (x >= en.x1 && x < en.x2 && z >= en.z1 && z < en.z2) {
+                        return en.chunk;
+                    }
+                }
+                return -1;
+            }
+            slot = (slot + 1) & (capacity - 1);
+        }
+        return -1;
+    }
+};
@@ -53,6 +53,16 @@ class MainConfig : public ConfigFile {
         setFloat("PlayerUY", 1);
         setFloat("PlayerUZ", 0);
         setFloat("RenderDistance", 60);
+        setFloat("LoadRadius", 0);
+        setBool("StreamLevels", false);
+        setFloat("StreamHysteresis", 8);
+        setBool("GreedyMeshing", true);
+        setBool("FloodLighting", false);
+        setBool("OcclusionCulling", true);
+        setBool("ParallelScripts", true);
+        setFloat("ScriptBudget", 4);
+        setBool("ScriptJit", true);
+        setBool("ScriptProfiler", false);
         setBool("CheatsEnabled", false);
         setBool("FreecamEnabled", false);
         setBool("GodmodeEnabled", false);
@@ -89,6 +99,8 @@ class DevConfig : public ConfigFile {
         // Set defaults
         setBool("DevEnabled", false);
         setBool("SaveMapOnExit", false);
+        setBool("BakeLighting", true);
+        setBool("SaveBakedLighting", false);
 
         // Load from file
         load();
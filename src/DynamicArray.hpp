@@ -91,6 +91,27 @@ class DynamicArray {
     void trim() {
         resize(len);
     }
+    /* Drop the items from count onwards. */
+    void truncate(size_t count) {
+        for (size_t i=count; i<len; i++) {
+            items[i] = T();
+        }
+        if (count < len) {
+            len = count;
+        }
+    }
+    /* Make the array exactly count items long, growing the allocation if needed, without going through get().
+       Items past the old length start out as T(). */
+    void setLength(size_t count) {
+        if (count > alloc) {
+            resize(count);
+        }
+        for (size_t i=len; i<count; i++) {
+            items[i] = T();
+        }
+        truncate(count);
+        len = count;
+    }
     T* collapse() {
         if (len == 0) {
             return nullptr;
@@ -101,6 +122,17 @@ class DynamicArray {
         }
         return newitems;
     }
+    /* Exchange contents with other without copying any items. */
+    void swap(DynamicArray<T, MIN_ALLOC>& other) {
+        size_t l = len, a = alloc;
+        T* it = items;
+        len = other.len;
+        alloc = other.alloc;
+        items = other.items;
+        other.len = l;
+        other.alloc = a;
+        other.items = it;
+    }
     operator T*() {
         return items;
     }
@@ -13,25 +13,33 @@
 #include "Helpers.hpp"
 #include "Registries.hpp"
 #include "MapData.hpp"
+#include "JobSystem.hpp"
+#include "LevelLoader.hpp"
 #include "ScriptEngine/ScriptInterface.hpp"
+#include "ScriptEngine/ScriptProfiler.hpp"
 #include "ShaderLoader.hpp"
 
 const char* MAIN_CONFIG_FILE = "config.dat";
 const char* SHADER_CONFIG_FILE = "assets/shaders/cfg.dat";
 const char* DEV_CONFIG_FILE = "dev.dat";
 const char* VERSION_STRING = "0.0.2-indev";
+// where the camera starts in every level, see ResetCamera(); v2 levels are loaded around it
+const Vector3 PLAYER_SPAWN = {0, PLAYER_HEIGHT, 0};
 
 EntityRenderer* GlobalEntityRenderer=nullptr;
 BR92Engine* GlobalEngine=nullptr;
 
 #pragma region Init
 void BR92Engine::Init() {
+	GlobalJobSystem = new JobSystem();
+	TraceLog(LOG_INFO, "Started job system with %llu workers", GlobalJobSystem->workerCount());
     GlobalMapTileRegistry = new MapTileRegistry();
     GlobalTextureRegistry = new TextureRegistry();
 	GlobalEntityRegistry = new EntityRegistry();
 	GlobalScriptRegistry = new ScriptRegistry();
 	GloablScriptInterface = new ScriptInterface();
 	GlobalEntityRenderer = new EntityRenderer();
+	levelLoader = new LevelLoader();
 	GlobalEngine = this;
 }
 
@@ -86,6 +94,16 @@ void BR92Engine::LoadData() {
 	GlobalMapData->SetTextureRegistry(GlobalTextureRegistry);
 	GlobalMapData->SetTileRegistry(GlobalMapTileRegistry);
 	GlobalMapData->renderDistance = cfg->getFloat("RenderDistance");
+	GlobalMapData->loadRadius = cfg->getFloat("LoadRadius");
+	GlobalMapData->streaming = cfg->getBool("StreamLevels");
+	GlobalMapData->streamHysteresis = cfg->getFloat("StreamHysteresis");
+	GlobalMapData->greedyMeshing = cfg->getBool("GreedyMeshing");
+	GlobalMapData->floodLighting = cfg->getBool("FloodLighting");
+	GlobalMapData->occlusionCulling = cfg->getBool("OcclusionCulling");
+	GlobalEntityRenderer->parallelScripts = cfg->getBool("ParallelScripts");
+	GlobalEntityRenderer->scriptBudget = cfg->getFloat("ScriptBudget");
+	ScriptBytecode::useJit = cfg->getBool("ScriptJit");
+	ScriptProfiler::enabled = cfg->getBool("ScriptProfiler");
 	GlobalMapData->fogColor[0] = scfg->getByte("FogColorR") * 1/255.0f;
 	GlobalMapData->fogColor[1] = scfg->getByte("FogColorG") * 1/255.0f;
 	GlobalMapData->fogColor[2] = scfg->getByte("FogColorB") * 1/255.0f;
@@ -103,28 +121,24 @@ bool BR92Engine::LoadLevel(char* name) {
     } else {
         levelFileName = name;
     }
-	RBuffer readbuf;
-	readbuf.open(levelFileName);
 	GlobalEntityRenderer->clear();
-	if (readbuf.available() > 0) {
-		if (!GlobalMapData->LoadMap(readbuf)) {
-			AssetFormatError(levelFileName);
-            return false;
-		}
-	} else {
-		MissingAssetError(levelFileName);
-        return false;
+	GlobalMapData->loadCenter = PLAYER_SPAWN;
+	if (!LevelLoader::read(GlobalMapData, levelFileName, dcfg->getBool("BakeLighting"), dcfg->getBool("SaveBakedLighting"))) {
+		return false;
 	}
-	// if (!map->HasLoadedLightmaps()) {
-	// 	map->BuildLighting();
-	// }
+	GloablScriptInterface->loadTileTable(GlobalMapTileRegistry);
 	GlobalEntityRenderer->Init();
-	GlobalMapData->GenerateMesh();
 	GlobalMapData->UploadMap();
+    ResetCamera();
+    return true;
+}
+#pragma endregion
+
+#pragma region ResetCamera
+void BR92Engine::ResetCamera() {
     Vector3 delta = Vector3Subtract(camera.target, camera.position);
-    camera.position = {0, PLAYER_HEIGHT, 0};
+    camera.position = PLAYER_SPAWN;
     camera.target = {delta.x, delta.y+PLAYER_HEIGHT, delta.z};
-    return true;
 }
 #pragma endregion
 
@@ -135,7 +149,9 @@ void BR92Engine::UnloadLevel() {
 #pragma endregion
 
 #pragma region LoadIndex
-char* BR92Engine::LoadIndex() {
+/* Return the path of the first level listed in assets/index (one name per line), or of the level listed after
+   the one at path `after`. Returns nullptr if there is none. Free with delete []. */
+char* BR92Engine::LoadIndex(const char* after) {
 	std::ifstream fd(AssetPath::root("index", nullptr));
 	if (fd.is_open()) {
 		size_t count = fstreamlen(fd);
@@ -143,7 +159,23 @@ char* BR92Engine::LoadIndex() {
 		fd.read(data, count);
 		data[count] = 0;
 		fd.close();
-		char* name = AssetPath::clone(AssetPath::level(data));
+		char* name = nullptr;
+		bool found = (after == nullptr);
+		char* line = data;
+		while (name == nullptr && *line) {
+			char* end = line + strcspn(line, "\r\n");
+			char next = *end;
+			*end = 0;
+			if (*line) {
+				char* path = AssetPath::level(line);
+				if (found) {
+					name = AssetPath::clone(path);
+				} else if (!strcmp(path, after)) {
+					found = true;
+				}
+			}
+			line = next ? end + 1 : end;
+		}
 		delete[] data;
         return name;
 	} else {
@@ -190,7 +222,9 @@ void BR92Engine::OpenWindow(char* title) {
 	SetTargetFPS(targetFps);
 	SetExitKey(-1);
 	GlobalEntityRenderer->PreInit();
-	postShader = ShaderLoader::load(AssetPath::shader("post"));
+	postShader.load(AssetPath::shader("post"));
+	postScreenTexture = postShader.uniform("screenTexture");
+	postResolution = postShader.uniform("resolution");
 	glGenVertexArrays(1, &postVao);
 
 	SetMousePosition(300, 220);
@@ -278,28 +312,104 @@ void BR92Engine::BeforeMainLoop() {
 	dev_lightColor[0] = dev_lightColor[1] = dev_lightColor[2] = 1.0f;
 	dev_liveUpdateLight = false;
 	dev_liveFollowLight = false;
+	PrefetchNextLevel();
 }
 #pragma endregion
 
 #pragma region TryLoadLevel
+/* Switch to level name, either a path or a name in assets/levels, without stalling the game: the current level
+   keeps playing until the new one is loaded and uploaded, and a prefetched level is switched to straight away.
+   Returns false if there is no such level. */
 bool BR92Engine::TryLoadLevel(char* name) {
-    char* oldname = levelFileName;
-    UnloadLevel();
-    name = AssetPath::clone(name);
-    if (!LoadLevel(name)) {
-        if (!LoadLevel(AssetPath::level(name))) {
-            // if (!LoadLevel(oldname)) {
-            //     exit(1);
-            // }
-            LoadLevel(oldname);
-            delete [] name;
+    if (!FileExists(name)) {
+        name = AssetPath::level(name);
+        if (!FileExists(name)) {
+            MissingAssetError(name);
             return false;
         }
     }
-    delete [] name;
+    delete [] wantedLevelName;
+    wantedLevelName = AssetPath::clone(name);
+    UpdateLevelLoading();
     return true;
 }
+#pragma endregion
 
+#pragma region PrefetchLevel
+/* Start loading level path name in the background, so switching to it later is instant. Returns false if
+   another level is still being loaded. */
+bool BR92Engine::PrefetchLevel(char* name) {
+    if (levelLoader->holds(name)) {
+        return true;
+    }
+    if (levelLoader->loading()) {
+        return false;
+    }
+    GlobalMapData->loadCenter = PLAYER_SPAWN;
+    levelLoader->start(name, dcfg->getBool("BakeLighting"));
+    return true;
+}
+#pragma endregion
+
+#pragma region PrefetchNextLevel
+void BR92Engine::PrefetchNextLevel() {
+    char* next = LoadIndex(levelFileName);
+    if (next != nullptr) {
+        PrefetchLevel(next);
+        delete [] next;
+    }
+}
+#pragma endregion
+
+#pragma region LoadNextLevel
+/* Switch to the level after the current one in assets/index. Returns false if this is the last one. */
+bool BR92Engine::LoadNextLevel() {
+    char* next = LoadIndex(levelFileName);
+    if (next == nullptr) {
+        return false;
+    }
+    bool rv = TryLoadLevel(next);
+    delete [] next;
+    return rv;
+}
+#pragma endregion
+
+#pragma region UpdateLevelLoading
+/* Advance background level loading by a frame: upload part of the staged level, and switch to it once it is
+   complete if it is the wanted one. */
+void BR92Engine::UpdateLevelLoading() {
+    LevelLoader::State state = levelLoader->step(LEVEL_UPLOAD_BUDGET_MS);
+    if (wantedLevelName == nullptr || state == LevelLoader::Loading) {
+        return;
+    }
+    if (!levelLoader->holds(wantedLevelName)) {
+        // the staged level (a prefetch) isn't the one asked for
+        GlobalMapData->loadCenter = PLAYER_SPAWN;
+        levelLoader->start(wantedLevelName, dcfg->getBool("BakeLighting"));
+        return;
+    }
+    if (state == LevelLoader::Failed) {
+        TraceLog(LOG_WARNING, "Could not load level %s, staying on %s", wantedLevelName, levelFileName);
+        levelLoader->discard();
+        delete [] wantedLevelName;
+        wantedLevelName = nullptr;
+        return;
+    }
+    if (state != LevelLoader::Ready) {
+        return;
+    }
+    GlobalEntityRenderer->clear();
+    levelLoader->take(GlobalMapData);
+    delete [] levelFileName;
+    levelFileName = wantedLevelName;
+    wantedLevelName = nullptr;
+    GloablScriptInterface->loadTileTable(GlobalMapTileRegistry);
+    GlobalEntityRenderer->Init();
+    ResetCamera();
+    playerMomentumVertical = 0;
+    TraceLog(LOG_INFO, "Switched to level %s", levelFileName);
+    PrefetchNextLevel();
+}
 #pragma endregion
 
 #pragma region Draw
@@ -343,14 +453,12 @@ void BR92Engine::Draw() {
 
 		EndTextureMode();
 
-		if (post_process_enabled && IsShaderReady(postShader)) {
-			glUseProgram(postShader.id);
+		if (post_process_enabled && postShader.ready()) {
+			postShader.use();
 			glActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, screenTexture.texture.id);
-			unsigned int loc = GetShaderLocation(postShader, "screenTexture");
-			glUniform1i(loc, 0);
-			loc = GetShaderLocation(postShader, "resolution");
-			glUniform2f(loc, screenTexture.texture.width, screenTexture.texture.height);
+			postShader.set(postScreenTexture, 0);
+			postShader.set(postResolution, (float)screenTexture.texture.width, (float)screenTexture.texture.height);
 			glDisable(GL_DEPTH_TEST);
 			glBindVertexArray(postVao);
 			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
@@ -432,6 +540,29 @@ void BR92Engine::Draw() {
 				}
 				if (ImGui::SliderFloat("Mouse Sensitivity", &mouseSensitivity, 0.05f, 1.0f)) {}
 				if (ImGui::SliderFloat("Render Distance", &GlobalMapData->renderDistance, 10.0f, 200.0f)) {}
+				if (ImGui::Checkbox("Greedy Meshing", &GlobalMapData->greedyMeshing)) {
+					GlobalMapData->GenerateMesh();
+					GlobalMapData->UploadMap();
+				}
+				if (ImGui::Checkbox("Flood Fill Lighting", &GlobalMapData->floodLighting)) {
+					GlobalMapData->BuildLighting();
+					GlobalMapData->UploadMap();
+				}
+				ImGui::Checkbox("Occlusion Culling", &GlobalMapData->occlusionCulling);
+				ImGui::Text("Chunks: %llu drawn, culled %llu by distance, %llu by frustum, %llu by occlusion",
+					(unsigned long long)GlobalMapData->chunksDrawn, (unsigned long long)GlobalMapData->chunksCulledDistance,
+					(unsigned long long)GlobalMapData->chunksCulledFrustum, (unsigned long long)GlobalMapData->chunksCulledOcclusion);
+				if (GlobalMapData->isStreaming()) {
+					ImGui::Text("Streaming: %llu of %llu chunks resident, %llu streamed in, %llu evicted",
+						(unsigned long long)GlobalMapData->chunksResident, (unsigned long long)GlobalMapData->streamEntryCount(),
+						(unsigned long long)GlobalMapData->chunksStreamedIn, (unsigned long long)GlobalMapData->chunksEvicted);
+				}
+				ImGui::Checkbox("Parallel Entity Scripts", &GlobalEntityRenderer->parallelScripts);
+				ImGui::SliderFloat("Script Budget (ms)", &GlobalEntityRenderer->scriptBudget, 0.0f, 16.0f);
+				ImGui::Text("Entity scripts: %llu run, %llu deferred",
+					(unsigned long long)GlobalEntityRenderer->scriptsRun, (unsigned long long)GlobalEntityRenderer->scriptsDeferred);
+				ImGui::Checkbox("Native Script Code", &ScriptBytecode::useJit);
+				ImGui::Checkbox("Profile Scripts", &ScriptProfiler::enabled);
 				if (ImGui::SliderInt("Render Scale", &renderScale, 320, 8192)) {
 					ResizeWindow();
 				}
@@ -448,6 +579,67 @@ void BR92Engine::Draw() {
 			}
 #pragma endregion
 
+#pragma region UI: Script Profiler
+			/* Script profiler totals, since start or the last reset */
+			if (ScriptProfiler::enabled) {
+				ImGui::Begin("Script Profiler");
+				if (ImGui::Button("Reset")) {
+					ScriptProfiler::reset();
+				}
+				ImGui::SameLine();
+				if (ImGui::Button("Save CSV")) {
+					ScriptProfiler::dumpCSV("script_profile.csv");
+				}
+				if (ImGui::BeginTable("Scripts", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit)) {
+					ImGui::TableSetupColumn("Script");
+					ImGui::TableSetupColumn("Runs");
+					ImGui::TableSetupColumn("Cycles");
+					ImGui::TableSetupColumn("Total ms");
+					ImGui::TableSetupColumn("us/run");
+					ImGui::TableHeadersRow();
+					for (size_t i=0; i<ScriptProfiler::scriptCount(); i++) {
+						ScriptProfiler::Script* script = ScriptProfiler::script(i);
+						unsigned long long runs = script->runs.load(), ns = script->nanoseconds.load();
+						ImGui::TableNextRow();
+						ImGui::TableNextColumn();
+						ImGui::Text("%s", script->name);
+						ImGui::TableNextColumn();
+						ImGui::Text("%llu", runs);
+						ImGui::TableNextColumn();
+						ImGui::Text("%llu", script->cycles.load());
+						ImGui::TableNextColumn();
+						ImGui::Text("%.2f", ns * 1e-6);
+						ImGui::TableNextColumn();
+						ImGui::Text("%.2f", runs > 0 ? ns * 1e-3 / runs : 0.0);
+					}
+					ImGui::EndTable();
+				}
+				static ScriptProfiler::Counters totals;
+				ScriptProfiler::total(totals);
+				if (ImGui::CollapsingHeader("Interface Calls")) {
+					for (size_t i=0; i<ScriptProfiler::NumCalls; i++) {
+						if (totals.calls[i] > 0) {
+							ImGui::Text("%-22s %10llu calls %9.2f ms", ScriptProfiler::callName(i), totals.calls[i],
+								totals.callNanoseconds[i] * 1e-6);
+						}
+					}
+				}
+#ifdef SCRIPT_PROFILE_OPCODES
+				if (ImGui::CollapsingHeader("Opcodes")) {
+					ImGui::Text("Native code runs are not counted.");
+					for (size_t i=0; ScriptProfiler::opcodeName(i) != nullptr; i++) {
+						if (totals.opcodes[i] > 0) {
+							ImGui::Text("%-22s %12llu", ScriptProfiler::opcodeName(i), totals.opcodes[i]);
+						}
+					}
+				}
+#else
+				ImGui::Text("Opcode counts need a build with the SCRIPT_PROFILER option.");
+#endif
+				ImGui::End();
+			}
+#pragma endregion
+
 #pragma region UI: Shader CFG
 			/* Shader Config Menu */
 			if (dev_enabled) {
@@ -476,6 +668,13 @@ void BR92Engine::Draw() {
                 ImGui::InputText("Path", tempLevelName, sizeof(tempLevelName));
                 if (ImGui::Button("Load Level")) {
                     TryLoadLevel(tempLevelName);
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Next Level")) {
+                    LoadNextLevel();
+                }
+                if (wantedLevelName != nullptr) {
+                    ImGui::Text("Loading %s...", wantedLevelName);
                 }
 				ImGui::End();
 			}
@@ -634,6 +833,10 @@ void BR92Engine::Update(float dt) {
 	if (!drawing_menus) {
 		GlobalEntityRenderer->Update(GlobalMapData, camera.position, dt);
 	}
+	GlobalMapData->UpdateStreaming(camera.position, STREAM_BUDGET_MS);
+	// apply this frame's map edits, and remesh chunks next to those just streamed in
+	GlobalMapData->UpdateDirty();
+	UpdateLevelLoading();
 }
 #pragma endregion
 
@@ -642,9 +845,18 @@ void BR92Engine::EndWindow() {
 	if (save_on_exit) {
 		GlobalMapData->SaveMap(levelFileName);
 	}
+	if (ScriptProfiler::enabled && !ScriptProfiler::dumpCSV("script_profile.csv")) {
+		TraceLog(LOG_WARNING, "Could not write script_profile.csv");
+	}
 
+	// the loader thread uses the job system, and staged meshes may own GL objects
+	levelLoader->discard();
 	rlImGuiShutdown();
 	CloseWindow();
+	delete GlobalEntityRenderer;
+	GlobalEntityRenderer = nullptr;
+	delete GlobalJobSystem;
+	GlobalJobSystem = nullptr;
 }
 #pragma endregion
 
@@ -669,6 +881,13 @@ void BR92Engine::SaveConfigs() {
     cfg->setFloat("PlayerUY", camera.up.y);
     cfg->setFloat("PlayerUZ", camera.up.z);
 	cfg->setFloat("RenderDistance", GlobalMapData->renderDistance);
+	cfg->setBool("GreedyMeshing", GlobalMapData->greedyMeshing);
+	cfg->setBool("FloodLighting", GlobalMapData->floodLighting);
+	cfg->setBool("OcclusionCulling", GlobalMapData->occlusionCulling);
+	cfg->setBool("ParallelScripts", GlobalEntityRenderer->parallelScripts);
+	cfg->setFloat("ScriptBudget", GlobalEntityRenderer->scriptBudget);
+	cfg->setBool("ScriptJit", ScriptBytecode::useJit);
+	cfg->setBool("ScriptProfiler", ScriptProfiler::enabled);
 	cfg->setFloat("MouseSensitivity", mouseSensitivity);
 	cfg->setBool("CheatsEnabled", cheats_enabled);
 	cfg->setBool("FreecamEnabled", freecam);
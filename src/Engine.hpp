@@ -2,10 +2,17 @@
 
 #include "Configs.hpp"
 #include "Entity.hpp"
+#include "ShaderLoader.hpp"
 #include "imgui.h"
 #include "raylib.h"
 
 #define PLAYER_SPEED 1.5f
+// milliseconds per frame spent uploading a level loaded in the background
+#define LEVEL_UPLOAD_BUDGET_MS 2.0
+// milliseconds per frame spent streaming in chunks of a streamed level
+#define STREAM_BUDGET_MS 2.0
+
+class LevelLoader;
 
 extern EntityRenderer* GlobalEntityRenderer;
 
@@ -15,7 +22,11 @@ class BR92Engine {
     ShaderConfig* scfg=nullptr;
     DevConfig* dcfg=nullptr;
     char* levelFileName=nullptr;
-    Shader postShader;
+    // level to switch to once levelLoader has it ready, nullptr if none
+    char* wantedLevelName=nullptr;
+    LevelLoader* levelLoader=nullptr;
+    ShaderProgram postShader;
+    int postScreenTexture, postResolution;
     RenderTexture2D gameTexture;
     RenderTexture2D screenTexture;
     Camera3D camera;
@@ -44,7 +55,7 @@ class BR92Engine {
     bool LoadRegistries(char* textures=nullptr, char* tiles=nullptr, char* entities=nullptr, char* scripts=nullptr);
     void LoadConfigs();
     void LoadData();
-    char* LoadIndex();
+    char* LoadIndex(const char* after=nullptr);
     void OpenWindow(char* title);
     void InitMesher();
     void InitCamera();
@@ -52,6 +63,11 @@ class BR92Engine {
     bool LoadLevel(char* name=nullptr);
     void UnloadLevel();
     bool TryLoadLevel(char* name);
+    bool PrefetchLevel(char* name);
+    void PrefetchNextLevel();
+    bool LoadNextLevel();
+    void UpdateLevelLoading();
+    void ResetCamera();
     void BeforeMainLoop();
     void Draw();
     void HandleInputs(float dt);
@@ -1,16 +1,26 @@
 #pragma once
 
 #include "EntityRegistry.hpp"
+#include "JobSystem.hpp"
 #include "MapData.hpp"
 #include "Registries.hpp"
 #include "ScriptEngine/ScriptBytecode.hpp"
+#include "ScriptEngine/ScriptContextPool.hpp"
 #include "external/glad.h"
 #include "raylib.h"
 #include "rlgl.h"
 #include "raymath.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
 #include <cmath>
 #include <ios>
 
+// entities whose scripts run as one job in a parallel update
+#define ENTITY_SCRIPT_GROUP 64
+// times an init script may yield before Init() gives up on it
+#define ENTITY_INIT_YIELDS 1024
+
 #define OpenGLDebug(s) if (GLenum e = glGetError()) printf("%s: OpenGL Error: %u\n", s, e)
 
 class Entity {
@@ -21,6 +31,12 @@ class Entity {
     unsigned short type;
     float timer, frametimer;
     unsigned char frameno;
+    // line of sight to the camera, resolved once per frame by EntityRenderer::UpdateLineOfSight
+    bool losValid, seesPlayer;
+    // script variables of this entity, shared by its init and update scripts. Null if it has no scripts.
+    ScriptBytecode::Context* context;
+    // frames since the update script last ran, raises its priority when the script budget runs out
+    unsigned short scriptWait;
 
     Entity(unsigned short ty=0, Vector3 p={0,0,0}, float r=0.0, float s=1.0f) {
         EntityType* entt = GlobalEntityRegistry->of(ty);
@@ -36,6 +52,9 @@ class Entity {
         scale = entt->scale * s;
         timer = frametimer = 0.0f;
         frameno = 0;
+        losValid = seesPlayer = false;
+        context = nullptr;
+        scriptWait = 0;
     }
 
     bool valid() {
@@ -52,6 +71,8 @@ class Entity {
     void Move(Vector3 dist, bool set=false) {
         if (set) {
             pos = dist;
+            // small moves keep this frame's line of sight, teleports don't
+            losValid = false;
         } else {
             pos = Vector3Add(pos, dist);
         }
@@ -60,6 +81,15 @@ class Entity {
 
 class EntityRenderer : public DynamicArray<Entity*> {
     unsigned int vao, vbo;
+    DynamicArray<Vector3> losOrigins, losDirs;
+    DynamicArray<float> losDists;
+    DynamicArray<HitInfo> losHits;
+    DynamicArray<size_t> losEntities;
+    ScriptContextPool contexts;
+    DynamicArray<ScriptCommandBuffer*, 16> commandBuffers;
+    // entities with an update script in the order they run, and their priority (lower runs first)
+    DynamicArray<size_t> scriptOrder;
+    DynamicArray<float> scriptPriority;
     static const constexpr char cubeverts[12] = {
         1, 0, 0,
         1, 1, 0,
@@ -81,6 +111,12 @@ class EntityRenderer : public DynamicArray<Entity*> {
         0, 0.25, 2,
     };
     public:
+    // run entity scripts on the job system, see Update()
+    bool parallelScripts = true;
+    // time update scripts may take per frame in milliseconds, 0 for no limit. See Update().
+    float scriptBudget = 4.0f;
+    // update scripts run and left for a later frame by the last Update()
+    size_t scriptsRun = 0, scriptsDeferred = 0;
     void PreInit() {
         glGenVertexArrays(1, &vao);
         glGenBuffers(1, &vbo);
@@ -92,9 +128,31 @@ class EntityRenderer : public DynamicArray<Entity*> {
     }
     Entity* Add(unsigned short type, Vector3 pos, float rot=0) {
         Entity* ent = new Entity(type, pos, rot);
+        EntityType* ent_type = GlobalEntityRegistry->of(ent->type);
+        if (ent_type != nullptr && (ent_type->script != 0 || ent_type->script_init != 0)) {
+            ent->context = contexts.acquire();
+            ent->context->seed(length());
+        }
         append(ent);
         return ent;
     }
+    /* Remove every entity, returning their script contexts to the pool. */
+    void clear() {
+        for (size_t i=0; i<length(); i++) {
+            Entity* ent = get(i);
+            if (ent != nullptr) {
+                contexts.release(ent->context);
+                ent->context = nullptr;
+            }
+        }
+        DynamicArray<Entity*>::clear();
+    }
+    ~EntityRenderer() {
+        for (size_t i=0; i<commandBuffers.length(); i++) {
+            delete commandBuffers[i];
+        }
+        commandBuffers.clear();
+    }
 
     void Init() {
         for (size_t i=0; i<length(); i++) {
@@ -107,68 +165,210 @@ class EntityRenderer : public DynamicArray<Entity*> {
                 continue;
             }
             Script* script = GlobalScriptRegistry->of(ent_type->script_init);
-            if (script == nullptr) {
+            if (script == nullptr || ent->context == nullptr) {
                 continue;
             }
             long long rval[8] = {0};
             long long argv[2] = {(signed)i, ent->frameno};
-            int res = script->code.run(2, argv, rval);
+            int res = script->code.run(*ent->context, 2, argv, rval);
+            // init scripts run to completion, a yield only splits the run
+            for (int y=0; res == ScriptBytecode::Result::Yielded && y < ENTITY_INIT_YIELDS; y++) {
+                res = script->code.run(*ent->context, 2, argv, rval);
+            }
             if (res != ScriptBytecode::Result::Success) {
                 TraceLog(LOG_ERROR, "Script %u (Init) exited with code %d", i, res);
             }
         }
     }
 
-    void Update(MapData* map, Vector3 camera, float dt) {
+    /* Cast the line of sight rays of every scripted entity to the camera as one batch. */
+    void UpdateLineOfSight(MapData* map, Vector3 camera) {
+        losOrigins.clear();
+        losDirs.clear();
+        losDists.clear();
+        losEntities.clear();
         for (size_t i=0; i<length(); i++) {
             Entity* ent = get(i);
             if (ent == nullptr || ent->type == 0) {
                 continue;
             }
             EntityType* ent_type = GlobalEntityRegistry->of(ent->type);
-            if (ent_type == nullptr) {
+            if (ent_type == nullptr || ent_type->script == 0) {
                 continue;
             }
-            if (ent_type->facesplayer) {
-                Vector3 dir = Vector3Subtract(ent->pos, camera);
-                float rot = -atan2f(dir.z, dir.x);
-                ent->Rotate(rot, true);
-            }
-            ent->frametimer += dt;
-            if (ent->frametimer >= ent_type->frametime) {
-                ent->frametimer -= ent_type->frametime;
-                ent->frameno++;
+            Vector3 dir = Vector3Subtract(camera, ent->pos);
+            losOrigins.append(ent->pos);
+            losDirs.append(dir);
+            losDists.append(Vector3Length(dir));
+            losEntities.append(i);
+        }
+        size_t count = losEntities.length();
+        if (count == 0) {
+            return;
+        }
+        losHits.setLength(count);
+        map->RayCastBatch(losOrigins, losDirs, losDists, losHits, count);
+        for (size_t j=0; j<count; j++) {
+            Entity* ent = get(losEntities[j]);
+            ent->seesPlayer = losHits[j].distance >= losDists[j];
+            ent->losValid = true;
+        }
+    }
+
+    /* Animate entity i. */
+    void AnimateEntity(size_t i, Vector3 camera, float dt) {
+        Entity* ent = get(i);
+        if (ent == nullptr || ent->type == 0) {
+            return;
+        }
+        EntityType* ent_type = GlobalEntityRegistry->of(ent->type);
+        if (ent_type == nullptr) {
+            return;
+        }
+        if (ent_type->facesplayer) {
+            Vector3 dir = Vector3Subtract(ent->pos, camera);
+            float rot = -atan2f(dir.z, dir.x);
+            ent->Rotate(rot, true);
+        }
+        ent->frametimer += dt;
+        if (ent->frametimer >= ent_type->frametime) {
+            ent->frametimer -= ent_type->frametime;
+            ent->frameno++;
+        }
+        if (ent->frameno >= ent_type->nframes) {
+            ent->frameno = 0;
+        }
+        ent->tno = ent_type->textures[ent->frameno];
+    }
+
+    /* The update script of entity i, or null if it has none or no context to run it in. */
+    Script* UpdateScript(size_t i) {
+        Entity* ent = get(i);
+        if (ent == nullptr || ent->type == 0 || ent->context == nullptr) {
+            return nullptr;
+        }
+        EntityType* ent_type = GlobalEntityRegistry->of(ent->type);
+        if (ent_type == nullptr || ent_type->script == 0) {
+            return nullptr;
+        }
+        return GlobalScriptRegistry->of(ent_type->script);
+    }
+
+    /* Run the update script of entity i, or continue it if it yielded. With a command buffer, the script's
+       entity changes are recorded into it instead of applied. */
+    void RunEntityScript(size_t i, ScriptCommandBuffer* buffer) {
+        Entity* ent = get(i);
+        Script* script = UpdateScript(i);
+        if (buffer != nullptr) {
+            buffer->beginRun();
+        }
+        long long rval[8] = {0};
+        long long argv[2] = {(signed)i, ent->frameno};
+        int res = script->code.run(*ent->context, 2, argv, rval);
+        if (res != ScriptBytecode::Result::Success && res != ScriptBytecode::Result::Yielded) {
+            TraceLog(LOG_ERROR, "Script %u (Update) exited with code %d", i, res);
+        }
+        ent->scriptWait = 0;
+    }
+
+    /* Collect the entities with an update script into scriptOrder. With a script budget they are sorted
+       nearest to the camera first, with the distance divided by the frames each one has waited so far off
+       entities are not left waiting forever. Without one they keep their index order. */
+    void ScheduleScripts(Vector3 camera, bool budgeted) {
+        scriptOrder.clear();
+        if (budgeted) {
+            scriptPriority.setLength(length());
+        }
+        for (size_t i=0; i<length(); i++) {
+            if (UpdateScript(i) == nullptr) {
+                continue;
             }
-            if (ent->frameno >= ent_type->nframes) {
-                ent->frameno = 0;
+            scriptOrder.append(i);
+            if (budgeted) {
+                Entity* ent = get(i);
+                scriptPriority[i] = Vector3Distance(ent->pos, camera) / (1.0f + ent->scriptWait);
             }
-            ent->tno = ent_type->textures[ent->frameno];
-            if (ent_type->script == 0) {
-                continue;
+        }
+        size_t n = scriptOrder.length();
+        if (budgeted && n > 1) {
+            size_t* order = scriptOrder;
+            float* priority = scriptPriority;
+            std::sort(order, order + n, [priority](size_t a, size_t b) {
+                return priority[a] < priority[b] || (priority[a] == priority[b] && a < b);
+            });
+        }
+    }
+
+    /* Update every entity. Every entity animates each frame, but update scripts share a time budget: they run
+       in scriptOrder until they have taken scriptBudget milliseconds, and the rest wait for a later frame. At least
+       one script runs each frame. Scripts that yield continue where they left off the next time they run.
+       With parallelScripts, scriptOrder runs in waves of ENTITY_SCRIPT_GROUP scripts per worker, split into
+       groups on the job system while the world is read-only. The budget is checked between waves, so the scripts
+       left over are always the lowest priority ones. Each group records its entity changes into its own command
+       buffer, and the buffers are applied in group order afterwards, so the result does not depend on which
+       worker ran which group. */
+    void Update(MapData* map, Vector3 camera, float dt) {
+        bool budgeted = scriptBudget > 0;
+        UpdateLineOfSight(map, camera);
+        size_t count = length();
+        for (size_t i=0; i<count; i++) {
+            AnimateEntity(i, camera, dt);
+        }
+        ScheduleScripts(camera, budgeted);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds((long long)(scriptBudget * 1000.0f));
+        size_t n = scriptOrder.length();
+        for (size_t k=0; k<n; k++) {
+            Entity* ent = get(scriptOrder[k]);
+            if (ent->scriptWait < USHRT_MAX) {
+                ent->scriptWait++;
             }
-            Script* script = GlobalScriptRegistry->of(ent_type->script);
-            if (script == nullptr) {
-                continue;
+        }
+        size_t ran = 0;
+        size_t groups = (n + ENTITY_SCRIPT_GROUP - 1) / ENTITY_SCRIPT_GROUP;
+        if (!parallelScripts || groups < 2 || GlobalJobSystem == nullptr || GlobalJobSystem->workerCount() < 2) {
+            for (size_t k=0; k<n; k++) {
+                if (budgeted && k > 0 && std::chrono::steady_clock::now() >= deadline) {
+                    break;
+                }
+                RunEntityScript(scriptOrder[k], nullptr);
+                ran++;
             }
-            long long rval[8] = {0};
-            long long argv[2] = {(signed)i, ent->frameno};
-            int res = script->code.run(2, argv, rval);
-            if (res != ScriptBytecode::Result::Success) {
-                TraceLog(LOG_ERROR, "Script %u (Update) exited with code %d", i, res);
+        } else {
+            size_t wave = budgeted ? GlobalJobSystem->workerCount() * ENTITY_SCRIPT_GROUP : n;
+            while (ran < n && (ran == 0 || !budgeted || std::chrono::steady_clock::now() < deadline)) {
+                size_t start = ran, end = std::min(n, ran + wave);
+                size_t waveGroups = (end - start + ENTITY_SCRIPT_GROUP - 1) / ENTITY_SCRIPT_GROUP;
+                while (commandBuffers.length() < waveGroups) {
+                    commandBuffers.append(new ScriptCommandBuffer());
+                }
+                GlobalJobSystem->parallelFor(waveGroups, [&](size_t g) {
+                    ScriptCommandBuffer* buffer = commandBuffers[g];
+                    buffer->clear();
+                    ScriptInterface::setCommandBuffer(buffer);
+                    size_t last = std::min(end, start + (g + 1) * ENTITY_SCRIPT_GROUP);
+                    for (size_t k=start+g*ENTITY_SCRIPT_GROUP; k<last; k++) {
+                        RunEntityScript(scriptOrder[k], buffer);
+                    }
+                    ScriptInterface::setCommandBuffer(nullptr);
+                });
+                for (size_t g=0; g<waveGroups; g++) {
+                    GloablScriptInterface->applyCommands(*commandBuffers[g]);
+                }
+                ran = end;
             }
         }
+        scriptsRun = ran;
+        scriptsDeferred = n - scriptsRun;
     }
 
     void Draw(MapData* map, Vector3 camera, float renderwidth) {
-        Shader shader = map->spriteShader;
-        glUseProgram(shader.id);
-        unsigned int loc = GetShaderLocation(shader, "renderwidth");
-        glUniform1f(loc, renderwidth);
+        ShaderProgram& shader = map->spriteShader;
+        ShaderUniforms& u = map->spriteUniforms;
+        shader.use();
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, map->atlas.id);
-        loc = GetShaderLocation(shader, "texture0");
-        glUniform1i(loc, 0);
-        glActiveTexture(GL_TEXTURE0);
+        shader.set(u.texture0, 0);
+        shader.set(u.texture1, 1);
         glEnable(GL_DEPTH_TEST);
         glDisable(GL_CULL_FACE);
         Matrix matView = rlGetMatrixModelview();
@@ -176,33 +376,25 @@ class EntityRenderer : public DynamicArray<Entity*> {
         Matrix matModel = rlGetMatrixTransform();
         Matrix matModelView = MatrixMultiply(matModel, matView);
         Matrix matModelViewProjection = MatrixMultiply(matModelView, matProjection);
-        rlSetUniformMatrix(shader.locs[SHADER_LOC_MATRIX_MVP], matModelViewProjection);
-        loc = GetShaderLocation(shader, "renderwidth");
-        glUniform1f(loc, renderwidth);
-        loc = GetShaderLocation(shader, "FogMin");
-        glUniform1f(loc, map->fogMin);
-        loc = GetShaderLocation(shader, "FogMax");
-        glUniform1f(loc, map->fogMax);
-        loc = GetShaderLocation(shader, "FogColor");
-        glUniform4f(loc, map->fogColor[0], map->fogColor[1], map->fogColor[2], map->fogColor[3]);
-        loc = GetShaderLocation(shader, "LightLevel");
-        glUniform1f(loc, map->lightLevel);
-        unsigned int tnoloc = GetShaderLocation(shader, "tno");
-        unsigned int t1loc = GetShaderLocation(shader, "texture1");
-        unsigned int modelloc = GetShaderLocation(shader, "model");
-        unsigned int scaleloc = GetShaderLocation(shader, "scale");
+        shader.set(u.mvp, matModelViewProjection);
+        shader.set(u.renderwidth, renderwidth);
+        shader.set(u.fogMin, map->fogMin);
+        shader.set(u.fogMax, map->fogMax);
+        shader.set(u.fogColor, map->fogColor[0], map->fogColor[1], map->fogColor[2], map->fogColor[3]);
+        shader.set(u.lightLevel, map->lightLevel);
+        // light maps go on unit 1, leaving the atlas bound on unit 0
+        glActiveTexture(GL_TEXTURE1);
         for (size_t i=0; i<length(); i++) {
             Entity* ent = get(i);
             if (Vector3Distance(ent->pos, camera) < map->renderDistance) {
                 LightMap* lmap = map->getLightMap(ent->pos);
                 if (lmap != nullptr) {
                     glBindTexture(GL_TEXTURE_2D, lmap->getId());
-                    glUniform1i(t1loc, 1);
                 }
                 Matrix modelmat = MatrixMultiply(MatrixRotateY(ent->rot), MatrixTranslate(ent->pos.x, ent->pos.y, ent->pos.z));
-                rlSetUniformMatrix(modelloc, modelmat);
-                glUniform1f(tnoloc, ent->tno);
-                glUniform1f(scaleloc, ent->scale);
+                shader.set(u.model, modelmat);
+                shader.set(u.tno, (float)ent->tno);
+                shader.set(u.scale, ent->scale);
                 glBindVertexArray(vao);
                 glDrawArrays(GL_TRIANGLES, 0, 2*3);
                 OpenGLDebug("hmmm");
@@ -210,6 +402,8 @@ class EntityRenderer : public DynamicArray<Entity*> {
         }
         glBindVertexArray(0);
         glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, 0);
     }
 };
 
@@ -0,0 +1,44 @@
+/* View frustum planes extracted from a combined model-view-projection matrix,
+ * used to reject axis-aligned boxes that lie entirely outside the view.
+ */
+#pragma once
+
+#include "raylib.h"
+
+class Frustum {
+    // left, right, bottom, top, near, far; a point p is inside a plane if dot(p, xyz) + w >= 0
+    Vector4 planes[6];
+    public:
+    Frustum() {}
+    Frustum(Matrix mvp) {
+        extract(mvp);
+    }
+    /* Take the planes from mvp, as built by raymath and applied to column vectors in the shader. */
+    void extract(Matrix m) {
+        Vector4 r0 = {m.m0, m.m4, m.m8, m.m12};
+        Vector4 r1 = {m.m1, m.m5, m.m9, m.m13};
+        Vector4 r2 = {m.m2, m.m6, m.m10, m.m14};
+        Vector4 r3 = {m.m3, m.m7, m.m11, m.m15};
+        planes[0] = {r3.x + r0.x, r3.y + r0.y, r3.z + r0.z, r3.w + r0.w};
+        planes[1] = {r3.x - r0.x, r3.y - r0.y, r3.z - r0.z, r3.w - r0.w};
+        planes[2] = {r3.x + r1.x, r3.y + r1.y, r3.z + r1.z, r3.w + r1.w};
+        planes[3] = {r3.x - r1.x, r3.y - r1.y, r3.z - r1.z, r3.w - r1.w};
+        planes[4] = {r3.x + r2.x, r3.y + r2.y, r3.z + r2.z, r3.w + r2.w};
+        planes[5] = {r3.x - r2.x, r3.y - r2.y, r3.z - r2.z, r3.w - r2.w};
+    }
+    /* Return false if the box min..max is entirely outside any one plane. This may keep a few
+       boxes near the corners of the frustum that are outside it, but never rejects a visible one. */
+    bool containsBox(Vector3 min, Vector3 max) const {
+        for (int i=0; i<6; i++) {
+            const Vector4& p = planes[i];
+            // test the corner furthest along the plane normal
+            float x = p.x >= 0 ? max.x : min.x;
+            float y = p.y >= 0 ? max.y : min.y;
+            float z = p.z >= 0 ? max.z : min.z;
+            if (p.x*x + p.y*y + p.z*z + p.w < 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
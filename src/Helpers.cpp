@@ -1,8 +1,11 @@
 
 #include "raylib.h"
 #include "Helpers.hpp"
+#include <mutex>
 
 std::ofstream __log_fd;
+// levels are loaded on a background thread, so log lines can come from more than one thread
+static std::mutex __log_lock;
 void _logprint(int logLevel, const char* text, va_list args) {
 	static std::string logLevels[] = {
 		"",
@@ -16,6 +19,7 @@ void _logprint(int logLevel, const char* text, va_list args) {
 	};
 	static char buffer[1024];
 	int len;
+	std::lock_guard<std::mutex> lk(__log_lock);
 	if (!__log_fd.is_open()) {
 		__log_fd.open("debug.log");
 	}
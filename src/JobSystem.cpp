@@ -0,0 +1,170 @@
+#include "JobSystem.hpp"
+
+JobSystem* GlobalJobSystem=nullptr;
+
+// queue owned by the current thread, if it is a worker
+static thread_local JobSystem* currentSystem = nullptr;
+static thread_local size_t currentQueue = 0;
+
+#pragma region JobSystem()
+JobSystem::JobSystem(size_t workers) {
+    if (workers == 0) {
+        workers = std::thread::hardware_concurrency();
+        if (workers == 0) {
+            workers = 1;
+        }
+    }
+    nworkers = workers;
+    queues = new WorkerQueue[nworkers];
+    threads = new std::thread[nworkers];
+    for (size_t i=0; i<nworkers; i++) {
+        threads[i] = std::thread(&JobSystem::_worker, this, i);
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lk(sleeplock);
+        running = false;
+    }
+    wake.notify_all();
+    for (size_t i=0; i<nworkers; i++) {
+        if (threads[i].joinable()) {
+            threads[i].join();
+        }
+    }
+    delete [] threads;
+    delete [] queues;
+}
+#pragma endregion
+
+#pragma region Queues
+// with only set, take the newest (_pop) or oldest (_steal) job of that group and skip the others
+bool JobSystem::_pop(size_t q, Job& job, JobGroup* only) {
+    WorkerQueue& queue = queues[q];
+    std::lock_guard<std::mutex> lk(queue.lock);
+    for (auto it = queue.jobs.rbegin(); it != queue.jobs.rend(); it++) {
+        if (only == nullptr || it->group == only) {
+            job = std::move(*it);
+            queue.jobs.erase(std::next(it).base());
+            job.group->queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool JobSystem::_steal(size_t q, Job& job, JobGroup* only) {
+    WorkerQueue& queue = queues[q];
+    std::lock_guard<std::mutex> lk(queue.lock);
+    for (auto it = queue.jobs.begin(); it != queue.jobs.end(); it++) {
+        if (only == nullptr || it->group == only) {
+            job = std::move(*it);
+            queue.jobs.erase(it);
+            job.group->queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool JobSystem::_runOne(size_t home, JobGroup* only) {
+    if (queued.load(std::memory_order_acquire) == 0) {
+        return false;
+    }
+    Job job;
+    bool found = _pop(home, job, only);
+    for (size_t i=1; !found && i<nworkers; i++) {
+        found = _steal((home + i) % nworkers, job, only);
+    }
+    if (!found) {
+        return false;
+    }
+    queued.fetch_sub(1, std::memory_order_acq_rel);
+    job.fn();
+    // the waiter may destroy the group as soon as it sees it done, so finish under its lock
+    JobGroup* group = job.group;
+    std::lock_guard<std::mutex> lk(group->lock);
+    if (group->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        group->wake.notify_all();
+    }
+    return true;
+}
+
+void JobSystem::_worker(size_t q) {
+    currentSystem = this;
+    currentQueue = q;
+    while (running.load(std::memory_order_acquire)) {
+        if (!_runOne(q)) {
+            std::unique_lock<std::mutex> lk(sleeplock);
+            wake.wait(lk, [this] {
+                return queued.load(std::memory_order_acquire) > 0 || !running.load(std::memory_order_acquire);
+            });
+        }
+    }
+}
+#pragma endregion
+
+#pragma region submit()
+void JobSystem::submit(JobGroup& group, std::function<void()> fn) {
+    size_t q;
+    if (currentSystem == this) {
+        q = currentQueue;
+    } else {
+        q = nextqueue.fetch_add(1, std::memory_order_relaxed) % nworkers;
+    }
+    group.pending.fetch_add(1, std::memory_order_acq_rel);
+    {
+        // taking the sleep lock orders this against a worker checking the queue count before sleeping
+        std::lock_guard<std::mutex> lk(sleeplock);
+        queued.fetch_add(1, std::memory_order_acq_rel);
+    }
+    {
+        std::lock_guard<std::mutex> lk(queues[q].lock);
+        queues[q].jobs.push_back({std::move(fn), &group});
+        group.queued.fetch_add(1, std::memory_order_relaxed);
+    }
+    wake.notify_one();
+    {
+        // orders this against a waiter checking the group before sleeping
+        std::lock_guard<std::mutex> lk(group.lock);
+    }
+    group.wake.notify_all();
+}
+#pragma endregion
+
+#pragma region wait()
+void JobSystem::wait(JobGroup& group) {
+    size_t home = currentSystem == this ? currentQueue : 0;
+    while (true) {
+        if (_runOne(home, &group)) {
+            continue;
+        }
+        // sleep while the group's remaining jobs run on workers. Seeing it done under its lock also means the
+        // last job has let go of it.
+        std::unique_lock<std::mutex> lk(group.lock);
+        group.wake.wait(lk, [&group] {
+            return group.pending.load(std::memory_order_acquire) == 0 || group.queued.load(std::memory_order_relaxed) > 0;
+        });
+        if (group.pending.load(std::memory_order_acquire) == 0) {
+            return;
+        }
+    }
+}
+
+void JobSystem::parallelFor(size_t count, std::function<void(size_t)> fn, size_t grain) {
+    if (grain == 0) {
+        grain = 1;
+    }
+    JobGroup group;
+    for (size_t start=0; start<count; start+=grain) {
+        size_t end = start + grain < count ? start + grain : count;
+        submit(group, [start, end, &fn] {
+            for (size_t i=start; i<end; i++) {
+                fn(i);
+            }
+        });
+    }
+    wait(group);
+}
+#pragma endregion
@@ -0,0 +1,75 @@
+/* Fixed-size worker pool with per-worker work-stealing queues.
+ * Jobs are submitted into a JobGroup and waited on as a group. Workers pop their own queue
+ * newest-first and steal from other queues oldest-first. A thread waiting on a group runs
+ * that group's queued jobs itself instead of blocking, so jobs may safely submit and wait on
+ * sub-jobs, and a frame waiting on its own work never picks up a long background job.
+ * Once none of its jobs are left in the queues it sleeps until they finish. Workers run jobs
+ * of any group.
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+class JobGroup {
+    friend class JobSystem;
+    std::atomic<size_t> pending{0};
+    // jobs still in a queue, changed under that queue's lock
+    std::atomic<size_t> queued{0};
+    // wakes a thread sleeping in wait() when the last job finishes or another one is queued
+    std::mutex lock;
+    std::condition_variable wake;
+    public:
+    JobGroup() {}
+    JobGroup(const JobGroup&) = delete;
+    JobGroup& operator=(const JobGroup&) = delete;
+    bool done() {
+        return pending.load(std::memory_order_acquire) == 0;
+    }
+};
+
+class JobSystem {
+    struct Job {
+        std::function<void()> fn;
+        JobGroup* group;
+    };
+    struct WorkerQueue {
+        std::mutex lock;
+        std::deque<Job> jobs;
+    };
+    WorkerQueue* queues = nullptr;
+    std::thread* threads = nullptr;
+    size_t nworkers = 0;
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> nextqueue{0};
+    std::atomic<bool> running{true};
+    std::mutex sleeplock;
+    std::condition_variable wake;
+
+    bool _pop(size_t q, Job& job, JobGroup* only);
+    bool _steal(size_t q, Job& job, JobGroup* only);
+    bool _runOne(size_t home, JobGroup* only=nullptr);
+    void _worker(size_t q);
+
+    public:
+    /* Start a pool with `workers` threads, or one per hardware thread if 0. */
+    JobSystem(size_t workers=0);
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+    ~JobSystem();
+    size_t workerCount() {
+        return nworkers;
+    }
+    /* Queue a job as part of group. */
+    void submit(JobGroup& group, std::function<void()> fn);
+    /* Run the group's queued jobs on the calling thread until every job in group has finished. */
+    void wait(JobGroup& group);
+    /* Call fn(i) for every i in 0..count-1, split into jobs of `grain` indices, and wait for all of them. */
+    void parallelFor(size_t count, std::function<void(size_t)> fn, size_t grain=1);
+};
+
+extern JobSystem* GlobalJobSystem;
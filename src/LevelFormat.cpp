@@ -0,0 +1,223 @@
+#include "LevelFormat.hpp"
+#include "MapData.hpp"
+#include "MappedFile.hpp"
+#include "raylib.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#pragma region RleCodec
+void RleCodec::encode(const unsigned char* src, size_t count, size_t size, size_t stride, size_t distance, std::string& out) {
+    auto same = [&](size_t a, size_t b) {
+        return !memcmp(src + a*stride, src + b*stride, size);
+    };
+    size_t i = 0;
+    while (i < count) {
+        size_t run = 1;
+        while (i + run < count && run < RLE_MAX_REPEAT && same(i, i + run)) {
+            run++;
+        }
+        size_t copy = 0;
+        if (distance > 0 && i >= distance) {
+            while (i + copy < count && copy < RLE_MAX_COPY && same(i + copy, i + copy - distance)) {
+                copy++;
+            }
+        }
+        if (copy >= 2 && copy >= run) {
+            out.push_back((char)(copy + 190));
+            i += copy;
+            continue;
+        }
+        if (run >= 2) {
+            out.push_back((char)(run + 126));
+            out.append((const char*)src + i*stride, size);
+            i += run;
+            continue;
+        }
+        // literals run up to the next place a repeat or copy packet could start
+        size_t lit = 1;
+        while (i + lit < count && lit < RLE_MAX_LITERAL) {
+            size_t j = i + lit;
+            if (j + 1 < count && same(j, j + 1)) {
+                break;
+            }
+            if (distance > 0 && j >= distance && j + 1 < count && same(j, j - distance) && same(j + 1, j + 1 - distance)) {
+                break;
+            }
+            lit++;
+        }
+        out.push_back((char)(lit - 1));
+        for (size_t k=0; k<lit; k++) {
+            out.append((const char*)src + (i + k)*stride, size);
+        }
+        i += lit;
+    }
+}
+
+// element size known at compile time for the common cases, so each element is copied with a plain move
+template<size_t SIZE>
+static bool _decode(const unsigned char* src, size_t srclen, unsigned char* dst, size_t count, size_t size, size_t stride,
+    size_t distance) {
+    size_t s = 0, i = 0;
+    size = SIZE > 0 ? SIZE : size;
+    while (s < srclen) {
+        unsigned char n = src[s++];
+        if (n < 128) {
+            size_t lit = (size_t)n + 1;
+            if (lit > count - i || lit*size > srclen - s) {
+                return false;
+            }
+            for (size_t k=0; k<lit; k++, i++, s+=size) {
+                memcpy(dst + i*stride, src + s, SIZE > 0 ? SIZE : size);
+            }
+        } else if (n < 192) {
+            size_t run = (size_t)n - 126;
+            if (run > count - i || size > srclen - s) {
+                return false;
+            }
+            for (size_t k=0; k<run; k++, i++) {
+                memcpy(dst + i*stride, src + s, SIZE > 0 ? SIZE : size);
+            }
+            s += size;
+        } else {
+            size_t copy = (size_t)n - 190;
+            if (distance == 0 || i < distance || copy > count - i) {
+                return false;
+            }
+            for (size_t k=0; k<copy; k++, i++) {
+                memcpy(dst + i*stride, dst + (i - distance)*stride, SIZE > 0 ? SIZE : size);
+            }
+        }
+    }
+    return i == count;
+}
+
+bool RleCodec::decode(const unsigned char* src, size_t srclen, unsigned char* dst, size_t count, size_t size, size_t stride,
+    size_t distance) {
+    if (size == 2) {
+        return _decode<2>(src, srclen, dst, count, size, stride, distance);
+    } else if (size == 3) {
+        return _decode<3>(src, srclen, dst, count, size, stride, distance);
+    }
+    return _decode<0>(src, srclen, dst, count, size, stride, distance);
+}
+#pragma endregion
+
+#pragma region isV2()
+bool LevelFormat::isV2(RBuffer& data) {
+    return data.length() >= sizeof(LevelHeader) && *(const unsigned int*)data.pointer(0) == LEVEL_V2_MAGIC_NUMBER;
+}
+#pragma endregion
+
+#pragma region writeSection()
+void LevelFormat::writeSection(std::ostream& out, const char* magic, const void* data, unsigned int size) {
+    out.write(magic, 4);
+    out.write((const char*)&size, 4);
+    out.write((const char*)data, size);
+}
+#pragma endregion
+
+#pragma region copySections()
+bool LevelFormat::copySections(RBuffer& data, std::string& out) {
+    if (isV2(data)) {
+        LevelHeader header;
+        data.seek(0);
+        data.readV<LevelHeader>(&header);
+        if (header.sectionsOffset > data.length() || header.sectionsSize > data.length() - header.sectionsOffset) {
+            return false;
+        }
+        out.append((const char*)data.pointer(header.sectionsOffset), header.sectionsSize);
+        return true;
+    }
+    data.seek(0);
+    while (data.available() >= 8) {
+        size_t start = data.tell();
+        unsigned int magic, size;
+        data.readV<unsigned int>(&magic);
+        data.readV<unsigned int>(&size);
+        if (size > data.available()) {
+            return false;
+        }
+        if (magic != TILE_MAP_MAGIC_NUMBER && magic != LIGHT_MAP_MAGIC_NUMBER && magic != WALL_MAP_MAGIC_NUMBER) {
+            out.append((const char*)data.pointer(start), 8 + size);
+        }
+        data.seek(start + 8 + size);
+    }
+    return true;
+}
+#pragma endregion
+
+#pragma region write()
+void LevelFormat::write(std::ostream& out, LevelChunkEntry* entries, const std::string* tiles, const std::string* lights,
+    size_t count, const std::string& sections) {
+    LevelHeader header;
+    header.magic = LEVEL_V2_MAGIC_NUMBER;
+    header.version = LEVEL_V2_VERSION;
+    header.chunkCount = count;
+    header.sectionsOffset = sizeof(LevelHeader) + count*sizeof(LevelChunkEntry);
+    header.sectionsSize = sections.size();
+    size_t offset = header.sectionsOffset + header.sectionsSize;
+    for (size_t i=0; i<count; i++) {
+        entries[i].tileOffset = offset;
+        entries[i].tileSize = tiles[i].size();
+        offset += tiles[i].size();
+        entries[i].lightOffset = lights[i].empty() ? 0 : offset;
+        entries[i].lightSize = lights[i].size();
+        offset += lights[i].size();
+    }
+    out.write((const char*)&header, sizeof(LevelHeader));
+    out.write((const char*)entries, count*sizeof(LevelChunkEntry));
+    out.write(sections.data(), sections.size());
+    for (size_t i=0; i<count; i++) {
+        out.write(tiles[i].data(), tiles[i].size());
+        out.write(lights[i].data(), lights[i].size());
+    }
+}
+#pragma endregion
+
+#pragma region convert()
+bool LevelFormat::convert(MapData* scratch, RBuffer& data, std::ostream& out) {
+    std::string sections;
+    if (!copySections(data, sections)) {
+        return false;
+    }
+    // every chunk has to be converted, and entities are only copied over as part of the sections
+    float radius = scratch->loadRadius;
+    bool defer = scratch->deferEntities, streaming = scratch->streaming;
+    scratch->ClearMap();
+    scratch->loadRadius = 0;
+    scratch->deferEntities = true;
+    scratch->streaming = false;
+    data.seek(0);
+    bool ok = scratch->LoadMap(data) && scratch->SaveMapV2(out, sections, scratch->HasLoadedLightmaps());
+    scratch->ClearMap();
+    scratch->loadRadius = radius;
+    scratch->deferEntities = defer;
+    scratch->streaming = streaming;
+    return ok;
+}
+
+bool LevelFormat::convert(MapData* scratch, const char* src, const char* dst) {
+    std::ostringstream out(std::ios::binary|std::ios::out);
+    {
+        MappedFile file;
+        if (!file.open(src)) {
+            return false;
+        }
+        RBuffer data(file.data(), file.length());
+        if (!convert(scratch, data, out)) {
+            return false;
+        }
+    }
+    // src is unmapped by now, so it may be overwritten
+    std::ofstream fd(dst, std::ios::binary|std::ios::out);
+    if (!fd.is_open()) {
+        return false;
+    }
+    std::string bytes = out.str();
+    fd.write(bytes.data(), bytes.size());
+    fd.close();
+    return fd.good();
+}
+#pragma endregion
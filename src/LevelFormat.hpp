@@ -0,0 +1,90 @@
+/* Level file formats.
+ * v1 files are a flat run of sections, each a 4 byte magic number and a 4 byte size (see MapData::LoadMapChunk),
+ * so the whole file has to be scanned to find any one chunk. v2 files start with a LevelHeader and a directory
+ * with one LevelChunkEntry per chunk, so a chunk can be found and decoded on its own. Tiles and light maps are
+ * RLE packed per chunk. The few sections that aren't per chunk (FOGC, LMUL, ENTT) are kept as one v1 style run
+ * of sections after the directory.
+ */
+#pragma once
+
+#include "Buffer.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#define LEVEL_V2_MAGIC_NUMBER_STR "BRLV"
+#define LEVEL_V2_MAGIC_NUMBER (*(uint32_t*)LEVEL_V2_MAGIC_NUMBER_STR)
+#define LEVEL_V2_VERSION 2
+
+// LevelChunkEntry flags
+#define LEVEL_CHUNK_LIT 1
+
+// longest literal, repeat and copy packets of RleCodec
+#define RLE_MAX_LITERAL 128
+#define RLE_MAX_REPEAT 65
+#define RLE_MAX_COPY 65
+
+class MapData;
+
+#pragma region LevelHeader
+struct LevelHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int chunkCount;
+    unsigned int sectionsOffset, sectionsSize;
+};
+#pragma endregion
+
+#pragma region LevelChunkEntry
+/* Directory entry of a v2 level. Offsets are from the start of the file. Tiles are width*height words and the
+   light map width*height RGB triplets, both row by row; lightSize is 0 unless flags has LEVEL_CHUNK_LIT. */
+struct LevelChunkEntry {
+    int x, y, z;
+    unsigned char width, height, flags, reserved;
+    unsigned int tileOffset, tileSize;
+    unsigned int lightOffset, lightSize;
+};
+#pragma endregion
+
+#pragma region RleCodec
+/* Run length coding of fixed size elements, with one LZ style back reference: copying from `distance` elements
+   back, i.e. the row above when distance is the row width. Each packet starts with a byte n:
+       0-127    n+1 literal elements follow
+       128-191  one element follows, repeated n-126 times
+       192-255  n-190 elements are copied from distance elements back
+   Level tiles are mostly short runs of a few IDs with rows much like the one above, and this decodes at close to
+   memcpy speed. */
+class RleCodec {
+    public:
+    /* Append count elements of size bytes, stride bytes apart in src, to out. */
+    static void encode(const unsigned char* src, size_t count, size_t size, size_t stride, size_t distance, std::string& out);
+    /* Decode srclen bytes of src into exactly count elements of size bytes, stride bytes apart in dst. Returns
+       false if src is malformed or doesn't hold exactly count elements. */
+    static bool decode(const unsigned char* src, size_t srclen, unsigned char* dst, size_t count, size_t size, size_t stride,
+        size_t distance);
+};
+#pragma endregion
+
+#pragma region LevelFormat
+class LevelFormat {
+    public:
+    /* Return whether the level data starts with a v2 header. */
+    static bool isV2(RBuffer& data);
+    /* Write a v1 style section: its magic number, the size and the data. */
+    static void writeSection(std::ostream& out, const char* magic, const void* data, unsigned int size);
+    /* Append the sections of a level that aren't per chunk (anything but TILE, LMAP and WALL) to out, unchanged.
+       Returns false if a section is truncated. */
+    static bool copySections(RBuffer& data, std::string& out);
+    /* Write a v2 level: count directory entries, whose offsets and sizes are filled in, each followed by its
+       packed tiles and light map (empty if it has none), and the other sections. */
+    static void write(std::ostream& out, LevelChunkEntry* entries, const std::string* tiles, const std::string* lights,
+        size_t count, const std::string& sections);
+    /* Convert level data of either version to v2, parsing it into scratch (a MapData with its tile registry set,
+       which is left empty). Light maps are kept if every chunk had one. Returns false if the level can't be read. */
+    static bool convert(MapData* scratch, RBuffer& data, std::ostream& out);
+    /* Convert level file src to v2 file dst, which may be the same file. */
+    static bool convert(MapData* scratch, const char* src, const char* dst);
+};
+#pragma endregion
@@ -0,0 +1,142 @@
+#include "LevelLoader.hpp"
+#include "AssetPath.hpp"
+#include "Helpers.hpp"
+#include "MappedFile.hpp"
+#include "Registries.hpp"
+#include "raylib.h"
+
+#pragma region ~LevelLoader()
+LevelLoader::~LevelLoader() {
+    _join();
+    delete [] fileName;
+}
+#pragma endregion
+
+#pragma region read()
+bool LevelLoader::read(MapData* map, const char* fname, bool bakeLighting, bool saveBakedLighting) {
+    /* the level is parsed straight out of the mapping, which only has to live until LoadMap returns, unless the
+       map streams the rest of a v2 level from it */
+    MappedFile* file = new MappedFile;
+    if (!file->open(fname)) {
+        delete file;
+        MissingAssetError(fname);
+        return false;
+    }
+    RBuffer readbuf(file->data(), file->length());
+    if (!map->LoadMap(readbuf)) {
+        delete file;
+        AssetFormatError(fname);
+        return false;
+    }
+    if (!map->SetStreamSource(file)) {
+        delete file;
+    }
+    if (map->floodLighting) {
+        // flood lighting is cheap enough to redo on every load, and is never saved
+        map->BuildLighting();
+    } else if (!map->HasLoadedLightmaps() && bakeLighting) {
+        map->BuildLighting();
+        // only part of a streamed level is loaded
+        if (saveBakedLighting && !map->isStreaming()) {
+            map->SaveLightMaps(fname);
+        }
+    }
+    map->GenerateMesh();
+    return true;
+}
+#pragma endregion
+
+#pragma region start()
+void LevelLoader::start(const char* fname, bool bakeLighting, bool upload) {
+    discard();
+    fileName = AssetPath::clone(fname);
+    this->bakeLighting = bakeLighting;
+    this->upload = upload;
+    staging.SetTileRegistry(GlobalMapTileRegistry);
+    staging.SetTextureRegistry(GlobalTextureRegistry);
+    staging.floodLighting = GlobalMapData->floodLighting;
+    staging.greedyMeshing = GlobalMapData->greedyMeshing;
+    staging.loadRadius = GlobalMapData->loadRadius;
+    staging.loadCenter = GlobalMapData->loadCenter;
+    staging.streaming = GlobalMapData->streaming;
+    staging.streamHysteresis = GlobalMapData->streamHysteresis;
+    staging.renderDistance = GlobalMapData->renderDistance;
+    staging.deferEntities = true;
+    // levels without FOGC/LMUL sections keep the current settings, as they do when loaded in place
+    staging.fogMin = GlobalMapData->fogMin;
+    staging.fogMax = GlobalMapData->fogMax;
+    for (int i=0; i<4; i++) {
+        staging.fogColor[i] = GlobalMapData->fogColor[i];
+    }
+    staging.lightLevel = GlobalMapData->lightLevel;
+    nextUpload = 0;
+    state.store(Loading, std::memory_order_release);
+    thread = std::thread(&LevelLoader::_load, this);
+}
+#pragma endregion
+
+#pragma region _load()
+void LevelLoader::_load() {
+    double start = GetTime();
+    if (!read(&staging, fileName, bakeLighting, false)) {
+        // nothing has been uploaded yet, so this doesn't touch GL
+        staging.ClearMap();
+        state.store(Failed, std::memory_order_release);
+        return;
+    }
+    TraceLog(LOG_INFO, "Loaded level %s in the background in %.2f ms.", fileName, (GetTime() - start)*1000.0);
+    state.store(upload ? Uploading : Ready, std::memory_order_release);
+}
+#pragma endregion
+
+#pragma region _join()
+void LevelLoader::_join() {
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+#pragma endregion
+
+#pragma region step()
+LevelLoader::State LevelLoader::step(double budget) {
+    if (status() == Uploading) {
+        _join();
+        nextUpload = staging.UploadMaps(nextUpload, budget);
+        if (nextUpload >= staging.chunkCount()) {
+            state.store(Ready, std::memory_order_release);
+        }
+    }
+    return status();
+}
+#pragma endregion
+
+#pragma region holds()
+bool LevelLoader::holds(const char* fname) {
+    return fileName != nullptr && fname != nullptr && !strcmp(fileName, fname);
+}
+#pragma endregion
+
+#pragma region take()
+bool LevelLoader::take(MapData* map) {
+    if (!ready()) {
+        return false;
+    }
+    _join();
+    map->TakeLevel(staging);
+    delete [] fileName;
+    fileName = nullptr;
+    state.store(Idle, std::memory_order_release);
+    return true;
+}
+#pragma endregion
+
+#pragma region discard()
+void LevelLoader::discard() {
+    _join();
+    staging.ClearMap();
+    delete [] fileName;
+    fileName = nullptr;
+    nextUpload = 0;
+    state.store(Idle, std::memory_order_release);
+}
+#pragma endregion
@@ -0,0 +1,64 @@
+/* Background level loading.
+ * A level is parsed, lit and meshed on a loader thread into a staging MapData while the current level keeps
+ * playing; the loader thread uses the job system for the parallel parts like a normal load does. Only the GL
+ * uploads are left for the render thread, which step() spreads over several frames. Once ready() the level is
+ * moved into place with take(), which doesn't copy, mesh or upload anything.
+ */
+#pragma once
+
+#include "MapData.hpp"
+
+#include <atomic>
+#include <thread>
+
+class LevelLoader {
+    public:
+    enum State : int {
+        Idle, Loading, Uploading, Ready, Failed,
+    };
+    private:
+    MapData staging;
+    std::thread thread;
+    std::atomic<int> state{Idle};
+    char* fileName = nullptr;
+    size_t nextUpload = 0;
+    bool bakeLighting = false;
+    bool upload = true;
+    void _load();
+    void _join();
+    public:
+    LevelLoader() {}
+    LevelLoader(const LevelLoader&) = delete;
+    LevelLoader& operator=(const LevelLoader&) = delete;
+    ~LevelLoader();
+    /* Load level fname into map: parse it, light it if needed and generate its meshes. Uploading is left to the
+       caller. Returns false after logging an error if the file is missing or malformed. */
+    static bool read(MapData* map, const char* fname, bool bakeLighting, bool saveBakedLighting);
+    /* Start loading fname in the background with the registries and settings of GlobalMapData, dropping whatever
+       was loaded before. Waits for the loader thread if it is still busy, so check loading() first. Without
+       upload the level is ready as soon as it is meshed, for headless use. Light maps baked here are never saved,
+       the loader thread must not rewrite level files. */
+    void start(const char* fname, bool bakeLighting, bool upload=true);
+    /* Upload staged chunks for up to budget milliseconds, once the loader thread is done. Call once per frame
+       from the render thread. Returns the new state. */
+    State step(double budget);
+    State status() {
+        return (State)state.load(std::memory_order_acquire);
+    }
+    bool loading() {
+        return status() == Loading;
+    }
+    bool ready() {
+        return status() == Ready;
+    }
+    /* Level being loaded or staged, or nullptr when idle. */
+    const char* name() {
+        return fileName;
+    }
+    /* Return whether fname is the level being loaded or staged. */
+    bool holds(const char* fname);
+    /* Move the staged level into map once ready(), spawning its entities. Returns false if it isn't ready. */
+    bool take(MapData* map);
+    /* Wait for the loader thread and free whatever was loaded. */
+    void discard();
+};
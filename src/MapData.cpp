@@ -2,14 +2,19 @@
 #include "MapData.hpp"
 #include "AssetPath.hpp"
 #include "Engine.hpp"
+#include "JobSystem.hpp"
+#include "MappedFile.hpp"
 #include "ShaderLoader.hpp"
 #include "TileRegistry.hpp"
 #include "raylib.h"
 #include "raymath.h"
 #include "raymath.h"
 #include <algorithm>
+#include <atomic>
+#include <climits>
 #include <cmath>
-#include <thread>
+#include <cstring>
+#include <sstream>
 
 MapData* GlobalMapData=nullptr;
 
@@ -80,10 +85,10 @@ float inverseSquareRoot(float v) {
 
 #pragma region InitMesher()
 void MapData::InitMesher(unsigned int depthTextureId) {
-    mainShader = ShaderLoader::load(AssetPath::shader("main"));
-    spriteShader = ShaderLoader::load(AssetPath::shader("sprite"));
-    glBindAttribLocation(mainShader.id, 0, "vertexInfo1");
-    glBindAttribLocation(mainShader.id, 1, "vertexInfo2");
+    mainShader.load(AssetPath::shader("main"));
+    spriteShader.load(AssetPath::shader("sprite"));
+    mainUniforms.resolve(mainShader);
+    spriteUniforms.resolve(spriteShader);
     this->depthTextureId = depthTextureId;
 }
 #pragma endregion
@@ -96,11 +101,100 @@ void MapData::BuildAtlas() {
 
 #pragma region LoadMap()
 bool MapData::LoadMap(RBuffer& data) {
-    do {
-        if (!LoadMapChunk(data)) {
+    size_t first = maps.length();
+    pendingTiles.clear();
+    pendingLightMaps.clear();
+    if (LevelFormat::isV2(data)) {
+        if (!LoadMapV2(data, first)) {
             return false;
         }
-    } while (!data.eof());
+    } else {
+        do {
+            if (!LoadMapChunk(data)) {
+                return false;
+            }
+        } while (!data.eof());
+    }
+    DecodeMapTiles(data);
+    DecodeLightMaps(data, first);
+    for (size_t i=first; i<maps.length(); i++) {
+        Vec3I p = positions[i];
+        chunkIndex.insert(i, p.x, p.y, p.z, maps[i].width(), maps[i].height());
+        TraceLog(LOG_DEBUG, "Loaded map #%llu at %d,%d,%d size %d,%d", i+1, p.x, p.y, p.z, maps[i].width(), maps[i].height());
+    }
+    // one line per chunk costs more than the rest of loading on big levels, so only the total is logged normally
+    TraceLog(LOG_INFO, "Loaded %llu maps", maps.length() - first);
+    return true;
+}
+#pragma endregion
+
+#pragma region LoadMapV2()
+// distance from c to the nearest tile of a directory entry, ignoring height
+static float _EntryDistance(const LevelChunkEntry& e, Vector3 c) {
+    float dx = fmaxf(fmaxf(e.x - c.x, c.x - (e.x + e.width)), 0);
+    float dz = fmaxf(fmaxf(e.z - c.z, c.z - (e.z + e.height)), 0);
+    return sqrtf(dx*dx + dz*dz);
+}
+
+/* Read the directory of a v2 level and reserve the chunks within loadRadius of loadCenter, then read its other
+   sections. The tiles and light maps of the reserved chunks are decoded later, the same way as v1 sections.
+   When streaming, the whole directory is kept and only the chunks within streamRadius() are reserved. */
+bool MapData::LoadMapV2(RBuffer& data, size_t first) {
+    // offsets in a v2 level are from the start of the data
+    LevelHeader header;
+    data.seek(0);
+    if (!data.readV<LevelHeader>(&header) || header.version != LEVEL_V2_VERSION) {
+        return false;
+    }
+    size_t len = data.length();
+    if (header.chunkCount > data.available() / sizeof(LevelChunkEntry)) {
+        return false;
+    }
+    if (header.sectionsOffset > len || header.sectionsSize > len - header.sectionsOffset) {
+        return false;
+    }
+    // only one level at a time can be streamed
+    bool stream = streaming && streamEntries.length() == 0;
+    float radius = stream ? streamRadius() : loadRadius;
+    size_t skipped = 0;
+    for (unsigned int i=0; i<header.chunkCount; i++) {
+        LevelChunkEntry e;
+        data.readV<LevelChunkEntry>(&e);
+        if (e.width == 0 || e.height == 0 || e.tileOffset > len || e.tileSize > len - e.tileOffset) {
+            return false;
+        }
+        bool lit = (e.flags & LEVEL_CHUNK_LIT) != 0;
+        if (lit && (e.lightOffset > len || e.lightSize > len - e.lightOffset)) {
+            return false;
+        }
+        if (stream) {
+            streamEntries.append(e);
+            streamChunks.append(-1);
+        }
+        if (radius > 0 && _EntryDistance(e, loadCenter) > radius) {
+            skipped++;
+            continue;
+        }
+        size_t chunk = addChunk(e.x, e.y, e.z, e.width, e.height);
+        if (stream) {
+            streamChunks[i] = chunk;
+            chunkEntries[chunk] = i;
+        }
+        size_t count = (size_t)e.width*e.height;
+        pendingTiles.append({chunk, e.tileOffset, count, nullptr, 0, nullptr, 0, e.tileSize});
+        if (lit) {
+            pendingLightMaps.append({chunk - first, e.lightOffset, count*3, e.lightSize});
+        }
+    }
+    if (skipped > 0) {
+        TraceLog(LOG_INFO, "Skipped %llu chunks further than %.1f tiles away", skipped, radius);
+    }
+    RBuffer sections(data.pointer(header.sectionsOffset), header.sectionsSize);
+    while (!sections.eof()) {
+        if (!LoadMapChunk(sections)) {
+            return false;
+        }
+    }
     return true;
 }
 #pragma endregion
@@ -115,17 +209,20 @@ bool MapData::LoadMapChunk(RBuffer& data) {
     if (!data.readV<unsigned int>(&size)) {
         return false;
     }
+    if (size > data.available()) {
+        return false;
+    }
+    size_t end = data.tell() + size;
     if (magic == WALL_MAP_MAGIC_NUMBER) {
         if (!LoadMapWalls(data)) {
             return false;
         }
     } else if (magic == TILE_MAP_MAGIC_NUMBER) {
-        if (!LoadMapTiles(data)) {
+        if (!LoadMapTiles(data, size)) {
             return false;
         }
     } else if (magic == LIGHT_MAP_MAGIC_NUMBER) {
-        hasLoadedLightmaps = true;
-        if (!LoadLightMap(data)) {
+        if (!LoadLightMap(data, size)) {
             return false;
         }
     } else if (magic == FOG_MAGIC_NUMBER) {
@@ -165,10 +262,14 @@ bool MapData::LoadMapChunk(RBuffer& data) {
         if (!data.readV<float>(&rot)) {
             return false;
         }
-        GlobalEntityRenderer->Add(type, pos, rot);
-    } else {
-        data.skip(size);
+        if (deferEntities) {
+            pendingEntities.append({type, pos, rot});
+        } else {
+            GlobalEntityRenderer->Add(type, pos, rot);
+        }
     }
+    // always continue from the end of the section, whatever was read from it
+    data.seek(end);
     return true;
 }
 #pragma endregion
@@ -190,8 +291,9 @@ bool MapData::LoadMapWalls(RBuffer& data) {
 #pragma endregion
 
 #pragma region LoadMapTile()
-bool MapData::LoadMapTiles(RBuffer& data) {
-    TileArray map;
+/* Read a TILE section header and reserve its chunk. The tiles themselves are decoded
+   in parallel by DecodeMapTiles() once the whole file has been scanned. */
+bool MapData::LoadMapTiles(RBuffer& data, unsigned int size) {
     int x, y, z;
     if (!data.readV<int>(&x)) {
         return false;
@@ -209,34 +311,107 @@ bool MapData::LoadMapTiles(RBuffer& data) {
     if (!data.read(sizeZ)) {
         return false;
     }
-    if (sizeX==0 || sizeZ==0) {
+    if (sizeX==0 || sizeZ==0 || size < 14) {
         return false;
     }
-    map.resize(sizeX, sizeZ);
-    for (unsigned char zz=0; zz<sizeZ; zz++) {
-        for (unsigned char xx=0; xx<sizeX; xx++) {
-            unsigned short tid;
-            if (!data.readV<unsigned short>(&tid)) {
-                return false;
+    size_t count = (size_t)sizeX*sizeZ;
+    if (size - 14 != count*2) {
+        TraceLog(LOG_WARNING, "TILE section at %d,%d,%d has %u bytes of tiles for a %dx%d header", x, y, z, size - 14,
+            sizeX, sizeZ);
+        return false;
+    }
+    size_t chunk = addChunk(x, y, z, sizeX, sizeZ);
+    pendingTiles.append({chunk, data.tell(), count, nullptr, 0, nullptr, 0, 0});
+    return true;
+}
+
+/* Append an empty w by h chunk at x,y,z, to be filled in by DecodeMapTiles(). Returns its number. */
+size_t MapData::addChunk(int x, int y, int z, int w, int h) {
+    TileArray map;
+    map.resize(w, h);
+    maps.append(map);
+    positions.append({x, y, z});
+    lightmaps.append(new LightMap(w, h));
+    MapIntMeshes.append(new MapIntMesh());
+    dirtyFlags.append(0);
+    chunkEntries.append(-1);
+    return maps.length()-1;
+}
+#pragma endregion
+
+#pragma region DecodeMapTiles()
+static void _DecodeMapTiles(const unsigned char* src, PendingTiles* p, TileArray* map, Vec3I pos, TileTable* table) {
+    unsigned short* tiles = *map;
+    if (p->packed > 0) {
+        if (!RleCodec::decode(src, p->packed, (unsigned char*)tiles, p->count, sizeof(unsigned short), sizeof(unsigned short), map->width())) {
+            TraceLog(LOG_WARNING, "Clearing chunk #%llu with malformed tiles", p->chunk+1);
+            memset(tiles, 0, p->count*sizeof(unsigned short));
+        }
+    } else if (p->count > 0) {
+        memcpy(tiles, src, p->count*sizeof(unsigned short));
+    }
+    for (size_t i=0; i<p->count; i++) {
+        const MapTile* tile = table->of(tiles[i]);
+        if (tile != nullptr) {
+            if (tile->light > 0) {
+                p->nlights++;
             }
-            map[{xx, zz}] = tid;
-            MapTile* tile = tileRegistry->of(tid);
+            if (tile->isSpawnable) {
+                p->nspawns++;
+            }
+        }
+    }
+    if (p->nlights > 0) {
+        p->lights = new PlacedLight[p->nlights];
+    }
+    if (p->nspawns > 0) {
+        p->spawns = new Vector3[p->nspawns];
+    }
+    size_t nl = 0, ns = 0;
+    for (int zz=0; zz<map->height(); zz++) {
+        for (int xx=0; xx<map->width(); xx++) {
+            const MapTile* tile = table->of(tiles[zz*map->width()+xx]);
             if (tile != nullptr) {
                 if (tile->light > 0) {
-                    lightList.append({x+xx, y, z+zz, tile->light, tile->tintr, tile->tintg, tile->tintb});
+                    p->lights[nl++] = {pos.x+xx, pos.y, pos.z+zz, tile->light, tile->tintr, tile->tintg, tile->tintb};
                 }
                 if (tile->isSpawnable) {
-                    spawnableSpaces.append({(float)x+xx, (float)y, (float)z+zz});
+                    p->spawns[ns++] = {(float)pos.x+xx, (float)pos.y, (float)pos.z+zz};
                 }
             }
         }
     }
-    maps.append(map);
-    positions.append({x, y, z});
-    lightmaps.append(new LightMap(sizeX, sizeZ));
-    MapIntMeshes.append(new MapIntMesh());
-    TraceLog(LOG_INFO, "Loaded map #%llu at %d,%d,%d size %d,%d", maps.length(), x, y, z, sizeX, sizeZ);
-    return true;
+}
+
+void MapData::DecodeMapTiles(RBuffer& data) {
+    size_t count = pendingTiles.length();
+    PendingTiles* pending = pendingTiles;
+    TileArray* chunks = maps;
+    Vec3I* chunkpositions = positions;
+    // look tiles up in a flat copy of the registry rather than through its growable arrays
+    TileTable table;
+    table.build(tileRegistry);
+    GlobalJobSystem->parallelFor(count, [&](size_t i) {
+        PendingTiles* p = &pending[i];
+        _DecodeMapTiles(data.pointer(p->offset), p, &chunks[p->chunk], chunkpositions[p->chunk], &table);
+    }, 4);
+    // gather lights and spawn points in file order
+    for (size_t i=0; i<count; i++) {
+        PendingTiles& p = pendingTiles[i];
+        for (size_t j=0; j<p.nlights; j++) {
+            lightList.append(p.lights[j]);
+        }
+        for (size_t j=0; j<p.nspawns; j++) {
+            spawnableSpaces.append(p.spawns[j]);
+        }
+        if (p.lights != nullptr) {
+            delete [] p.lights;
+        }
+        if (p.spawns != nullptr) {
+            delete [] p.spawns;
+        }
+    }
+    pendingTiles.clear();
 }
 #pragma endregion
 
@@ -244,53 +419,69 @@ bool MapData::LoadMapTiles(RBuffer& data) {
 bool MapData::HasLoadedLightmaps() {
     return hasLoadedLightmaps;
 }
-bool MapData::LoadLightMap(RBuffer& data) {
+/* Read an LMAP section header. The colours are decoded by DecodeLightMaps() once the
+   whole file has been scanned. */
+bool MapData::LoadLightMap(RBuffer& data, unsigned int size) {
     int i;
-    if (!data.readV<int>(&i)) {
+    if (size < 4 || !data.readV<int>(&i)) {
         return false;
     }
-    LightMap* map = nullptr;
-    char sizeX, sizeZ;
-    if (i < lightmaps.length()) {
-        map = lightmaps[i];
-        sizeX = map->width();
-        sizeZ = map->height();
-    } else {
-        if (i < maps.length()) {
-            sizeX = maps[i].width();
-            sizeZ = maps[i].height();
-        } else {
-            return false;
-        }
-        map = new LightMap(sizeX, sizeZ);
-        lightmaps[i] = map;
-    }
-    if (sizeX==0 || sizeZ==0) {
+    if (i < 0) {
         return false;
     }
-    for (int z=0; z<sizeZ; z++) {
-        for (int x=0; x<sizeX; x++) {
-            Color l;
-            if (!data.read(l.r)) {
-                return false;
-            }
-            if (!data.read(l.g)) {
-                return false;
-            }
-            if (!data.read(l.b)) {
-                return false;
-            }
-            l.a = 255;
-            *map->get(x, z) = l;
-       }
+    pendingLightMaps.append({(size_t)i, data.tell(), size - 4});
+    return true;
+}
+
+/* Fill map with the colours of an LMAP section, or of a v2 directory entry. Returns false if they are malformed. */
+static bool _DecodeLightMap(const unsigned char* src, PendingLightMap& p, LightMap* map) {
+    // the light map image is one contiguous run of rows, so expand the whole section in one pass
+    Color* dst = map->get(0, 0);
+    size_t count = (size_t)map->width()*map->height();
+    if (p.packed > 0) {
+        // RGB straight into the RGBA image, whose alpha is already 255
+        return RleCodec::decode(src, p.packed, (unsigned char*)dst, count, 3, sizeof(Color), map->width());
+    }
+    for (size_t k=0; k<count; k++) {
+        dst[k] = {src[k*3], src[k*3+1], src[k*3+2], 255};
     }
     return true;
 }
 
+/* Fill in the light maps read by LoadLightMap(). Chunk numbers are counted from the first chunk
+   of the file. The level counts as lit only if every one of its chunks had a light map. */
+void MapData::DecodeLightMaps(RBuffer& data, size_t first) {
+    size_t loaded = 0;
+    for (size_t j=0; j<pendingLightMaps.length(); j++) {
+        PendingLightMap& p = pendingLightMaps[j];
+        size_t i = first + p.chunk;
+        if (i >= maps.length()) {
+            TraceLog(LOG_WARNING, "Ignoring light map for missing chunk #%llu", p.chunk+1);
+            continue;
+        }
+        LightMap* map = lightmaps[i];
+        if (p.size != map->width()*map->height()*3) {
+            TraceLog(LOG_WARNING, "Ignoring light map for chunk #%llu with mismatched size", p.chunk+1);
+            continue;
+        }
+        if (!_DecodeLightMap(data.pointer(p.offset), p, map)) {
+            TraceLog(LOG_WARNING, "Ignoring malformed light map for chunk #%llu", p.chunk+1);
+            continue;
+        }
+        loaded++;
+    }
+    hasLoadedLightmaps = loaded > 0 && loaded >= maps.length() - first;
+    pendingLightMaps.clear();
+}
 #pragma endregion
 
 #pragma region SaveMap()
 void MapData::SaveMap(const char* fname) {
+    // only part of a streamed level is loaded, and it is still read from the file
+    if (streamFile != nullptr) {
+        TraceLog(LOG_WARNING, "Not saving streamed level \"%s\"", fname);
+        return;
+    }
     std::ofstream fd(fname, std::ios::binary|std::ios::out);
     SaveMap(fd);
     fd.close();
@@ -306,9 +497,140 @@ void MapData::SaveMap(std::ostream& fd) {
 }
 #pragma endregion
 
+#pragma region SaveLightMaps()
+/* Rewrite the level file fname with the current light maps, keeping every other section as it is.
+   Existing LMAP sections are replaced. */
+bool MapData::SaveLightMaps(const char* fname) {
+    if (streamFile != nullptr) {
+        TraceLog(LOG_WARNING, "Not saving light maps into streamed level \"%s\"", fname);
+        return false;
+    }
+    MappedFile file;
+    if (!file.open(fname)) {
+        return false;
+    }
+    RBuffer level(file.data(), file.length());
+    std::ostringstream out(std::ios::binary|std::ios::out);
+    if (LevelFormat::isV2(level)) {
+        if (!SaveLightMapsV2(level, out)) {
+            TraceLog(LOG_WARNING, "Not saving light maps into \"%s\": malformed level", fname);
+            return false;
+        }
+    } else {
+        while (level.available() >= 8) {
+            size_t start = level.tell();
+            unsigned int magic, size;
+            if (!level.readV<unsigned int>(&magic) || !level.readV<unsigned int>(&size) || size > level.available()) {
+                TraceLog(LOG_WARNING, "Not saving light maps into \"%s\": truncated section", fname);
+                return false;
+            }
+            if (magic != LIGHT_MAP_MAGIC_NUMBER) {
+                out.write((const char*)level.pointer(start), 8 + size);
+            }
+            level.seek(start + 8 + size);
+        }
+        for (size_t i=0; i<maps.length(); i++) {
+            SaveLightMap(out, i);
+        }
+    }
+    // unmap before the file is truncated
+    file.close();
+    std::ofstream fd(fname, std::ios::binary|std::ios::out);
+    if (!fd.is_open()) {
+        return false;
+    }
+    std::string bytes = out.str();
+    fd.write(bytes.data(), bytes.size());
+    fd.close();
+    TraceLog(LOG_INFO, "Saved %llu light maps into \"%s\"", maps.length(), fname);
+    return true;
+}
+
+/* Copy v2 level data to out with the light maps of the loaded chunks replaced. Chunks that weren't loaded
+   (outside loadRadius) keep the light maps they had. */
+bool MapData::SaveLightMapsV2(RBuffer& level, std::ostream& out) {
+    LevelHeader header;
+    level.seek(0);
+    if (!level.readV<LevelHeader>(&header) || header.chunkCount > level.available() / sizeof(LevelChunkEntry)) {
+        return false;
+    }
+    size_t len = level.length();
+    if (header.sectionsOffset > len || header.sectionsSize > len - header.sectionsOffset) {
+        return false;
+    }
+    size_t count = header.chunkCount;
+    LevelChunkEntry* entries = new LevelChunkEntry[count];
+    std::string* tiles = new std::string[count];
+    std::string* lights = new std::string[count];
+    bool ok = true;
+    for (size_t j=0; j<count && ok; j++) {
+        LevelChunkEntry& e = entries[j];
+        if (!level.readV<LevelChunkEntry>(&e) || e.tileOffset > len || e.tileSize > len - e.tileOffset) {
+            ok = false;
+            break;
+        }
+        tiles[j].assign((const char*)level.pointer(e.tileOffset), e.tileSize);
+        int i = findChunk(e.x, e.y, e.z);
+        if (i != -1 && positions[i].x == e.x && positions[i].z == e.z &&
+            maps[i].width() == e.width && maps[i].height() == e.height) {
+            RleCodec::encode((const unsigned char*)lightmaps[i]->get(0, 0), (size_t)e.width*e.height, 3, sizeof(Color), e.width, lights[j]);
+            e.flags |= LEVEL_CHUNK_LIT;
+        } else if (e.flags & LEVEL_CHUNK_LIT) {
+            if (e.lightOffset > len || e.lightSize > len - e.lightOffset) {
+                ok = false;
+                break;
+            }
+            lights[j].assign((const char*)level.pointer(e.lightOffset), e.lightSize);
+        }
+    }
+    if (ok) {
+        std::string sections((const char*)level.pointer(header.sectionsOffset), header.sectionsSize);
+        LevelFormat::write(out, entries, tiles, lights, count, sections);
+    }
+    delete [] entries;
+    delete [] tiles;
+    delete [] lights;
+    return ok;
+}
+#pragma endregion
+
+#pragma region SaveMapV2()
+/* Write the loaded chunks as a v2 level, with the light maps if lightmaps is set. sections holds the level's
+   other sections (see LevelFormat::copySections), as they are to be written. */
+bool MapData::SaveMapV2(std::ostream& fd, const std::string& sections, bool lightmaps) {
+    size_t count = 0;
+    LevelChunkEntry* entries = new LevelChunkEntry[maps.length()];
+    std::string* tiles = new std::string[maps.length()];
+    std::string* lights = new std::string[maps.length()];
+    for (size_t i=0; i<maps.length(); i++) {
+        TileArray& map = maps[i];
+        if (map.width() == 0 || map.height() == 0) {
+            continue; // clipped away entirely
+        }
+        Vec3I p = positions[i];
+        LevelChunkEntry& e = entries[count];
+        e = {p.x, p.y, p.z, (unsigned char)map.width(), (unsigned char)map.height(), 0, 0, 0, 0, 0, 0};
+        size_t n = (size_t)map.width()*map.height();
+        RleCodec::encode((const unsigned char*)(unsigned short*)map, n, sizeof(unsigned short), sizeof(unsigned short), map.width(), tiles[count]);
+        if (lightmaps) {
+            RleCodec::encode((const unsigned char*)this->lightmaps[i]->get(0, 0), n, 3, sizeof(Color), map.width(), lights[count]);
+            e.flags |= LEVEL_CHUNK_LIT;
+        }
+        count++;
+    }
+    LevelFormat::write(fd, entries, tiles, lights, count, sections);
+    delete [] entries;
+    delete [] tiles;
+    delete [] lights;
+    return fd.good();
+}
+#pragma endregion
+
 #pragma region SaveMapTile()
 void MapData::SaveMapTile(std::ostream& fd, TileArray* map, Vec3I position) {
+    unsigned int size = 14 + map->width()*map->height()*2;
     fd.write(TILE_MAP_MAGIC_NUMBER_STR, 4);
+    fd.write((char*)&size, 4);
     fd.write((char*)&position.x, 4);
     fd.write((char*)&position.y, 4);
     fd.write((char*)&position.z, 4);
@@ -329,7 +651,9 @@ void MapData::SaveLightMap(std::ostream& fd, size_t i, LightMap* map) {
         map = lightmaps[i];
     }
     unsigned int il = i;
+    unsigned int size = 4 + map->width()*map->height()*3;
     fd.write(LIGHT_MAP_MAGIC_NUMBER_STR, 4);
+    fd.write((char*)&size, 4);
     fd.write((char*)&il, 4);
     for (int z=0; z<map->height(); z++) {
         for (int x=0; x<map->width(); x++) {
@@ -342,214 +666,900 @@ void MapData::SaveLightMap(std::ostream& fd, size_t i, LightMap* map) {
 }
 #pragma endregion
 
-#pragma region DDACast()
-float DDACast(MapTileRegistry* reg, MapData* map, int y, int x1, int z1, int x2, int z2, bool (*issolid)(MapTileRegistry* reg, unsigned short tid)) {
-    int sx = x1 < x2 ? x1 : x2;
-    int sz = z1 < z2 ? z1 : z2;
-    int ex = x1 > x2 ? x1 : x2;
-    int ez = z1 > z2 ? z1 : z2;
-    Vector2 rdelta = Vector2Normalize({(float)ex-sx, (float)ez-sz});
-    float ddx = rdelta.x == 0 ? 1e30 : 1.0f / rdelta.x;
-    float ddz = rdelta.y == 0 ? 1e30 : 1.0f / rdelta.y;
-    int stepX, stepZ;
-    float sdx, sdz;
-    if (rdelta.x < 0) {
-        stepX = -1;
-        sdx = 0.0f;
-    } else {
-        stepX = 1;
-        sdx = 1.0f;
+#pragma region BuildLighting()
+static void _AddLight(Color* c, float v, unsigned char r, unsigned char g, unsigned char b) {
+    if (c != nullptr) {
+        unsigned short rs = r;
+        unsigned short gs = g;
+        unsigned short bs = b;
+        rs = (rs * c->r) >> 8;
+        gs = (gs * c->g) >> 8;
+        bs = (bs * c->b) >> 8;
+        if (rs > 255) rs = 255;
+        if (gs > 255) gs = 255;
+        if (bs > 255) bs = 255;
+        r = rs; g = gs; b = bs;
+        *c = {r, g, b, 255};
     }
-    if (rdelta.y < 0) {
-        stepZ = -1;
-        sdz = 0.0f;
-    } else {
-        stepZ = 1;
-        sdz = 1.0f;
-    }
-    unsigned short tid;
-    bool zside = false;
-    do {
-        if (sdx < sdz) {
-            sdx += ddx;
-            sx += stepX;
-            zside = false;
+}
+
+/* Return whether light travels from the centre of tile x1,z1 to the centre of tile x2,z2 on level y
+   without crossing a tile that blocks light. Neither end tile is tested, so walls facing a light are lit.
+   Where the line passes exactly through a corner, light gets through if either side tile is open. */
+bool MapData::lightVisible(ChunkCursor& cursor, int y, int x1, int z1, int x2, int z2) {
+    int dx = x2 - x1, dz = z2 - z1;
+    int nx = dx < 0 ? -dx : dx, nz = dz < 0 ? -dz : dz;
+    int sx = dx < 0 ? -1 : 1, sz = dz < 0 ? -1 : 1;
+    int x = x1, z = z1;
+    // walk the tiles crossed by the line, comparing boundary crossings in integer units of 1/(2*nx*nz)
+    for (int ix=0, iz=0; ix<nx || iz<nz;) {
+        long long cx = (long long)(2*ix + 1) * nz;
+        long long cz = (long long)(2*iz + 1) * nx;
+        if (cx == cz) {
+            MapTile* a = tileRegistry->of(cursorGet(cursor, x + sx, y, z));
+            MapTile* b = tileRegistry->of(cursorGet(cursor, x, y, z + sz));
+            if (a != nullptr && a->blocksLight && b != nullptr && b->blocksLight) {
+                return false;
+            }
+            x += sx; z += sz;
+            ix++; iz++;
+        } else if (cx < cz) {
+            x += sx;
+            ix++;
         } else {
-            sdz += ddz;
-            sz += stepZ;
-            zside = true;
+            z += sz;
+            iz++;
         }
-        tid = map->get({(float)sx, (float)y, (float)sz});
-        if (issolid(reg, tid)) {
-            return 0;
+        if (x == x2 && z == z2) {
+            return true;
+        }
+        MapTile* tile = tileRegistry->of(cursorGet(cursor, x, y, z));
+        if (tile != nullptr && tile->blocksLight) {
+            return false;
         }
-    } while (sx < ex && sz < ez);
-    if (zside) {
-        return sdz - ddz;
-    } else {
-        return sdx - ddx;
     }
+    return true;
 }
-#pragma endregion
 
-#pragma region BuildLighting()
-bool isSolidToLight(MapTileRegistry* reg, unsigned short tid) {
-    MapTile* tile = reg->of(tid);
-    return tile->blocksLight;
+/* Bake the lights within LIGHT_RANGE of chunk i into its light map, summing an inverse square falloff that fades
+   to zero at LIGHT_RANGE. Lights are summed in order of position, so the result doesn't depend on the order of
+   lights. Returns the number of lights that reached the chunk. */
+size_t MapData::lightChunk(size_t i, PlacedLight* lights, size_t nlights) {
+    TileArray* map = &maps[i];
+    LightMap* lmap = lightmaps[i];
+    Vec3I p = positions[i];
+    int w = map->width(), h = map->height();
+    if (w == 0 || h == 0) {
+        return 0;
+    }
+    auto reaches = [&](PlacedLight* light) {
+        return light->y == p.y && light->x + LIGHT_RANGE >= p.x && light->x - LIGHT_RANGE <= p.x + w - 1 &&
+            light->z + LIGHT_RANGE >= p.z && light->z - LIGHT_RANGE <= p.z + h - 1;
+    };
+    size_t used = 0;
+    for (size_t j=0; j<nlights; j++) {
+        used += reaches(&lights[j]);
+    }
+    PlacedLight** near = new PlacedLight*[used + 1];
+    for (size_t j=0, k=0; j<nlights; j++) {
+        if (reaches(&lights[j])) {
+            near[k++] = &lights[j];
+        }
+    }
+    std::sort(near, near + used, [](PlacedLight* a, PlacedLight* b) {
+        return a->z != b->z ? a->z < b->z : a->x < b->x;
+    });
+    float* sum = new float[w*h*3]();
+    ChunkCursor cursor;
+    for (size_t j=0; j<used; j++) {
+        PlacedLight* light = near[j];
+        int x1 = std::max(light->x - LIGHT_RANGE, p.x), x2 = std::min(light->x + LIGHT_RANGE, p.x + w - 1);
+        int z1 = std::max(light->z - LIGHT_RANGE, p.z), z2 = std::min(light->z + LIGHT_RANGE, p.z + h - 1);
+        float v = light->v / 255.0f;
+        float tint[3] = {(float)light->r, (float)light->g, (float)light->b};
+        for (int z=z1; z<=z2; z++) {
+            for (int x=x1; x<=x2; x++) {
+                float d2 = (x - light->x)*(x - light->x) + (z - light->z)*(z - light->z);
+                float fade = 1.0f - d2 / (LIGHT_RANGE*LIGHT_RANGE);
+                if (fade <= 0 || !lightVisible(cursor, p.y, light->x, light->z, x, z)) {
+                    continue;
+                }
+                float f = v * fade * fade / (1.0f + d2);
+                float* c = &sum[((z - p.z)*w + x - p.x)*3];
+                c[0] += tint[0] * f;
+                c[1] += tint[1] * f;
+                c[2] += tint[2] * f;
+            }
+        }
+    }
+    for (int z=0; z<h; z++) {
+        for (int x=0; x<w; x++) {
+            float* c = &sum[(z*w + x)*3];
+            *lmap->get(x, z) = {
+                (unsigned char)std::min(c[0], 255.0f),
+                (unsigned char)std::min(c[1], 255.0f),
+                (unsigned char)std::min(c[2], 255.0f),
+                255,
+            };
+        }
+    }
+    delete [] sum;
+    delete [] near;
+    return used;
 }
 
+/* Bake every placed light into the light maps, or flood fill them if floodLighting is set. Each chunk is baked by
+   its own job, see lightChunk(). */
 void MapData::BuildLighting() {
-    TraceLog(LOG_INFO, "Building lighting for %llu lights...", lightList.length());
+    if (floodLighting) {
+        BuildFloodLighting();
+        return;
+    }
+    double start = GetTime();
+    size_t nlights = lightList.length();
+    PlacedLight* lights = lightList;
+    std::atomic<size_t> pairs{0};
+    GlobalJobSystem->parallelFor(maps.length(), [&](size_t i) {
+        pairs.fetch_add(lightChunk(i, lights, nlights), std::memory_order_relaxed);
+    });
+    hasLoadedLightmaps = true;
+    TraceLog(LOG_INFO, "Baked %llu lights into %llu light maps (%llu light/chunk pairs) in %.2f ms.",
+        nlights, maps.length(), pairs.load(), (GetTime() - start)*1000.0);
+}
+#pragma endregion
+
+#pragma region Flood Lighting
+// light level a tile emits on one colour channel
+static inline unsigned char _FloodSource(MapTile* tile, char c) {
+    if (tile == nullptr || tile->light == 0) {
+        return 0;
+    }
+    unsigned char tint = c == 0 ? tile->tintr : c == 1 ? tile->tintg : tile->tintb;
+    return tile->light * tint / 255;
+}
+
+static inline unsigned char& _Channel(Color* l, char c) {
+    return c == 0 ? l->r : c == 1 ? l->g : l->b;
+}
+
+static inline bool _BlocksLight(MapTile* tile) {
+    return tile != nullptr && tile->blocksLight;
+}
+
+static const int floodneighbours[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+
+/* Return the light map texel for tile x,y,z and set tile to its tile, or return nullptr outside the map. */
+Color* MapData::cursorLight(ChunkCursor& c, int x, int y, int z, MapTile*& tile) {
+    unsigned short tid = cursorGet(c, x, y, z);
+    if (c.chunk == -1) {
+        tile = nullptr;
+        return nullptr;
+    }
+    tile = tileRegistry->of(tid);
+    return lightmaps[c.chunk]->get(x - c.pos.x, z - c.pos.z);
+}
+
+/* Spread channel c outwards from every node in floodQueue, losing LIGHT_FLOOD_STEP per tile.
+   Tiles that block light are lit but don't pass it on. */
+void MapData::floodPropagate(char c) {
+    ChunkCursor cursor;
+    for (size_t q=0; q<floodQueue.length(); q++) {
+        FloodNode n = floodQueue[q];
+        MapTile* tile;
+        Color* l = cursorLight(cursor, n.x, n.y, n.z, tile);
+        // skip nodes whose light has changed since they were queued; the change queued them again
+        if (n.v <= LIGHT_FLOOD_STEP || l == nullptr || _Channel(l, c) != n.v) {
+            continue;
+        }
+        unsigned char v = n.v - LIGHT_FLOOD_STEP;
+        for (int j=0; j<4; j++) {
+            int x = n.x + floodneighbours[j][0], z = n.z + floodneighbours[j][1];
+            l = cursorLight(cursor, x, n.y, z, tile);
+            if (l == nullptr || _Channel(l, c) >= v) {
+                continue;
+            }
+            _Channel(l, c) = v;
+            markDirty(cursor.chunk, CHUNK_DIRTY_LIGHT);
+            if (!_BlocksLight(tile)) {
+                floodQueue.append({x, n.y, z, v});
+            }
+        }
+    }
+    floodQueue.clear();
+    // relight blocking tiles cleared by floodRemove() from their brightest open neighbour
+    for (size_t q=0; q<floodBlockers.length(); q++) {
+        FloodNode n = floodBlockers[q];
+        MapTile* tile;
+        Color* l = cursorLight(cursor, n.x, n.y, n.z, tile);
+        int chunk = cursor.chunk;
+        for (int j=0; l!=nullptr && j<4; j++) {
+            MapTile* ntile;
+            Color* nl = cursorLight(cursor, n.x + floodneighbours[j][0], n.y, n.z + floodneighbours[j][1], ntile);
+            if (nl != nullptr && !_BlocksLight(ntile) && _Channel(nl, c) > LIGHT_FLOOD_STEP) {
+                unsigned char v = _Channel(nl, c) - LIGHT_FLOOD_STEP;
+                if (v > _Channel(l, c)) {
+                    _Channel(l, c) = v;
+                    markDirty(chunk, CHUNK_DIRTY_LIGHT);
+                }
+            }
+        }
+    }
+    floodBlockers.clear();
+}
+
+/* Clear channel c from every tile that could have been lit through the nodes in floodRemoveQueue,
+   queueing the light sources and brighter edges found on the way to be propagated again. */
+void MapData::floodRemove(char c) {
+    ChunkCursor cursor;
+    for (size_t q=0; q<floodRemoveQueue.length(); q++) {
+        FloodNode n = floodRemoveQueue[q];
+        for (int j=0; j<4; j++) {
+            int x = n.x + floodneighbours[j][0], z = n.z + floodneighbours[j][1];
+            MapTile* tile;
+            Color* l = cursorLight(cursor, x, n.y, z, tile);
+            if (l == nullptr) {
+                continue;
+            }
+            unsigned char v = _Channel(l, c);
+            if (v != 0 && v < n.v) {
+                unsigned char source = _FloodSource(tile, c);
+                _Channel(l, c) = source;
+                markDirty(cursor.chunk, CHUNK_DIRTY_LIGHT);
+                if (_BlocksLight(tile)) {
+                    // it may also have been lit from a side this removal never reaches
+                    floodBlockers.append({x, n.y, z, 0});
+                } else {
+                    floodRemoveQueue.append({x, n.y, z, v});
+                }
+                if (source > 0) {
+                    floodQueue.append({x, n.y, z, source});
+                }
+            } else if (v >= n.v && !_BlocksLight(tile)) {
+                floodQueue.append({x, n.y, z, v});
+            }
+        }
+    }
+    floodRemoveQueue.clear();
+}
+
+/* Light the whole map by flood filling from every tile that emits light. Light spreads to the four
+   neighbouring tiles on the same level, and each channel keeps the brightest light reaching it. */
+void MapData::BuildFloodLighting() {
+    double start = GetTime();
+    size_t sources = 0;
     for (size_t i=0; i<maps.length(); i++) {
-        TileArray* map = &maps[i];
-        int y = positions[i].y;
-        int xx = positions[i].x;
-        int zz = positions[i].z;
-        for (size_t j=0; j<lightList.length(); j++) {
-            PlacedLight* light = &lightList[j];
-            TraceLog(LOG_INFO, "Building light %llu", j);
-            // float dy = powf(y - light->y, 2);
-            for (int z=0; z<map->height(); z++) {
-                for (int x=0; x<map->width(); x++) {
-                    float dist = DDACast(tileRegistry, this, y, xx+x, zz+z, light->x, light->z, isSolidToLight);
-                    if (dist > 0) {
-                        float d = inverseSquareRoot(dist*dist);
-                        addLight(xx+x, y, zz+z, light->v*d, light->r, light->g, light->b);
+        TileArray& map = maps[i];
+        for (int z=0; z<map.height(); z++) {
+            for (int x=0; x<map.width(); x++) {
+                *lightmaps[i]->get(x, z) = {0, 0, 0, 255};
+            }
+        }
+    }
+    for (char c=0; c<3; c++) {
+        for (size_t i=0; i<maps.length(); i++) {
+            TileArray& map = maps[i];
+            Vec3I p = positions[i];
+            for (int z=0; z<map.height(); z++) {
+                for (int x=0; x<map.width(); x++) {
+                    unsigned char v = _FloodSource(tileRegistry->of(map.get({x, z})), c);
+                    if (v > 0) {
+                        _Channel(lightmaps[i]->get(x, z), c) = v;
+                        floodQueue.append({p.x + x, p.y, p.z + z, v});
+                        sources += c == 0;
                     }
                 }
             }
         }
+        floodPropagate(c);
     }
-    TraceLog(LOG_INFO, "Done building lights!");
+    floodLit = true;
+    TraceLog(LOG_INFO, "Flood filled %llu light sources into %llu light maps in %.2f ms.",
+        sources, maps.length(), (GetTime() - start)*1000.0);
+}
+
+/* Flood light into chunks just added to a flood lit map, from the sources in them and from the light already on
+   the open tiles around them. Light that came from chunks since evicted is left where it reached. */
+void MapData::floodChunks(const size_t* chunks, size_t count) {
+    for (size_t j=0; j<count; j++) {
+        TileArray& map = maps[chunks[j]];
+        for (int z=0; z<map.height(); z++) {
+            for (int x=0; x<map.width(); x++) {
+                *lightmaps[chunks[j]]->get(x, z) = {0, 0, 0, 255};
+            }
+        }
+    }
+    ChunkCursor cursor;
+    for (char c=0; c<3; c++) {
+        for (size_t j=0; j<count; j++) {
+            size_t i = chunks[j];
+            TileArray& map = maps[i];
+            Vec3I p = positions[i];
+            int w = map.width(), h = map.height();
+            for (int z=0; z<h; z++) {
+                for (int x=0; x<w; x++) {
+                    unsigned char v = _FloodSource(tileRegistry->of(map.get({x, z})), c);
+                    if (v > 0) {
+                        _Channel(lightmaps[i]->get(x, z), c) = v;
+                        floodQueue.append({p.x + x, p.y, p.z + z, v});
+                    }
+                }
+            }
+            // the ring of tiles around the chunk
+            for (int k=-1; k<=std::max(w, h); k++) {
+                int ring[4][2] = {{p.x + k, p.z - 1}, {p.x + k, p.z + h}, {p.x - 1, p.z + k}, {p.x + w, p.z + k}};
+                for (int r=0; r<4; r++) {
+                    if ((r < 2 && k > w) || (r >= 2 && (k < 0 || k >= h))) {
+                        continue;
+                    }
+                    MapTile* tile;
+                    Color* l = cursorLight(cursor, ring[r][0], p.y, ring[r][1], tile);
+                    if (l != nullptr && !_BlocksLight(tile) && _Channel(l, c) > LIGHT_FLOOD_STEP) {
+                        floodQueue.append({ring[r][0], p.y, ring[r][1], _Channel(l, c)});
+                    }
+                }
+            }
+        }
+        floodPropagate(c);
+    }
+}
+
+/* Relight around tile x,y,z after it changed from oldtid, touching only the tiles its old and new
+   light could reach. Does nothing unless the map was lit by BuildFloodLighting(). */
+void MapData::UpdateFloodLight(int x, int y, int z, unsigned short oldtid) {
+    if (!floodLit) {
+        return;
+    }
+    ChunkCursor cursor;
+    MapTile* tile;
+    Color* l = cursorLight(cursor, x, y, z, tile);
+    MapTile* old = tileRegistry->of(oldtid);
+    if (l == nullptr || (old == tile) || (_BlocksLight(old) == _BlocksLight(tile) &&
+        _FloodSource(old, 0) == _FloodSource(tile, 0) && _FloodSource(old, 1) == _FloodSource(tile, 1) &&
+        _FloodSource(old, 2) == _FloodSource(tile, 2))) {
+        return;
+    }
+    int chunk = cursor.chunk;
+    for (char c=0; c<3; c++) {
+        unsigned char v = _Channel(l, c);
+        if (v > 0) {
+            _Channel(l, c) = 0;
+            floodRemoveQueue.append({x, y, z, v});
+            floodRemove(c);
+        }
+        unsigned char source = _FloodSource(tile, c);
+        if (source > _Channel(l, c)) {
+            _Channel(l, c) = source;
+        }
+        if (_Channel(l, c) > 0) {
+            floodQueue.append({x, y, z, _Channel(l, c)});
+        }
+        if (!_BlocksLight(tile)) {
+            // let light from around the tile back in
+            for (int j=0; j<4; j++) {
+                MapTile* ntile;
+                Color* nl = cursorLight(cursor, x + floodneighbours[j][0], y, z + floodneighbours[j][1], ntile);
+                if (nl != nullptr && _Channel(nl, c) > 0 && !_BlocksLight(ntile)) {
+                    floodQueue.append({x + floodneighbours[j][0], y, z + floodneighbours[j][1], _Channel(nl, c)});
+                }
+            }
+        }
+        floodPropagate(c);
+    }
+    markDirty(chunk, CHUNK_DIRTY_LIGHT);
 }
 #pragma endregion
 
 #pragma region RayCast()
-Vector3 MapData::RayCast(Vector3 pos, Vector3 dir, HitInfo& hit, size_t max_steps) {
-    Vector3 p = pos;
+// surface normal hit when stepping along each axis in the negative/positive direction
+static const unsigned char rayhitfaces[3][2] = {
+    {HIT_FACE_POS_X, HIT_FACE_NEG_X},
+    {HIT_FACE_POS_Y, HIT_FACE_NEG_Y},
+    {HIT_FACE_POS_Z, HIT_FACE_NEG_Z},
+};
+
+/* Return the tile at x,y,z, reusing the cursor's chunk while the position stays inside it. */
+inline unsigned short MapData::cursorGet(ChunkCursor& c, int x, int y, int z) {
+    if (c.chunk == -1 || y != c.pos.y || x < c.pos.x || z < c.pos.z || x - c.pos.x >= c.map->width() || z - c.pos.z >= c.map->height()) {
+        c.chunk = findChunk(x, y, z);
+        if (c.chunk == -1) {
+            return 0;
+        }
+        c.pos = positions[c.chunk];
+        c.map = &maps[c.chunk];
+    }
+    return c.map->get({x - c.pos.x, z - c.pos.z});
+}
+
+// set up one axis of a grid traversal
+static inline void _RayAxis(float origin, float delta, int cell, int& step, float& tmax, float& tdelta) {
+    if (delta > 0) {
+        step = 1;
+        tdelta = 1.0f / delta;
+        tmax = (cell + 1 - origin) * tdelta;
+    } else if (delta < 0) {
+        step = -1;
+        tdelta = -1.0f / delta;
+        tmax = (origin - cell) * tdelta;
+    } else {
+        step = 0;
+        tdelta = tmax = INFINITY;
+    }
+}
+
+static inline void _RayHit(HitInfo& hit, char axis, int step, unsigned short tid, float t) {
+    if (axis == 1) {
+        if (step < 0) {
+            hit.hitFloor = true;
+        } else {
+            hit.hitCeiling = true;
+        }
+    } else {
+        hit.hitWall = true;
+    }
+    // the surface faces back against the direction of travel
+    hit.face = rayhitfaces[(int)axis][step > 0 ? 1 : 0];
+    hit.tileid = tid;
+    hit.distance = t;
+}
+
+static inline void _RayMiss(HitInfo& hit) {
     hit.flags = 0;
-    for (size_t i=0; i<max_steps; i++) {
-        MapTile* tile = tileRegistry->of(get(p.x, p.y, p.z));
+    hit.face = HIT_FACE_NONE;
+    hit.tileid = 0;
+    hit.distance = INFINITY;
+}
+
+/* Walk the grid cell by cell along the ray (Amanatides & Woo) until a solid tile, or a solid
+   floor or ceiling, is crossed. max_steps*|dir| is the maximum distance travelled. */
+Vector3 MapData::RayCast(Vector3 pos, Vector3 dir, HitInfo& hit, size_t max_steps) {
+    float len = Vector3Length(dir);
+    float maxdist = max_steps * len;
+    RayCast(pos, dir, maxdist, hit);
+    if (hit.distance == INFINITY) {
+        return len == 0 ? pos : Vector3Add(pos, Vector3Scale(dir, maxdist / len));
+    }
+    return Vector3Add(pos, Vector3Scale(dir, hit.distance / len));
+}
+
+void MapData::RayCast(Vector3 pos, Vector3 dir, float maxdist, HitInfo& hit) {
+    _RayMiss(hit);
+    float len = Vector3Length(dir);
+    if (len == 0) {
+        return;
+    }
+    float origin[3] = {pos.x, pos.y, pos.z};
+    float delta[3] = {dir.x / len, dir.y / len, dir.z / len};
+    int cell[3], step[3];
+    float tmax[3], tdelta[3];
+    for (int a=0; a<3; a++) {
+        cell[a] = floorf(origin[a]);
+        _RayAxis(origin[a], delta[a], cell[a], step[a], tmax[a], tdelta[a]);
+    }
+    ChunkCursor cursor;
+    unsigned short tid = cursorGet(cursor, cell[0], cell[1], cell[2]);
+    MapTile* tile = tileRegistry->of(tid);
+    if (tile != nullptr && tile->isSolid) {
+        hit.hitWall = true;
+        hit.tileid = tid;
+        hit.distance = 0;
+        return;
+    }
+    while (true) {
+        int a = 0;
+        if (tmax[1] < tmax[a]) {
+            a = 1;
+        }
+        if (tmax[2] < tmax[a]) {
+            a = 2;
+        }
+        float t = tmax[a];
+        if (t > maxdist) {
+            return;
+        }
+        // leaving the cell through its floor or ceiling
+        if (a == 1 && tile != nullptr && (step[1] < 0 ? tile->solidFloor : tile->solidCeiling)) {
+            _RayHit(hit, a, step[1], tid, t);
+            return;
+        }
+        cell[a] += step[a];
+        tmax[a] += tdelta[a];
+        tid = cursorGet(cursor, cell[0], cell[1], cell[2]);
+        tile = tileRegistry->of(tid);
         if (tile != nullptr && tile->isSolid) {
-            hit.hitWall = true;
-            hit.distance = Vector3Distance(pos, p);
-            break;
+            _RayHit(hit, a, step[a], tid, t);
+            return;
+        }
+    }
+}
+#pragma endregion
+
+#pragma region RayCastBatch()
+#ifdef MAPDATA_SIMD_RAYS
+// the lane operations RayCastLanes needs, RAY_LANES wide
+#ifdef __AVX2__
+typedef __m256 LaneFloats;
+typedef __m256i LaneInts;
+static inline LaneFloats _LanesLoad(const float* p) { return _mm256_load_ps(p); }
+static inline void _LanesStore(float* p, LaneFloats v) { _mm256_store_ps(p, v); }
+static inline LaneInts _LanesLoad(const int* p) { return _mm256_load_si256((const __m256i*)p); }
+static inline void _LanesStore(int* p, LaneInts v) { _mm256_store_si256((__m256i*)p, v); }
+static inline LaneFloats _LanesLE(LaneFloats a, LaneFloats b) { return _mm256_cmp_ps(a, b, _CMP_LE_OS); }
+static inline LaneFloats _LanesGT(LaneFloats a, LaneFloats b) { return _mm256_cmp_ps(a, b, _CMP_GT_OS); }
+static inline LaneFloats _LanesAnd(LaneFloats a, LaneFloats b) { return _mm256_and_ps(a, b); }
+static inline LaneFloats _LanesAndNot(LaneFloats a, LaneFloats b) { return _mm256_andnot_ps(a, b); }
+static inline LaneFloats _LanesOr(LaneFloats a, LaneFloats b) { return _mm256_or_ps(a, b); }
+static inline LaneFloats _LanesAdd(LaneFloats a, LaneFloats b) { return _mm256_add_ps(a, b); }
+// a + (b where mask is set)
+static inline LaneInts _LanesAddMasked(LaneInts a, LaneInts b, LaneFloats mask) {
+    return _mm256_add_epi32(a, _mm256_and_si256(b, _mm256_castps_si256(mask)));
+}
+static inline int _LanesBits(LaneFloats mask) { return _mm256_movemask_ps(mask); }
+// all lanes set
+static inline LaneFloats _LanesAll() { return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); }
+// set the lanes whose bit is set in bits, the inverse of _LanesBits
+static inline LaneFloats _LanesFromBits(int bits) {
+    __m256i lanebits = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+    return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits), lanebits), lanebits));
+}
+#else
+typedef __m128 LaneFloats;
+typedef __m128i LaneInts;
+static inline LaneFloats _LanesLoad(const float* p) { return _mm_load_ps(p); }
+static inline void _LanesStore(float* p, LaneFloats v) { _mm_store_ps(p, v); }
+static inline LaneInts _LanesLoad(const int* p) { return _mm_load_si128((const __m128i*)p); }
+static inline void _LanesStore(int* p, LaneInts v) { _mm_store_si128((__m128i*)p, v); }
+static inline LaneFloats _LanesLE(LaneFloats a, LaneFloats b) { return _mm_cmple_ps(a, b); }
+static inline LaneFloats _LanesGT(LaneFloats a, LaneFloats b) { return _mm_cmpgt_ps(a, b); }
+static inline LaneFloats _LanesAnd(LaneFloats a, LaneFloats b) { return _mm_and_ps(a, b); }
+static inline LaneFloats _LanesAndNot(LaneFloats a, LaneFloats b) { return _mm_andnot_ps(a, b); }
+static inline LaneFloats _LanesOr(LaneFloats a, LaneFloats b) { return _mm_or_ps(a, b); }
+static inline LaneFloats _LanesAdd(LaneFloats a, LaneFloats b) { return _mm_add_ps(a, b); }
+static inline LaneInts _LanesAddMasked(LaneInts a, LaneInts b, LaneFloats mask) {
+    return _mm_add_epi32(a, _mm_and_si128(b, _mm_castps_si128(mask)));
+}
+static inline int _LanesBits(LaneFloats mask) { return _mm_movemask_ps(mask); }
+static inline LaneFloats _LanesAll() { return _mm_castsi128_ps(_mm_set1_epi32(-1)); }
+static inline LaneFloats _LanesFromBits(int bits) {
+    __m128i lanebits = _mm_set_epi32(8, 4, 2, 1);
+    return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(bits), lanebits), lanebits));
+}
+#endif
+
+/* Traverse rays RAY_LANES at a time, one per SIMD lane. The grid stepping runs in lanes, while tile
+   fetches go through a chunk cursor per lane. A lane whose ray finishes picks up the next ray
+   straight away, so lanes don't sit idle waiting for the longest ray of a group. */
+void MapData::RayCastLanes(const Vector3* origins, const Vector3* dirs, const float* maxdists, HitInfo* hits, size_t count) {
+    alignas(sizeof(LaneFloats)) float tmax[3][RAY_LANES], tdelta[3][RAY_LANES], maxd[RAY_LANES], tout[RAY_LANES];
+    alignas(sizeof(LaneInts)) int cell[3][RAY_LANES], step[3][RAY_LANES];
+    unsigned short tid[RAY_LANES];
+    MapTile* tile[RAY_LANES];
+    size_t ray[RAY_LANES];
+    ChunkCursor cursor[RAY_LANES];
+    size_t next = 0;
+    int active = 0;
+    // start the next ray that needs traversing in lane l, or leave the lane idle if there are none
+    auto fill = [&](int l) {
+        while (next < count) {
+            size_t i = next++;
+            _RayMiss(hits[i]);
+            float len = Vector3Length(dirs[i]);
+            if (len == 0) {
+                continue;
+            }
+            float origin[3] = {origins[i].x, origins[i].y, origins[i].z};
+            float delta[3] = {dirs[i].x / len, dirs[i].y / len, dirs[i].z / len};
+            for (int a=0; a<3; a++) {
+                cell[a][l] = floorf(origin[a]);
+                _RayAxis(origin[a], delta[a], cell[a][l], step[a][l], tmax[a][l], tdelta[a][l]);
+            }
+            tid[l] = cursorGet(cursor[l], cell[0][l], cell[1][l], cell[2][l]);
+            tile[l] = tileRegistry->of(tid[l]);
+            if (tile[l] != nullptr && tile[l]->isSolid) {
+                hits[i].hitWall = true;
+                hits[i].tileid = tid[l];
+                hits[i].distance = 0;
+                continue;
+            }
+            maxd[l] = maxdists[i];
+            ray[l] = i;
+            active |= 1 << l;
+            return;
+        }
+        maxd[l] = -1;
+        for (int a=0; a<3; a++) {
+            tmax[a][l] = tdelta[a][l] = INFINITY;
+            cell[a][l] = step[a][l] = 0;
+        }
+        active &= ~(1 << l);
+    };
+    for (int l=0; l<RAY_LANES; l++) {
+        fill(l);
+    }
+    while (active) {
+        LaneFloats TX = _LanesLoad(tmax[0]), TY = _LanesLoad(tmax[1]), TZ = _LanesLoad(tmax[2]);
+        // pick the nearest boundary per lane, preferring x then y then z on ties like RayCast
+        LaneFloats MX = _LanesAnd(_LanesLE(TX, TY), _LanesLE(TX, TZ));
+        LaneFloats MY = _LanesAndNot(MX, _LanesLE(TY, TZ));
+        LaneFloats MZ = _LanesAndNot(_LanesOr(MX, MY), _LanesAll());
+        LaneFloats T = _LanesOr(_LanesOr(_LanesAnd(MX, TX), _LanesAnd(MY, TY)), _LanesAnd(MZ, TZ));
+        _LanesStore(tout, T);
+        int finished = _LanesBits(_LanesGT(T, _LanesLoad(maxd))) & active;
+        int ylanes = _LanesBits(MY) & active & ~finished;
+        for (int l=0; ylanes; l++, ylanes>>=1) {
+            // leaving the cell through its floor or ceiling
+            if ((ylanes & 1) && tile[l] != nullptr && (step[1][l] < 0 ? tile[l]->solidFloor : tile[l]->solidCeiling)) {
+                _RayHit(hits[ray[l]], 1, step[1][l], tid[l], tout[l]);
+                finished |= 1 << l;
+            }
+        }
+        int moving = active & ~finished;
+        LaneFloats A = _LanesFromBits(moving);
+        MX = _LanesAnd(MX, A);
+        MY = _LanesAnd(MY, A);
+        MZ = _LanesAnd(MZ, A);
+        _LanesStore(tmax[0], _LanesAdd(TX, _LanesAnd(_LanesLoad(tdelta[0]), MX)));
+        _LanesStore(tmax[1], _LanesAdd(TY, _LanesAnd(_LanesLoad(tdelta[1]), MY)));
+        _LanesStore(tmax[2], _LanesAdd(TZ, _LanesAnd(_LanesLoad(tdelta[2]), MZ)));
+        _LanesStore(cell[0], _LanesAddMasked(_LanesLoad(cell[0]), _LanesLoad(step[0]), MX));
+        _LanesStore(cell[1], _LanesAddMasked(_LanesLoad(cell[1]), _LanesLoad(step[1]), MY));
+        _LanesStore(cell[2], _LanesAddMasked(_LanesLoad(cell[2]), _LanesLoad(step[2]), MZ));
+        int xlanes = _LanesBits(MX);
+        int ylanesmoved = _LanesBits(MY);
+        for (int l=0; l<RAY_LANES; l++) {
+            if (moving & (1 << l)) {
+                tid[l] = cursorGet(cursor[l], cell[0][l], cell[1][l], cell[2][l]);
+                tile[l] = tileRegistry->of(tid[l]);
+                if (tile[l] != nullptr && tile[l]->isSolid) {
+                    char a = (xlanes & (1 << l)) ? 0 : (ylanesmoved & (1 << l)) ? 1 : 2;
+                    _RayHit(hits[ray[l]], a, step[(int)a][l], tid[l], tout[l]);
+                    finished |= 1 << l;
+                }
+            }
+            if (finished & (1 << l)) {
+                fill(l);
+            }
+        }
+    }
+}
+#endif
+
+/* Cast count rays at once. Each ray stops at maxdists[i]; hits[i] is filled like RayCast().
+   Batches of more than RAY_BATCH_GROUP rays are split across the job system. */
+void MapData::RayCastBatch(const Vector3* origins, const Vector3* dirs, const float* maxdists, HitInfo* hits, size_t count) {
+    auto castgroup = [&](size_t g) {
+        size_t i = g * RAY_BATCH_GROUP;
+        size_t n = count - i < RAY_BATCH_GROUP ? count - i : RAY_BATCH_GROUP;
+#ifdef MAPDATA_SIMD_RAYS
+        RayCastLanes(&origins[i], &dirs[i], &maxdists[i], &hits[i], n);
+#else
+        for (size_t j=0; j<n; j++) {
+            RayCast(origins[i+j], dirs[i+j], maxdists[i+j], hits[i+j]);
         }
-        p = Vector3Add(p, dir);
+#endif
+    };
+    size_t groups = (count + RAY_BATCH_GROUP - 1) / RAY_BATCH_GROUP;
+    if (groups == 1 || GlobalJobSystem == nullptr || GlobalJobSystem->workerCount() < 2) {
+        for (size_t g=0; g<groups; g++) {
+            castgroup(g);
+        }
+    } else {
+        GlobalJobSystem->parallelFor(groups, castgroup);
     }
-    return p;
 }
 #pragma endregion
 
 #pragma region _GenerateMesh()
-static void _GenerateMesh(TileArray* map, LightMap* lmap, MapTileRegistry* tileRegistry, DynamicArray<unsigned int>* verts, DynamicArray<unsigned short>* indices) {
+// texture repeat axis for each face: 0 = x, 1 = z, 2 = y (always 1 tile)
+static const constexpr char faceuaxis[6] = {1, 0, 1, 1, 0, 0};
+static const constexpr char facevaxis[6] = {0, 1, 2, 2, 2, 2};
+
+static void _EmitQuad(DynamicArray<unsigned int>* verts, DynamicArray<unsigned short>* indices, unsigned int& mi,
+                      char fi, int x, int z, int sx, int sz, unsigned short tid) {
+    char fo = fi*3*4;
+    int spans[3] = {sx, sz, 1};
+    int uspan = spans[(int)faceuaxis[(int)fi]];
+    int vspan = spans[(int)facevaxis[(int)fi]];
+    for (int j=0; j<4; j++) {
+        char vno = vertexnumbers[j];
+        verts->append(
+            (vno << 30) | // Vertex number
+            (cubeverts[fo + j*3 + 1]<<29) | // Y position
+            ((cubeverts[fo + j*3 + 0]*sx + x)<<20) | // X position
+            ((cubeverts[fo + j*3 + 2]*sz + z)<<12) | // Z position
+            tid & 0xfff // texture ID
+        );
+        verts->append(
+            ((vno & 1) ? uspan : 0) | // texture U repeat
+            ((vno & 2) ? vspan : 0) << 8 // texture V repeat
+        );
+    }
+    for (char j=0; j<6; j++) {
+        indices->append(mi+triangleindices[j]);
+    }
+    mi += 4;
+}
+
+// tile at x,z relative to the chunk, looking into the neighbouring chunk when outside of it
+static inline unsigned short _NeighbourTile(TileArray* map, Vec3I pos, MapData* world, int x, int z) {
+    if (x >= 0 && z >= 0 && x < map->width() && z < map->height()) {
+        return map->get({x, z});
+    }
+    return world->get(pos.x+x, pos.y, pos.z+z);
+}
+
+static unsigned short _FaceTexture(TileArray* map, Vec3I pos, MapData* world, MapTileRegistry* tileRegistry, int x, int z, char fi) {
+    MapTile* tile = tileRegistry->of(map->get({x, z}));
+    if (tile == nullptr) {
+        return 0;
+    }
+    if (fi == 0) {
+        return tile->ceiling;
+    } else if (fi == 1) {
+        return tile->floor;
+    }
+    unsigned short tid2;
+    if (fi == 2) { // +X
+        tid2 = _NeighbourTile(map, pos, world, x+1, z);
+    } else if (fi == 3) { // -X
+        tid2 = _NeighbourTile(map, pos, world, x-1, z);
+    } else if (fi == 4) { // +Z
+        tid2 = _NeighbourTile(map, pos, world, x, z+1);
+    } else { // -Z
+        tid2 = _NeighbourTile(map, pos, world, x, z-1);
+    }
+    MapTile* tile2 = tileRegistry->of(tid2);
+    if (tile2 != nullptr && tile2->isSolid) {
+        return 0;
+    }
+    return tile->wall;
+}
+
+/* Build the mesh for one chunk. Wall faces against solid tiles are culled, including across the
+   chunk boundary, so a chunk's mesh also depends on the edge tiles of its neighbours.
+   In greedy mode coplanar neighbouring faces with the same texture are merged into a single quad,
+   and the texture is repeated across it by the shader.
+   Returns the number of visible tile faces (the quad count without merging) in faces. */
+static void _GenerateMesh(TileArray* map, Vec3I pos, MapData* world, MapTileRegistry* tileRegistry, bool greedy,
+                          DynamicArray<unsigned int>* verts, DynamicArray<unsigned short>* indices, unsigned int* faces) {
     unsigned int mi = 0;
-    for (int z=0; z<map->height(); z++) {
-        for (int x=0; x<map->width(); x++) {
-            MapTile* tile = tileRegistry->of(map->get({x, z}));
-            if (tile == nullptr) {
-                continue;
+    unsigned int nfaces = 0;
+    int w = map->width();
+    int h = map->height();
+    if (!greedy) {
+        for (int z=0; z<h; z++) {
+            for (int x=0; x<w; x++) {
+                for (char fi=0; fi<6; fi++) {
+                    unsigned short tid = _FaceTexture(map, pos, world, tileRegistry, x, z, fi);
+                    if (tid > 0) {
+                        _EmitQuad(verts, indices, mi, fi, x, z, 1, 1, tid);
+                        nfaces++;
+                    }
+                }
             }
-            unsigned short tid;
-            for (char fi=0; fi<6; fi++) {
-                if (fi == 0) {
-                    tid = tile->ceiling;
-                } else if (fi == 1) {
-                    tid = tile->floor;
-                } else {
-                    MapTile* tile2;
-                    unsigned short tid2;
-                    tid = tile->wall;
-                    if (fi == 2) { // +X
-                        tid2 = map->getOrDefault({x+1, z});
-                    } else if (fi == 3) { // -X
-                        tid2 = map->getOrDefault({x-1, z});
-                    } else if (fi == 4) { // +Z
-                        tid2 = map->getOrDefault({x, z+1});
-                    } else if (fi == 5) { // -Z
-                        tid2 = map->getOrDefault({x, z-1});
+        }
+        *faces = nfaces;
+        return;
+    }
+    unsigned short* mask = new unsigned short[w*h];
+    for (char fi=0; fi<6; fi++) {
+        for (int z=0; z<h; z++) {
+            for (int x=0; x<w; x++) {
+                mask[z*w+x] = _FaceTexture(map, pos, world, tileRegistry, x, z, fi);
+                if (mask[z*w+x] > 0) {
+                    nfaces++;
+                }
+            }
+        }
+        for (int z=0; z<h; z++) {
+            for (int x=0; x<w; x++) {
+                unsigned short tid = mask[z*w+x];
+                if (tid == 0) {
+                    continue;
+                }
+                int sx = 1, sz = 1;
+                if (fi == 0 || fi == 1) {
+                    // floors and ceilings merge into rectangles
+                    while (x+sx < w && mask[z*w+x+sx] == tid) {
+                        sx++;
                     }
-                    tile2 = tileRegistry->of(tid2);
-                    if (tile2 != nullptr && tile2->isSolid) {
-                        continue;
+                    while (z+sz < h) {
+                        bool rowmatches = true;
+                        for (int k=0; k<sx; k++) {
+                            if (mask[(z+sz)*w+x+k] != tid) {
+                                rowmatches = false;
+                                break;
+                            }
+                        }
+                        if (!rowmatches) {
+                            break;
+                        }
+                        sz++;
                     }
-                }
-                if (tid > 0) {
-                    char fo = fi*3*4;
-                    for (char j=0; j<4; j++) {
-                        // TraceLog(LOG_INFO, "vertex %d, %d, %d [%u]",
-                        //     cubeverts[fo + j*3 + 0] + x, cubeverts[fo + j*3 + 1], cubeverts[fo + j*3 + 2] + z, tid);
-                        verts->append(
-                            (vertexnumbers[j] << 30) | // Vertex number
-                            (cubeverts[fo + j*3 + 1]<<29) | // Y position
-                            ((cubeverts[fo + j*3 + 0] + x)<<20) | // X position
-                            ((cubeverts[fo + j*3 + 2] + z)<<12) | // Z position
-                            tid & 0xfff // texture ID
-                        );
+                } else if (fi == 2 || fi == 3) {
+                    // X facing walls merge along Z
+                    while (z+sz < h && mask[(z+sz)*w+x] == tid) {
+                        sz++;
+                    }
+                } else {
+                    // Z facing walls merge along X
+                    while (x+sx < w && mask[z*w+x+sx] == tid) {
+                        sx++;
                     }
-                    for (char j=0; j<6; j++) {
-                        // TraceLog(LOG_INFO, "index %d", mi+I[j]);
-                        indices->append(mi+triangleindices[j]);
+                }
+                for (int zz=z; zz<z+sz; zz++) {
+                    for (int xx=x; xx<x+sx; xx++) {
+                        mask[zz*w+xx] = 0;
                     }
-                    mi += 4;
                 }
+                _EmitQuad(verts, indices, mi, fi, x, z, sx, sz, tid);
             }
         }
     }
+    delete [] mask;
+    *faces = nfaces;
 }
 #pragma endregion
 
 #pragma region GenerateMesh()
 void MapData::SetLevelMesh(size_t i, unsigned int vertCount, unsigned int* verts, unsigned int triangleCount, unsigned short* indices) {
     MapIntMesh* mesh = MapIntMeshes[i];
-    if (mesh->verts != nullptr) {
-        delete mesh->verts;
-    }
-    if (mesh->indices != nullptr) {
-        delete mesh->indices;
-    }
+    delete [] mesh->verts;
+    delete [] mesh->indices;
     mesh->vertexCount = vertCount;
     mesh->verts = verts;
     mesh->triangleCount = triangleCount;
     mesh->indices = indices;
-    TraceLog(LOG_INFO, "Generated level mesh #%llu with %u verts and %u triangles.",
-        i+1, mesh->vertexCount, mesh->triangleCount);
+    TraceLog(LOG_DEBUG, "Generated level mesh #%llu with %u verts and %u triangles.",
+        (unsigned long long)i+1, mesh->vertexCount, mesh->triangleCount);
 }
 
 void MapData::GenerateMesh(size_t i) {
-    DynamicArray<unsigned int>* vertarray = new DynamicArray<unsigned int>(maps[i].size()*6*4*2);
-    DynamicArray<unsigned short>* indexarray = new DynamicArray<unsigned short>(maps[i].size()*36);
-    _GenerateMesh(&maps[i], lightmaps[i], tileRegistry, vertarray, indexarray);
-    SetLevelMesh(i,
-        vertarray->length()/2, vertarray->collapse(),
-        indexarray->length()/3, indexarray->collapse()
-    );
-    delete vertarray;
-    delete indexarray;
+    GenerateMeshes(&i, 1);
 }
 
 void MapData::GenerateMesh() {
-    std::thread threads[maps.length()];
-    DynamicArray<unsigned int>* vertarrays[maps.length()];
-    DynamicArray<unsigned short>* indexarrays[maps.length()];
-    for (size_t i=0; i<maps.length(); i++) {
-        vertarrays[i] = new DynamicArray<unsigned int>();
-        indexarrays[i] = new DynamicArray<unsigned short>();
-        vertarrays[i]->resize(maps[i].size()*6*4*2);
-        indexarrays[i]->resize(maps[i].size()*36);
-        threads[i] = std::thread(_GenerateMesh, &maps[i], lightmaps[i], tileRegistry, vertarrays[i], indexarrays[i]);
+    size_t count = maps.length();
+    size_t* chunks = new size_t[count];
+    for (size_t i=0; i<count; i++) {
+        chunks[i] = i;
     }
-    for (size_t i=0; i<maps.length(); i++) {
-        if (threads[i].joinable()) {
-            threads[i].join();
-            SetLevelMesh(i,
-                vertarrays[i]->length(), vertarrays[i]->collapse(),
-                indexarrays[i]->length()/3, indexarrays[i]->collapse()
-            );
-            delete vertarrays[i];
-            delete indexarrays[i];
-        }
+    GenerateMeshes(chunks, count);
+    delete [] chunks;
+    meshFaceCount = meshVertexCount = meshTriangleCount = 0;
+    for (size_t i=0; i<count; i++) {
+        meshFaceCount += MapIntMeshes[i]->faceCount;
+        meshVertexCount += MapIntMeshes[i]->vertexCount;
+        meshTriangleCount += MapIntMeshes[i]->triangleCount;
+    }
+    TraceLog(LOG_INFO, "Generated %s level mesh: %llu verts and %llu triangles (unmerged: %llu verts and %llu triangles).",
+        greedyMeshing ? "greedy" : "per-tile", meshVertexCount, meshTriangleCount, meshFaceCount*4, meshFaceCount*2);
+}
+
+/* Mesh a list of chunks in parallel. Meshes are only swapped in once all of them are done. */
+void MapData::GenerateMeshes(const size_t* chunks, size_t count) {
+    DynamicArray<unsigned int>** vertarrays = new DynamicArray<unsigned int>*[count];
+    DynamicArray<unsigned short>** indexarrays = new DynamicArray<unsigned short>*[count];
+    unsigned int* faces = new unsigned int[count];
+    TileArray* tiles = maps;
+    Vec3I* chunkpositions = positions;
+    GlobalJobSystem->parallelFor(count, [&](size_t j) {
+        size_t i = chunks[j];
+        vertarrays[j] = new DynamicArray<unsigned int>(tiles[i].size()*6*4*2);
+        indexarrays[j] = new DynamicArray<unsigned short>(tiles[i].size()*36);
+        _GenerateMesh(&tiles[i], chunkpositions[i], this, tileRegistry, greedyMeshing, vertarrays[j], indexarrays[j], &faces[j]);
+    });
+    for (size_t j=0; j<count; j++) {
+        SetLevelMesh(chunks[j],
+            vertarrays[j]->length()/2, vertarrays[j]->collapse(),
+            indexarrays[j]->length()/3, indexarrays[j]->collapse()
+        );
+        MapIntMeshes[chunks[j]]->faceCount = faces[j];
+        delete vertarrays[j];
+        delete indexarrays[j];
     }
+    delete [] vertarrays;
+    delete [] indexarrays;
+    delete [] faces;
 }
 #pragma endregion
 
@@ -567,33 +1577,71 @@ void MapData::UploadMap(size_t mapno) {
     }
     glBindVertexArray(mesh->vao);
     glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo[0]);
-    glBufferData(GL_ARRAY_BUFFER, mesh->vertexCount*sizeof(uint32_t), mesh->verts, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, mesh->vertexCount*2*sizeof(uint32_t), mesh->verts, GL_STATIC_DRAW);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->vbo[1]);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->triangleCount*3*sizeof(unsigned short), mesh->indices, GL_STATIC_DRAW);
-    glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, sizeof(uint32_t)*1, (void*)0);
+    glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, sizeof(uint32_t)*2, (void*)0);
     glEnableVertexAttribArray(0);
+    glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(uint32_t)*2, (void*)sizeof(uint32_t));
+    glEnableVertexAttribArray(1);
     glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 void MapData::UploadMap() {
+    double start = GetTime();
+    size_t bytes = 0;
     for (size_t i=0; i<MapIntMeshes.length(); i++) {
+        if (evicted(i)) {
+            continue;
+        }
         UploadMap(i);
+        lightmaps[i]->update();
+        bytes += MapIntMeshes[i]->vertexCount*2*sizeof(uint32_t) + MapIntMeshes[i]->triangleCount*3*sizeof(unsigned short);
+    }
+    TraceLog(LOG_INFO, "Uploaded %llu level meshes (%llu KiB) in %.2f ms.",
+        MapIntMeshes.length(), bytes/1024, (GetTime() - start)*1000.0);
+}
+/* Upload chunks from first onwards until budget milliseconds have passed, always at least one.
+   Returns the number of the next chunk to upload, chunkCount() once all of them are. */
+size_t MapData::UploadMaps(size_t first, double budget) {
+    double end = GetTime() + budget/1000.0;
+    size_t i = first;
+    while (i < MapIntMeshes.length()) {
+        if (!evicted(i)) {
+            UploadMap(i);
+            lightmaps[i]->update();
+        }
+        i++;
+        if (GetTime() >= end) {
+            break;
+        }
     }
+    return i;
 }
 #pragma endregion
 
 #pragma region ClearMap
-void MapData::ClearMap() {
-    for (size_t i=0; i<MapIntMeshes.length(); i++) {
-        MapIntMesh* mesh = MapIntMeshes[i];
-        delete mesh->indices;
-        delete mesh->verts;
-        mesh->vertexCount = 0;
-        mesh->indices = 0;
+// free a chunk mesh and its GL objects, leaving it empty
+static void _FreeMesh(MapIntMesh* mesh) {
+    delete [] mesh->indices;
+    delete [] mesh->verts;
+    mesh->indices = nullptr;
+    mesh->verts = nullptr;
+    mesh->vertexCount = mesh->triangleCount = mesh->faceCount = 0;
+    // meshes that were never uploaded have no GL objects (e.g. headless benchmarks)
+    if (mesh->vao != 0) {
         glDeleteVertexArrays(1, &mesh->vao);
         glDeleteBuffers(2, mesh->vbo);
-        delete mesh;
+    }
+    mesh->vao = 0;
+    mesh->vbo[0] = mesh->vbo[1] = 0;
+}
+
+void MapData::ClearMap() {
+    for (size_t i=0; i<MapIntMeshes.length(); i++) {
+        _FreeMesh(MapIntMeshes[i]);
+        delete MapIntMeshes[i];
     }
     for (size_t i=0; i<lightmaps.length(); i++) {
         delete lightmaps[i];
@@ -606,7 +1654,281 @@ void MapData::ClearMap() {
     maps.clear();
     positions.clear();
     lightList.clear();
+    spawnableSpaces.clear();
+    dirtyFlags.clear();
+    dirtyChunks.clear();
+    pendingEntities.clear();
+    chunkIndex.clear();
+    delete streamFile;
+    streamFile = nullptr;
+    streamEntries.clear();
+    streamChunks.clear();
+    chunkEntries.clear();
+    freeChunks.clear();
+    streamQueue.clear();
+    streamNext = 0;
+    streamScanned = false;
+    chunksResident = chunksStreamedIn = chunksEvicted = 0;
     hasLoadedLightmaps = false;
+    floodLit = false;
+}
+#pragma endregion
+
+#pragma region TakeLevel
+/* Replace the level with the one loaded into staged, leaving staged empty. Nothing is copied or re-meshed:
+   chunks staged already uploaded are drawn as they are, and entities it deferred are spawned now. */
+void MapData::TakeLevel(MapData& staged) {
+    ClearMap();
+    positions.swap(staged.positions);
+    maps.swap(staged.maps);
+    MapIntMeshes.swap(staged.MapIntMeshes);
+    lightmaps.swap(staged.lightmaps);
+    lightList.swap(staged.lightList);
+    dirtyFlags.swap(staged.dirtyFlags);
+    dirtyChunks.swap(staged.dirtyChunks);
+    spawnableSpaces.swap(staged.spawnableSpaces);
+    chunkIndex.swap(staged.chunkIndex);
+    std::swap(streamFile, staged.streamFile);
+    streamEntries.swap(staged.streamEntries);
+    streamChunks.swap(staged.streamChunks);
+    chunkEntries.swap(staged.chunkEntries);
+    freeChunks.swap(staged.freeChunks);
+    chunksResident = staged.chunksResident;
+    visibleChunks.clear();
+    chunkVisible.clear();
+    hasLoadedLightmaps = staged.hasLoadedLightmaps;
+    floodLit = staged.floodLit;
+    fogMin = staged.fogMin;
+    fogMax = staged.fogMax;
+    for (int i=0; i<4; i++) {
+        fogColor[i] = staged.fogColor[i];
+    }
+    lightLevel = staged.lightLevel;
+    meshFaceCount = staged.meshFaceCount;
+    meshVertexCount = staged.meshVertexCount;
+    meshTriangleCount = staged.meshTriangleCount;
+    for (size_t i=0; i<staged.pendingEntities.length(); i++) {
+        PendingEntity& e = staged.pendingEntities[i];
+        GlobalEntityRenderer->Add(e.type, e.pos, e.rot);
+    }
+    staged.ClearMap();
+}
+#pragma endregion
+
+#pragma region Streaming
+/* Keep streaming file, the v2 level just loaded from it, and load and evict its chunks from UpdateStreaming().
+   Returns false, leaving file to the caller, unless streaming is set and a v2 level was loaded. */
+bool MapData::SetStreamSource(MappedFile* file) {
+    if (!streaming || streamEntries.length() == 0 || streamFile != nullptr) {
+        return false;
+    }
+    streamFile = file;
+    streamQueue.clear();
+    streamNext = 0;
+    streamScanned = false;
+    chunksResident = maps.length() - freeChunks.length();
+    TraceLog(LOG_INFO, "Streaming %llu chunks, %llu within %.1f tiles loaded", streamEntries.length(), chunksResident,
+        streamRadius());
+    return true;
+}
+bool MapData::isStreaming() {
+    return streamFile != nullptr;
+}
+float MapData::streamRadius() {
+    return loadRadius > 0 ? loadRadius : renderDistance + LIGHT_RANGE;
+}
+size_t MapData::streamEntryCount() {
+    return streamEntries.length();
+}
+
+/* Unload chunk i, keeping its number for the next chunk streamed in. */
+void MapData::evictChunk(size_t i) {
+    Vec3I p = positions[i];
+    chunkIndex.remove(i, p.x, p.y, p.z, maps[i].width(), maps[i].height());
+    _FreeMesh(MapIntMeshes[i]);
+    delete lightmaps[i];
+    lightmaps[i] = nullptr;
+    maps[i].resize(0, 0);
+    if (dirtyFlags[i] != 0) {
+        for (size_t j=0; j<dirtyChunks.length(); j++) {
+            if (dirtyChunks[j] == i) {
+                dirtyChunks[j] = dirtyChunks[dirtyChunks.length()-1];
+                dirtyChunks.truncate(dirtyChunks.length()-1);
+                break;
+            }
+        }
+        dirtyFlags[i] = 0;
+    }
+    if (chunkEntries[i] != -1) {
+        streamChunks[chunkEntries[i]] = -1;
+        chunkEntries[i] = -1;
+    }
+    freeChunks.append(i);
+    chunksEvicted++;
+}
+
+/* Load count directory entries of the streamed level as resident chunks, in the same steps as LoadMap(): tiles are
+   decoded and meshed by the job system, and light maps are read from the file, flood filled or baked, whichever lit
+   the rest of the level. Resident chunks next to them are marked to be remeshed by UpdateDirty(), and baked ones
+   within LIGHT_RANGE are relit straight away. */
+void MapData::streamIn(const size_t* entries, size_t count, bool upload) {
+    size_t* chunks = new size_t[count];
+    pendingTiles.clear();
+    for (size_t j=0; j<count; j++) {
+        LevelChunkEntry& e = streamEntries[entries[j]];
+        size_t c;
+        if (freeChunks.length() > 0) {
+            c = freeChunks[freeChunks.length()-1];
+            freeChunks.truncate(freeChunks.length()-1);
+            maps[c].resize(e.width, e.height);
+            positions[c] = {e.x, e.y, e.z};
+            lightmaps[c] = new LightMap(e.width, e.height);
+        } else {
+            c = addChunk(e.x, e.y, e.z, e.width, e.height);
+        }
+        streamChunks[entries[j]] = c;
+        chunkEntries[c] = entries[j];
+        chunks[j] = c;
+        pendingTiles.append({c, e.tileOffset, (size_t)e.width*e.height, nullptr, 0, nullptr, 0, e.tileSize});
+    }
+    RBuffer data(streamFile->data(), streamFile->length());
+    DecodeMapTiles(data);
+    auto litInFile = [&](size_t c) {
+        return chunkEntries[c] != -1 && (streamEntries[chunkEntries[c]].flags & LEVEL_CHUNK_LIT) != 0;
+    };
+    bool bake = !floodLit && hasLoadedLightmaps;
+    DynamicArray<size_t> relight;
+    for (size_t j=0; j<count; j++) {
+        size_t c = chunks[j];
+        LevelChunkEntry& e = streamEntries[entries[j]];
+        chunkIndex.insert(c, e.x, e.y, e.z, e.width, e.height);
+        if (!floodLit && litInFile(c)) {
+            PendingLightMap p = {c, e.lightOffset, (size_t)e.width*e.height*3, e.lightSize};
+            if (_DecodeLightMap(data.pointer(e.lightOffset), p, lightmaps[c])) {
+                continue;
+            }
+            TraceLog(LOG_WARNING, "Ignoring malformed light map for chunk #%llu", c+1);
+        }
+        if (bake) {
+            relight.append(c);
+        }
+    }
+    size_t fresh = relight.length();
+    // resident chunks touching the new ones have wall faces against them, and baked light reaches LIGHT_RANGE tiles
+    for (size_t i=0; i<maps.length(); i++) {
+        if (evicted(i) || std::find(chunks, chunks + count, i) != chunks + count) {
+            continue;
+        }
+        Vec3I p = positions[i];
+        int gap = INT_MAX;
+        for (size_t j=0; j<count; j++) {
+            Vec3I q = positions[chunks[j]];
+            if (q.y != p.y) {
+                continue;
+            }
+            int dx = std::max(std::max(q.x - (p.x + maps[i].width()), p.x - (q.x + maps[chunks[j]].width())), 0);
+            int dz = std::max(std::max(q.z - (p.z + maps[i].height()), p.z - (q.z + maps[chunks[j]].height())), 0);
+            gap = std::min(gap, std::max(dx, dz));
+        }
+        if (gap == 0) {
+            markDirty(i, CHUNK_DIRTY_MESH);
+        }
+        if (bake && gap < LIGHT_RANGE && !litInFile(i)) {
+            relight.append(i);
+        }
+    }
+    if (floodLit) {
+        floodChunks(chunks, count);
+    } else if (relight.length() > 0) {
+        PlacedLight* lights = lightList;
+        size_t nlights = lightList.length();
+        size_t* relit = relight;
+        GlobalJobSystem->parallelFor(relight.length(), [&](size_t j) {
+            lightChunk(relit[j], lights, nlights);
+        });
+        for (size_t j=fresh; j<relight.length(); j++) {
+            markDirty(relight[j], CHUNK_DIRTY_LIGHT);
+        }
+    }
+    GenerateMeshes(chunks, count);
+    for (size_t j=0; upload && j<count; j++) {
+        UploadMap(chunks[j]);
+        lightmaps[chunks[j]]->update();
+    }
+    chunksStreamedIn += count;
+    delete [] chunks;
+}
+
+/* Evict the resident chunks further than streamRadius() plus streamHysteresis from camerapos, and queue the chunks
+   within streamRadius() that aren't resident, nearest first. */
+void MapData::scanStream(Vector3 camerapos) {
+    float radius = streamRadius();
+    size_t evictions = 0;
+    streamQueue.clear();
+    for (size_t i=0; i<streamEntries.length(); i++) {
+        float d = _EntryDistance(streamEntries[i], camerapos);
+        if (streamChunks[i] != -1 && d > radius + streamHysteresis) {
+            evictChunk(streamChunks[i]);
+            evictions++;
+        } else if (streamChunks[i] == -1 && d <= radius) {
+            streamQueue.append(i);
+        }
+    }
+    LevelChunkEntry* entries = streamEntries;
+    size_t* queue = streamQueue;
+    std::sort(queue, queue + streamQueue.length(), [&](size_t a, size_t b) {
+        float da = _EntryDistance(entries[a], camerapos), db = _EntryDistance(entries[b], camerapos);
+        return da != db ? da < db : a < b;
+    });
+    if (evictions > 0) {
+        // drop the lights and spawn points of evicted chunks, which are added again when they are streamed back in
+        size_t n = 0;
+        for (size_t i=0; i<lightList.length(); i++) {
+            PlacedLight l = lightList[i];
+            if (findChunk(l.x, l.y, l.z) != -1) {
+                lightList[n++] = l;
+            }
+        }
+        lightList.truncate(n);
+        n = 0;
+        for (size_t i=0; i<spawnableSpaces.length(); i++) {
+            Vector3 s = spawnableSpaces[i];
+            if (findChunk(floorf(s.x), floorf(s.y), floorf(s.z)) != -1) {
+                spawnableSpaces[n++] = s;
+            }
+        }
+        spawnableSpaces.truncate(n);
+        TraceLog(LOG_DEBUG, "Evicted %llu chunks", evictions);
+    }
+    streamNext = 0;
+    streamScanCenter = camerapos;
+    streamScanned = true;
+}
+
+/* Stream chunks in and out around camerapos. Call once per frame. The level is rescanned once the camera has moved
+   a tile, then queued chunks are streamed in STREAM_BATCH_SIZE at a time until budget milliseconds have passed,
+   always at least one batch. Without upload only the CPU side is updated. Returns the number of chunks streamed in. */
+size_t MapData::UpdateStreaming(Vector3 camerapos, double budget, bool upload) {
+    if (streamFile == nullptr) {
+        return 0;
+    }
+    float dx = camerapos.x - streamScanCenter.x, dz = camerapos.z - streamScanCenter.z;
+    if (!streamScanned || dx*dx + dz*dz >= 1.0f) {
+        scanStream(camerapos);
+    }
+    double end = GetTime() + budget/1000.0;
+    size_t loaded = 0;
+    while (streamNext < streamQueue.length()) {
+        size_t n = std::min((size_t)STREAM_BATCH_SIZE, streamQueue.length() - streamNext);
+        streamIn((size_t*)streamQueue + streamNext, n, upload);
+        streamNext += n;
+        loaded += n;
+        if (GetTime() >= end) {
+            break;
+        }
+    }
+    chunksResident = maps.length() - freeChunks.length();
+    return loaded;
 }
 #pragma endregion
 
@@ -627,16 +1949,124 @@ unsigned short MapData::get(Vector3 pos) {
     return get(floorf(pos.x), floorf(pos.y), floorf(pos.z));
 }
 unsigned short MapData::get(int x, int y, int z) {
+    int i = findChunk(x, y, z);
+    if (i == -1) {
+        return 0;
+    }
+    Vec3I p = positions[i];
+    return maps[i][{x-p.x, z-p.z}];
+}
+#pragma endregion
+
+#pragma region setTile()
+bool MapData::setTile(Vector3 pos, unsigned short tid) {
+    return setTile(floorf(pos.x), floorf(pos.y), floorf(pos.z), tid);
+}
+/* Change a tile. The mesh of its chunk, and of any chunk bordering it, is rebuilt by UpdateDirty().
+   With flood lighting the light around the tile is updated straight away. */
+bool MapData::setTile(int x, int y, int z, unsigned short tid) {
+    int i = findChunk(x, y, z);
+    if (i == -1) {
+        return false;
+    }
+    Vec3I p = positions[i];
+    unsigned short old = maps[i][{x-p.x, z-p.z}];
+    maps[i][{x-p.x, z-p.z}] = tid;
+    markTileDirty(x, y, z, CHUNK_DIRTY_MESH);
+    if (floodLighting && old != tid) {
+        UpdateFloodLight(x, y, z, old);
+    }
+    return true;
+}
+#pragma endregion
+
+#pragma region Dirty Chunks
+void MapData::markDirty(size_t chunk, unsigned char flags) {
+    if (chunk >= maps.length()) {
+        return;
+    }
+    if (dirtyFlags[chunk] == 0) {
+        dirtyChunks.append(chunk);
+    }
+    dirtyFlags[chunk] |= flags;
+}
+void MapData::markTileDirty(int x, int y, int z, unsigned char flags) {
+    int i = findChunk(x, y, z);
+    if (i == -1) {
+        return;
+    }
+    markDirty(i, flags);
+    if (flags & CHUNK_DIRTY_MESH) {
+        // wall faces of neighbouring tiles are culled against this one
+        const int offsets[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+        for (int j=0; j<4; j++) {
+            int n = findChunk(x+offsets[j][0], y, z+offsets[j][1]);
+            if (n != -1 && n != i) {
+                markDirty(n, CHUNK_DIRTY_MESH);
+            }
+        }
+    }
+}
+/* Remesh and reupload dirty chunks, and reupload dirty light maps. Call once per frame.
+   Without upload only the CPU side is updated. Returns the number of chunks updated. */
+size_t MapData::UpdateDirty(bool upload) {
+    size_t count = dirtyChunks.length();
+    if (count == 0) {
+        return 0;
+    }
+    size_t* meshchunks = new size_t[count];
+    size_t nmesh = 0;
+    for (size_t j=0; j<count; j++) {
+        size_t i = dirtyChunks[j];
+        if (dirtyFlags[i] & CHUNK_DIRTY_MESH) {
+            meshchunks[nmesh++] = i;
+        }
+    }
+    GenerateMeshes(meshchunks, nmesh);
+    for (size_t j=0; upload && j<nmesh; j++) {
+        UploadMap(meshchunks[j]);
+    }
+    for (size_t j=0; j<count; j++) {
+        size_t i = dirtyChunks[j];
+        if (upload && (dirtyFlags[i] & CHUNK_DIRTY_LIGHT)) {
+            lightmaps[i]->update();
+        }
+        dirtyFlags[i] = 0;
+    }
+    dirtyChunks.clear();
+    delete [] meshchunks;
+    return count;
+}
+#pragma endregion
+
+#pragma region findChunk()
+int MapData::findChunk(int x, int y, int z) {
+    return chunkIndex.find(x, y, z);
+}
+// reference implementation of findChunk, kept for benchmarking the chunk index against
+int MapData::findChunkLinear(int x, int y, int z) {
     for (size_t i=0; i<maps.length(); i++) {
         Vec3I p = positions[i];
         if (x >= p.x && y == p.y && z >= p.z) {
             TileArray& map = maps[i];
             if (x-p.x < map.width() && z-p.z < map.height()) {
-                return map[{x-p.x, z-p.z}];
+                return i;
             }
         }
     }
-    return 0;
+    return -1;
+}
+size_t MapData::chunkCount() {
+    return maps.length();
+}
+Vec3I MapData::chunkPosition(size_t i) {
+    return positions[i];
+}
+TileArray* MapData::chunk(size_t i) {
+    return &maps[i];
+}
+MapIntMesh* MapData::chunkMesh(size_t i) {
+    return MapIntMeshes[i];
 }
 #pragma endregion
 
@@ -655,13 +2085,11 @@ void MapData::setLight(Vector3 p1, Vector3 p2, float v, unsigned char r, unsigne
                 Color* ptr = getLight(x, y, z);
                 if (ptr != nullptr) {
                     *ptr = l;
+                    markTileDirty(x, y, z, CHUNK_DIRTY_LIGHT);
                 }
             }
         }
     }
-    // regen and reupload the whole map for convenience.
-    GenerateMesh();
-    UploadMap();
 }
 void MapData::setLight(Vector3 pos, float v, unsigned char r, unsigned char g, unsigned char b) {
     setLight(floorf(pos.x), floorf(pos.y), floorf(pos.z), v, r, g, b);
@@ -671,13 +2099,8 @@ void MapData::setLight(int x, int y, int z, float v, unsigned char r, unsigned c
     if (l != nullptr) {
         // set the lightmap value
         *l = {r, g, b, 255};
-        // regen and reupload the associated map mesh
-        // size_t i = findLight(x, y, z);
-        // if (i != -1) {
-        //     GenerateMesh(i);
-        //     UploadMap(i);
-        //     return;
-        // }
+        markTileDirty(x, y, z, CHUNK_DIRTY_LIGHT);
+        return;
     }
     TraceLog(LOG_WARNING, "Failed to set light at %d,%d,%d", x, y, z);
 }
@@ -685,19 +2108,15 @@ void MapData::setLight(int x, int y, int z, float v, unsigned char r, unsigned c
 
 #pragma region getLight()
 Color* MapData::getLight(Vector3 pos) {
-    return getLight(pos.x, pos.y, pos.z);
+    return getLight(floorf(pos.x), floorf(pos.y), floorf(pos.z));
 }
 Color* MapData::getLight(int x, int y, int z) {
-    for (size_t i=0; i<lightmaps.length(); i++) {
-        Vec3I p = positions[i];
-        if (x >= p.x && y == p.y && z >= p.z) {
-            LightMap* map = lightmaps[i];
-            if (x-p.x < map->width() && z-p.z < map->height()) {
-                return map->get(x-p.x, z-p.z);
-            }
-        }
+    int i = findChunk(x, y, z);
+    if (i == -1) {
+        return nullptr;
     }
-    return nullptr;
+    Vec3I p = positions[i];
+    return lightmaps[i]->get(x-p.x, z-p.z);
 }
 LightMap* MapData::getLightMap(Vector3 pos) {
     size_t i = MapData::findLight(pos);
@@ -714,35 +2133,13 @@ size_t MapData::findLight(Vector3 pos) {
 }
 
 size_t MapData::findLight(int x, int y, int z) {
-    for (size_t i=0; i<lightmaps.length(); i++) {
-        Vec3I p = positions[i];
-        if (x >= p.x && y == p.y && z >= p.z) {
-            LightMap* map = lightmaps[i];
-            if (x-p.x < map->width() && z-p.z < map->height()) {
-                return i;
-            }
-        }
-    }
-    return -1;
+    return findChunk(x, y, z);
 }
 #pragma endregion
 
 #pragma region addLight()
 void MapData::addLight(int x, int y, int z, float v, unsigned char r, unsigned char g, unsigned char b) {
-    Color* c = getLight(x, y, z);
-    if (c != nullptr) {
-        unsigned short rs = r;
-        unsigned short gs = g;
-        unsigned short bs = b;
-        rs = (rs * c->r) >> 8;
-        gs = (gs * c->g) >> 8;
-        bs = (bs * c->b) >> 8;
-        if (rs > 255) rs = 255;
-        if (gs > 255) gs = 255;
-        if (bs > 255) bs = 255;
-        r = rs; g = gs; b = bs;
-        *c = {r, g, b, 255};
-    }
+    _AddLight(getLight(x, y, z), v, r, g, b);
 }
 #pragma endregion
 
@@ -760,55 +2157,152 @@ bool MapData::ShouldRenderMap(Vector3 pos, size_t mapno) {
 }
 #pragma endregion
 
+#pragma region CullChunks()
+/* Flood the camera's level outwards from the camera's tile through non-solid tiles, only entering
+   tiles that are in the frustum, and flag every chunk reached (open tiles and the walls bounding them).
+   A tile seen from the camera is always reached, since the line of sight to it crosses only open
+   tiles inside the frustum. Tiles further than renderDistance from the camera are treated as hidden.
+   Returns false if the camera isn't in an open tile, in which case nothing is flagged. */
+bool MapData::occlusionFlood(Vector3 camerapos, const Frustum& frustum) {
+    int cx = floorf(camerapos.x), cy = floorf(camerapos.y), cz = floorf(camerapos.z);
+    ChunkCursor cursor;
+    MapTile* start = tileRegistry->of(cursorGet(cursor, cx, cy, cz));
+    if (cursor.chunk == -1 || (start != nullptr && start->isSolid)) {
+        return false;
+    }
+    // a line of sight that leaves the bounds of the level's chunks can't come back in, so don't flood outside them
+    int minx = INT_MAX, minz = INT_MAX, maxx = INT_MIN, maxz = INT_MIN;
+    for (size_t i=0; i<maps.length(); i++) {
+        if (positions[i].y == cy && !evicted(i)) {
+            minx = std::min(minx, positions[i].x);
+            minz = std::min(minz, positions[i].z);
+            maxx = std::max(maxx, positions[i].x + maps[i].width() - 1);
+            maxz = std::max(maxz, positions[i].z + maps[i].height() - 1);
+        }
+    }
+    int r = renderDistance > 1 ? (int)renderDistance : 1;
+    int size = 2*r + 1;
+    occlusionGrid.setLength((size_t)size*size);
+    memset((unsigned char*)occlusionGrid, 0, (size_t)size*size);
+    chunkReached[cursor.chunk] = 1;
+    occlusionQueue.clear();
+    occlusionQueue.append(r*size + r);
+    occlusionGrid[r*size + r] = 1;
+    for (size_t q=0; q<occlusionQueue.length(); q++) {
+        int gx = occlusionQueue[q] % size, gz = occlusionQueue[q] / size;
+        for (int j=0; j<4; j++) {
+            int nx = gx + floodneighbours[j][0], nz = gz + floodneighbours[j][1];
+            if (nx < 0 || nz < 0 || nx >= size || nz >= size || occlusionGrid[nz*size + nx]) {
+                continue;
+            }
+            occlusionGrid[nz*size + nx] = 1;
+            int x = cx + nx - r, z = cz + nz - r;
+            if (x < minx || z < minz || x > maxx || z > maxz) {
+                continue;
+            }
+            // the camera's neighbours are skipped by the test, as the near plane is slightly in front of the camera
+            bool nearby = abs(x - cx) <= 1 && abs(z - cz) <= 1;
+            if (!nearby && !frustum.containsBox({(float)x, (float)cy, (float)z}, {(float)x + 1, (float)cy + LEVEL_HEIGHT, (float)z + 1})) {
+                continue;
+            }
+            // gaps between chunks are empty space that can be seen through
+            MapTile* tile = tileRegistry->of(cursorGet(cursor, x, cy, z));
+            if (cursor.chunk != -1) {
+                chunkReached[cursor.chunk] = 1;
+            }
+            if (tile == nullptr || !tile->isSolid) {
+                occlusionQueue.append(nz*size + nx);
+            }
+        }
+    }
+    return true;
+}
+
+/* Work out which chunks to draw from camerapos with the view mvp. Chunks are rejected by distance,
+   then by their bounding box against the frustum, and then, if occlusionCulling is set, chunks on the
+   camera's level that can't be seen past walls are rejected too. Returns the number of chunks to draw. */
+size_t MapData::CullChunks(Vector3 camerapos, Matrix mvp) {
+    Frustum frustum(mvp);
+    size_t count = maps.length();
+    chunkReached.setLength(count);
+    chunkVisible.setLength(count);
+    for (size_t i=0; i<count; i++) {
+        chunkReached[i] = 0;
+        chunkVisible[i] = 0;
+    }
+    bool occlusion = occlusionCulling && count > 0 && occlusionFlood(camerapos, frustum);
+    int cy = floorf(camerapos.y);
+    visibleChunks.clear();
+    chunksCulledDistance = chunksCulledFrustum = chunksCulledOcclusion = 0;
+    for (size_t i=0; i<count; i++) {
+        Vec3I p = positions[i];
+        if (evicted(i)) {
+            continue;
+        } else if (!ShouldRenderMap(camerapos, i)) {
+            chunksCulledDistance++;
+        } else if (!frustum.containsBox({(float)p.x, (float)p.y, (float)p.z}, {(float)p.x + maps[i].width(), (float)p.y + LEVEL_HEIGHT, (float)p.z + maps[i].height()})) {
+            chunksCulledFrustum++;
+        } else if (occlusion && p.y == cy && !chunkReached[i]) {
+            chunksCulledOcclusion++;
+        } else {
+            visibleChunks.append(i);
+            chunkVisible[i] = 1;
+        }
+    }
+    chunksDrawn = visibleChunks.length();
+    return chunksDrawn;
+}
+
+/* Return whether chunk i was kept by the last CullChunks(). */
+bool MapData::isChunkVisible(size_t i) {
+    return i < chunkVisible.length() && chunkVisible[i];
+}
+#pragma endregion
 
 #pragma region Draw()
 void MapData::Draw(Vector3 camerapos, Matrix* mat, float renderwidth) {
-    unsigned int loc;
-    glUseProgram(mainShader.id);
+    ShaderUniforms& u = mainUniforms;
+    mainShader.use();
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, atlas.id);
-    loc = GetShaderLocation(mainShader, "texture0");
-    glUniform1i(loc, 0);
+    mainShader.set(u.texture0, 0);
+    mainShader.set(u.texture1, 1);
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
-    // loc = GetShaderLocation(mainShader, "cameraPosition");
-    // glUniform3f(loc, camerapos.x, camerapos.y, camerapos.z);
+    Matrix matModelViewProjection;
     if (mat==nullptr) {
         Matrix matView = rlGetMatrixModelview();
         Matrix matProjection = rlGetMatrixProjection();
         Matrix matModel = rlGetMatrixTransform();
         Matrix matModelView = MatrixMultiply(matModel, matView);
-        Matrix matModelViewProjection = MatrixMultiply(matModelView, matProjection);
-        rlSetUniformMatrix(mainShader.locs[SHADER_LOC_MATRIX_MVP], matModelViewProjection);
+        matModelViewProjection = MatrixMultiply(matModelView, matProjection);
     } else {
-        rlSetUniformMatrix(mainShader.locs[SHADER_LOC_MATRIX_MVP], *mat);
-    }
-    loc = GetShaderLocation(mainShader, "renderwidth");
-    glUniform1f(loc, renderwidth);
-    loc = GetShaderLocation(mainShader, "FogMin");
-    glUniform1f(loc, fogMin);
-    loc = GetShaderLocation(mainShader, "FogMax");
-    glUniform1f(loc, fogMax);
-    loc = GetShaderLocation(mainShader, "FogColor");
-    glUniform4f(loc, fogColor[0], fogColor[1], fogColor[2], fogColor[3]);
-    loc = GetShaderLocation(mainShader, "LightLevel");
-    glUniform1f(loc, lightLevel);
-    loc = GetShaderLocation(mainShader, "drawPosition");
-    unsigned int lmaploc = GetShaderLocation(mainShader, "texture1");
-    for (size_t i=0; i<MapIntMeshes.length(); i++) {
-        if (ShouldRenderMap(camerapos, i)) {
-            MapIntMesh* imesh = MapIntMeshes[i];
-            Vec3I pos = positions[i];
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, lightmaps[i]->getId());
-            glUniform1i(lmaploc, 1);
-            glUniform3f(loc, pos.x, pos.y, pos.z);
-            glBindVertexArray(imesh->vao);
-            glDrawElements(GL_TRIANGLES, imesh->triangleCount*3, GL_UNSIGNED_SHORT, 0);
+        matModelViewProjection = *mat;
+    }
+    mainShader.set(u.mvp, matModelViewProjection);
+    CullChunks(camerapos, matModelViewProjection);
+    mainShader.set(u.renderwidth, renderwidth);
+    mainShader.set(u.fogMin, fogMin);
+    mainShader.set(u.fogMax, fogMax);
+    mainShader.set(u.fogColor, fogColor[0], fogColor[1], fogColor[2], fogColor[3]);
+    mainShader.set(u.lightLevel, lightLevel);
+    glActiveTexture(GL_TEXTURE1);
+    for (size_t j=0; j<visibleChunks.length(); j++) {
+        size_t i = visibleChunks[j];
+        MapIntMesh* imesh = MapIntMeshes[i];
+        if (imesh->vao == 0) {
+            continue; // not uploaded yet
         }
+        Vec3I pos = positions[i];
+        glBindTexture(GL_TEXTURE_2D, lightmaps[i]->getId());
+        mainShader.set(u.drawPosition, (float)pos.x, (float)pos.y, (float)pos.z);
+        glBindVertexArray(imesh->vao);
+        glDrawElements(GL_TRIANGLES, imesh->triangleCount*3, GL_UNSIGNED_SHORT, 0);
     }
     glBindVertexArray(0);
     glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
 }
 #pragma endregion
 
@@ -5,12 +5,28 @@
 #include "TileRegistry.hpp"
 #include "TextureRegistry.hpp"
 #include "Buffer.hpp"
+#include "ChunkIndex.hpp"
+#include "Frustum.hpp"
+#include "LevelFormat.hpp"
+#include "ShaderLoader.hpp"
 #include "Vec3.hpp"
 
 #include "raylib.h"
 #include "rlgl.h"
 #include "external/glad.h"
 
+// rays traversed side by side by MapData::RayCastLanes: eight in AVX2 lanes (MSVC builds with /arch:AVX2),
+// otherwise four in SSE2 lanes
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MAPDATA_SIMD_RAYS
+#define RAY_LANES 8
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MAPDATA_SIMD_RAYS
+#define RAY_LANES 4
+#endif
+
 #pragma region Defines
 #define TILE_MAP_MAGIC_NUMBER_STR "TILE"
 #define LIGHT_MAP_MAGIC_NUMBER_STR "LMAP"
@@ -26,6 +42,8 @@
 #define ENTITY_MAGIC_NUMBER (*(uint32_t*)ENTITY_MAGIC_NUMBER_STR)
 
 #define LIGHT_RANGE 6
+// light lost per tile by flood lighting, so the brightest lights reach about LIGHT_RANGE tiles
+#define LIGHT_FLOOD_STEP (256 / (LIGHT_RANGE + 2))
 #define PLAYER_HEIGHT 0.4f
 #define PLAYER_JUMP 0.15f
 #define LEVEL_HEIGHT 1.0f
@@ -33,13 +51,36 @@
 #define GRAVITY -9.81
 #define MAX_FALL_SPEED 10.0
 
+#define HIT_FACE_NONE 0
+#define HIT_FACE_POS_X 1
+#define HIT_FACE_NEG_X 2
+#define HIT_FACE_POS_Y 3
+#define HIT_FACE_NEG_Y 4
+#define HIT_FACE_POS_Z 5
+#define HIT_FACE_NEG_Z 6
+
+// rays per job in MapData::RayCastBatch
+#define RAY_BATCH_GROUP 256
+
+#define CHUNK_DIRTY_MESH 1
+#define CHUNK_DIRTY_LIGHT 2
+
+// chunks streamed in together by MapData::UpdateStreaming, decoded, lit and meshed by the job system as one batch
+#define STREAM_BATCH_SIZE 16
+// tiles a resident chunk may be past the streaming radius before it is evicted
+#define STREAM_HYSTERESIS 8.0f
+
 #pragma endregion
 
 #pragma region MapIntMesh
+/* Chunk mesh. Each vertex is two packed words:
+   vertexInfo1 = vertex number (2 bits) | Y (1 bit) | unused (1 bit) | X (8 bits) | Z (8 bits) | texture ID (12 bits)
+   vertexInfo2 = texture V repeat (8 bits) << 8 | texture U repeat (8 bits) */
 class MapIntMesh {
     public:
     unsigned int vertexCount = 0;
     unsigned int triangleCount = 0;
+    unsigned int faceCount = 0;
     unsigned int vbo[2] = {0, 0};
     unsigned int vao = 0;
     unsigned int* verts = nullptr;
@@ -80,14 +121,31 @@ class LightMap {
     LightMap(int width, int height) {
         _img = GenImageColor(width, height, WHITE);
     }
+    LightMap(const LightMap&) = delete;
+    LightMap& operator=(const LightMap&) = delete;
+    ~LightMap() {
+        // never uploaded without a window, e.g. in headless benchmarks
+        if (_tex.id != 0) {
+            UnloadTexture(_tex);
+        }
+        UnloadImage(_img);
+    }
     void upload() {
         _tex = LoadTextureFromImage(_img);
     }
+    /* Upload the image, or update the existing texture if it was already uploaded. */
+    void update() {
+        if (_tex.id == 0) {
+            upload();
+        } else {
+            UpdateTexture(_tex, _img.data);
+        }
+    }
     size_t width() {
-        return _tex.width;
+        return _img.width;
     }
     size_t height() {
-        return _tex.height;
+        return _img.height;
     }
     Color* get(int x, int y) {
         Color* colors = (Color*)_img.data;
@@ -104,10 +162,77 @@ class LightMap {
 };
 #pragma endregion
 
+#pragma region ShaderUniforms
+// uniform slots shared by the level and sprite shaders, -1 where a shader doesn't use one
+struct ShaderUniforms {
+    int mvp, texture0, texture1, renderwidth, fogMin, fogMax, fogColor, lightLevel;
+    int drawPosition;
+    int model, tno, scale;
+    void resolve(ShaderProgram& shader) {
+        mvp = shader.uniform("mvp");
+        texture0 = shader.uniform("texture0");
+        texture1 = shader.uniform("texture1");
+        renderwidth = shader.uniform("renderwidth");
+        fogMin = shader.uniform("FogMin");
+        fogMax = shader.uniform("FogMax");
+        fogColor = shader.uniform("FogColor");
+        lightLevel = shader.uniform("LightLevel");
+        drawPosition = shader.uniform("drawPosition");
+        model = shader.uniform("model");
+        tno = shader.uniform("tno");
+        scale = shader.uniform("scale");
+    }
+};
+#pragma endregion
+
+#pragma region PendingTiles
+// a TILE section that has been scanned but not yet decoded
+struct PendingTiles {
+    size_t chunk;
+    size_t offset;
+    size_t count;
+    PlacedLight* lights;
+    size_t nlights;
+    Vector3* spawns;
+    size_t nspawns;
+    size_t packed; // bytes of RLE data at offset, 0 if the tiles are stored as they are
+};
+#pragma endregion
+
+#pragma region PendingLightMap
+// an LMAP section that has been scanned but not yet decoded
+struct PendingLightMap {
+    size_t chunk;
+    size_t offset;
+    size_t size;
+    size_t packed; // bytes of RLE data at offset, 0 if the colours are stored as they are
+};
+#pragma endregion
+
+#pragma region PendingEntity
+// an ENTT section read while entities are deferred, spawned by MapData::TakeLevel
+struct PendingEntity {
+    unsigned short type;
+    Vector3 pos;
+    float rot;
+};
+#pragma endregion
+
+#pragma region FloodNode
+// a tile waiting to pass on light level v during flood lighting
+struct FloodNode {
+    int x, y, z;
+    unsigned char v;
+};
+#pragma endregion
+
 #pragma region HitInfo
+/* Result of MapData::RayCast. distance is INFINITY if nothing was hit.
+   face is the HIT_FACE_* normal of the surface that was hit. */
 struct HitInfo {
     float distance;
     unsigned short tileid;
+    unsigned char face;
     union {
         unsigned char flags;
         struct {
@@ -119,46 +244,148 @@ struct HitInfo {
 };
 #pragma endregion
 
+#pragma region ChunkCursor
+// last chunk visited by a walk through the map
+struct ChunkCursor {
+    int chunk = -1;
+    Vec3I pos = {0, 0, 0};
+    TileArray* map = nullptr;
+};
+#pragma endregion
+
 #pragma region MapData
+class MappedFile;
+
 class MapData {
     DynamicArray<Vec3I> positions;
     DynamicArray<TileArray> maps;
     DynamicArray<MapIntMesh*> MapIntMeshes;
     DynamicArray<LightMap*> lightmaps;
     DynamicArray<PlacedLight> lightList;
+    DynamicArray<PendingTiles> pendingTiles;
+    DynamicArray<PendingLightMap> pendingLightMaps;
+    DynamicArray<PendingEntity> pendingEntities;
+    DynamicArray<unsigned char> dirtyFlags;
+    DynamicArray<size_t> dirtyChunks;
+    DynamicArray<FloodNode> floodQueue;
+    DynamicArray<FloodNode> floodRemoveQueue;
+    DynamicArray<FloodNode> floodBlockers;
+    DynamicArray<size_t> visibleChunks;
+    DynamicArray<unsigned char> chunkVisible;
+    DynamicArray<unsigned char> chunkReached;
+    DynamicArray<unsigned char> occlusionGrid;
+    DynamicArray<int> occlusionQueue;
+    ChunkIndex chunkIndex;
+    // streaming state, see UpdateStreaming(); streamFile is only set while a v2 level is streamed from it
+    MappedFile* streamFile = nullptr;
+    DynamicArray<LevelChunkEntry> streamEntries;
+    DynamicArray<int> streamChunks; // chunk holding each directory entry, -1 while it isn't resident
+    DynamicArray<int> chunkEntries; // directory entry of each chunk, -1 if it isn't streamed
+    DynamicArray<size_t> freeChunks; // evicted chunks, reused before new ones are added
+    DynamicArray<size_t> streamQueue; // entries to stream in, nearest first
+    size_t streamNext = 0;
+    Vector3 streamScanCenter = {0, 0, 0};
+    bool streamScanned = false;
     MapTileRegistry* tileRegistry = nullptr;
     TextureRegistry* textureRegistry = nullptr;
     unsigned int depthTextureId;
     bool hasLoadedLightmaps = false;
+    bool floodLit = false;
+    inline unsigned short cursorGet(ChunkCursor& c, int x, int y, int z);
+    bool lightVisible(ChunkCursor& cursor, int y, int x1, int z1, int x2, int z2);
+    Color* cursorLight(ChunkCursor& c, int x, int y, int z, MapTile*& tile);
+    void floodPropagate(char c);
+    void floodRemove(char c);
+    bool occlusionFlood(Vector3 camerapos, const Frustum& frustum);
+    size_t addChunk(int x, int y, int z, int w, int h);
+    bool evicted(size_t i) {
+        return lightmaps[i] == nullptr;
+    }
+    size_t lightChunk(size_t i, PlacedLight* lights, size_t nlights);
+    void floodChunks(const size_t* chunks, size_t count);
+    void scanStream(Vector3 camerapos);
+    void streamIn(const size_t* entries, size_t count, bool upload);
+    void evictChunk(size_t i);
+#ifdef MAPDATA_SIMD_RAYS
+    void RayCastLanes(const Vector3* origins, const Vector3* dirs, const float* maxdists, HitInfo* hits, size_t count);
+#endif
     public:
     DynamicArray<Vector3> spawnableSpaces;
-    Shader mainShader, spriteShader;
+    ShaderProgram mainShader, spriteShader;
+    ShaderUniforms mainUniforms, spriteUniforms;
     Texture2D atlas = {0};
     float fogMin, fogMax, fogColor[4], lightLevel, renderDistance;
+    bool greedyMeshing = true;
+    bool floodLighting = false;
+    bool occlusionCulling = true;
+    // only chunks of v2 levels within loadRadius tiles of loadCenter are loaded, or every chunk if it is 0
+    float loadRadius = 0;
+    Vector3 loadCenter = {0, 0, 0};
+    // queue ENTT sections instead of adding them to GlobalEntityRenderer, for levels loaded off the main thread
+    bool deferEntities = false;
+    /* keep only the chunks of v2 levels near the camera in memory, see UpdateStreaming(). They are kept within
+       loadRadius tiles, or within renderDistance plus LIGHT_RANGE if it is 0, and evicted streamHysteresis tiles
+       further out */
+    bool streaming = false;
+    float streamHysteresis = STREAM_HYSTERESIS;
+    // chunk counts from streaming so far
+    size_t chunksResident = 0, chunksStreamedIn = 0, chunksEvicted = 0;
+    // chunk counts from the last CullChunks()
+    size_t chunksDrawn = 0, chunksCulledDistance = 0, chunksCulledFrustum = 0, chunksCulledOcclusion = 0;
+    size_t meshFaceCount = 0, meshVertexCount = 0, meshTriangleCount = 0;
     void BuildAtlas();
     void InitMesher(unsigned int depthTextureId);
     bool LoadMap(RBuffer& data);
     bool LoadMapChunk(RBuffer& data);
+    bool LoadMapV2(RBuffer& data, size_t first);
     bool LoadMapWalls(RBuffer& data);
-    bool LoadMapTiles(RBuffer& data);
-    bool LoadLightMap(RBuffer& data);
+    bool LoadMapTiles(RBuffer& data, unsigned int size);
+    void DecodeMapTiles(RBuffer& data);
+    bool LoadLightMap(RBuffer& data, unsigned int size);
+    void DecodeLightMaps(RBuffer& data, size_t first);
     bool HasLoadedLightmaps();
     void SaveMap(const char* fname);
     void SaveMap(std::ostream& fd);
     void SaveMapTile(std::ostream& fd, TileArray* arr, Vec3I position);
     void SaveLightMap(std::ostream& fd, size_t i, LightMap* map=nullptr);
+    bool SaveLightMaps(const char* fname);
+    bool SaveLightMapsV2(RBuffer& level, std::ostream& out);
+    bool SaveMapV2(std::ostream& fd, const std::string& sections, bool lightmaps);
     Vector3 RayCast(Vector3 pos, Vector3 dir, HitInfo& hit, size_t max_steps=100);
+    void RayCast(Vector3 pos, Vector3 dir, float maxdist, HitInfo& hit);
+    void RayCastBatch(const Vector3* origins, const Vector3* dirs, const float* maxdists, HitInfo* hits, size_t count);
     void SetLevelMesh(size_t i, unsigned int vertCount, unsigned int* verts, unsigned int triangleCount, unsigned short* indices);
     void GenerateMesh(size_t i);
     void GenerateMesh();
+    void GenerateMeshes(const size_t* chunks, size_t count);
     void BuildLighting();
+    void BuildFloodLighting();
+    void UpdateFloodLight(int x, int y, int z, unsigned short oldtid);
     void UploadMap(size_t mapno);
     void UploadMap();
+    size_t UploadMaps(size_t first, double budget);
     void ClearMap();
+    void TakeLevel(MapData& staged);
+    bool SetStreamSource(MappedFile* file);
+    bool isStreaming();
+    float streamRadius();
+    size_t streamEntryCount();
+    size_t UpdateStreaming(Vector3 camerapos, double budget, bool upload=true);
     void SetTileRegistry(MapTileRegistry* reg);
     void SetTextureRegistry(TextureRegistry* reg);
     unsigned short get(Vector3 pos);
     unsigned short get(int x, int y, int z);
+    bool setTile(Vector3 pos, unsigned short tid);
+    bool setTile(int x, int y, int z, unsigned short tid);
+    void markDirty(size_t chunk, unsigned char flags);
+    void markTileDirty(int x, int y, int z, unsigned char flags);
+    size_t UpdateDirty(bool upload=true);
+    int findChunk(int x, int y, int z);
+    int findChunkLinear(int x, int y, int z);
+    size_t chunkCount();
+    Vec3I chunkPosition(size_t i);
+    TileArray* chunk(size_t i);
+    MapIntMesh* chunkMesh(size_t i);
     void setLight(Vector3 p1, Vector3 p2, float v, unsigned char r, unsigned char g, unsigned char b);
     void setLight(Vector3 pos, float v, unsigned char r, unsigned char g, unsigned char b);
     void setLight(int x, int y, int z, float v, unsigned char r, unsigned char g, unsigned char b);
@@ -169,6 +396,8 @@ class MapData {
     Color* getLight(int x, int y, int z);
     void addLight(int x, int y, int z, float v, unsigned char r, unsigned char g, unsigned char b);
     bool ShouldRenderMap(Vector3 pos, size_t mapno);
+    size_t CullChunks(Vector3 camerapos, Matrix mvp);
+    bool isChunkVisible(size_t i);
     void Draw(Vector3 camerapos, Matrix* mat=nullptr, float renderwidth=1920);
     void SetFog(float fogMin, float fogMax, float* fogColor);
     Vector3 MoveTo(Vector3 position, Vector3 move, bool noclip=false);
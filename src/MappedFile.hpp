@@ -0,0 +1,34 @@
+/* Read-only memory mapping of a whole file.
+ * The mapping lives until close() or destruction, so pointers into data() must not outlive the MappedFile.
+ */
+#pragma once
+
+#include <cstddef>
+
+class MappedFile {
+    const unsigned char* _data = nullptr;
+    size_t _len = 0;
+#ifdef _WIN32
+    void* _file = nullptr;
+    void* _mapping = nullptr;
+#endif
+    public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() {
+        close();
+    }
+    /* Map fname, replacing any previous mapping. Returns false if the file is missing, empty or can't be mapped. */
+    bool open(const char* fname);
+    void close();
+    bool isOpen() {
+        return _data != nullptr;
+    }
+    const unsigned char* data() {
+        return _data;
+    }
+    size_t length() {
+        return _len;
+    }
+};
@@ -0,0 +1,136 @@
+/* On-disk cache of compiled script bytecode, stored next to the assembly source as "<source>.bin".
+ * Layout, little endian:
+ *   header      magic "BRSC", u16 version, u16 reference count, u32 code length,
+ *               u64 source length, u64 FNV-1a hash of the source
+ *   references  per #texture:/#tile:/#entity: reference: u8 kind, u16 registry ID, u16 name length, name
+ *   code        optimized bytecode
+ * A cache is fresh when the source hash matches, every reference still resolves to the same registry ID and
+ * the bytecode decodes. Fresh bytecode runs straight from the mapped file.
+ */
+#pragma once
+
+#include "MappedFile.hpp"
+#include "ScriptEngine/ScriptAssemblyCompiler.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#define SCRIPT_CACHE_MAGIC "BRSC"
+// bump whenever the compiler or optimizer output changes
+#define SCRIPT_CACHE_VERSION 1
+#define SCRIPT_CACHE_HEADER_SIZE 28
+
+class ScriptCache {
+    static unsigned long long readLE(const unsigned char* p, int bytes) {
+        unsigned long long v = 0;
+        for (int i=bytes-1; i>=0; i--) {
+            v = v << 8 | p[i];
+        }
+        return v;
+    }
+    static void writeLE(std::ofstream& fd, unsigned long long v, int bytes) {
+        for (int i=0; i<bytes; i++) {
+            fd.put((char)(v >> (i*8)));
+        }
+    }
+    public:
+    static unsigned long long hash(const char* data, size_t len) {
+        unsigned long long h = 0xCBF29CE484222325ULL;
+        for (size_t i=0; i<len; i++) {
+            h = (h ^ (unsigned char)data[i]) * 0x100000001B3ULL;
+        }
+        return h;
+    }
+    /* Name of the cache file of a script source. Free with delete []. */
+    static char* path(const char* source) {
+        size_t len = strlen(source);
+        char* s = new char[len + 5];
+        memcpy(s, source, len);
+        memcpy(s + len, ".bin", 5);
+        return s;
+    }
+    /* Map the cache file and check it against the source. On success file stays mapped and code points into it. */
+    static bool load(const char* fname, const char* source, size_t sourcelen, MappedFile& file,
+        const unsigned char** code, size_t* codelen) {
+        if (!file.open(fname)) {
+            return false;
+        }
+        const unsigned char* data = file.data();
+        size_t len = file.length();
+        if (len < SCRIPT_CACHE_HEADER_SIZE || memcmp(data, SCRIPT_CACHE_MAGIC, 4) ||
+            readLE(data + 4, 2) != SCRIPT_CACHE_VERSION || readLE(data + 12, 8) != sourcelen ||
+            readLE(data + 20, 8) != hash(source, sourcelen)) {
+            file.close();
+            return false;
+        }
+        size_t nrefs = readLE(data + 6, 2);
+        size_t clen = readLE(data + 8, 4);
+        size_t offset = SCRIPT_CACHE_HEADER_SIZE;
+        char name[256];
+        for (size_t i=0; i<nrefs; i++) {
+            if (offset + 5 > len) {
+                file.close();
+                return false;
+            }
+            char kind = data[offset];
+            unsigned short id = readLE(data + offset + 1, 2), current;
+            size_t namelen = readLE(data + offset + 3, 2);
+            offset += 5;
+            if (namelen >= sizeof(name) || offset + namelen > len) {
+                file.close();
+                return false;
+            }
+            memcpy(name, data + offset, namelen);
+            name[namelen] = 0;
+            offset += namelen;
+            // registries may have been reordered since the script was compiled
+            ScriptAssemblyCompiler::resolve(kind, name, current);
+            if (current != id) {
+                file.close();
+                return false;
+            }
+        }
+        if (offset + clen != len || clen == 0) {
+            file.close();
+            return false;
+        }
+        *code = data + offset;
+        *codelen = clen;
+        return true;
+    }
+    /* Write the cache file of a compiled and optimized script. */
+    static bool save(const char* fname, const char* source, size_t sourcelen, ScriptAssemblyCompiler& compiler,
+        const unsigned char* code, size_t codelen) {
+        size_t nrefs = compiler.references.length();
+        if (nrefs > 0xFFFF || codelen > 0xFFFFFFFF) {
+            return false;
+        }
+        for (size_t i=0; i<nrefs; i++) {
+            // load() reads names into a fixed buffer
+            if (strlen(compiler.references[i].name) > 255) {
+                return false;
+            }
+        }
+        std::ofstream fd(fname, std::ios::binary | std::ios::trunc);
+        if (!fd.is_open()) {
+            return false;
+        }
+        fd.write(SCRIPT_CACHE_MAGIC, 4);
+        writeLE(fd, SCRIPT_CACHE_VERSION, 2);
+        writeLE(fd, nrefs, 2);
+        writeLE(fd, codelen, 4);
+        writeLE(fd, sourcelen, 8);
+        writeLE(fd, hash(source, sourcelen), 8);
+        for (size_t i=0; i<nrefs; i++) {
+            ScriptAssemblyCompiler::Reference& ref = compiler.references[i];
+            size_t namelen = strlen(ref.name);
+            fd.put(ref.kind);
+            writeLE(fd, ref.id, 2);
+            writeLE(fd, namelen, 2);
+            fd.write(ref.name, namelen);
+        }
+        fd.write((const char*)code, codelen);
+        fd.close();
+        return !fd.fail();
+    }
+};
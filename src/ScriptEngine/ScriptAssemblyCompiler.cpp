@@ -1,5 +1,7 @@
 #include "ScriptAssemblyCompiler.hpp"
 #include "../Registries.hpp"
+#include <climits>
+#include <cmath>
 
 static constexpr const char *opcodes[] {
     "nop", "rv", "returnDoNothing", "returnFail", "returnDestroy",
@@ -13,6 +15,13 @@ static constexpr const char *opcodes[] {
     "eq", "neq", "gt", "lt", "gteq", "lteq", "eqf", "neqf", "gtf", "ltf", "gteqf", "lteqf",
     "bzset32", "bnzset32", "pusharg", "pushvar", "abs", "absf", "sqrt", "sqrtf", "itof", "ftoi",
     "i64", "u64", "i64b", "u64b",
+    "yield",
+    "vset32", "vset64", "vmov", "varg", "vrandom",
+    "vadd", "vsub", "vmul", "vdiv", "vmod", "vand", "vor", "vxor",
+    "vaddf", "vsubf", "vmulf", "vdivf", "vmodf",
+    "veq", "vneq", "vgt", "vlt", "vgteq", "vlteq", "veqf", "vneqf", "vgtf", "vltf", "vgteqf", "vlteqf",
+    "vabs", "vabsf", "vsqrtf", "vitof", "vftoi",
+    "vbz", "vbnz", "vcall",
     nullptr,
 };
 static constexpr const char *opcodes80[] {
@@ -21,6 +30,7 @@ static constexpr const char *opcodes80[] {
     "camerax", "cameray", "cameraz", "entityx", "entityy", "entityz",
     "entitymovetowards", "entityrotate", "entityteleport", "canseeplayer",
     "getentitytimer", "setentitytimer", "randomteleportentity", "getdeltatime",
+    "tileflags", "areaflags", "areacount",
     nullptr,
 };
 
@@ -135,7 +145,40 @@ size_t ScriptAssemblyCompiler::compile(const char *data, size_t datalen, unsigne
                         outbuf.append(token_int);
                         outbuf.append(token_int >> 8);
                     }
+                    break;
+                case VSet32:
+                case VSet64:
+                    {
+                        int size = tk == VSet32 ? 4 : 8;
+                        tk = next(data, datalen, inoffset);
+                        outbuf.append(token_int);
+                        tk = next(data, datalen, inoffset);
+                        for (int k=0; k<size; k++) {
+                            outbuf.append(token_int >> (k*8));
+                        }
+                    }
+                    break;
+                case VBZ:
+                case VBNZ:
+                    tk = next(data, datalen, inoffset);
+                    outbuf.append(token_int);
+                    tk = next(data, datalen, inoffset);
+                    if (tk == LabelUsage) {
+                        outbuf.append(0);
+                        outbuf.append(0);
+                    } else {
+                        outbuf.append(token_int);
+                        outbuf.append(token_int >> 8);
+                    }
+                    break;
                 default:
+                    if (tk >= VMove && tk <= VCall) {
+                        // variable operands, and the interface opcode of vcall
+                        for (int k=operandSize(tk); k>0; k--) {
+                            tk = next(data, datalen, inoffset);
+                            outbuf.append(token_int);
+                        }
+                    }
                     break;
             }
         }
@@ -165,6 +208,30 @@ size_t ScriptAssemblyCompiler::compile(const char *data, size_t datalen, unsigne
     return outbuf.length();
 }
 
+bool ScriptAssemblyCompiler::resolve(char kind, const char *name, unsigned short &id) {
+    id = 0;
+    if (kind == 'x') {
+        RegisteredTexture* tex = GlobalTextureRegistry->of(name);
+        if (tex != nullptr) {
+            id = tex->id;
+        }
+        return tex != nullptr;
+    } else if (kind == 't') {
+        MapTile* tile = GlobalMapTileRegistry->of(name);
+        if (tile != nullptr) {
+            id = tile->id;
+        }
+        return tile != nullptr;
+    } else if (kind == 'e') {
+        EntityType* ent = GlobalEntityRegistry->of(name);
+        if (ent != nullptr) {
+            id = ent->id;
+        }
+        return ent != nullptr;
+    }
+    return false;
+}
+
 char ScriptAssemblyCompiler::peek(const char *data, size_t datalen, size_t i) {
     if (i < datalen) {
         return data[i];
@@ -210,19 +277,15 @@ ScriptAssemblyCompiler::Token ScriptAssemblyCompiler::next(const char *data, siz
     } else if (c == '#') {
         // block/item ID
         i++;
-        bool istexture = false;
-        bool istile = false;
-        bool isentity = false;
-        bool isitem = false;
+        char kind = 0;
         if (consumeToken(data, datalen, i, "texture:")) {
-            istexture = true;
+            kind = 'x';
         } else if (consumeToken(data, datalen, i, "tile:")) {
-            istile = true;
+            kind = 't';
         } else if (consumeToken(data, datalen, i, "entity:")) {
-            isentity = true;
+            kind = 'e';
         } else {
             printf("Script Warning: Unknown content type on line %llu\n", lno);
-            token_int = 0;
         }
 
         size_t j = i;
@@ -231,33 +294,15 @@ ScriptAssemblyCompiler::Token ScriptAssemblyCompiler::next(const char *data, siz
         } while (c > ' ');
         i--;
         const char* contentid = subcstr(data, datalen, j, i-j);
-        if (istexture) {
-            RegisteredTexture* tex = GlobalTextureRegistry->of(contentid);
-            if (tex == nullptr) {
-                printf("Script Warning: Unknown texture id \"%s\" on line %llu\n", contentid, lno);
-                token_int = 0;
-            } else {
-                token_int = tex->id;
+        unsigned short id = 0;
+        if (kind != 0) {
+            if (!resolve(kind, contentid, id)) {
+                printf("Script Warning: Unknown %s id \"%s\" on line %llu\n",
+                    kind == 'x' ? "texture" : kind == 't' ? "tile" : "entity", contentid, (unsigned long long)lno);
             }
-        } else if (istile) {
-            MapTile* tile = GlobalMapTileRegistry->of(contentid);
-            if (tile == nullptr) {
-                printf("Script Warning: Unknown tile id \"%s\" on line %llu\n", contentid, lno);
-                token_int = 0;
-            } else {
-                token_int = tile->id;
-            }
-        } else if (isentity) {
-            EntityType* ent = GlobalEntityRegistry->of(contentid);
-            if (ent == nullptr) {
-                printf("Script Warning: Unknown entity id \"%s\" on line %llu\n", contentid, lno);
-                token_int = 0;
-            } else {
-                token_int = ent->id;
-            }
-        // } else if (isitem) {
-        //     ;
+            references.append({kind, contentid, id});
         }
+        token_int = id;
         tk = Integer;
     } else if (c == '$' || c == '-' || c == '.' || c >= '0' && c <= '9') {
         // number
@@ -407,3 +452,602 @@ ScriptAssemblyCompiler::Token ScriptAssemblyCompiler::next(const char *data, siz
 
     return tk;
 }
+
+#pragma region Optimizer
+// register and control flow effects of an opcode
+enum {
+    ReadsA = 1, ReadsB = 2, WritesA = 4, WritesB = 8, Jumps = 16, Stops = 32,
+};
+
+/* Number of operand bytes following an opcode, or -1 if the opcode is unknown. */
+int ScriptAssemblyCompiler::operandSize(unsigned char op) {
+    switch (op) {
+        case Return:
+        case Immediate16: case Immediate16U: case Immediate16B: case Immediate16UB:
+        case BA: case BZ: case BNZ: case JSR: case JSRZ: case JSRNZ:
+            return 2;
+        case VMove: case VArg: case VAbs: case VAbsF: case VSqrtF: case VItof: case VFtoi:
+            return 2;
+        case Frameset: case ReadArg: case LoadVar: case StoreVar: case PushArg: case PushVar:
+        case Immediate8: case Immediate8U: case Immediate8B: case Immediate8UB:
+        case VRandom:
+            return 1;
+        case VAdd: case VSub: case VMul: case VDiv: case VMod: case VAnd: case VOr: case VXor:
+        case VAddF: case VSubF: case VMulF: case VDivF: case VModF:
+        case VEQ: case VNEQ: case VGT: case VLT: case VGTEQ: case VLTEQ:
+        case VEQF: case VNEQF: case VGTF: case VLTF: case VGTEQF: case VLTEQF:
+        case VBZ: case VBNZ: case VCall:
+            return 3;
+        case Immediate32: case Immediate32U: case Immediate32B: case Immediate32UB:
+            return 4;
+        case VSet32:
+            return 5;
+        case BZSet32: case BNZSet32:
+            return 6;
+        case Immediate64: case Immediate64U: case Immediate64B: case Immediate64UB:
+            return 8;
+        case VSet64:
+            return 9;
+        default:
+            return effects(op) == 0xFF ? -1 : 0;
+    }
+}
+
+/* Which registers an opcode reads and writes, and whether it branches or stops. Calls and returns count as
+   reading both registers, since the code on the other side may use them. V opcodes only touch variables.
+   0xFF for unknown opcodes. */
+unsigned char ScriptAssemblyCompiler::effects(unsigned char op) {
+    if (op >= VSet32 && op <= VCall) {
+        return op == VBZ || op == VBNZ ? Jumps : 0;
+    }
+    switch (op) {
+        case Nop: case Return: case ReturnDoNothing: case ReturnFail: case ReturnDestroy: case ReturnPlace:
+        case ReturnKeep: case ReturnUpdate: case ReturnReverseUpdate: case Frameset: case PushArg: case PushVar:
+        case Yield:
+            return 0;
+        case End:
+            return Stops;
+        case ReadArg: case Random: case Pop:
+        case Immediate8: case Immediate16: case Immediate32: case Immediate64:
+        case Immediate8U: case Immediate16U: case Immediate32U: case Immediate64U:
+        case GetTileId: case GetLightLevel: case CameraX: case CameraY: case CameraZ: case GetDeltaTime:
+        case TileFlags: case AreaFlags: case AreaCount:
+            return WritesA;
+        case LoadVar: case PopB:
+        case Immediate8B: case Immediate16B: case Immediate32B: case Immediate64B:
+        case Immediate8UB: case Immediate16UB: case Immediate32UB: case Immediate64UB:
+            return WritesB;
+        case StoreVar: case Push:
+        case EntityMoveTowards: case EntityRotate: case EntityTeleport: case SetEntityTimer: case RandomTeleportEntity:
+            return ReadsA;
+        case PushB:
+            return ReadsB;
+        case Exchange:
+            return ReadsA | ReadsB | WritesA | WritesB;
+        case Add: case Sub: case Mul: case Div: case Mod: case And: case Or: case Xor: case Lor: case Land:
+        case AddF: case SubF: case MulF: case DivF: case ModF: case PowF:
+        case EQ: case NEQ: case GT: case LT: case GTEQ: case LTEQ:
+        case EQF: case NEQF: case GTF: case LTF: case GTEQF: case LTEQF:
+            return ReadsA | ReadsB | WritesA;
+        case Inc: case Dec: case NanF: case InfF: case Abs: case AbsF: case Sqrt: case SqrtF: case Itof: case Ftoi:
+        case TileLightLevel: case TileIsSolid: case TileIsSpawnable: case TileIsWall: case TileFloor: case TileCeiling:
+        case TileWall: case EntityX: case EntityY: case EntityZ: case CanSeePlayer: case GetEntityTimer:
+            return ReadsA | WritesA;
+        case BA:
+            return Jumps | Stops;
+        case BZ: case BNZ:
+            return ReadsA | Jumps;
+        case BZSet32: case BNZSet32:
+            return ReadsA | WritesA | Jumps;
+        case JSR: case JSRZ: case JSRNZ:
+            return ReadsA | ReadsB | Jumps;
+        case RTS:
+            return ReadsA | ReadsB | Stops;
+        case RTSZ: case RTSNZ:
+            return ReadsA | ReadsB;
+        default:
+            return 0xFF;
+    }
+}
+
+/* Evaluate a one register op on a constant the way ScriptBytecode does. False if the result is undefined
+   or the op can't be folded. */
+bool ScriptAssemblyCompiler::foldUnary(unsigned char op, long long acc, long long& out) {
+    union { long long i; double f; } v = {.i = acc};
+    switch (op) {
+        case Inc:
+            out = (unsigned long long)acc + 1;
+            return true;
+        case Dec:
+            out = (unsigned long long)acc - 1;
+            return true;
+        case NanF:
+            out = 0;
+            return true;
+        case InfF:
+            out = v.f == INFINITY;
+            return true;
+        case Abs:
+            if (acc == LLONG_MIN) {
+                return false;
+            }
+            out = acc < 0 ? -acc : acc;
+            return true;
+        case AbsF:
+            v.f = fabs(v.f);
+            out = v.i;
+            return true;
+        case Sqrt:
+            if (acc < 0) {
+                return false;
+            }
+            out = sqrt(acc);
+            return true;
+        case SqrtF:
+            v.f = sqrt(v.f);
+            out = v.i;
+            return true;
+        case Itof:
+            v.f = acc;
+            out = v.i;
+            return true;
+        case Ftoi:
+            if (!(v.f > -9.2e18 && v.f < 9.2e18)) {
+                return false;
+            }
+            out = v.f;
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Evaluate a two register op on constants the way ScriptBytecode does. */
+bool ScriptAssemblyCompiler::foldBinary(unsigned char op, long long acc, long long bcc, long long& out) {
+    union { long long i; double f; } a = {.i = acc}, b = {.i = bcc};
+    switch (op) {
+        case Add:
+            out = (unsigned long long)acc + bcc;
+            return true;
+        case Sub:
+            out = (unsigned long long)acc - bcc;
+            return true;
+        case Mul:
+            out = (unsigned long long)acc * bcc;
+            return true;
+        case Div: case Mod:
+            if (acc == LLONG_MIN && bcc == -1) {
+                return false;
+            }
+            out = bcc == 0 ? -1 : op == Div ? acc / bcc : acc % bcc;
+            return true;
+        case And:
+            out = acc & bcc;
+            return true;
+        case Or:
+            out = acc | bcc;
+            return true;
+        case Xor:
+            out = acc ^ bcc;
+            return true;
+        case Lor:
+            out = acc || bcc;
+            return true;
+        case Land:
+            out = acc && bcc;
+            return true;
+        case AddF:
+            a.f += b.f;
+            out = a.i;
+            return true;
+        case SubF:
+            a.f -= b.f;
+            out = a.i;
+            return true;
+        case MulF:
+            a.f *= b.f;
+            out = a.i;
+            return true;
+        case DivF:
+            a.f /= b.f;
+            out = a.i;
+            return true;
+        case ModF:
+            a.f = fmod(a.f, b.f);
+            out = a.i;
+            return true;
+        case PowF:
+            a.f = pow(a.f, b.f);
+            out = a.i;
+            return true;
+        case EQ:
+            out = acc == bcc;
+            return true;
+        case NEQ:
+            out = acc != bcc;
+            return true;
+        case GT:
+            out = acc > bcc;
+            return true;
+        case LT:
+            out = acc < bcc;
+            return true;
+        case GTEQ:
+            out = acc >= bcc;
+            return true;
+        case LTEQ:
+            out = acc <= bcc;
+            return true;
+        case EQF:
+            out = a.f == b.f;
+            return true;
+        case NEQF:
+            out = a.f != b.f;
+            return true;
+        case GTF:
+            out = a.f > b.f;
+            return true;
+        case LTF:
+            out = a.f < b.f;
+            return true;
+        case GTEQF:
+            out = a.f >= b.f;
+            return true;
+        case LTEQF:
+            out = a.f <= b.f;
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Shortest immediate load of v into the accumulator, or into the B register if b is set. */
+unsigned char ScriptAssemblyCompiler::immediateOp(long long v, bool b) {
+    unsigned char op;
+    if (v >= -128 && v <= 127) {
+        op = Immediate8;
+    } else if (v >= 0 && v <= 255) {
+        op = Immediate8U;
+    } else if (v >= -32768 && v <= 32767) {
+        op = Immediate16;
+    } else if (v >= 0 && v <= 65535) {
+        op = Immediate16U;
+    } else if (v >= INT_MIN && v <= INT_MAX) {
+        op = Immediate32;
+    } else if (v >= 0 && v <= UINT_MAX) {
+        op = Immediate32U;
+    } else {
+        return b ? Immediate64UB : Immediate64U;
+    }
+    // the B register loads follow the accumulator loads in the same order
+    return b ? op + (Immediate8B - Immediate8) : op;
+}
+
+/* Optimize compiled bytecode into a new buffer:
+   - constant conversions and arithmetic are folded into immediate loads, and branches on constants resolved
+   - immediate loads whose value is overwritten before being read are removed, along with push/pop, pushb/popb
+     and ex/ex pairs
+   - branches to unconditional branches jump straight to the final target, branches to the next instruction
+     and unreachable code are removed
+   - immediates are re-encoded in their shortest form
+   Return addresses are computed when JSR runs, so calls stay correct. Bytecode that can't be analysed (unknown
+   opcodes, truncated operands, branches into the middle of an instruction) is copied unchanged. */
+size_t ScriptAssemblyCompiler::optimize(const unsigned char *code, size_t len, unsigned char **out) {
+    DynamicArray<Instruction, 256> ins;
+    size_t *index = new size_t[len+1];
+    bool valid = len > 0 && len <= 0xFFFF;
+    for (size_t pc=0; pc<len && valid; ) {
+        unsigned char op = code[pc];
+        int size = operandSize(op);
+        if (size < 0 || pc + 1 + size > len) {
+            valid = false;
+            break;
+        }
+        index[pc] = ins.length();
+        for (int i=1; i<=size; i++) {
+            index[pc+i] = SIZE_MAX;
+        }
+        const unsigned char *operand = &code[pc+1];
+        Instruction in = {op, 0, 0, SIZE_MAX, false, false};
+        switch (op) {
+            case Return:
+                in.a = operand[0];
+                in.b = operand[1];
+                break;
+            case Frameset: case ReadArg: case LoadVar: case StoreVar: case PushArg: case PushVar:
+            case Immediate8U: case Immediate8UB:
+                in.a = operand[0];
+                break;
+            case Immediate8: case Immediate8B:
+                in.a = (signed char)operand[0];
+                break;
+            case Immediate16: case Immediate16B:
+                in.a = (short)(operand[0] | operand[1] << 8);
+                break;
+            case Immediate16U: case Immediate16UB:
+                in.a = operand[0] | operand[1] << 8;
+                break;
+            case Immediate32: case Immediate32B: case BZSet32: case BNZSet32:
+                in.a = (int)(operand[0] | operand[1] << 8 | operand[2] << 16 | (unsigned)operand[3] << 24);
+                break;
+            case Immediate32U: case Immediate32UB:
+                in.a = (unsigned int)(operand[0] | operand[1] << 8 | operand[2] << 16 | (unsigned)operand[3] << 24);
+                break;
+            case Immediate64: case Immediate64U: case Immediate64B: case Immediate64UB:
+                for (int i=7; i>=0; i--) {
+                    in.a = in.a << 8 | operand[i];
+                }
+                break;
+            case VSet32:
+                in.b = operand[0];
+                in.a = (int)(operand[1] | operand[2] << 8 | operand[3] << 16 | (unsigned)operand[4] << 24);
+                break;
+            case VSet64:
+                in.b = operand[0];
+                for (int i=8; i>=1; i--) {
+                    in.a = in.a << 8 | operand[i];
+                }
+                break;
+            default:
+                // the variables of the other V opcodes are kept as they are
+                if (op >= VMove && op <= VCall) {
+                    for (int i=size-1; i>=0; i--) {
+                        in.a = in.a << 8 | operand[i];
+                    }
+                }
+                break;
+        }
+        unsigned char e = effects(op);
+        if ((op >= Immediate8 && op <= Immediate32U) || op == Immediate64 || op == Immediate64U) {
+            in.op = Immediate64U;
+        } else if ((op >= Immediate8B && op <= Immediate32UB) || op == Immediate64B || op == Immediate64UB) {
+            in.op = Immediate64UB;
+        } else if (e & Jumps) {
+            // branch targets are bytecode offsets for now, resolved to instructions below
+            in.target = operand[size-2] | operand[size-1] << 8;
+        }
+        ins.append(in);
+        pc += 1 + size;
+    }
+    size_t n = ins.length();
+    index[len] = n;
+    for (size_t i=0; i<n && valid; i++) {
+        Instruction& in = ins[i];
+        if (in.target != SIZE_MAX) {
+            in.target = in.target >= len ? n : index[in.target];
+            valid = in.target != SIZE_MAX;
+        }
+    }
+    delete [] index;
+    stats = {len, len, n, n};
+    if (!valid) {
+        ins.resize(0);
+        *out = new unsigned char[len];
+        memcpy(*out, code, len);
+        return len;
+    }
+
+    // first live instruction at or after i, n if there is none
+    auto resolve = [&](size_t i) {
+        while (i < n && ins[i].removed) {
+            i++;
+        }
+        return i;
+    };
+    // labels: branch targets and the return points after calls, recomputed whenever code has been removed
+    auto findLabels = [&]() {
+        for (size_t i=0; i<n; i++) {
+            ins[i].label = false;
+        }
+        for (size_t i=0; i<n; i++) {
+            Instruction& in = ins[i];
+            if (in.removed || in.target == SIZE_MAX) {
+                continue;
+            }
+            size_t t = resolve(in.target);
+            if (t < n) {
+                ins[t].label = true;
+            }
+            if (in.op == JSR || in.op == JSRZ || in.op == JSRNZ) {
+                size_t next = resolve(i+1);
+                if (next < n) {
+                    ins[next].label = true;
+                }
+            }
+        }
+    };
+    bool changed = true;
+    for (int pass=0; changed && pass<16; pass++) {
+        changed = false;
+        findLabels();
+        // jump threading
+        for (size_t i=0; i<n; i++) {
+            Instruction& in = ins[i];
+            if (in.removed || in.target == SIZE_MAX) {
+                continue;
+            }
+            for (int hops=0; hops<16; hops++) {
+                size_t t = resolve(in.target);
+                // a taken BZ/BNZ lands on another BZ/BNZ that is taken too, the accumulator hasn't changed
+                if (t < n && t != i && (ins[t].op == BA || (ins[t].op == in.op && (in.op == BZ || in.op == BNZ))) &&
+                    resolve(ins[t].target) != t) {
+                    in.target = ins[t].target;
+                    changed = true;
+                } else {
+                    break;
+                }
+            }
+            if ((in.op == BA || in.op == BZ || in.op == BNZ || in.op == VBZ || in.op == VBNZ) &&
+                resolve(in.target) == resolve(i+1)) {
+                in.removed = true;
+                changed = true;
+            }
+        }
+        // unreachable code after a jump, return or end, up to the next label
+        findLabels();
+        for (size_t i=0; i<n; i++) {
+            if (ins[i].removed || !(effects(ins[i].op) & Stops)) {
+                continue;
+            }
+            for (size_t j=i+1; j<n && !ins[j].label; j++) {
+                if (!ins[j].removed) {
+                    ins[j].removed = true;
+                    changed = true;
+                }
+            }
+        }
+        // constant folding through each basic block
+        findLabels();
+        bool knownA = false, knownB = false;
+        long long valueA = 0, valueB = 0, value;
+        for (size_t i=0; i<n; i++) {
+            Instruction& in = ins[i];
+            if (in.removed) {
+                continue;
+            }
+            if (in.label) {
+                knownA = knownB = false;
+            }
+            unsigned char e = effects(in.op);
+            if (in.op == Immediate64U) {
+                knownA = true;
+                valueA = in.a;
+            } else if (in.op == Immediate64UB) {
+                knownB = true;
+                valueB = in.a;
+            } else if (in.op == Exchange) {
+                bool known = knownA;
+                knownA = knownB;
+                knownB = known;
+                value = valueA;
+                valueA = valueB;
+                valueB = value;
+            } else if (((in.op == NanF || knownA) && foldUnary(in.op, valueA, value)) ||
+                (knownA && knownB && foldBinary(in.op, valueA, valueB, value))) {
+                in.op = Immediate64U;
+                in.a = value;
+                knownA = true;
+                valueA = value;
+                changed = true;
+            } else if (knownA && (in.op == BZ || in.op == BNZ)) {
+                if ((valueA == 0) == (in.op == BZ)) {
+                    in.op = BA;
+                } else {
+                    in.removed = true;
+                }
+                changed = true;
+            } else {
+                if (e & WritesA) {
+                    knownA = false;
+                }
+                if (e & WritesB) {
+                    knownB = false;
+                }
+            }
+            if (ins[i].op == BA || e & (Jumps | Stops)) {
+                knownA = knownB = false;
+            }
+        }
+        // register moves that cancel out
+        findLabels();
+        for (size_t i=0; i<n; i++) {
+            Instruction& in = ins[i];
+            if (in.removed) {
+                continue;
+            }
+            size_t j = resolve(i+1);
+            if (j < n && !ins[j].label && ((in.op == Push && ins[j].op == Pop) || (in.op == PushB && ins[j].op == PopB) ||
+                (in.op == Exchange && ins[j].op == Exchange))) {
+                in.removed = ins[j].removed = true;
+                changed = true;
+            }
+        }
+        // immediate loads that are overwritten before anything reads them
+        for (size_t i=0; i<n; i++) {
+            Instruction& in = ins[i];
+            if (in.removed || (in.op != Immediate64U && in.op != Immediate64UB)) {
+                continue;
+            }
+            unsigned char reads = in.op == Immediate64U ? ReadsA : ReadsB;
+            unsigned char writes = in.op == Immediate64U ? WritesA : WritesB;
+            bool dead = true;
+            for (size_t j=resolve(i+1); j<n; j=resolve(j+1)) {
+                unsigned char e = effects(ins[j].op);
+                if (e & (reads | Jumps)) {
+                    dead = false;
+                    break;
+                }
+                if (e & (writes | Stops)) {
+                    break;
+                }
+            }
+            if (dead) {
+                in.removed = true;
+                changed = true;
+            }
+        }
+    }
+
+    // lay out the surviving instructions and write them out
+    size_t *offsets = new size_t[n+1];
+    size_t outlen = 0, count = 0;
+    for (size_t i=0; i<n; i++) {
+        Instruction& in = ins[i];
+        offsets[i] = outlen;
+        if (in.removed) {
+            continue;
+        }
+        if (in.op == Immediate64U || in.op == Immediate64UB) {
+            in.op = immediateOp(in.a, in.op == Immediate64UB);
+        } else if (in.op == VSet64 && in.a >= INT_MIN && in.a <= INT_MAX) {
+            in.op = VSet32;
+        }
+        outlen += 1 + operandSize(in.op);
+        count++;
+    }
+    offsets[n] = outlen;
+    DynamicArray<unsigned char, 512> buf;
+    for (size_t i=0; i<n; i++) {
+        Instruction& in = ins[i];
+        if (in.removed) {
+            continue;
+        }
+        buf.append(in.op);
+        int size = operandSize(in.op);
+        if (in.op == Return) {
+            buf.append(in.a);
+            buf.append(in.b);
+        } else if (in.op == VSet32 || in.op == VSet64) {
+            buf.append(in.b);
+            for (int k=0; k<size-1; k++) {
+                buf.append(in.a >> (k*8));
+            }
+        } else if (in.target != SIZE_MAX) {
+            // the immediate of BZSet32/BNZSet32 or the variable of VBZ/VBNZ comes first
+            for (int k=0; k<size-2; k++) {
+                buf.append(in.a >> (k*8));
+            }
+            size_t target = offsets[resolve(in.target)];
+            buf.append(target);
+            buf.append(target >> 8);
+        } else {
+            for (int k=0; k<size; k++) {
+                buf.append(in.a >> (k*8));
+            }
+        }
+    }
+    delete [] offsets;
+    stats.bytesOut = outlen;
+    stats.instructionsOut = count;
+    if (outlen == 0) {
+        // everything was dead, keep an end so the script stays valid
+        buf.append(End);
+        stats.bytesOut = stats.instructionsOut = 1;
+    }
+    *out = buf.collapse();
+    outlen = buf.length();
+    ins.resize(0);
+    buf.resize(0);
+    return outlen;
+}
+#pragma endregion
@@ -35,20 +35,58 @@ class ScriptAssemblyCompiler {
         EQ, NEQ, GT, LT, GTEQ, LTEQ, EQF, NEQF, GTF, LTF, GTEQF, LTEQF,
         BZSet32, BNZSet32, PushArg, PushVar, Abs, AbsF, Sqrt, SqrtF, Itof, Ftoi,
         Immediate64, Immediate64U, Immediate64B, Immediate64UB,
+        Yield,
+        VSet32, VSet64, VMove, VArg, VRandom,
+        VAdd, VSub, VMul, VDiv, VMod, VAnd, VOr, VXor,
+        VAddF, VSubF, VMulF, VDivF, VModF,
+        VEQ, VNEQ, VGT, VLT, VGTEQ, VLTEQ, VEQF, VNEQF, VGTF, VLTF, VGTEQF, VLTEQF,
+        VAbs, VAbsF, VSqrtF, VItof, VFtoi,
+        VBZ, VBNZ, VCall,
 
         GetTileId=0x80, GetLightLevel, TileLightLevel, TileIsSolid, TileIsSpawnable, TileIsWall,
         TileFloor, TileCeiling, TileWall,
         CameraX, CameraY, CameraZ, EntityX, EntityY, EntityZ,
         EntityMoveTowards, EntityRotate, EntityTeleport, CanSeePlayer,
         GetEntityTimer, SetEntityTimer, RandomTeleportEntity, GetDeltaTime,
+        TileFlags, AreaFlags, AreaCount,
 
         None=0xF8, Integer, Label, LabelUsage,
     };
+    // one instruction while optimizing. Immediate loads are widened to Immediate64U/Immediate64UB.
+    typedef struct {
+        unsigned char op;
+        long long a; // immediate value, or the operand bytes
+        unsigned char b; // second operand byte of Return, destination variable of VSet32/VSet64
+        size_t target; // branch target instruction index, the instruction count for past the end
+        bool label; // a branch target or return point
+        bool removed;
+    } Instruction;
+    static int operandSize(unsigned char op);
+    static unsigned char effects(unsigned char op);
+    static bool foldUnary(unsigned char op, long long acc, long long& out);
+    static bool foldBinary(unsigned char op, long long acc, long long bcc, long long& out);
+    static unsigned char immediateOp(long long v, bool b);
     public:
+    /* Code size and instruction count before and after the last optimize(). */
+    typedef struct {
+        size_t bytesIn, bytesOut;
+        size_t instructionsIn, instructionsOut;
+    } Stats;
+    Stats stats;
+    /* A #texture:, #tile: or #entity: reference and the registry ID it resolved to, 0 if it didn't. */
+    typedef struct {
+        char kind; // 'x' texture, 't' tile, 'e' entity
+        const char *name;
+        unsigned short id;
+    } Reference;
+    DynamicArray<Reference, 16> references;
+    /* Look up a content ID in the registry of its kind. */
+    static bool resolve(char kind, const char *name, unsigned short &id);
     ScriptAssemblyCompiler();
     char peek(const char *data, size_t datalen, size_t i);
     bool consumeToken(const char* data, size_t datalen, size_t& i, const char* tok);
     size_t compile(const char *data, size_t datalen, unsigned char **out);
+    size_t optimize(const unsigned char *code, size_t len, unsigned char **out);
     Token next(const char *data, size_t datalen, size_t &i);
 };
 
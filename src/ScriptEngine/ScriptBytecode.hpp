@@ -1,12 +1,44 @@
 #ifndef __SCRIPTBYTECODE_H__
 #define __SCRIPTBYTECODE_H__
 
+#include <climits>
 #include <cmath>
 #include <cstdio>
+#include <cstdlib>
 #include "ScriptInterface.hpp"
+#include "ScriptProfiler.hpp"
 #include "raylib.h"
 
+// GCC and clang support labels as values, which lets each decoded handler jump straight to the next one.
+#if defined(__GNUC__)
+#define SCRIPT_THREADED_DISPATCH
+#endif
+
+// opcodes with a handler in the decoded interpreter. The other immediate loads are folded into
+// Immediate64U and Immediate64UB when decoding.
+#define SCRIPT_DECODED_OPCODES(X) \
+    X(Nop) X(Return) X(ReturnDoNothing) X(ReturnFail) X(ReturnDestroy) X(ReturnPlace) X(ReturnKeep) \
+    X(ReturnUpdate) X(ReturnReverseUpdate) X(End) X(Frameset) X(ReadArg) X(Random) X(LoadVar) X(StoreVar) \
+    X(Exchange) X(Add) X(Sub) X(Mul) X(Div) X(Mod) X(And) X(Or) X(Xor) X(Lor) X(Land) X(Inc) X(Dec) \
+    X(AddF) X(SubF) X(MulF) X(DivF) X(ModF) X(PowF) X(NanF) X(InfF) \
+    X(Push) X(Pop) X(PushB) X(PopB) X(BA) X(BZ) X(BNZ) X(JSR) X(RTS) X(JSRZ) X(JSRNZ) X(RTSZ) X(RTSNZ) \
+    X(EQ) X(NEQ) X(GT) X(LT) X(GTEQ) X(LTEQ) X(EQF) X(NEQF) X(GTF) X(LTF) X(GTEQF) X(LTEQF) \
+    X(BZSet32) X(BNZSet32) X(PushArg) X(PushVar) X(Abs) X(AbsF) X(Sqrt) X(SqrtF) X(Itof) X(Ftoi) \
+    X(Immediate64U) X(Immediate64UB) X(Yield) \
+    X(VSet64) X(VMove) X(VArg) X(VRandom) X(VAdd) X(VSub) X(VMul) X(VDiv) X(VMod) X(VAnd) X(VOr) X(VXor) \
+    X(VAddF) X(VSubF) X(VMulF) X(VDivF) X(VModF) X(VEQ) X(VNEQ) X(VGT) X(VLT) X(VGTEQ) X(VLTEQ) \
+    X(VEQF) X(VNEQF) X(VGTF) X(VLTF) X(VGTEQF) X(VLTEQF) X(VAbs) X(VAbsF) X(VSqrtF) X(VItof) X(VFtoi) \
+    X(VBZ) X(VBNZ) X(VCall) \
+    X(GetTileId) X(GetLightLevel) X(TileLightLevel) X(TileIsSolid) X(TileIsSpawnable) X(TileIsWall) \
+    X(TileFloor) X(TileCeiling) X(TileWall) X(CameraX) X(CameraY) X(CameraZ) X(EntityX) X(EntityY) X(EntityZ) \
+    X(EntityMoveTowards) X(EntityRotate) X(EntityTeleport) X(CanSeePlayer) \
+    X(GetEntityTimer) X(SetEntityTimer) X(RandomTeleportEntity) X(GetDeltaTime) \
+    X(TileFlags) X(AreaFlags) X(AreaCount)
+
+class ScriptJit;
+
 class ScriptBytecode {
+    friend class ScriptJit;
     typedef union { long long i; double f; } i64;
     enum Opcode {
         Nop = 0,
@@ -20,26 +52,56 @@ class ScriptBytecode {
         EQ, NEQ, GT, LT, GTEQ, LTEQ, EQF, NEQF, GTF, LTF, GTEQF, LTEQF,
         BZSet32, BNZSet32, PushArg, PushVar, Abs, AbsF, Sqrt, SqrtF, Itof, Ftoi,
         Immediate64, Immediate64U, Immediate64B, Immediate64UB,
+        Yield,
+        // three-address forms working on the variables instead of acc/bcc. Operands are variable numbers,
+        // the destination first. VCall takes an interface opcode and the first of its consecutive arguments.
+        VSet32, VSet64, VMove, VArg, VRandom,
+        VAdd, VSub, VMul, VDiv, VMod, VAnd, VOr, VXor,
+        VAddF, VSubF, VMulF, VDivF, VModF,
+        VEQ, VNEQ, VGT, VLT, VGTEQ, VLTEQ, VEQF, VNEQF, VGTF, VLTF, VGTEQF, VLTEQF,
+        VAbs, VAbsF, VSqrtF, VItof, VFtoi,
+        VBZ, VBNZ, VCall,
 
         GetTileId=0x80, GetLightLevel, TileLightLevel, TileIsSolid, TileIsSpawnable, TileIsWall,
         TileFloor, TileCeiling, TileWall,
         CameraX, CameraY, CameraZ, EntityX, EntityY, EntityZ,
         EntityMoveTowards, EntityRotate, EntityTeleport, CanSeePlayer,
         GetEntityTimer, SetEntityTimer, RandomTeleportEntity, GetDeltaTime,
+        // batched tile queries, resolved through the level's tile table
+        TileFlags, AreaFlags, AreaCount,
     };
+    // dense handler numbers of the decoded interpreter
+    enum Handler {
+        #define SCRIPT_HANDLER_ENUM(name) Op##name,
+        SCRIPT_DECODED_OPCODES(SCRIPT_HANDLER_ENUM)
+        #undef SCRIPT_HANDLER_ENUM
+        OpUnknown, OpHalt,
+    };
+    // one decoded instruction. Operands are widened to their final type so handlers never touch the bytecode.
+    typedef struct {
+        const void *handler;
+        i64 a; // immediate value, argument/variable index or return slot
+        unsigned int b; // branch target instruction, variable index for Return, or the variables of a V opcode,
+                        // destination in the low byte
+        unsigned int offset; // bytecode offset, for JSR return addresses and error reports
+        unsigned char op;
+    } Instruction;
+    static constexpr const unsigned int NO_INSTRUCTION = UINT_MAX;
+    static constexpr const size_t NO_TARGET = SIZE_MAX;
     static constexpr const unsigned char DO_NOTHING_BYTECODE[] = {Opcode::Return, 0, Opcode::End};
     static constexpr const size_t STACK_SIZE = 64;
     static constexpr const size_t MAX_CYCLES = 1024;
-    static constexpr const size_t MAX_VARS = 32;
     static constexpr const i64 i64Zero = {.i = 0};
     const unsigned char *bytecode;
     size_t len;
-    size_t nvars = 0;
     size_t max_cycles = 0x800000;
-    i64 *vars = nullptr;
-    i64 *stack = nullptr;
+    Instruction *code = nullptr;
+    unsigned int *starts = nullptr; // instruction index of each bytecode offset, or NO_INSTRUCTION
+    size_t ninstructions = 0;
     ScriptInterface *interface;
     public:
+    // size of a context's variable file, shared with ScriptExpressionCompiler's temporaries
+    static constexpr const size_t MAX_VARS = 32;
     enum Result {
         Success = 0,
         UnknownOpcode,
@@ -49,11 +111,102 @@ class ScriptBytecode {
         StackOverflow,
         StackUnderflow,
         Timeout,
+        // not an error: the script ran a yield and continues after it on the next run with the same context
+        Yielded,
     };
-    Result result;
+    /* Execution state of one running instance of a script: variables, stack and the last run's result.
+       The bytecode itself is never written while running, so any number of contexts can share it. */
+    class Context {
+        public:
+        i64 vars[MAX_VARS];
+        i64 stack[STACK_SIZE];
+        Result result;
+        // number of instructions executed by the last run
+        size_t executed;
+        // next free context, while owned by a ScriptContextPool
+        Context *nextFree;
+        // the script whose last run yielded in this context, or null. Its next run resumes at resumeOffset
+        // with the saved registers, the variables and stack are where it left them.
+        const ScriptBytecode *suspended;
+        size_t resumeOffset;
+        size_t resumeSp;
+        i64 resumeAcc, resumeBcc;
+        // state of the Random and VRandom generator. Each context has its own, so scripts running on
+        // worker threads neither share rand() nor depend on the order they ran in.
+        unsigned long long rngState;
+        Context() {
+            reset();
+        }
+        /* Clear the variables and result for a new script instance, and restart its random sequence. */
+        void reset() {
+            for (size_t i=0; i<MAX_VARS; i++) {
+                vars[i] = i64Zero;
+            }
+            result = Result::Success;
+            executed = 0;
+            nextFree = nullptr;
+            suspended = nullptr;
+            seed(0);
+        }
+        /* Start the random sequence over from value, e.g. the entity's index so entities do not all draw the
+           same numbers. */
+        void seed(unsigned long long value) {
+            rngState = (value + 1) * 0x9E3779B97F4A7C15ULL;
+        }
+        /* Next number of the random sequence, from 0 to INT_MAX like rand() on glibc. */
+        long long random() {
+            rngState = rngState * 6364136223846793005ULL + 1442695040888963407ULL;
+            return (long long)(rngState >> 33);
+        }
+        i64 pop(size_t& sp) {
+            if (sp == STACK_SIZE) {
+                result = Result::StackUnderflow;
+                return i64Zero;
+            } else {
+                return stack[sp++];
+            }
+        }
+        void push(size_t& sp, i64 val) {
+            if (sp == 0) {
+                result = Result::StackOverflow;
+            } else {
+                stack[--sp] = val;
+            }
+        }
+        i64 getvar(unsigned char n) {
+            if (n == 0) {
+                return i64Zero;
+            }
+            if (n < MAX_VARS) {
+                return vars[n];
+            }
+            result = Result::OutOfBoundsRead;
+            return i64Zero;
+        }
+        void setvar(unsigned char n, i64 val) {
+            if (n < MAX_VARS) {
+                if (n > 0) {
+                    vars[n] = val;
+                }
+            } else {
+                result = Result::OutOfBoundsRead;
+            }
+        }
+    };
+    // true if the bytecode passed validation and runs from the decoded instructions
+    bool decoded = false;
+    // set to false to run the byte-by-byte interpreter even if the bytecode was decoded
+    bool useDecoded = true;
+    // native code compiled by ScriptJit::compile(), or null
+    ScriptJit *jit = nullptr;
+    // set to false to run every script with the interpreters even if it was compiled to native code
+    static bool useJit;
+    // profiler totals of a registered script, or null to leave it out of the profile
+    ScriptProfiler::Script *profile = nullptr;
     ScriptBytecode() {
         bytecode = DO_NOTHING_BYTECODE;
         len = sizeof(DO_NOTHING_BYTECODE);
+        decode();
     }
     ScriptBytecode(const unsigned char *bytecode, size_t len) : ScriptBytecode(bytecode, len, MAX_CYCLES) {}
 
@@ -61,12 +214,7 @@ class ScriptBytecode {
         this->bytecode = bytecode;
         this->len = len;
         this->max_cycles = max_cycles;
-        if (this->len > 0) {
-            stack = new i64[STACK_SIZE];
-            vars = new i64[MAX_VARS];
-        } else {
-            stack = vars = nullptr;
-        }
+        decode();
     }
     void setInterface(ScriptInterface *interface) {
         this->interface = interface;
@@ -74,11 +222,61 @@ class ScriptBytecode {
     void setMaxCycles(size_t cycles) {
         max_cycles = cycles;
     }
+    /* Free the decoded instructions and native code. The bytecode itself belongs to the caller. */
+    void unload();
     size_t dump(char** data) {
         *data = (char*)bytecode;
         return len;
     }
-    int run(size_t argc, long long *argv, long long *retval) {
+    /* Run the script in ctx, which keeps its variables between runs. If the last run in ctx yielded, this run
+       continues after the yield. */
+    int run(Context& ctx, size_t argc, long long *argv, long long *retval) {
+        if (ScriptProfiler::enabled && profile != nullptr) {
+            auto start = std::chrono::steady_clock::now();
+            int res = runSelected(ctx, argc, argv, retval);
+            profile->record(ctx.executed, start);
+            return res;
+        }
+        return runSelected(ctx, argc, argv, retval);
+    }
+    private:
+    /* Run with the fastest enabled implementation. */
+    int runSelected(Context& ctx, size_t argc, long long *argv, long long *retval) {
+        if (ctx.suspended != nullptr && ctx.suspended != this) {
+            // another script yielded in this context, this one starts from the beginning
+            ctx.suspended = nullptr;
+        }
+        if (ctx.suspended == this && (ctx.resumeOffset >= len || (decoded && starts[ctx.resumeOffset] == NO_INSTRUCTION))) {
+            // the yield was the last instruction, so resuming finishes the run
+            ctx.suspended = nullptr;
+            for (int i=0; i<8; i++) {
+                retval[i] = 0;
+            }
+            ctx.result = Result::Success;
+            ctx.executed = 0;
+            return ctx.result;
+        }
+        if (jit != nullptr && useJit && useDecoded) {
+            return runNative(ctx, argc, argv, retval);
+        }
+        if (decoded && useDecoded) {
+            return execute(&ctx, argc, argv, retval, nullptr);
+        }
+        return interpret(ctx, argc, argv, retval);
+    }
+    /* Save the registers of a run that yielded, so the next run in ctx continues at offset. */
+    void suspend(Context& ctx, size_t offset, size_t sp, i64 acc, i64 bcc) const {
+        ctx.suspended = this;
+        ctx.resumeOffset = offset;
+        ctx.resumeSp = sp;
+        ctx.resumeAcc = acc;
+        ctx.resumeBcc = bcc;
+    }
+    // defined with unload() and the compiler in ScriptJit.cpp
+    int runNative(Context& ctx, size_t argc, long long *argv, long long *retval);
+    /* Reference interpreter, decoding every byte as it runs. Used for bytecode that failed validation. */
+    int interpret(Context& ctx, size_t argc, long long *argv, long long *retval) {
+        Result& result = ctx.result;
         size_t cycles = 0;
         size_t pc = 0;
         size_t sp = STACK_SIZE;
@@ -92,23 +290,37 @@ class ScriptBytecode {
             retval[i] = 0;
         }
         acc.i = bcc.i = 0;
-        nvars = MAX_VARS;
+        if (ctx.suspended == this) {
+            pc = ctx.resumeOffset;
+            sp = ctx.resumeSp;
+            acc = ctx.resumeAcc;
+            bcc = ctx.resumeBcc;
+        }
+        ctx.suspended = nullptr;
         result = Result::Success;
+#ifdef SCRIPT_PROFILE_OPCODES
+        unsigned long long *opcounts = ScriptProfiler::enabled ? ScriptProfiler::threadCounters()->opcodes : nullptr;
+#endif
         while (pc < len) {
             if (cycles++ >= max_cycles) {
                 result = Result::Timeout;
                 break;
             }
-            switch (next(pc)) {
+#ifdef SCRIPT_PROFILE_OPCODES
+            if (opcounts != nullptr) {
+                opcounts[handlerOf(bytecode[pc])]++;
+            }
+#endif
+            switch (next(pc, result)) {
                 case Nop:
                     break;
                 case Return:
-                    tmp = next(pc);
+                    tmp = next(pc, result);
                     if (tmp < 0 || tmp >= 8) {
                         result = Result::OutOfBoundsWrite;
                     } else {
-                        tmp2 = next(pc);
-                        retval[tmp] = getvar(tmp2).i;
+                        tmp2 = next(pc, result);
+                        retval[tmp] = ctx.getvar(tmp2).i;
                     }
                     break;
                 // note: these return functions need to be updated if Components::TickingFunction::TickResult changes.
@@ -134,16 +346,17 @@ class ScriptBytecode {
                     retval[0] = 6;
                     break;
                 case Random:
-                    acc.i = rand();
+                    acc.i = ctx.random();
                     break;
                 case End:
+                    ctx.executed = cycles;
                     return Result::Success;
                 case Frameset:
-                    tmpC = next(pc);
+                    tmpC = next(pc, result);
                     sp += tmpC;
                     break;
                 case ReadArg:
-                    tmp = next(pc);
+                    tmp = next(pc, result);
                     if (tmp < 0 || tmp >= argc) {
                         result = Result::OutOfBoundsRead;
                     } else {
@@ -151,54 +364,54 @@ class ScriptBytecode {
                     }
                     break;
                 case Immediate8:
-                    tmpC = next(pc);
+                    tmpC = next(pc, result);
                     acc.i = tmpC;
                     break;
                 case Immediate16:
-                    tmpS = nextw(pc);
+                    tmpS = nextw(pc, result);
                     acc.i = tmpS;
                     break;
                 case Immediate32:
-                    tmpI = nexti(pc);
+                    tmpI = nexti(pc, result);
                     acc.i = tmpI;
                     break;
                 case Immediate8U:
-                    acc.i = next(pc);
+                    acc.i = next(pc, result);
                     break;
                 case Immediate16U:
-                    acc.i = nextw(pc);
+                    acc.i = nextw(pc, result);
                     break;
                 case Immediate32U:
-                    acc.i = nexti(pc);
+                    acc.i = nexti(pc, result);
                     break;
                 case Immediate8B:
-                    tmpC = next(pc);
+                    tmpC = next(pc, result);
                     bcc.i = tmpC;
                     break;
                 case Immediate16B:
-                    tmpS = nextw(pc);
+                    tmpS = nextw(pc, result);
                     bcc.i = tmpS;
                     break;
                 case Immediate32B:
-                    tmpI = nexti(pc);
+                    tmpI = nexti(pc, result);
                     bcc.i = tmpI;
                     break;
                 case Immediate8UB:
-                    bcc.i = next(pc);
+                    bcc.i = next(pc, result);
                     break;
                 case Immediate16UB:
-                    bcc.i = nextw(pc);
+                    bcc.i = nextw(pc, result);
                     break;
                 case Immediate32UB:
-                    bcc.i = nexti(pc);
+                    bcc.i = nexti(pc, result);
                     break;
                 case LoadVar:
-                    tmp = next(pc);
-                    bcc = getvar(tmp);
+                    tmp = next(pc, result);
+                    bcc = ctx.getvar(tmp);
                     break;
                 case StoreVar:
-                    tmp = next(pc);
-                    setvar(tmp, acc);
+                    tmp = next(pc, result);
+                    ctx.setvar(tmp, acc);
                     break;
                 case Exchange:
                     tmp = acc.i;
@@ -276,62 +489,62 @@ class ScriptBytecode {
                     acc.i = acc.f == INFINITY;
                     break;
                 case Push:
-                    push(sp, acc);
+                    ctx.push(sp, acc);
                     break;
                 case Pop:
-                    acc = pop(sp);
+                    acc = ctx.pop(sp);
                     break;
                 case PushB:
-                    push(sp, bcc);
+                    ctx.push(sp, bcc);
                     break;
                 case PopB:
-                    bcc = pop(sp);
+                    bcc = ctx.pop(sp);
                     break;
                 case BA:
-                    pc = nextw(pc);
+                    pc = nextw(pc, result);
                     break;
                 case BZ:
-                    tmp = nextw(pc);
+                    tmp = nextw(pc, result);
                     if (acc.i == 0) {
                         pc = tmp;
                     }
                     break;
                 case BNZ:
-                    tmp = nextw(pc);
+                    tmp = nextw(pc, result);
                     if (acc.i != 0) {
                         pc = tmp;
                     }
                     break;
                 case JSR:
-                    tmp = nextw(pc);
-                    push(sp, {.i = (signed)pc});
+                    tmp = nextw(pc, result);
+                    ctx.push(sp, {.i = (signed)pc});
                     pc = tmp;
                     break;
                 case JSRZ:
-                    tmp = nextw(pc);
+                    tmp = nextw(pc, result);
                     if (acc.i == 0) {
-                        push(sp, {.i = (signed)pc});
+                        ctx.push(sp, {.i = (signed)pc});
                         pc = tmp;
                     }
                     break;
                 case JSRNZ:
-                    tmp = nextw(pc);
+                    tmp = nextw(pc, result);
                     if (acc.i != 0) {
-                        push(sp, {.i = (signed)pc});
+                        ctx.push(sp, {.i = (signed)pc});
                         pc = tmp;
                     }
                     break;
                 case RTS:
-                    pc = pop(sp).i;
+                    pc = ctx.pop(sp).i;
                     break;
                 case RTSZ:
                     if (acc.i == 0) {
-                        pc = pop(sp).i;
+                        pc = ctx.pop(sp).i;
                     }
                     break;
                 case RTSNZ:
                     if (acc.i != 0) {
-                        pc = pop(sp).i;
+                        pc = ctx.pop(sp).i;
                     }
                     break;
                 case EQ:
@@ -371,35 +584,35 @@ class ScriptBytecode {
                     acc.i = acc.f <= bcc.f;
                     break;
                 case BZSet32:
-                    tmpI = nextl(pc);
-                    tmp = nextw(pc);
+                    tmpI = nexti(pc, result);
+                    tmp = nextw(pc, result);
                     if (acc.i == 0) {
                         acc.i = tmpI;
                         pc = tmp;
                     }
                     break;
                 case BNZSet32:
-                    tmpI = nextl(pc);
-                    tmp = nextw(pc);
-                    if (acc.i == 0) {
+                    tmpI = nexti(pc, result);
+                    tmp = nextw(pc, result);
+                    if (acc.i != 0) {
                         acc.i = tmpI;
                         pc = tmp;
                     }
                     break;
                 case PushArg:
-                    tmp = next(pc);
+                    tmp = next(pc, result);
                     if (tmp < 0 || tmp >= argc) {
                         result = Result::OutOfBoundsRead;
                     } else {
-                        push(sp, i64 { .i = argv[tmp] });
+                        ctx.push(sp, i64 { .i = argv[tmp] });
                     }
                     break;
                 case PushVar:
-                    tmp = next(pc);
-                    push(sp, getvar(tmp));
+                    tmp = next(pc, result);
+                    ctx.push(sp, ctx.getvar(tmp));
                     break;
                 case Abs:
-                    acc.i = abs(acc.i);
+                    acc.i = llabs(acc.i);
                     break;
                 case AbsF:
                     acc.f = fabs(acc.f);
@@ -417,29 +630,109 @@ class ScriptBytecode {
                     acc.i = acc.f;
                     break;
                 case Immediate64:
-                    tmpI = nextl(pc);
-                    acc.i = tmpI;
+                    acc.i = nextl(pc, result);
                     break;
                 case Immediate64U:
-                    acc.i = nextl(pc);
+                    acc.i = nextl(pc, result);
                     break;
                 case Immediate64B:
-                    tmpI = nextl(pc);
-                    bcc.i = tmpI;
+                    bcc.i = nextl(pc, result);
                     break;
                 case Immediate64UB:
-                    bcc.i = nextl(pc);
+                    bcc.i = nextl(pc, result);
+                    break;
+                case Yield:
+                    suspend(ctx, pc, sp, acc, bcc);
+                    result = Result::Yielded;
+                    break;
+                case VSet32:
+                    tmp = next(pc, result);
+                    tmpI = nexti(pc, result);
+                    ctx.setvar(tmp, {.i = tmpI});
+                    break;
+                case VSet64:
+                    tmp = next(pc, result);
+                    tmp2 = nextl(pc, result);
+                    ctx.setvar(tmp, {.i = tmp2});
+                    break;
+                case VMove:
+                    tmp = next(pc, result);
+                    tmp2 = next(pc, result);
+                    ctx.setvar(tmp, ctx.getvar(tmp2));
+                    break;
+                case VArg:
+                    tmp = next(pc, result);
+                    tmp2 = next(pc, result);
+                    if (tmp2 >= (long long)argc) {
+                        result = Result::OutOfBoundsRead;
+                    } else {
+                        ctx.setvar(tmp, {.i = argv[tmp2]});
+                    }
+                    break;
+                case VRandom:
+                    tmp = next(pc, result);
+                    ctx.setvar(tmp, {.i = ctx.random()});
+                    break;
+                case VAdd: case VSub: case VMul: case VDiv: case VMod: case VAnd: case VOr: case VXor:
+                case VAddF: case VSubF: case VMulF: case VDivF: case VModF:
+                case VEQ: case VNEQ: case VGT: case VLT: case VGTEQ: case VLTEQ:
+                case VEQF: case VNEQF: case VGTF: case VLTF: case VGTEQF: case VLTEQF:
+                    tmp4 = bytecode[pc-1];
+                    tmp = next(pc, result);
+                    tmp2 = next(pc, result);
+                    tmp3 = next(pc, result);
+                    ctx.setvar(tmp, binaryV(tmp4, ctx.getvar(tmp2), ctx.getvar(tmp3)));
+                    break;
+                case VAbs: case VAbsF: case VSqrtF: case VItof: case VFtoi:
+                    tmp4 = bytecode[pc-1];
+                    tmp = next(pc, result);
+                    tmp2 = next(pc, result);
+                    ctx.setvar(tmp, unaryV(tmp4, ctx.getvar(tmp2)));
+                    break;
+                case VBZ:
+                    tmp = next(pc, result);
+                    tmp2 = nextw(pc, result);
+                    if (ctx.getvar(tmp).i == 0) {
+                        pc = tmp2;
+                    }
+                    break;
+                case VBNZ:
+                    tmp = next(pc, result);
+                    tmp2 = nextw(pc, result);
+                    if (ctx.getvar(tmp).i != 0) {
+                        pc = tmp2;
+                    }
+                    break;
+                case VCall:
+                    tmp = next(pc, result);
+                    tmp2 = next(pc, result);
+                    tmp3 = next(pc, result);
+                    tmp4 = interfaceArgs(tmp);
+                    if (tmp4 < 0) {
+                        result = Result::UnknownOpcode;
+                        printf("Opcode: 0x%02X\n", (unsigned int)tmp);
+                    } else if (tmp3 + tmp4 > (long long)MAX_VARS) {
+                        result = Result::OutOfBoundsRead;
+                    } else {
+                        i64 args[5], out;
+                        for (int k=0; k<tmp4; k++) {
+                            args[k] = ctx.getvar(tmp3 + k);
+                        }
+                        if (callInterface(interface, tmp, args, out)) {
+                            ctx.setvar(tmp2, out);
+                        }
+                    }
                     break;
                 case GetTileId:
-                    tmp = pop(sp).i;
-                    tmp2 = pop(sp).i;
-                    tmp3 = pop(sp).i;
+                    tmp = ctx.pop(sp).i;
+                    tmp2 = ctx.pop(sp).i;
+                    tmp3 = ctx.pop(sp).i;
                     acc.i = interface->getTileId(tmp, tmp2, tmp3);
                     break;
                 case GetLightLevel:
-                    tmp = pop(sp).i;
-                    tmp2 = pop(sp).i;
-                    tmp3 = pop(sp).i;
+                    tmp = ctx.pop(sp).i;
+                    tmp2 = ctx.pop(sp).i;
+                    tmp3 = ctx.pop(sp).i;
                     acc.i = interface->getLightColor(tmp, tmp2, tmp3);
                     break;
                 case TileLightLevel:
@@ -482,20 +775,20 @@ class ScriptBytecode {
                     acc.f = interface->entityZ(acc.i);
                     break;
                 case EntityMoveTowards:
-                    tmpf = pop(sp).f;
-                    tmpf2 = pop(sp).f;
-                    tmpf3 = pop(sp).f;
-                    tmpf4 = pop(sp).f;
+                    tmpf = ctx.pop(sp).f;
+                    tmpf2 = ctx.pop(sp).f;
+                    tmpf3 = ctx.pop(sp).f;
+                    tmpf4 = ctx.pop(sp).f;
                     interface->entityMoveTowards(acc.i, tmpf, tmpf2, tmpf3, tmpf4);
                     break;
                 case EntityRotate:
-                    tmpf = pop(sp).f;
+                    tmpf = ctx.pop(sp).f;
                     interface->entityRotate(acc.i, tmpf);
                     break;
                 case EntityTeleport:
-                    tmpf = pop(sp).f;
-                    tmpf2 = pop(sp).f;
-                    tmpf3 = pop(sp).f;
+                    tmpf = ctx.pop(sp).f;
+                    tmpf2 = ctx.pop(sp).f;
+                    tmpf3 = ctx.pop(sp).f;
                     interface->entityTeleport(acc.i, tmpf, tmpf2, tmpf3);
                     break;
                 case CanSeePlayer:
@@ -506,18 +799,40 @@ class ScriptBytecode {
                     acc.f = interface->getEntityTimer(acc.i);
                     break;
                 case SetEntityTimer:
-                    tmpf = pop(sp).f;
+                    tmpf = ctx.pop(sp).f;
                     interface->setEntityTimer(acc.i, tmpf);
                     break;
                 case RandomTeleportEntity:
-                    tmpf = pop(sp).f;
-                    tmpf2 = pop(sp).f;
-                    tmp = pop(sp).i;
+                    tmpf = ctx.pop(sp).f;
+                    tmpf2 = ctx.pop(sp).f;
+                    tmp = ctx.pop(sp).i;
                     interface->randomTeleportEntity(acc.i, tmpf, tmpf2, tmp);
                     break;
                 case GetDeltaTime:
                     acc.f = interface->getDeltaTime();
                     break;
+                case TileFlags:
+                    tmp = ctx.pop(sp).i;
+                    tmp2 = ctx.pop(sp).i;
+                    tmp3 = ctx.pop(sp).i;
+                    acc.i = interface->tileFlags(tmp, tmp2, tmp3);
+                    break;
+                case AreaFlags:
+                    tmp = ctx.pop(sp).i;
+                    tmp2 = ctx.pop(sp).i;
+                    tmp3 = ctx.pop(sp).i;
+                    tmp4 = ctx.pop(sp).i;
+                    tmp5 = ctx.pop(sp).i;
+                    acc.i = interface->areaFlags(tmp, tmp2, tmp3, tmp4, tmp5);
+                    break;
+                case AreaCount:
+                    tmp = ctx.pop(sp).i;
+                    tmp2 = ctx.pop(sp).i;
+                    tmp3 = ctx.pop(sp).i;
+                    tmp4 = ctx.pop(sp).i;
+                    tmp5 = ctx.pop(sp).i;
+                    acc.i = interface->areaCount(tmp, tmp2, tmp3, tmp4, tmp5);
+                    break;
                 default:
                     result = Result::UnknownOpcode;
                     printf("Opcode: 0x%02X\n", bytecode[pc-1]);
@@ -527,64 +842,1019 @@ class ScriptBytecode {
                 break;
             }
         }
-        if (result != Result::Success) {
+        ctx.executed = result == Result::Timeout ? cycles - 1 : cycles;
+        if (result != Result::Success && result != Result::Yielded) {
             printf("Program counter: 0x%04llX\n", pc-1);
             printf("Stack pointer: 0x%04llX\n", sp);
             printf("Accumulator: 0x%016llX\n", acc.i);
         }
         return result;
     }
-    private:
-    i64 pop(size_t& sp) {
-        if (sp == STACK_SIZE) {
-            result = Result::StackUnderflow;
-            return i64Zero;
-        } else {
-            return stack[sp++];
+    /* Number of operand bytes following an opcode, or -1 if the opcode is unknown. */
+    static int operandSize(unsigned char op) {
+        switch (op) {
+            case Return:
+                return 2;
+            case Frameset: case ReadArg: case LoadVar: case StoreVar: case PushArg: case PushVar:
+            case Immediate8: case Immediate8U: case Immediate8B: case Immediate8UB:
+            case VRandom:
+                return 1;
+            case Immediate16: case Immediate16U: case Immediate16B: case Immediate16UB:
+            case BA: case BZ: case BNZ: case JSR: case JSRZ: case JSRNZ:
+            case VMove: case VArg: case VAbs: case VAbsF: case VSqrtF: case VItof: case VFtoi:
+                return 2;
+            case VAdd: case VSub: case VMul: case VDiv: case VMod: case VAnd: case VOr: case VXor:
+            case VAddF: case VSubF: case VMulF: case VDivF: case VModF:
+            case VEQ: case VNEQ: case VGT: case VLT: case VGTEQ: case VLTEQ:
+            case VEQF: case VNEQF: case VGTF: case VLTF: case VGTEQF: case VLTEQF:
+            case VBZ: case VBNZ: case VCall:
+                return 3;
+            case Immediate32: case Immediate32U: case Immediate32B: case Immediate32UB:
+                return 4;
+            case VSet32:
+                return 5;
+            case BZSet32: case BNZSet32:
+                return 6;
+            case Immediate64: case Immediate64U: case Immediate64B: case Immediate64UB:
+                return 8;
+            case VSet64:
+                return 9;
+            default:
+                return handlerOf(op) == OpUnknown ? -1 : 0;
         }
     }
-    void push(size_t& sp, i64 val) {
-        if (sp == 0) {
-            result = Result::StackOverflow;
-        } else {
-            stack[--sp] = val;
+    /* Number of arguments of an interface opcode, or -1 if op isn't one. */
+    static int interfaceArgs(unsigned char op) {
+        switch (op) {
+            case CameraX: case CameraY: case CameraZ: case GetDeltaTime:
+                return 0;
+            case TileLightLevel: case TileIsSolid: case TileIsSpawnable: case TileIsWall: case TileFloor:
+            case TileCeiling: case TileWall: case EntityX: case EntityY: case EntityZ: case CanSeePlayer:
+            case GetEntityTimer:
+                return 1;
+            case EntityRotate: case SetEntityTimer:
+                return 2;
+            case GetTileId: case GetLightLevel: case TileFlags:
+                return 3;
+            case EntityTeleport: case RandomTeleportEntity:
+                return 4;
+            case EntityMoveTowards: case AreaFlags: case AreaCount:
+                return 5;
+            default:
+                return -1;
         }
     }
-    i64 getvar(unsigned char n) {
-        if (n == 0) {
-            return i64Zero;
+    /* Call an interface opcode for VCall with its arguments in v, converted the same way as the stack
+       arguments of the accumulator form. Returns false if the function has no result. */
+    static bool callInterface(ScriptInterface *interface, unsigned char op, const i64 *v, i64& out) {
+        switch (op) {
+            case GetTileId:
+                out.i = interface->getTileId(v[0].i, v[1].i, v[2].i);
+                return true;
+            case GetLightLevel:
+                out.i = interface->getLightColor(v[0].i, v[1].i, v[2].i);
+                return true;
+            case TileLightLevel:
+                out.i = interface->tileLightLevel(v[0].i);
+                return true;
+            case TileIsSolid:
+                out.i = interface->isSolid(v[0].i);
+                return true;
+            case TileIsSpawnable:
+                out.i = interface->isSpawnable(v[0].i);
+                return true;
+            case TileIsWall:
+                out.i = interface->isWall(v[0].i);
+                return true;
+            case TileFloor:
+                out.i = interface->tileFloor(v[0].i);
+                return true;
+            case TileCeiling:
+                out.i = interface->tileCeiling(v[0].i);
+                return true;
+            case TileWall:
+                out.i = interface->tileWall(v[0].i);
+                return true;
+            case CameraX:
+                out.f = interface->cameraX();
+                return true;
+            case CameraY:
+                out.f = interface->cameraY();
+                return true;
+            case CameraZ:
+                out.f = interface->cameraZ();
+                return true;
+            case EntityX:
+                out.f = interface->entityX(v[0].i);
+                return true;
+            case EntityY:
+                out.f = interface->entityY(v[0].i);
+                return true;
+            case EntityZ:
+                out.f = interface->entityZ(v[0].i);
+                return true;
+            case EntityMoveTowards:
+                interface->entityMoveTowards(v[0].i, (float)v[1].f, (float)v[2].f, (float)v[3].f, (float)v[4].f);
+                return false;
+            case EntityRotate:
+                interface->entityRotate(v[0].i, (float)v[1].f);
+                return false;
+            case EntityTeleport:
+                interface->entityTeleport(v[0].i, (float)v[1].f, (float)v[2].f, (float)v[3].f);
+                return false;
+            case CanSeePlayer:
+                out.i = interface->canSeePlayer(v[0].i);
+                return true;
+            case GetEntityTimer:
+                out.f = interface->getEntityTimer(v[0].i);
+                return true;
+            case SetEntityTimer:
+                interface->setEntityTimer(v[0].i, (float)v[1].f);
+                return false;
+            case RandomTeleportEntity:
+                interface->randomTeleportEntity(v[0].i, (float)v[1].f, (float)v[2].f, v[3].i);
+                return false;
+            case GetDeltaTime:
+                out.f = interface->getDeltaTime();
+                return true;
+            case TileFlags:
+                out.i = interface->tileFlags(v[0].i, v[1].i, v[2].i);
+                return true;
+            case AreaFlags:
+                out.i = interface->areaFlags(v[0].i, v[1].i, v[2].i, v[3].i, v[4].i);
+                return true;
+            case AreaCount:
+                out.i = interface->areaCount(v[0].i, v[1].i, v[2].i, v[3].i, v[4].i);
+                return true;
+            default:
+                return false;
         }
-        if (vars != nullptr && n < nvars) {
-            return vars[n];
+    }
+    /* Two operand V opcodes for interpret(), with the same results as their accumulator forms. */
+    static i64 binaryV(unsigned char op, i64 x, i64 y) {
+        i64 r;
+        switch (op) {
+            case VAdd: r.i = x.i + y.i; break;
+            case VSub: r.i = x.i - y.i; break;
+            case VMul: r.i = x.i * y.i; break;
+            case VDiv: r.i = y.i == 0 ? -1 : x.i / y.i; break;
+            case VMod: r.i = y.i == 0 ? -1 : x.i % y.i; break;
+            case VAnd: r.i = x.i & y.i; break;
+            case VOr: r.i = x.i | y.i; break;
+            case VXor: r.i = x.i ^ y.i; break;
+            case VAddF: r.f = x.f + y.f; break;
+            case VSubF: r.f = x.f - y.f; break;
+            case VMulF: r.f = x.f * y.f; break;
+            case VDivF: r.f = x.f / y.f; break;
+            case VModF: r.f = fmod(x.f, y.f); break;
+            case VEQ: r.i = x.i == y.i; break;
+            case VNEQ: r.i = x.i != y.i; break;
+            case VGT: r.i = x.i > y.i; break;
+            case VLT: r.i = x.i < y.i; break;
+            case VGTEQ: r.i = x.i >= y.i; break;
+            case VLTEQ: r.i = x.i <= y.i; break;
+            case VEQF: r.i = x.f == y.f; break;
+            case VNEQF: r.i = x.f != y.f; break;
+            case VGTF: r.i = x.f > y.f; break;
+            case VLTF: r.i = x.f < y.f; break;
+            case VGTEQF: r.i = x.f >= y.f; break;
+            case VLTEQF: r.i = x.f <= y.f; break;
+            default: r.i = 0; break;
         }
-        result = Result::OutOfBoundsRead;
-        return i64Zero;
+        return r;
     }
-    void setvar(unsigned char n, i64 val) {
-        if (vars != nullptr && n < nvars) {
-            if (n > 0) {
-                vars[n] = val;
+    /* One operand V opcodes for interpret(). */
+    static i64 unaryV(unsigned char op, i64 x) {
+        i64 r;
+        switch (op) {
+            case VAbs: r.i = llabs(x.i); break;
+            case VAbsF: r.f = fabs(x.f); break;
+            case VSqrtF: r.f = sqrt(x.f); break;
+            case VItof: r.f = x.i; break;
+            case VFtoi: r.i = x.f; break;
+            default: r.i = 0; break;
+        }
+        return r;
+    }
+    /* Handler number of an opcode, folding the narrow immediate loads into the 64 bit ones. */
+    static unsigned char handlerOf(unsigned char op) {
+        switch (op) {
+            case Immediate8: case Immediate16: case Immediate32: case Immediate64:
+            case Immediate8U: case Immediate16U: case Immediate32U:
+                return OpImmediate64U;
+            case Immediate8B: case Immediate16B: case Immediate32B: case Immediate64B:
+            case Immediate8UB: case Immediate16UB: case Immediate32UB:
+                return OpImmediate64UB;
+            case VSet32:
+                return OpVSet64;
+            #define SCRIPT_HANDLER_CASE(name) case name: return Op##name;
+            SCRIPT_DECODED_OPCODES(SCRIPT_HANDLER_CASE)
+            #undef SCRIPT_HANDLER_CASE
+            default:
+                return OpUnknown;
+        }
+    }
+    /* Whether the variables of a decoded V opcode are in range for execute(), which indexes ctx->vars directly.
+       Only VCall may write variable 0, which it skips; the others are left to interpret() to ignore. */
+    static bool variablesValid(unsigned char op, const Instruction& ins) {
+        unsigned int d = ins.b & 0xFF, x = (ins.b >> 8) & 0xFF, y = ins.b >> 16;
+        switch (op) {
+            case VBZ: case VBNZ:
+                return ins.a.i < (long long)MAX_VARS;
+            case VCall:
+                return interfaceArgs(ins.a.i) >= 0 && d < MAX_VARS && x + interfaceArgs(ins.a.i) <= MAX_VARS;
+            default:
+                return d > 0 && d < MAX_VARS && x < MAX_VARS && y < MAX_VARS;
+        }
+    }
+    /* Validate the bytecode and decode it into instructions for execute().
+       Bytecode with truncated operands, branches into the middle of an instruction or V opcodes with variables
+       out of range is left to interpret(). */
+    void decode() {
+        decoded = false;
+        if (len == 0 || len >= NO_INSTRUCTION) {
+            return;
+        }
+        unsigned int *index = new unsigned int[len];
+        size_t n = 0;
+        for (size_t pc=0; pc<len; n++) {
+            int size = operandSize(bytecode[pc]);
+            index[pc++] = n;
+            if (size < 0) {
+                // unknown opcodes fail when executed, like in interpret()
+                continue;
             }
-        } else {
-            result = Result::OutOfBoundsRead;
+            if (pc + size > len) {
+                delete [] index;
+                return;
+            }
+            for (int i=0; i<size; i++) {
+                index[pc++] = NO_INSTRUCTION;
+            }
+        }
+        const void* const* table = nullptr;
+        execute(nullptr, 0, nullptr, nullptr, &table);
+        Instruction *instructions = new Instruction[n+1];
+        Result result = Result::Success;
+        size_t pc = 0;
+        for (size_t i=0; i<n; i++) {
+            Instruction& ins = instructions[i];
+            unsigned char op = bytecode[pc];
+            ins.offset = pc++;
+            ins.op = handlerOf(op);
+            ins.a.i = 0;
+            ins.b = 0;
+            size_t target = NO_TARGET;
+            switch (op) {
+                case Return:
+                    ins.a.i = next(pc, result);
+                    ins.b = next(pc, result);
+                    break;
+                case Frameset:
+                    ins.a.i = (signed char)next(pc, result);
+                    break;
+                case ReadArg: case LoadVar: case StoreVar: case PushArg: case PushVar:
+                case Immediate8U: case Immediate8UB:
+                    ins.a.i = next(pc, result);
+                    break;
+                case Immediate8: case Immediate8B:
+                    ins.a.i = (signed char)next(pc, result);
+                    break;
+                case Immediate16: case Immediate16B:
+                    ins.a.i = (short)nextw(pc, result);
+                    break;
+                case Immediate16U: case Immediate16UB:
+                    ins.a.i = nextw(pc, result);
+                    break;
+                case Immediate32: case Immediate32B:
+                    ins.a.i = (int)nexti(pc, result);
+                    break;
+                case Immediate32U: case Immediate32UB:
+                    ins.a.i = nexti(pc, result);
+                    break;
+                case Immediate64: case Immediate64U: case Immediate64B: case Immediate64UB:
+                    ins.a.i = nextl(pc, result);
+                    break;
+                case BA: case BZ: case BNZ: case JSR: case JSRZ: case JSRNZ:
+                    target = nextw(pc, result);
+                    break;
+                case BZSet32: case BNZSet32:
+                    ins.a.i = (int)nexti(pc, result);
+                    target = nextw(pc, result);
+                    break;
+                case VSet32:
+                    ins.b = next(pc, result);
+                    ins.a.i = (int)nexti(pc, result);
+                    break;
+                case VSet64:
+                    ins.b = next(pc, result);
+                    ins.a.i = nextl(pc, result);
+                    break;
+                case VArg:
+                    ins.b = next(pc, result);
+                    ins.a.i = next(pc, result);
+                    break;
+                case VRandom:
+                    ins.b = next(pc, result);
+                    break;
+                case VMove: case VAbs: case VAbsF: case VSqrtF: case VItof: case VFtoi:
+                    ins.b = next(pc, result);
+                    ins.b |= next(pc, result) << 8;
+                    break;
+                case VAdd: case VSub: case VMul: case VDiv: case VMod: case VAnd: case VOr: case VXor:
+                case VAddF: case VSubF: case VMulF: case VDivF: case VModF:
+                case VEQ: case VNEQ: case VGT: case VLT: case VGTEQ: case VLTEQ:
+                case VEQF: case VNEQF: case VGTF: case VLTF: case VGTEQF: case VLTEQF:
+                    ins.b = next(pc, result);
+                    ins.b |= next(pc, result) << 8;
+                    ins.b |= next(pc, result) << 16;
+                    break;
+                case VBZ: case VBNZ:
+                    ins.a.i = next(pc, result);
+                    target = nextw(pc, result);
+                    break;
+                case VCall:
+                    ins.a.i = next(pc, result);
+                    ins.b = next(pc, result);
+                    ins.b |= next(pc, result) << 8;
+                    break;
+                default:
+                    break;
+            }
+            if (op >= VSet32 && op <= VCall && !variablesValid(op, ins)) {
+                delete [] instructions;
+                delete [] index;
+                return;
+            }
+            if (target < len) {
+                if (index[target] == NO_INSTRUCTION) {
+                    delete [] instructions;
+                    delete [] index;
+                    return;
+                }
+                ins.b = index[target];
+            } else if (target != NO_TARGET) {
+                ins.b = n;
+            }
+            ins.handler = table == nullptr ? nullptr : table[ins.op];
+        }
+        // running off the end of the bytecode halts, like the end of interpret()'s loop
+        Instruction& halt = instructions[n];
+        halt.offset = len;
+        halt.op = OpHalt;
+        halt.a.i = 0;
+        halt.b = 0;
+        halt.handler = table == nullptr ? nullptr : table[OpHalt];
+        code = instructions;
+        starts = index;
+        ninstructions = n;
+        decoded = true;
+    }
+    /* Run the decoded instructions. Operands were validated and widened by decode(), so handlers only check
+       the things that depend on run time state (stack depth, variable and argument indices, return addresses).
+       If table is not null, it receives the handler address table used by decode() instead. */
+    int execute(Context *ctx, size_t argc, long long *argv, long long *retval, const void* const** table) {
+#ifdef SCRIPT_THREADED_DISPATCH
+        static const void* const handlers[] = {
+            #define SCRIPT_HANDLER_LABEL(name) &&op_##name,
+            SCRIPT_DECODED_OPCODES(SCRIPT_HANDLER_LABEL)
+            #undef SCRIPT_HANDLER_LABEL
+            &&op_Unknown, &&op_Halt,
+        };
+        if (table != nullptr) {
+            *table = handlers;
+            return 0;
         }
+        #define SCRIPT_OP(name) op_##name:
+        #define SCRIPT_DISPATCH() { if (cycles++ >= max_cycles) goto timeout; SCRIPT_COUNT(); goto *ip->handler; }
+#else
+        if (table != nullptr) {
+            *table = nullptr;
+            return 0;
+        }
+        #define SCRIPT_OP(name) case Op##name:
+        #define SCRIPT_DISPATCH() goto dispatch
+#endif
+#ifdef SCRIPT_PROFILE_OPCODES
+        #define SCRIPT_COUNT() if (opcounts != nullptr) opcounts[ip->op]++
+        unsigned long long *opcounts = ScriptProfiler::enabled ? ScriptProfiler::threadCounters()->opcodes : nullptr;
+#else
+        #define SCRIPT_COUNT()
+#endif
+        #define SCRIPT_NEXT() { ip++; SCRIPT_DISPATCH(); }
+        #define SCRIPT_JUMP(target) { ip = code + (target); SCRIPT_DISPATCH(); }
+        #define SCRIPT_CHECK() if (result != Result::Success) goto fail
+        Result& result = ctx->result;
+        const Instruction *ip = code;
+        size_t cycles = 0;
+        size_t sp = STACK_SIZE;
+        i64 acc, bcc;
+        long long tmp, tmp2, tmp3, tmp4, tmp5;
+        float tmpf, tmpf2, tmpf3, tmpf4;
+        unsigned int target;
+        for (int i=0; i<8; i++) {
+            retval[i] = 0;
+        }
+        acc.i = bcc.i = 0;
+        if (ctx->suspended == this) {
+            ip = code + starts[ctx->resumeOffset];
+            sp = ctx->resumeSp;
+            acc = ctx->resumeAcc;
+            bcc = ctx->resumeBcc;
+        }
+        ctx->suspended = nullptr;
+        result = Result::Success;
+#ifdef SCRIPT_THREADED_DISPATCH
+        SCRIPT_DISPATCH();
+#else
+        dispatch:
+        if (cycles++ >= max_cycles) {
+            goto timeout;
+        }
+        SCRIPT_COUNT();
+        switch (ip->op) {
+#endif
+        SCRIPT_OP(Nop)
+            SCRIPT_NEXT();
+        SCRIPT_OP(Return)
+            if (ip->a.i >= 8) {
+                result = Result::OutOfBoundsWrite;
+                goto fail;
+            }
+            retval[ip->a.i] = ctx->getvar(ip->b).i;
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        // note: these return functions need to be updated if Components::TickingFunction::TickResult changes.
+        SCRIPT_OP(ReturnDoNothing)
+            retval[0] = 0;
+            SCRIPT_NEXT();
+        SCRIPT_OP(ReturnFail)
+            retval[0] = 1;
+            SCRIPT_NEXT();
+        SCRIPT_OP(ReturnDestroy)
+            retval[0] = 2;
+            SCRIPT_NEXT();
+        SCRIPT_OP(ReturnPlace)
+            retval[0] = 3;
+            SCRIPT_NEXT();
+        SCRIPT_OP(ReturnKeep)
+            retval[0] = 4;
+            SCRIPT_NEXT();
+        SCRIPT_OP(ReturnUpdate)
+            retval[0] = 5;
+            SCRIPT_NEXT();
+        SCRIPT_OP(ReturnReverseUpdate)
+            retval[0] = 6;
+            SCRIPT_NEXT();
+        SCRIPT_OP(Random)
+            acc.i = ctx->random();
+            SCRIPT_NEXT();
+        SCRIPT_OP(End)
+            ctx->executed = cycles;
+            return Result::Success;
+        SCRIPT_OP(Frameset)
+            sp += ip->a.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(ReadArg)
+            if ((size_t)ip->a.i >= argc) {
+                result = Result::OutOfBoundsRead;
+                goto fail;
+            }
+            acc.i = argv[ip->a.i];
+            SCRIPT_NEXT();
+        SCRIPT_OP(Immediate64U)
+            acc = ip->a;
+            SCRIPT_NEXT();
+        SCRIPT_OP(Immediate64UB)
+            bcc = ip->a;
+            SCRIPT_NEXT();
+        SCRIPT_OP(Yield)
+            suspend(*ctx, ip[1].offset, sp, acc, bcc);
+            result = Result::Yielded;
+            ctx->executed = cycles;
+            return result;
+        SCRIPT_OP(LoadVar)
+            bcc = ctx->getvar(ip->a.i);
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        SCRIPT_OP(StoreVar)
+            ctx->setvar(ip->a.i, acc);
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        SCRIPT_OP(Exchange)
+            tmp = acc.i;
+            acc.i = bcc.i;
+            bcc.i = tmp;
+            SCRIPT_NEXT();
+        SCRIPT_OP(Add)
+            acc.i += bcc.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(Sub)
+            acc.i -= bcc.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(Mul)
+            acc.i *= bcc.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(Div)
+            acc.i = bcc.i == 0 ? -1 : acc.i / bcc.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(Mod)
+            acc.i = bcc.i == 0 ? -1 : acc.i % bcc.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(And)
+            acc.i &= bcc.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(Or)
+            acc.i |= bcc.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(Xor)
+            acc.i ^= bcc.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(Lor)
+            acc.i = acc.i || bcc.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(Land)
+            acc.i = acc.i && bcc.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(Inc)
+            acc.i++;
+            SCRIPT_NEXT();
+        SCRIPT_OP(Dec)
+            acc.i--;
+            SCRIPT_NEXT();
+        SCRIPT_OP(AddF)
+            acc.f += bcc.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(SubF)
+            acc.f -= bcc.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(MulF)
+            acc.f *= bcc.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(DivF)
+            acc.f /= bcc.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(ModF)
+            acc.f = fmod(acc.f, bcc.f);
+            SCRIPT_NEXT();
+        SCRIPT_OP(PowF)
+            acc.f = pow(acc.f, bcc.f);
+            SCRIPT_NEXT();
+        SCRIPT_OP(NanF)
+            acc.i = acc.f == NAN;
+            SCRIPT_NEXT();
+        SCRIPT_OP(InfF)
+            acc.i = acc.f == INFINITY;
+            SCRIPT_NEXT();
+        SCRIPT_OP(Push)
+            ctx->push(sp, acc);
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        SCRIPT_OP(Pop)
+            acc = ctx->pop(sp);
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        SCRIPT_OP(PushB)
+            ctx->push(sp, bcc);
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        SCRIPT_OP(PopB)
+            bcc = ctx->pop(sp);
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        SCRIPT_OP(BA)
+            SCRIPT_JUMP(ip->b);
+        SCRIPT_OP(BZ)
+            if (acc.i == 0) {
+                SCRIPT_JUMP(ip->b);
+            }
+            SCRIPT_NEXT();
+        SCRIPT_OP(BNZ)
+            if (acc.i != 0) {
+                SCRIPT_JUMP(ip->b);
+            }
+            SCRIPT_NEXT();
+        SCRIPT_OP(JSR)
+            ctx->push(sp, {.i = ip[1].offset});
+            SCRIPT_CHECK();
+            SCRIPT_JUMP(ip->b);
+        SCRIPT_OP(JSRZ)
+            if (acc.i == 0) {
+                ctx->push(sp, {.i = ip[1].offset});
+                SCRIPT_CHECK();
+                SCRIPT_JUMP(ip->b);
+            }
+            SCRIPT_NEXT();
+        SCRIPT_OP(JSRNZ)
+            if (acc.i != 0) {
+                ctx->push(sp, {.i = ip[1].offset});
+                SCRIPT_CHECK();
+                SCRIPT_JUMP(ip->b);
+            }
+            SCRIPT_NEXT();
+        SCRIPT_OP(RTS)
+            tmp = ctx->pop(sp).i;
+            SCRIPT_CHECK();
+            goto returnto;
+        SCRIPT_OP(RTSZ)
+            if (acc.i == 0) {
+                tmp = ctx->pop(sp).i;
+                SCRIPT_CHECK();
+                goto returnto;
+            }
+            SCRIPT_NEXT();
+        SCRIPT_OP(RTSNZ)
+            if (acc.i != 0) {
+                tmp = ctx->pop(sp).i;
+                SCRIPT_CHECK();
+                goto returnto;
+            }
+            SCRIPT_NEXT();
+        SCRIPT_OP(EQ)
+            acc.i = acc.i == bcc.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(NEQ)
+            acc.i = acc.i != bcc.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(GT)
+            acc.i = acc.i > bcc.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(LT)
+            acc.i = acc.i < bcc.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(GTEQ)
+            acc.i = acc.i >= bcc.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(LTEQ)
+            acc.i = acc.i <= bcc.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(EQF)
+            acc.i = acc.f == bcc.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(NEQF)
+            acc.i = acc.f != bcc.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(GTF)
+            acc.i = acc.f > bcc.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(LTF)
+            acc.i = acc.f < bcc.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(GTEQF)
+            acc.i = acc.f >= bcc.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(LTEQF)
+            acc.i = acc.f <= bcc.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(BZSet32)
+            if (acc.i == 0) {
+                acc = ip->a;
+                SCRIPT_JUMP(ip->b);
+            }
+            SCRIPT_NEXT();
+        SCRIPT_OP(BNZSet32)
+            if (acc.i != 0) {
+                acc = ip->a;
+                SCRIPT_JUMP(ip->b);
+            }
+            SCRIPT_NEXT();
+        SCRIPT_OP(PushArg)
+            if ((size_t)ip->a.i >= argc) {
+                result = Result::OutOfBoundsRead;
+                goto fail;
+            }
+            ctx->push(sp, i64 { .i = argv[ip->a.i] });
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        SCRIPT_OP(PushVar)
+            ctx->push(sp, ctx->getvar(ip->a.i));
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        SCRIPT_OP(Abs)
+            acc.i = llabs(acc.i);
+            SCRIPT_NEXT();
+        SCRIPT_OP(AbsF)
+            acc.f = fabs(acc.f);
+            SCRIPT_NEXT();
+        SCRIPT_OP(Sqrt)
+            acc.i = sqrt(acc.i);
+            SCRIPT_NEXT();
+        SCRIPT_OP(SqrtF)
+            acc.f = sqrt(acc.f);
+            SCRIPT_NEXT();
+        SCRIPT_OP(Itof)
+            acc.f = acc.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(Ftoi)
+            acc.i = acc.f;
+            SCRIPT_NEXT();
+        // V opcodes: destination, then first and second operand variable
+        #define SCRIPT_VD ctx->vars[ip->b & 0xFF]
+        #define SCRIPT_VX ctx->vars[(ip->b >> 8) & 0xFF]
+        #define SCRIPT_VY ctx->vars[ip->b >> 16]
+        SCRIPT_OP(VSet64)
+            SCRIPT_VD = ip->a;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VMove)
+            SCRIPT_VD = SCRIPT_VX;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VArg)
+            if ((size_t)ip->a.i >= argc) {
+                result = Result::OutOfBoundsRead;
+                goto fail;
+            }
+            SCRIPT_VD.i = argv[ip->a.i];
+            SCRIPT_NEXT();
+        SCRIPT_OP(VRandom)
+            SCRIPT_VD.i = ctx->random();
+            SCRIPT_NEXT();
+        SCRIPT_OP(VAdd)
+            SCRIPT_VD.i = SCRIPT_VX.i + SCRIPT_VY.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VSub)
+            SCRIPT_VD.i = SCRIPT_VX.i - SCRIPT_VY.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VMul)
+            SCRIPT_VD.i = SCRIPT_VX.i * SCRIPT_VY.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VDiv)
+            SCRIPT_VD.i = SCRIPT_VY.i == 0 ? -1 : SCRIPT_VX.i / SCRIPT_VY.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VMod)
+            SCRIPT_VD.i = SCRIPT_VY.i == 0 ? -1 : SCRIPT_VX.i % SCRIPT_VY.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VAnd)
+            SCRIPT_VD.i = SCRIPT_VX.i & SCRIPT_VY.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VOr)
+            SCRIPT_VD.i = SCRIPT_VX.i | SCRIPT_VY.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VXor)
+            SCRIPT_VD.i = SCRIPT_VX.i ^ SCRIPT_VY.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VAddF)
+            SCRIPT_VD.f = SCRIPT_VX.f + SCRIPT_VY.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VSubF)
+            SCRIPT_VD.f = SCRIPT_VX.f - SCRIPT_VY.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VMulF)
+            SCRIPT_VD.f = SCRIPT_VX.f * SCRIPT_VY.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VDivF)
+            SCRIPT_VD.f = SCRIPT_VX.f / SCRIPT_VY.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VModF)
+            SCRIPT_VD.f = fmod(SCRIPT_VX.f, SCRIPT_VY.f);
+            SCRIPT_NEXT();
+        SCRIPT_OP(VEQ)
+            SCRIPT_VD.i = SCRIPT_VX.i == SCRIPT_VY.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VNEQ)
+            SCRIPT_VD.i = SCRIPT_VX.i != SCRIPT_VY.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VGT)
+            SCRIPT_VD.i = SCRIPT_VX.i > SCRIPT_VY.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VLT)
+            SCRIPT_VD.i = SCRIPT_VX.i < SCRIPT_VY.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VGTEQ)
+            SCRIPT_VD.i = SCRIPT_VX.i >= SCRIPT_VY.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VLTEQ)
+            SCRIPT_VD.i = SCRIPT_VX.i <= SCRIPT_VY.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VEQF)
+            SCRIPT_VD.i = SCRIPT_VX.f == SCRIPT_VY.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VNEQF)
+            SCRIPT_VD.i = SCRIPT_VX.f != SCRIPT_VY.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VGTF)
+            SCRIPT_VD.i = SCRIPT_VX.f > SCRIPT_VY.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VLTF)
+            SCRIPT_VD.i = SCRIPT_VX.f < SCRIPT_VY.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VGTEQF)
+            SCRIPT_VD.i = SCRIPT_VX.f >= SCRIPT_VY.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VLTEQF)
+            SCRIPT_VD.i = SCRIPT_VX.f <= SCRIPT_VY.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VAbs)
+            SCRIPT_VD.i = llabs(SCRIPT_VX.i);
+            SCRIPT_NEXT();
+        SCRIPT_OP(VAbsF)
+            SCRIPT_VD.f = fabs(SCRIPT_VX.f);
+            SCRIPT_NEXT();
+        SCRIPT_OP(VSqrtF)
+            SCRIPT_VD.f = sqrt(SCRIPT_VX.f);
+            SCRIPT_NEXT();
+        SCRIPT_OP(VItof)
+            SCRIPT_VD.f = SCRIPT_VX.i;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VFtoi)
+            SCRIPT_VD.i = SCRIPT_VX.f;
+            SCRIPT_NEXT();
+        SCRIPT_OP(VBZ)
+            if (ctx->vars[ip->a.i].i == 0) {
+                SCRIPT_JUMP(ip->b);
+            }
+            SCRIPT_NEXT();
+        SCRIPT_OP(VBNZ)
+            if (ctx->vars[ip->a.i].i != 0) {
+                SCRIPT_JUMP(ip->b);
+            }
+            SCRIPT_NEXT();
+        SCRIPT_OP(VCall)
+            {
+                i64 out;
+                if (callInterface(interface, ip->a.i, &SCRIPT_VX, out) && (ip->b & 0xFF) != 0) {
+                    SCRIPT_VD = out;
+                }
+            }
+            SCRIPT_NEXT();
+        #undef SCRIPT_VD
+        #undef SCRIPT_VX
+        #undef SCRIPT_VY
+        SCRIPT_OP(GetTileId)
+            tmp = ctx->pop(sp).i;
+            tmp2 = ctx->pop(sp).i;
+            tmp3 = ctx->pop(sp).i;
+            acc.i = interface->getTileId(tmp, tmp2, tmp3);
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        SCRIPT_OP(GetLightLevel)
+            tmp = ctx->pop(sp).i;
+            tmp2 = ctx->pop(sp).i;
+            tmp3 = ctx->pop(sp).i;
+            acc.i = interface->getLightColor(tmp, tmp2, tmp3);
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        SCRIPT_OP(TileLightLevel)
+            acc.i = interface->tileLightLevel(acc.i);
+            SCRIPT_NEXT();
+        SCRIPT_OP(TileIsSolid)
+            acc.i = interface->isSolid(acc.i);
+            SCRIPT_NEXT();
+        SCRIPT_OP(TileIsSpawnable)
+            acc.i = interface->isSpawnable(acc.i);
+            SCRIPT_NEXT();
+        SCRIPT_OP(TileIsWall)
+            acc.i = interface->isWall(acc.i);
+            SCRIPT_NEXT();
+        SCRIPT_OP(TileFloor)
+            acc.i = interface->tileFloor(acc.i);
+            SCRIPT_NEXT();
+        SCRIPT_OP(TileCeiling)
+            acc.i = interface->tileCeiling(acc.i);
+            SCRIPT_NEXT();
+        SCRIPT_OP(TileWall)
+            acc.i = interface->tileWall(acc.i);
+            SCRIPT_NEXT();
+        SCRIPT_OP(CameraX)
+            acc.f = interface->cameraX();
+            SCRIPT_NEXT();
+        SCRIPT_OP(CameraY)
+            acc.f = interface->cameraY();
+            SCRIPT_NEXT();
+        SCRIPT_OP(CameraZ)
+            acc.f = interface->cameraZ();
+            SCRIPT_NEXT();
+        SCRIPT_OP(EntityX)
+            acc.f = interface->entityX(acc.i);
+            SCRIPT_NEXT();
+        SCRIPT_OP(EntityY)
+            acc.f = interface->entityY(acc.i);
+            SCRIPT_NEXT();
+        SCRIPT_OP(EntityZ)
+            acc.f = interface->entityZ(acc.i);
+            SCRIPT_NEXT();
+        SCRIPT_OP(EntityMoveTowards)
+            tmpf = ctx->pop(sp).f;
+            tmpf2 = ctx->pop(sp).f;
+            tmpf3 = ctx->pop(sp).f;
+            tmpf4 = ctx->pop(sp).f;
+            interface->entityMoveTowards(acc.i, tmpf, tmpf2, tmpf3, tmpf4);
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        SCRIPT_OP(EntityRotate)
+            tmpf = ctx->pop(sp).f;
+            interface->entityRotate(acc.i, tmpf);
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        SCRIPT_OP(EntityTeleport)
+            tmpf = ctx->pop(sp).f;
+            tmpf2 = ctx->pop(sp).f;
+            tmpf3 = ctx->pop(sp).f;
+            interface->entityTeleport(acc.i, tmpf, tmpf2, tmpf3);
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        SCRIPT_OP(CanSeePlayer)
+            acc.i = interface->canSeePlayer(acc.i);
+            SCRIPT_NEXT();
+        SCRIPT_OP(GetEntityTimer)
+            acc.f = interface->getEntityTimer(acc.i);
+            SCRIPT_NEXT();
+        SCRIPT_OP(SetEntityTimer)
+            tmpf = ctx->pop(sp).f;
+            interface->setEntityTimer(acc.i, tmpf);
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        SCRIPT_OP(RandomTeleportEntity)
+            tmpf = ctx->pop(sp).f;
+            tmpf2 = ctx->pop(sp).f;
+            tmp = ctx->pop(sp).i;
+            interface->randomTeleportEntity(acc.i, tmpf, tmpf2, tmp);
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        SCRIPT_OP(GetDeltaTime)
+            acc.f = interface->getDeltaTime();
+            SCRIPT_NEXT();
+        SCRIPT_OP(TileFlags)
+            tmp = ctx->pop(sp).i;
+            tmp2 = ctx->pop(sp).i;
+            tmp3 = ctx->pop(sp).i;
+            acc.i = interface->tileFlags(tmp, tmp2, tmp3);
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        SCRIPT_OP(AreaFlags)
+            tmp = ctx->pop(sp).i;
+            tmp2 = ctx->pop(sp).i;
+            tmp3 = ctx->pop(sp).i;
+            tmp4 = ctx->pop(sp).i;
+            tmp5 = ctx->pop(sp).i;
+            acc.i = interface->areaFlags(tmp, tmp2, tmp3, tmp4, tmp5);
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        SCRIPT_OP(AreaCount)
+            tmp = ctx->pop(sp).i;
+            tmp2 = ctx->pop(sp).i;
+            tmp3 = ctx->pop(sp).i;
+            tmp4 = ctx->pop(sp).i;
+            tmp5 = ctx->pop(sp).i;
+            acc.i = interface->areaCount(tmp, tmp2, tmp3, tmp4, tmp5);
+            SCRIPT_CHECK();
+            SCRIPT_NEXT();
+        SCRIPT_OP(Unknown)
+            result = Result::UnknownOpcode;
+            printf("Opcode: 0x%02X\n", bytecode[ip->offset]);
+            goto fail;
+        SCRIPT_OP(Halt)
+            ctx->executed = cycles - 1;
+            return result;
+#ifndef SCRIPT_THREADED_DISPATCH
+        }
+#endif
+        returnto:
+        // return addresses are bytecode offsets, shared with interpret()
+        if ((unsigned long long)tmp >= len) {
+            SCRIPT_JUMP(ninstructions);
+        }
+        target = starts[tmp];
+        if (target == NO_INSTRUCTION) {
+            result = Result::OutOfBoundsExec;
+            goto fail;
+        }
+        SCRIPT_JUMP(target);
+        timeout:
+        if (ip->op == OpHalt) {
+            ctx->executed = cycles - 1;
+            return result;
+        }
+        cycles--;
+        result = Result::Timeout;
+        fail:
+        ctx->executed = cycles;
+        printf("Program counter: 0x%04llX\n", (unsigned long long)ip->offset);
+        printf("Stack pointer: 0x%04llX\n", (unsigned long long)sp);
+        printf("Accumulator: 0x%016llX\n", acc.i);
+        return result;
+        #undef SCRIPT_OP
+        #undef SCRIPT_DISPATCH
+        #undef SCRIPT_NEXT
+        #undef SCRIPT_JUMP
+        #undef SCRIPT_CHECK
+        #undef SCRIPT_COUNT
     }
-    unsigned long long nextl(size_t &i) {
-        unsigned int tmp = nexti(i);
-        unsigned int tmp2 = nexti(i);
+    unsigned long long nextl(size_t &i, Result& result) const {
+        unsigned int tmp = nexti(i, result);
+        unsigned int tmp2 = nexti(i, result);
         return (tmp & 0xffffffff) | ((unsigned long long)tmp2 << 32);
     }
-    unsigned int nexti(size_t &i) {
-        unsigned short tmp = nextw(i);
-        unsigned short tmp2 = nextw(i);
+    unsigned int nexti(size_t &i, Result& result) const {
+        unsigned short tmp = nextw(i, result);
+        unsigned short tmp2 = nextw(i, result);
         return (tmp & 0xffff) | ((unsigned int)tmp2 << 16);
     }
-    unsigned short nextw(size_t &i) {
-        unsigned char tmp = next(i);
-        unsigned char tmp2 = next(i);
+    unsigned short nextw(size_t &i, Result& result) const {
+        unsigned char tmp = next(i, result);
+        unsigned char tmp2 = next(i, result);
         return (tmp & 0xff) | ((unsigned short)tmp2<<8);
     }
-    unsigned char next(size_t &i) {
+    unsigned char next(size_t &i, Result& result) const {
         if (i < len)
             return bytecode[i++];
         result = Result::OutOfBoundsRead;
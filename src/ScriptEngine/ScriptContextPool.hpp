@@ -0,0 +1,49 @@
+#ifndef __SCRIPT_CONTEXT_POOL_HPP__
+#define __SCRIPT_CONTEXT_POOL_HPP__
+
+#include "../DynamicArray.hpp"
+#include "ScriptBytecode.hpp"
+
+/* Hands out script contexts from blocks of BLOCK_SIZE, reusing released contexts before allocating more.
+   Contexts stay valid until the pool is destroyed, so entities can hold on to them across frames. */
+class ScriptContextPool {
+    static constexpr const size_t BLOCK_SIZE = 64;
+    DynamicArray<ScriptBytecode::Context*, 16> blocks;
+    ScriptBytecode::Context *freeList = nullptr;
+    size_t blockUsed = BLOCK_SIZE;
+    size_t inUse = 0;
+    public:
+    /* Return a cleared context. */
+    ScriptBytecode::Context* acquire() {
+        ScriptBytecode::Context *ctx = freeList;
+        if (ctx != nullptr) {
+            freeList = ctx->nextFree;
+        } else {
+            if (blockUsed == BLOCK_SIZE) {
+                blocks.append(new ScriptBytecode::Context[BLOCK_SIZE]);
+                blockUsed = 0;
+            }
+            ctx = &blocks[blocks.length()-1][blockUsed++];
+        }
+        ctx->reset();
+        inUse++;
+        return ctx;
+    }
+    /* Return a context to the pool. */
+    void release(ScriptBytecode::Context *ctx) {
+        if (ctx == nullptr) {
+            return;
+        }
+        ctx->nextFree = freeList;
+        freeList = ctx;
+        inUse--;
+    }
+    size_t used() {
+        return inUse;
+    }
+    size_t allocated() {
+        return blocks.length() * BLOCK_SIZE;
+    }
+};
+
+#endif
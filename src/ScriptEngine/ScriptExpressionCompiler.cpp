@@ -0,0 +1,812 @@
+#include "ScriptExpressionCompiler.hpp"
+#include "ScriptBytecode.hpp"
+#include <cctype>
+#include <climits>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+static constexpr const char *mnemonics[] {
+    "vadd", "vsub", "vmul", "vdiv", "vmod", "vand", "vor", "vxor",
+    "veq", "vneq", "vgt", "vlt", "vgteq", "vlteq", "vabs", "vsqrt", "vitof", "vftoi",
+};
+// interface functions: assembly name, argument types ('i' int, 'f' float) and result ('v' for none)
+static constexpr const struct {
+    const char *name;
+    const char *args;
+    char result;
+} functions[] {
+    {"gettile", "iii", 'i'}, {"getlight", "iii", 'i'}, {"tilelight", "i", 'i'},
+    {"tileissolid", "i", 'i'}, {"tileisspawnable", "i", 'i'}, {"tileiswall", "i", 'i'},
+    {"tilefloor", "i", 'i'}, {"tileceiling", "i", 'i'}, {"tilewall", "i", 'i'},
+    {"camerax", "", 'f'}, {"cameray", "", 'f'}, {"cameraz", "", 'f'},
+    {"entityx", "i", 'f'}, {"entityy", "i", 'f'}, {"entityz", "i", 'f'},
+    {"entitymovetowards", "iffff", 'v'}, {"entityrotate", "if", 'v'}, {"entityteleport", "ifff", 'v'},
+    {"canseeplayer", "i", 'i'}, {"getentitytimer", "i", 'f'}, {"setentitytimer", "if", 'v'},
+    {"randomteleportentity", "iffi", 'v'}, {"getdeltatime", "", 'f'},
+    {"tileflags", "iii", 'i'}, {"areaflags", "iiiii", 'i'}, {"areacount", "iiiii", 'i'},
+};
+static constexpr const char *keywords[] {
+    "if", "else", "while", "yield", "end", "return", "int", "float", "abs", "sqrt", "random",
+};
+
+typedef union { long long i; double f; } ExpressionValue;
+
+/* Digits are accumulated like ScriptAssemblyCompiler::next() does, so a literal has the same value in both
+   front ends. */
+static double parseFloat(const char *s, size_t len) {
+    long long num = 0;
+    double dec = 0;
+    double place = 0.1f;
+    bool decimal = false;
+    for (size_t i=0; i<len; i++) {
+        if (s[i] == '.') {
+            decimal = true;
+        } else if (decimal) {
+            dec += (s[i] - '0') * place;
+            place *= 0.1f;
+        } else {
+            num = num * 10 + s[i] - '0';
+        }
+    }
+    return dec + num;
+}
+
+/* Evaluate an operator on constants the way the V opcodes do. False if the result is undefined. */
+bool ScriptExpressionCompiler::fold(unsigned char op, bool isFloat, long long x, long long y, long long& out) {
+    ExpressionValue a = {.i = x}, b = {.i = y}, r;
+    if (isFloat) {
+        switch (op) {
+            case Add: r.f = a.f + b.f; break;
+            case Sub: r.f = a.f - b.f; break;
+            case Mul: r.f = a.f * b.f; break;
+            case Div: r.f = a.f / b.f; break;
+            case EQ: r.i = a.f == b.f; break;
+            case NEQ: r.i = a.f != b.f; break;
+            case GT: r.i = a.f > b.f; break;
+            case LT: r.i = a.f < b.f; break;
+            case GTEQ: r.i = a.f >= b.f; break;
+            case LTEQ: r.i = a.f <= b.f; break;
+            default: return false;
+        }
+        out = r.i;
+        return true;
+    }
+    switch (op) {
+        case Add: out = (unsigned long long)x + y; return true;
+        case Sub: out = (unsigned long long)x - y; return true;
+        case Mul: out = (unsigned long long)x * y; return true;
+        case Div: case Mod:
+            if (x == LLONG_MIN && y == -1) {
+                return false;
+            }
+            out = y == 0 ? -1 : op == Div ? x / y : x % y;
+            return true;
+        case And: out = x & y; return true;
+        case Or: out = x | y; return true;
+        case Xor: out = x ^ y; return true;
+        case EQ: out = x == y; return true;
+        case NEQ: out = x != y; return true;
+        case GT: out = x > y; return true;
+        case LT: out = x < y; return true;
+        case GTEQ: out = x >= y; return true;
+        case LTEQ: out = x <= y; return true;
+        default: return false;
+    }
+}
+
+ScriptExpressionCompiler::ScriptExpressionCompiler() {
+    data = nullptr;
+    datalen = pos = 0;
+    lno = line = 1;
+    tok = {TEnd, nullptr, 0, 0, 1};
+    failed = false;
+    nextVar = 1;
+    tempTop = (int)ScriptBytecode::MAX_VARS - 1;
+    lowestTemp = (int)ScriptBytecode::MAX_VARS;
+    labels = 0;
+}
+
+ScriptExpressionCompiler::~ScriptExpressionCompiler() {
+    nodes.resize(0);
+    outbuf.resize(0);
+}
+
+int ScriptExpressionCompiler::error(const char *fmt, ...) {
+    if (!failed) {
+        char msg[256];
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(msg, sizeof(msg), fmt, args);
+        va_end(args);
+        printf("Warning: error loading script: %s (line %llu)\n", msg, (unsigned long long)line);
+    }
+    failed = true;
+    return -1;
+}
+
+#pragma region Lexer
+ScriptExpressionCompiler::Token ScriptExpressionCompiler::lex() {
+    // whitespace and comments
+    while (pos < datalen) {
+        char c = data[pos];
+        if (c == '\n') {
+            lno++;
+        }
+        if (c == '/' && pos + 1 < datalen && data[pos+1] == '/') {
+            while (pos < datalen && data[pos] != '\n') {
+                pos++;
+            }
+        } else if (c > 0 && c <= ' ') {
+            pos++;
+        } else {
+            break;
+        }
+    }
+    Token t = {TEnd, &data[pos], 0, 0, lno};
+    if (pos >= datalen) {
+        return t;
+    }
+    size_t start = pos;
+    char c = data[pos];
+    if (isalpha(c) || c == '_') {
+        while (pos < datalen && (isalnum(data[pos]) || data[pos] == '_')) {
+            pos++;
+        }
+        t.kind = TName;
+    } else if (isdigit(c) || (c == '.' && pos + 1 < datalen && isdigit(data[pos+1]))) {
+        if (c == '0' && pos + 1 < datalen && (data[pos+1] == 'x' || data[pos+1] == 'X')) {
+            pos += 2;
+            while (pos < datalen && isxdigit(data[pos])) {
+                t.value = t.value * 16 + (isdigit(data[pos]) ? data[pos] - '0' : tolower(data[pos]) - 'a' + 10);
+                pos++;
+            }
+            t.kind = TInt;
+        } else {
+            bool isfloat = false;
+            while (pos < datalen && (isdigit(data[pos]) || (data[pos] == '.' && !isfloat))) {
+                isfloat |= data[pos] == '.';
+                pos++;
+            }
+            size_t end = pos;
+            if (pos < datalen && (data[pos] == 'f' || data[pos] == 'F')) {
+                isfloat = true;
+                pos++;
+            }
+            if (isfloat) {
+                ExpressionValue v;
+                v.f = parseFloat(&data[start], end - start);
+                t.value = v.i;
+                t.kind = TFloat;
+            } else {
+                for (size_t i=start; i<end; i++) {
+                    t.value = t.value * 10 + data[i] - '0';
+                }
+                t.kind = TInt;
+            }
+        }
+    } else if (c == '#') {
+        while (pos < datalen && data[pos] > ' ' && !strchr(",;(){}", data[pos])) {
+            pos++;
+        }
+        t.kind = TRef;
+    } else {
+        static constexpr const char *ops[] {
+            "==", "!=", "<=", ">=", "&&", "||",
+            "+", "-", "*", "/", "%", "&", "|", "^", "!", "<", ">", "=", "(", ")", "{", "}", ",", ";",
+        };
+        for (const char *op : ops) {
+            size_t len = strlen(op);
+            if (pos + len <= datalen && !memcmp(&data[pos], op, len)) {
+                pos += len;
+                t.kind = TOp;
+                break;
+            }
+        }
+        if (t.kind != TOp) {
+            line = lno;
+            error("Unexpected character '%c'", c);
+            pos = datalen;
+            return t;
+        }
+    }
+    t.len = pos - start;
+    return t;
+}
+
+ScriptExpressionCompiler::Token ScriptExpressionCompiler::peekToken() {
+    size_t p = pos, l = lno;
+    Token t = lex();
+    pos = p;
+    lno = l;
+    return t;
+}
+
+void ScriptExpressionCompiler::advance() {
+    line = tok.line;
+    tok = lex();
+}
+
+bool ScriptExpressionCompiler::isOp(const char *op) {
+    return tok.kind == TOp && tok.len == strlen(op) && !memcmp(tok.start, op, tok.len);
+}
+
+bool ScriptExpressionCompiler::isName(const char *name) {
+    return tok.kind == TName && tok.len == strlen(name) && !memcmp(tok.start, name, tok.len);
+}
+
+bool ScriptExpressionCompiler::expect(const char *op) {
+    if (!isOp(op)) {
+        error("Expected '%s'", op);
+        return false;
+    }
+    advance();
+    return true;
+}
+#pragma endregion
+
+#pragma region Parser
+int ScriptExpressionCompiler::node(NodeKind kind, Type type) {
+    Node n = {kind, type, type, 0, 0, nullptr, 0, {-1, -1, -1, -1, -1}, 0};
+    nodes.append(n);
+    return nodes.length() - 1;
+}
+
+int ScriptExpressionCompiler::constant(Type type, long long value) {
+    int n = node(NConst, type);
+    nodes[n].value = value;
+    return n;
+}
+
+/* A node that has to produce a value. */
+int ScriptExpressionCompiler::value(int n) {
+    if (n >= 0 && nodes[n].type == Void) {
+        return error("Function has no value");
+    }
+    return n;
+}
+
+int ScriptExpressionCompiler::convert(int n, Type type) {
+    if (n < 0 || nodes[n].type == type) {
+        return n;
+    }
+    if (nodes[n].kind == NConst && type == Float) {
+        ExpressionValue v;
+        v.f = nodes[n].value;
+        return constant(Float, v.i);
+    }
+    return unary(type == Float ? Itof : Ftoi, n);
+}
+
+int ScriptExpressionCompiler::unary(unsigned char op, int x) {
+    x = value(x);
+    if (x < 0) {
+        return -1;
+    }
+    Type type = nodes[x].type;
+    if (op == Sqrt) {
+        x = convert(x, Float);
+        type = Float;
+    }
+    int n = node(NUnary, op == Itof ? Float : op == Ftoi ? Int : type);
+    nodes[n].operands = nodes[x].type;
+    nodes[n].op = op;
+    nodes[n].args[0] = x;
+    nodes[n].nargs = 1;
+    return n;
+}
+
+int ScriptExpressionCompiler::binary(unsigned char op, int x, int y) {
+    x = value(x);
+    y = value(y);
+    if (x < 0 || y < 0) {
+        return -1;
+    }
+    bool isFloat = nodes[x].type == Float || nodes[y].type == Float;
+    int n;
+    if (op == LogicAnd || op == LogicOr) {
+        if (isFloat) {
+            return error("Logical operator on a float");
+        }
+        n = node(op == LogicAnd ? NAnd : NOr, Int);
+    } else {
+        if (isFloat && (op == And || op == Or || op == Xor)) {
+            return error("Bitwise operator on a float");
+        }
+        if (isFloat) {
+            x = convert(x, Float);
+            y = convert(y, Float);
+        }
+        long long folded;
+        if (nodes[x].kind == NConst && nodes[y].kind == NConst &&
+            fold(op, isFloat, nodes[x].value, nodes[y].value, folded)) {
+            return constant(op >= EQ || !isFloat ? Int : Float, folded);
+        }
+        n = node(NBinary, op >= EQ || !isFloat ? Int : Float);
+        nodes[n].operands = isFloat ? Float : Int;
+        nodes[n].op = op;
+    }
+    nodes[n].args[0] = x;
+    nodes[n].args[1] = y;
+    nodes[n].nargs = 2;
+    return n;
+}
+
+/* A parenthesized argument list. Returns the argument count, or -1 on error. */
+int ScriptExpressionCompiler::arguments(int *args, int max) {
+    if (!expect("(")) {
+        return -1;
+    }
+    int count = 0;
+    while (!failed && !isOp(")")) {
+        if (count > 0 && !expect(",")) {
+            return -1;
+        }
+        int arg = value(expression());
+        if (count < max) {
+            args[count] = arg;
+        }
+        count++;
+    }
+    return expect(")") ? count : -1;
+}
+
+int ScriptExpressionCompiler::primary() {
+    if (failed) {
+        return -1;
+    }
+    int n;
+    if (tok.kind == TInt || tok.kind == TFloat) {
+        n = constant(tok.kind == TInt ? Int : Float, tok.value);
+        advance();
+        return n;
+    } else if (tok.kind == TRef) {
+        n = node(NRef, Int);
+        nodes[n].text = tok.start;
+        nodes[n].len = tok.len;
+        advance();
+        return n;
+    } else if (isOp("(")) {
+        advance();
+        n = expression();
+        return expect(")") ? n : -1;
+    } else if (tok.kind != TName) {
+        return error("Expected an expression");
+    }
+    char name[64];
+    if (tok.len >= sizeof(name)) {
+        return error("Name too long");
+    }
+    memcpy(name, tok.start, tok.len);
+    name[tok.len] = 0;
+    advance();
+    int args[5];
+    if (!strcmp(name, "random")) {
+        if (arguments(args, 0) != 0) {
+            return error("random() takes no arguments");
+        }
+        return node(NRandom, Int);
+    }
+    if (!strcmp(name, "int") || !strcmp(name, "float") || !strcmp(name, "abs") || !strcmp(name, "sqrt")) {
+        if (arguments(args, 1) != 1) {
+            return error("%s() takes one argument", name);
+        }
+        if (name[0] == 'i' || name[0] == 'f') {
+            return convert(args[0], name[0] == 'i' ? Int : Float);
+        }
+        return unary(name[0] == 'a' ? Abs : Sqrt, args[0]);
+    }
+    if (!strncmp(name, "arg", 3) && name[3] >= '0' && name[3] <= '7' && name[4] == 0) {
+        n = node(NArg, Int);
+        nodes[n].value = name[3] - '0';
+        return n;
+    }
+    char lower[64];
+    for (size_t i=0; i<sizeof(lower); i++) {
+        lower[i] = tolower(name[i]);
+    }
+    for (size_t k=0; k<sizeof(functions)/sizeof(functions[0]); k++) {
+        if (!strcmp(lower, functions[k].name)) {
+            int argc = strlen(functions[k].args);
+            int count = arguments(args, 5);
+            if (count < 0) {
+                return -1;
+            } else if (count != argc) {
+                return error("%s() takes %d argument%s", name, argc, argc == 1 ? "" : "s");
+            }
+            Type result = functions[k].result == 'v' ? Void : functions[k].result == 'i' ? Int : Float;
+            n = node(NCall, result);
+            for (int i=0; i<argc; i++) {
+                int arg = convert(args[i], functions[k].args[i] == 'i' ? Int : Float);
+                if (arg < 0) {
+                    return -1;
+                }
+                nodes[n].args[i] = arg;
+            }
+            nodes[n].op = k;
+            nodes[n].nargs = argc;
+            return n;
+        }
+    }
+    if (!variables.has(name)) {
+        return error("Unknown variable '%s'", name);
+    }
+    Variable& v = variables[name];
+    n = node(NVar, v.type);
+    nodes[n].value = v.var;
+    return n;
+}
+
+int ScriptExpressionCompiler::prefix() {
+    if (isOp("-")) {
+        advance();
+        int x = value(prefix());
+        if (x < 0) {
+            return -1;
+        }
+        Type type = nodes[x].type;
+        if (nodes[x].kind == NConst) {
+            ExpressionValue v = {.i = nodes[x].value};
+            if (type == Float) {
+                v.f = -v.f;
+            } else {
+                v.i = -(unsigned long long)v.i;
+            }
+            return constant(type, v.i);
+        }
+        // multiplying by -1.0 keeps the sign of a float zero, 0.0 - x wouldn't
+        return type == Float ? binary(Mul, x, constant(Float, 0xBFF0000000000000LL)) : binary(Sub, constant(Int, 0), x);
+    } else if (isOp("!")) {
+        advance();
+        int x = value(prefix());
+        if (x >= 0 && nodes[x].type != Int) {
+            return error("Logical operator on a float");
+        }
+        return binary(EQ, x, constant(Int, 0));
+    }
+    return primary();
+}
+
+int ScriptExpressionCompiler::expression(int level) {
+    // binary operators by precedence level, lowest first
+    static constexpr const struct {
+        const char *op;
+        int level;
+        unsigned char code;
+    } operators[] {
+        {"||", 0, LogicOr}, {"&&", 1, LogicAnd},
+        {"==", 2, EQ}, {"!=", 2, NEQ}, {">", 2, GT}, {"<", 2, LT}, {">=", 2, GTEQ}, {"<=", 2, LTEQ},
+        {"|", 3, Or}, {"^", 4, Xor}, {"&", 5, And}, {"+", 6, Add}, {"-", 6, Sub}, {"*", 7, Mul}, {"/", 7, Div},
+        {"%", 7, Mod},
+    };
+    if (level == 8) {
+        return prefix();
+    }
+    int left = expression(level+1);
+    while (!failed && tok.kind == TOp) {
+        int code = -1;
+        for (size_t k=0; k<sizeof(operators)/sizeof(operators[0]); k++) {
+            if (operators[k].level == level && isOp(operators[k].op)) {
+                code = operators[k].code;
+                break;
+            }
+        }
+        if (code < 0) {
+            break;
+        }
+        advance();
+        left = binary(code, left, expression(level+1));
+    }
+    return left;
+}
+
+int ScriptExpressionCompiler::condition() {
+    int n = value(expression());
+    if (n >= 0 && nodes[n].type != Int) {
+        return error("Condition must be an int");
+    }
+    return n;
+}
+#pragma endregion
+
+#pragma region Code generation
+void ScriptExpressionCompiler::emit(const char *fmt, ...) {
+    char line[512];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    for (int i=0; i<len && i<(int)sizeof(line)-1; i++) {
+        outbuf.append(line[i]);
+    }
+    outbuf.append('\n');
+}
+
+int ScriptExpressionCompiler::temp() {
+    if (tempTop < 1) {
+        error("Expression too complex");
+        return 0;
+    }
+    if (tempTop < lowestTemp) {
+        lowestTemp = tempTop;
+    }
+    return tempTop--;
+}
+
+/* Generate code leaving the value of node n in variable dest, or in any variable if dest is negative.
+   Returns the variable holding the value. Variables aren't written until the value is complete, so dest may
+   appear in the expression. */
+int ScriptExpressionCompiler::gen(int n, int dest) {
+    const Node& nd = nodes[n];
+    int mark = tempTop, r, x, y;
+    switch (nd.kind) {
+        case NConst:
+            if (nd.value == 0 && dest < 0) {
+                // variable 0 always reads 0
+                return 0;
+            }
+            r = dest >= 0 ? dest : temp();
+            emit("%s %d %lld", nd.value >= INT_MIN && nd.value <= INT_MAX ? "vset32" : "vset64", r, nd.value);
+            return r;
+        case NRef:
+            r = dest >= 0 ? dest : temp();
+            emit("vset32 %d %.*s", r, (int)nd.len, nd.text);
+            return r;
+        case NVar:
+            if (dest < 0 || dest == nd.value) {
+                return nd.value;
+            }
+            emit("vmov %d %lld", dest, nd.value);
+            return dest;
+        case NArg:
+            r = dest >= 0 ? dest : temp();
+            emit("varg %d %lld", r, nd.value);
+            return r;
+        case NRandom:
+            r = dest >= 0 ? dest : temp();
+            emit("vrandom %d", r);
+            return r;
+        case NUnary:
+            x = gen(nd.args[0], -1);
+            tempTop = mark;
+            r = dest >= 0 ? dest : temp();
+            emit("%s%s %d %d", mnemonics[nd.op], nd.operands == Float && nd.op <= Sqrt ? "f" : "", r, x);
+            return r;
+        case NBinary:
+            x = gen(nd.args[0], -1);
+            y = gen(nd.args[1], -1);
+            tempTop = mark;
+            r = dest >= 0 ? dest : temp();
+            emit("%s%s %d %d %d", mnemonics[nd.op], nd.operands == Float ? "f" : "", r, x, y);
+            return r;
+        case NAnd:
+        case NOr:
+            {
+                int no = labels++, done = labels++;
+                r = dest >= 0 ? dest : temp();
+                cond(n, false, no);
+                emit("vset32 %d 1", r);
+                emit("ba @L%d", done);
+                emit(":L%d", no);
+                emit("vset32 %d 0", r);
+                emit(":L%d", done);
+            }
+            return r;
+        case NCall:
+            return genCall(n, dest, false);
+    }
+    return 0;
+}
+
+/* Interface calls take their arguments from consecutive variables. A discarded result goes to variable 0. */
+int ScriptExpressionCompiler::genCall(int n, int dest, bool discard) {
+    const Node& nd = nodes[n];
+    int mark = tempTop, first = 0;
+    if (nd.nargs > 0) {
+        first = tempTop - nd.nargs + 1;
+        if (first < 1) {
+            return error("Expression too complex");
+        }
+        tempTop = first - 1;
+        if (first < lowestTemp) {
+            lowestTemp = first;
+        }
+        for (int k=0; k<nd.nargs; k++) {
+            gen(nd.args[k], first + k);
+        }
+    }
+    tempTop = mark;
+    int r = discard || nd.type == Void ? 0 : dest >= 0 ? dest : temp();
+    emit("vcall %s %d %d", functions[nd.op].name, r, first);
+    return r;
+}
+
+/* Branch to label if the condition n is non-zero (jump set) or zero (jump clear). */
+void ScriptExpressionCompiler::cond(int n, bool jump, int label) {
+    const Node& nd = nodes[n];
+    int mark = tempTop, r;
+    if (nd.kind == NAnd || nd.kind == NOr) {
+        // a && b jumps when false as soon as a is false, a || b jumps when true as soon as a is true
+        if (jump == (nd.kind == NOr)) {
+            cond(nd.args[0], jump, label);
+            cond(nd.args[1], jump, label);
+        } else {
+            int skip = labels++;
+            cond(nd.args[0], !jump, skip);
+            cond(nd.args[1], jump, label);
+            emit(":L%d", skip);
+        }
+        return;
+    }
+    if (nd.kind == NConst) {
+        if ((nd.value != 0) == jump) {
+            emit("ba @L%d", label);
+        }
+        return;
+    }
+    if (nd.kind == NBinary && nd.operands == Int && (nd.op == EQ || nd.op == NEQ)) {
+        // comparisons against 0 test the other side directly
+        int other = -1;
+        if (nodes[nd.args[1]].kind == NConst && nodes[nd.args[1]].value == 0) {
+            other = nd.args[0];
+        } else if (nodes[nd.args[0]].kind == NConst && nodes[nd.args[0]].value == 0) {
+            other = nd.args[1];
+        }
+        if (other >= 0) {
+            r = gen(other, -1);
+            tempTop = mark;
+            emit("%s %d @L%d", (nd.op == EQ) == jump ? "vbz" : "vbnz", r, label);
+            return;
+        }
+    }
+    r = gen(n, -1);
+    tempTop = mark;
+    emit("%s %d @L%d", jump ? "vbnz" : "vbz", r, label);
+}
+#pragma endregion
+
+#pragma region Statements
+void ScriptExpressionCompiler::statement() {
+    if (isOp(";")) {
+        advance();
+    } else if (isName("if")) {
+        ifStatement();
+    } else if (isName("while")) {
+        advance();
+        int c = condition();
+        if (c < 0) {
+            return;
+        }
+        // the condition is tested at the bottom, entering through a test that skips the loop
+        int top = labels++, done = labels++;
+        cond(c, false, done);
+        emit(":L%d", top);
+        block();
+        cond(c, true, top);
+        emit(":L%d", done);
+    } else if (isName("yield") || isName("end")) {
+        emit("%s", isName("yield") ? "yield" : "end");
+        advance();
+    } else if (isName("return")) {
+        advance();
+        int n = value(expression());
+        if (n >= 0) {
+            emit("rv 0 %d", gen(n, -1));
+            emit("end");
+        }
+    } else if ((isName("int") || isName("float")) && peekToken().kind == TName) {
+        Type type = isName("int") ? Int : Float;
+        advance();
+        assignment(type);
+    } else if (tok.kind == TName && peekToken().kind == TOp && peekToken().len == 1 && peekToken().start[0] == '=') {
+        assignment(Void);
+    } else if (tok.kind == TEnd) {
+        error("Unexpected end of script");
+    } else {
+        int n = expression();
+        if (n >= 0 && nodes[n].kind != NCall) {
+            error("Statement has no effect");
+        } else if (n >= 0) {
+            genCall(n, -1, true);
+        }
+    }
+}
+
+void ScriptExpressionCompiler::block() {
+    if (!expect("{")) {
+        return;
+    }
+    while (!failed && !isOp("}") && tok.kind != TEnd) {
+        statement();
+    }
+    expect("}");
+}
+
+void ScriptExpressionCompiler::ifStatement() {
+    advance();
+    int c = condition();
+    if (c < 0) {
+        return;
+    }
+    int otherwise = labels++;
+    cond(c, false, otherwise);
+    block();
+    if (isName("else")) {
+        int done = labels++;
+        emit("ba @L%d", done);
+        emit(":L%d", otherwise);
+        advance();
+        if (isName("if")) {
+            ifStatement();
+        } else {
+            block();
+        }
+        emit(":L%d", done);
+    } else {
+        emit(":L%d", otherwise);
+    }
+}
+
+/* "name = expr", or a declaration of the given type with an optional initial value. */
+void ScriptExpressionCompiler::assignment(Type declared) {
+    char name[64];
+    if (tok.len >= sizeof(name)) {
+        error("Name too long");
+        return;
+    }
+    memcpy(name, tok.start, tok.len);
+    name[tok.len] = 0;
+    for (const char *keyword : keywords) {
+        if (!strcmp(name, keyword)) {
+            error("'%s' is not a variable name", name);
+            return;
+        }
+    }
+    if (!strncmp(name, "arg", 3) && name[3] >= '0' && name[3] <= '7' && name[4] == 0) {
+        error("'%s' is not a variable name", name);
+        return;
+    }
+    advance();
+    if (declared != Void && variables.has(name)) {
+        error("Variable '%s' already defined", name);
+        return;
+    }
+    int n = -1;
+    if (declared == Void || isOp("=")) {
+        expect("=");
+        n = value(expression());
+        if (n < 0) {
+            return;
+        }
+    }
+    if (!variables.has(name)) {
+        variables.add(name, {nextVar++, declared != Void ? declared : nodes[n].type});
+    }
+    Variable v = variables[name];
+    if (n >= 0) {
+        n = convert(n, v.type);
+        if (n >= 0) {
+            gen(n, v.var);
+        }
+    }
+}
+
+size_t ScriptExpressionCompiler::compile(const char *data, size_t datalen, char **out) {
+    this->data = data;
+    this->datalen = datalen;
+    advance();
+    while (!failed && tok.kind != TEnd) {
+        statement();
+    }
+    if (!failed && nextVar > lowestTemp) {
+        error("Too many variables (%d named, %d temporary)", nextVar - 1, (int)ScriptBytecode::MAX_VARS - lowestTemp);
+    }
+    if (failed) {
+        *out = nullptr;
+        return 0;
+    }
+    outbuf.append(0);
+    *out = outbuf.collapse();
+    return outbuf.length() - 1;
+}
+#pragma endregion
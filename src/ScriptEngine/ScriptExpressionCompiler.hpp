@@ -0,0 +1,116 @@
+#ifndef __SCRIPT_EXPRESSION_COMPILER_HPP__
+#define __SCRIPT_EXPRESSION_COMPILER_HPP__
+
+#include "../Dictionary.hpp"
+#include "../DynamicArray.hpp"
+#include <cstddef>
+
+/* Front end for ".scr" scripts: a small expression language translated to assembly for ScriptAssemblyCompiler,
+   using the three-address V opcodes on the script variables.
+
+       // drift towards the player, and give up after five seconds out of sight
+       entityMoveTowards(arg0, cameraX(), cameraY(), cameraZ(), 1.25)
+       if canSeePlayer(arg0) == 0 && getEntityTimer(arg0) > 5.0 {
+           randomTeleportEntity(arg0, 10.0, 40.0, 0)
+       }
+
+   Statements are assignments, interface calls, "int name" and "float name" declarations, if/else if/else, while,
+   yield, end and "return expr" (sets return value 0 and ends). Values are ints or floats: a number with a '.' or an
+   'f' suffix is a float, a variable has the type of its declaration or first assignment, and ints are converted
+   where they meet floats. Operators are || && == != < > <= >= | ^ & + - * / % and unary - !, with the bitwise
+   operators binding tighter than comparisons; conditions take ints. Builtins are int(x), float(x), abs(x),
+   sqrt(x), random(), arg0 to arg7 and #texture:/#tile:/#entity: references. Interface calls are case insensitive.
+   Named variables are numbered from 1, temporaries from the top of the variable file down. */
+class ScriptExpressionCompiler {
+    enum Type : unsigned char {
+        Void, Int, Float,
+    };
+    enum TokenKind : unsigned char {
+        TEnd, TName, TInt, TFloat, TRef, TOp,
+    };
+    typedef struct {
+        TokenKind kind;
+        const char *start;
+        size_t len;
+        long long value; // integer value, or the bits of a float
+        size_t line;
+    } Token;
+    // operators and builtins, in the order of their V opcode mnemonics
+    enum Op : unsigned char {
+        Add, Sub, Mul, Div, Mod, And, Or, Xor, EQ, NEQ, GT, LT, GTEQ, LTEQ, Abs, Sqrt, Itof, Ftoi,
+        LogicAnd, LogicOr,
+    };
+    enum NodeKind : unsigned char {
+        NConst, NRef, NVar, NArg, NRandom, NUnary, NBinary, NAnd, NOr, NCall,
+    };
+    typedef struct {
+        NodeKind kind;
+        Type type;
+        Type operands; // type the operands of NUnary/NBinary are computed in
+        unsigned char op; // Op of NUnary/NBinary, interface function of NCall
+        long long value; // constant (bits of a float), variable or argument number
+        const char *text; // reference as written
+        size_t len;
+        int args[5];
+        int nargs;
+    } Node;
+    typedef struct {
+        int var;
+        Type type;
+    } Variable;
+
+    const char *data;
+    size_t datalen;
+    size_t pos;
+    size_t lno;
+    size_t line; // line of the last token read, for errors
+    Token tok;
+    bool failed;
+    Dictionary<Variable> variables;
+    int nextVar;
+    int tempTop; // highest free temporary
+    int lowestTemp;
+    int labels;
+    DynamicArray<Node, 64> nodes;
+    DynamicArray<char, 1024> outbuf;
+
+    static bool fold(unsigned char op, bool isFloat, long long x, long long y, long long& out);
+    int error(const char *fmt, ...);
+    Token lex();
+    Token peekToken();
+    void advance();
+    bool isOp(const char *op);
+    bool isName(const char *name);
+    bool expect(const char *op);
+
+    int node(NodeKind kind, Type type);
+    int constant(Type type, long long value);
+    int value(int n);
+    int convert(int n, Type type);
+    int unary(unsigned char op, int x);
+    int binary(unsigned char op, int x, int y);
+    int arguments(int *args, int max);
+    int primary();
+    int prefix();
+    int expression(int level=0);
+    int condition();
+
+    void emit(const char *fmt, ...);
+    int temp();
+    int gen(int n, int dest);
+    int genCall(int n, int dest, bool discard);
+    void cond(int n, bool jump, int label);
+
+    void statement();
+    void block();
+    void ifStatement();
+    void assignment(Type declared);
+    public:
+    ScriptExpressionCompiler();
+    ~ScriptExpressionCompiler();
+    /* Translate source into NUL terminated assembly text, free with delete []. Returns the text length, or 0 after
+       printing a warning if the source has an error. */
+    size_t compile(const char *data, size_t datalen, char **out);
+};
+
+#endif
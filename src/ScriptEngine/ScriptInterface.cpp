@@ -1,17 +1,71 @@
 
 #include "ScriptInterface.hpp"
+#include "ScriptProfiler.hpp"
 #include "../Registries.hpp"
 #include "../MapData.hpp"
 #include "../Engine.hpp"
 #include "raylib.h"
 #include "raymath.h"
+#include <climits>
 
 ScriptInterface* GloablScriptInterface=nullptr;
+thread_local ScriptCommandBuffer* ScriptInterface::commandBuffer=nullptr;
 
-ScriptInterface::ScriptInterface() {}
+ScriptInterface::ScriptInterface() {
+    tileTable = new TileTable();
+}
+
+ScriptInterface::~ScriptInterface() {
+    delete tileTable;
+}
+
+void ScriptInterface::loadTileTable(MapTileRegistry* reg) {
+    tileTable->build(reg);
+}
+
+void ScriptInterface::setCommandBuffer(ScriptCommandBuffer* buffer) {
+    commandBuffer = buffer;
+}
+
+void ScriptInterface::applyCommands(ScriptCommandBuffer& buffer) {
+    for (size_t i=0; i<buffer.commands.length(); i++) {
+        ScriptCommandBuffer::Command& c = buffer.commands[i];
+        if (c.type == ScriptCommandBuffer::RandomTeleport) {
+            randomTeleportEntity(c.entity, c.x, c.y, c.z != 0);
+            continue;
+        }
+        Entity* ent = GlobalEntityRenderer->get(c.entity);
+        if (ent == nullptr) {
+            continue;
+        }
+        switch (c.type) {
+            case ScriptCommandBuffer::Move:
+                ent->Move({c.x, c.y, c.z}, true);
+                break;
+            case ScriptCommandBuffer::Rotate:
+                ent->Rotate(c.x, true);
+                break;
+            case ScriptCommandBuffer::SetTimer:
+                ent->timer = c.x;
+                break;
+        }
+    }
+}
+
+// position of an entity, including a move recorded by the running script
+static Vector3 entityPosition(Entity* ent, ScriptCommandBuffer* buffer, unsigned int id) {
+    if (buffer != nullptr) {
+        ScriptCommandBuffer::Command* c = buffer->pending(ScriptCommandBuffer::Move, id);
+        if (c != nullptr) {
+            return {c->x, c->y, c->z};
+        }
+    }
+    return ent->pos;
+}
 
 bool ScriptInterface::isSolid(unsigned short id) {
-    MapTile* tile = GlobalMapTileRegistry->of(id);
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_isSolid);
+    const MapTile* tile = tileTable->of(id);
     if (tile == nullptr) {
         return false;
     }
@@ -19,7 +73,8 @@ bool ScriptInterface::isSolid(unsigned short id) {
 }
 
 bool ScriptInterface::isSpawnable(unsigned short id) {
-    MapTile* tile = GlobalMapTileRegistry->of(id);
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_isSpawnable);
+    const MapTile* tile = tileTable->of(id);
     if (tile == nullptr) {
         return false;
     }
@@ -27,7 +82,8 @@ bool ScriptInterface::isSpawnable(unsigned short id) {
 }
 
 bool ScriptInterface::isWall(unsigned short id) {
-    MapTile* tile = GlobalMapTileRegistry->of(id);
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_isWall);
+    const MapTile* tile = tileTable->of(id);
     if (tile == nullptr) {
         return false;
     }
@@ -35,7 +91,8 @@ bool ScriptInterface::isWall(unsigned short id) {
 }
 
 unsigned short ScriptInterface::tileFloor(unsigned short id) {
-    MapTile* tile = GlobalMapTileRegistry->of(id);
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_tileFloor);
+    const MapTile* tile = tileTable->of(id);
     if (tile == nullptr) {
         return 0;
     }
@@ -43,7 +100,8 @@ unsigned short ScriptInterface::tileFloor(unsigned short id) {
 }
 
 unsigned short ScriptInterface::tileCeiling(unsigned short id) {
-    MapTile* tile = GlobalMapTileRegistry->of(id);
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_tileCeiling);
+    const MapTile* tile = tileTable->of(id);
     if (tile == nullptr) {
         return 0;
     }
@@ -51,7 +109,8 @@ unsigned short ScriptInterface::tileCeiling(unsigned short id) {
 }
 
 unsigned short ScriptInterface::tileWall(unsigned short id) {
-    MapTile* tile = GlobalMapTileRegistry->of(id);
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_tileWall);
+    const MapTile* tile = tileTable->of(id);
     if (tile == nullptr) {
         return 0;
     }
@@ -59,7 +118,8 @@ unsigned short ScriptInterface::tileWall(unsigned short id) {
 }
 
 float ScriptInterface::tileLightLevel(unsigned short id) {
-    MapTile* tile = GlobalMapTileRegistry->of(id);
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_tileLightLevel);
+    const MapTile* tile = tileTable->of(id);
     if (tile == nullptr) {
         return 0.0f;
     }
@@ -67,10 +127,12 @@ float ScriptInterface::tileLightLevel(unsigned short id) {
 }
 
 unsigned short ScriptInterface::getTileId(int x, int y, int z) {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_getTileId);
     return GlobalMapData->get(x, y, z);
 }
 
 unsigned long ScriptInterface::getLightColor(int x, int y, int z) {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_getLightColor);
     Color* c = GlobalMapData->getLight(x, y, z);
     if (c == nullptr) {
         return 0.0f;
@@ -78,19 +140,77 @@ unsigned long ScriptInterface::getLightColor(int x, int y, int z) {
     return *(unsigned long*)c;
 }
 
+unsigned char ScriptInterface::tileFlags(int x, int y, int z) {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_tileFlags);
+    return tileTable->flagsOf(GlobalMapData->get(x, y, z));
+}
+
+/* Call f with the flags of every tile in a w by d area, a row of a chunk at a time so each row costs one chunk
+   lookup per chunk it crosses rather than one per tile. Tiles outside the level read as tile 0, which has no
+   flags, so areas too far out to index without overflowing are skipped. */
+template<class F>
+static void scanArea(MapData* map, TileTable* table, long long x, int y, long long z, int w, int d, F f) {
+    if (x < INT_MIN / 2 || x > INT_MAX / 2 || z < INT_MIN / 2 || z > INT_MAX / 2) {
+        return;
+    }
+    w = w < 0 ? 0 : w > SCRIPT_AREA_MAX ? SCRIPT_AREA_MAX : w;
+    d = d < 0 ? 0 : d > SCRIPT_AREA_MAX ? SCRIPT_AREA_MAX : d;
+    for (int row=z; row<z+d; row++) {
+        int cx = x;
+        while (cx < x + w) {
+            int i = map->findChunk(cx, y, row);
+            if (i == -1) {
+                f(table->flagsOf(0));
+                cx++;
+                continue;
+            }
+            Vec3I p = map->chunkPosition(i);
+            TileArray* chunk = map->chunk(i);
+            int end = p.x + chunk->width() < x + w ? p.x + chunk->width() : x + w;
+            const unsigned short* tiles = (unsigned short*)*chunk + (row - p.z) * chunk->width();
+            for (; cx < end; cx++) {
+                f(table->flagsOf(tiles[cx - p.x]));
+            }
+        }
+    }
+}
+
+unsigned char ScriptInterface::areaFlags(int x, int y, int z, int w, int d) {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_areaFlags);
+    unsigned char flags = 0;
+    scanArea(GlobalMapData, tileTable, x, y, z, w, d, [&](unsigned char f) {
+        flags |= f;
+    });
+    return flags;
+}
+
+unsigned int ScriptInterface::areaCount(int x, int y, int z, int r, unsigned char mask) {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_areaCount);
+    r = r < 0 ? 0 : r > SCRIPT_AREA_MAX / 2 ? SCRIPT_AREA_MAX / 2 : r;
+    unsigned int count = 0;
+    scanArea(GlobalMapData, tileTable, (long long)x - r, y, (long long)z - r, r*2 + 1, r*2 + 1, [&](unsigned char f) {
+        count += (f & mask) != 0;
+    });
+    return count;
+}
+
 float ScriptInterface::cameraX() {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_cameraX);
     return GlobalEngine->camera.position.x;
 }
 
 float ScriptInterface::cameraY() {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_cameraY);
     return GlobalEngine->camera.position.y;
 }
 
 float ScriptInterface::cameraZ() {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_cameraZ);
     return GlobalEngine->camera.position.z;
 }
 
 float ScriptInterface::entityX(unsigned int id) {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_entityX);
     if (id >= GlobalEntityRenderer->length()) {
         return 0;
     }
@@ -98,10 +218,11 @@ float ScriptInterface::entityX(unsigned int id) {
     if (ent == nullptr) {
         return 0;
     }
-    return ent->pos.x;
+    return entityPosition(ent, commandBuffer, id).x;
 }
 
 float ScriptInterface::entityY(unsigned int id) {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_entityY);
     if (id >= GlobalEntityRenderer->length()) {
         return 0;
     }
@@ -109,10 +230,11 @@ float ScriptInterface::entityY(unsigned int id) {
     if (ent == nullptr) {
         return 0;
     }
-    return ent->pos.y;
+    return entityPosition(ent, commandBuffer, id).y;
 }
 
 float ScriptInterface::entityZ(unsigned int id) {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_entityZ);
     if (id >= GlobalEntityRenderer->length()) {
         return 0;
     }
@@ -120,10 +242,11 @@ float ScriptInterface::entityZ(unsigned int id) {
     if (ent == nullptr) {
         return 0;
     }
-    return ent->pos.z;
+    return entityPosition(ent, commandBuffer, id).z;
 }
 
 void ScriptInterface::entityMoveTowards(unsigned int id, float x, float y, float z, float speed) {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_entityMoveTowards);
     if (id >= GlobalEntityRenderer->length()) {
         return;
     }
@@ -131,12 +254,19 @@ void ScriptInterface::entityMoveTowards(unsigned int id, float x, float y, float
     if (ent == nullptr) {
         return;
     }
-    Vector3 dir = Vector3Scale(Vector3Normalize(Vector3Subtract({x, y, z}, ent->pos)), GlobalEngine->deltatime*speed);
+    Vector3 pos = entityPosition(ent, commandBuffer, id);
+    Vector3 dir = Vector3Scale(Vector3Normalize(Vector3Subtract({x, y, z}, pos)), GlobalEngine->deltatime*speed);
     dir.y = 0;
-    ent->Move(GlobalMapData->MoveTo(ent->pos, dir), true);
+    pos = GlobalMapData->MoveTo(pos, dir);
+    if (commandBuffer != nullptr) {
+        commandBuffer->record(ScriptCommandBuffer::Move, id, pos.x, pos.y, pos.z);
+    } else {
+        ent->Move(pos, true);
+    }
 }
 
 void ScriptInterface::entityRotate(unsigned int id, float r) {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_entityRotate);
     if (id >= GlobalEntityRenderer->length()) {
         return;
     }
@@ -144,9 +274,14 @@ void ScriptInterface::entityRotate(unsigned int id, float r) {
     if (ent == nullptr) {
         return;
     }
-    ent->Rotate(r, true);
+    if (commandBuffer != nullptr) {
+        commandBuffer->record(ScriptCommandBuffer::Rotate, id, r);
+    } else {
+        ent->Rotate(r, true);
+    }
 }
 void ScriptInterface::entityTeleport(unsigned int id, float x, float y, float z) {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_entityTeleport);
     if (id >= GlobalEntityRenderer->length()) {
         return;
     }
@@ -154,10 +289,15 @@ void ScriptInterface::entityTeleport(unsigned int id, float x, float y, float z)
     if (ent == nullptr) {
         return;
     }
-    ent->Move({x, y, z}, true);
+    if (commandBuffer != nullptr) {
+        commandBuffer->record(ScriptCommandBuffer::Move, id, x, y, z);
+    } else {
+        ent->Move({x, y, z}, true);
+    }
 }
 
 bool ScriptInterface::canSeePlayer(unsigned int id) {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_canSeePlayer);
     if (id >= GlobalEntityRenderer->length()) {
         return 0;
     }
@@ -165,14 +305,21 @@ bool ScriptInterface::canSeePlayer(unsigned int id) {
     if (ent == nullptr) {
         return false;
     }
-    Vector3 dir = Vector3Normalize(Vector3Subtract(GlobalEngine->camera.position, ent->pos));
+    // a recorded move invalidates the line of sight, like Entity::Move does
+    bool moved = commandBuffer != nullptr && commandBuffer->pending(ScriptCommandBuffer::Move, id) != nullptr;
+    if (ent->losValid && !moved) {
+        return ent->seesPlayer;
+    }
+    Vector3 pos = entityPosition(ent, commandBuffer, id);
+    Vector3 dir = Vector3Subtract(GlobalEngine->camera.position, pos);
     HitInfo hit;
-    GlobalMapData->RayCast(ent->pos, dir, hit);
-    float dist = Vector3Distance(GlobalEngine->camera.position, ent->pos);
+    float dist = Vector3Length(dir);
+    GlobalMapData->RayCast(pos, dir, dist, hit);
     return (hit.distance >= dist);
 }
 
 float ScriptInterface::getEntityTimer(unsigned int id) {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_getEntityTimer);
     if (id >= GlobalEntityRenderer->length()) {
         return 0;
     }
@@ -180,23 +327,41 @@ float ScriptInterface::getEntityTimer(unsigned int id) {
     if (ent == nullptr) {
         return 0;
     }
+    if (commandBuffer != nullptr) {
+        ScriptCommandBuffer::Command* c = commandBuffer->pending(ScriptCommandBuffer::SetTimer, id);
+        if (c != nullptr) {
+            return c->x;
+        }
+    }
     return ent->timer;
 }
 
 void ScriptInterface::setEntityTimer(unsigned int id, float v) {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_setEntityTimer);
     if (id >= GlobalEntityRenderer->length()) {
         return;
     }
     Entity* ent = GlobalEntityRenderer->get(id);
-    if (ent != nullptr) {
+    if (ent == nullptr) {
+        return;
+    }
+    if (commandBuffer != nullptr) {
+        commandBuffer->record(ScriptCommandBuffer::SetTimer, id, v);
+    } else {
         ent->timer = v;
     }
 }
 
 void ScriptInterface::randomTeleportEntity(unsigned int id, float min_dist, float max_dist, bool avoid_player) {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_randomTeleportEntity);
     if (id >= GlobalEntityRenderer->length()) {
         return;
     }
+    // picks spawn points with rand(), so it runs when the commands are applied to keep the sequence deterministic
+    if (commandBuffer != nullptr) {
+        commandBuffer->record(ScriptCommandBuffer::RandomTeleport, id, min_dist, max_dist, avoid_player);
+        return;
+    }
     Entity* ent = GlobalEntityRenderer->get(id);
     if (ent == nullptr) {
         return;
@@ -215,5 +380,6 @@ void ScriptInterface::randomTeleportEntity(unsigned int id, float min_dist, floa
 }
 
 float ScriptInterface::getDeltaTime() {
+    ScriptProfiler::Scope profile(ScriptProfiler::Call_getDeltaTime);
     return GlobalEngine->deltatime;
 }
\ No newline at end of file
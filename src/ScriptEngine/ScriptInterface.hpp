@@ -2,10 +2,68 @@
 #define __SCRIPT_INTERFACE_HPP__
 
 #include <stdint.h>
+#include "../DynamicArray.hpp"
+
+class MapTileRegistry;
+class TileTable;
+
+// largest side of an area scanned by one areaFlags/areaCount call
+#define SCRIPT_AREA_MAX 64
+
+/* Entity changes made by scripts while running in parallel. They are applied in recording order once every
+   script has run, so the world stays read-only while scripts run. */
+class ScriptCommandBuffer {
+    public:
+    enum Type {
+        Move, Rotate, SetTimer, RandomTeleport,
+    };
+    typedef struct {
+        unsigned char type;
+        unsigned int entity;
+        float x, y, z, w;
+    } Command;
+    DynamicArray<Command> commands;
+    // first command recorded by the script that is running
+    size_t runStart = 0;
+    /* Start recording the commands of another script run. */
+    void beginRun() {
+        runStart = commands.length();
+    }
+    void record(unsigned char type, unsigned int entity, float x=0, float y=0, float z=0, float w=0) {
+        commands.append({type, entity, x, y, z, w});
+    }
+    /* Find the latest command of this type for entity recorded by the running script. */
+    Command* pending(unsigned char type, unsigned int entity) {
+        for (size_t i=commands.length(); i>runStart; i--) {
+            Command& c = commands[i-1];
+            if (c.type == type && c.entity == entity) {
+                return &c;
+            }
+        }
+        return nullptr;
+    }
+    void clear() {
+        commands.clear();
+        runStart = 0;
+    }
+};
 
 class ScriptInterface {
+    // command buffer of the scripts running on this thread, or null to change entities directly
+    static thread_local ScriptCommandBuffer* commandBuffer;
+    // tile properties for the loaded level, rebuilt by loadTileTable()
+    TileTable* tileTable;
     public:
     ScriptInterface();
+    ~ScriptInterface();
+    /* Resolve the tile registry into the flat table tile queries read. Call once per level, before its scripts
+       run; until then every tile reads as not solid with no textures. */
+    void loadTileTable(MapTileRegistry* reg);
+    /* Record entity changes made on this thread into buffer instead of applying them, until reset to null.
+       Entity reads still see changes the running script recorded itself. */
+    static void setCommandBuffer(ScriptCommandBuffer* buffer);
+    /* Apply recorded entity changes in order. */
+    void applyCommands(ScriptCommandBuffer& buffer);
     bool isSolid(unsigned short id);
     bool isSpawnable(unsigned short id);
     bool isWall(unsigned short id);
@@ -15,6 +73,12 @@ class ScriptInterface {
     float tileLightLevel(unsigned short id);
     unsigned short getTileId(int x, int y, int z);
     unsigned long getLightColor(int x, int y, int z);
+    /* TILE_FLAG_* bits of the tile at a position, 0 outside the level. */
+    unsigned char tileFlags(int x, int y, int z);
+    /* Flags of every tile in the w by d area at level y with its lowest corner at x, z, or'ed together. */
+    unsigned char areaFlags(int x, int y, int z, int w, int d);
+    /* Number of tiles within r tiles of x, z (a square) at level y with any of the flags in mask. */
+    unsigned int areaCount(int x, int y, int z, int r, unsigned char mask);
     float cameraX();
     float cameraY();
     float cameraZ();
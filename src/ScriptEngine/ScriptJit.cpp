@@ -0,0 +1,1225 @@
+#include "ScriptJit.hpp"
+#include "../DynamicArray.hpp"
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#ifdef SCRIPT_JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+bool ScriptBytecode::useJit = true;
+
+int ScriptBytecode::runNative(Context& ctx, size_t argc, long long *argv, long long *retval) {
+    return jit->run(*this, ctx, argc, argv, retval);
+}
+
+void ScriptBytecode::unload() {
+    delete jit;
+    delete [] code;
+    delete [] starts;
+    jit = nullptr;
+    code = nullptr;
+    starts = nullptr;
+    ninstructions = 0;
+    decoded = false;
+}
+
+int ScriptJit::run(ScriptBytecode& code, ScriptBytecode::Context& ctx, size_t argc, long long *argv, long long *retval) {
+    for (int i=0; i<8; i++) {
+        retval[i] = 0;
+    }
+    ctx.result = ScriptBytecode::Result::Success;
+    Frame frame = {&ctx, code.interface, argv, argc, retval, code.max_cycles, ScriptBytecode::STACK_SIZE, 0, 0, nullptr, 0};
+    if (ctx.suspended == &code) {
+        frame.sp = ctx.resumeSp;
+        frame.acc = ctx.resumeAcc.i;
+        frame.bcc = ctx.resumeBcc.i;
+        frame.resume = returnTargets[ctx.resumeOffset];
+    }
+    ctx.suspended = nullptr;
+    entry(&frame);
+    if (ctx.result == ScriptBytecode::Result::Yielded) {
+        code.suspend(ctx, frame.offset, frame.sp, {.i = frame.acc}, {.i = frame.bcc});
+    } else if (ctx.result != ScriptBytecode::Result::Success) {
+        printf("Program counter: 0x%04llX\n", (unsigned long long)frame.offset);
+        printf("Stack pointer: 0x%04llX\n", (unsigned long long)frame.sp);
+        printf("Accumulator: 0x%016llX\n", frame.acc);
+    }
+    return ctx.result;
+}
+
+#ifndef SCRIPT_JIT_SUPPORTED
+bool ScriptJit::compile(ScriptBytecode& /*code*/) {
+    return false;
+}
+
+ScriptJit::~ScriptJit() {}
+#else
+#pragma region Helpers
+typedef union { long long i; double f; } JitValue;
+/* Opcodes that are not worth inlining call one of these. They take the registers and return the new accumulator,
+   popping their arguments from the frame's stack pointer the same way execute() does. */
+typedef long long (*JitHelper)(ScriptJit::Frame *f, long long acc, long long bcc);
+
+static long long jitRandom(ScriptJit::Frame *f, long long /*acc*/, long long /*bcc*/) {
+    return f->ctx->random();
+}
+static long long jitModF(ScriptJit::Frame* /*f*/, long long acc, long long bcc) {
+    JitValue a = {.i = acc}, b = {.i = bcc};
+    a.f = fmod(a.f, b.f);
+    return a.i;
+}
+static long long jitPowF(ScriptJit::Frame* /*f*/, long long acc, long long bcc) {
+    JitValue a = {.i = acc}, b = {.i = bcc};
+    a.f = pow(a.f, b.f);
+    return a.i;
+}
+static long long jitAbs(ScriptJit::Frame* /*f*/, long long acc, long long /*bcc*/) {
+    return llabs(acc);
+}
+static long long jitSqrt(ScriptJit::Frame* /*f*/, long long acc, long long /*bcc*/) {
+    return sqrt(acc);
+}
+static long long jitGetTileId(ScriptJit::Frame *f, long long /*acc*/, long long /*bcc*/) {
+    long long x = f->ctx->pop(f->sp).i;
+    long long y = f->ctx->pop(f->sp).i;
+    long long z = f->ctx->pop(f->sp).i;
+    return f->interface->getTileId(x, y, z);
+}
+static long long jitGetLightLevel(ScriptJit::Frame *f, long long /*acc*/, long long /*bcc*/) {
+    long long x = f->ctx->pop(f->sp).i;
+    long long y = f->ctx->pop(f->sp).i;
+    long long z = f->ctx->pop(f->sp).i;
+    return f->interface->getLightColor(x, y, z);
+}
+static long long jitTileLightLevel(ScriptJit::Frame *f, long long acc, long long /*bcc*/) {
+    return f->interface->tileLightLevel(acc);
+}
+static long long jitTileIsSolid(ScriptJit::Frame *f, long long acc, long long /*bcc*/) {
+    return f->interface->isSolid(acc);
+}
+static long long jitTileIsSpawnable(ScriptJit::Frame *f, long long acc, long long /*bcc*/) {
+    return f->interface->isSpawnable(acc);
+}
+static long long jitTileIsWall(ScriptJit::Frame *f, long long acc, long long /*bcc*/) {
+    return f->interface->isWall(acc);
+}
+static long long jitTileFloor(ScriptJit::Frame *f, long long acc, long long /*bcc*/) {
+    return f->interface->tileFloor(acc);
+}
+static long long jitTileCeiling(ScriptJit::Frame *f, long long acc, long long /*bcc*/) {
+    return f->interface->tileCeiling(acc);
+}
+static long long jitTileWall(ScriptJit::Frame *f, long long acc, long long /*bcc*/) {
+    return f->interface->tileWall(acc);
+}
+static long long jitCameraX(ScriptJit::Frame *f, long long /*acc*/, long long /*bcc*/) {
+    JitValue v;
+    v.f = f->interface->cameraX();
+    return v.i;
+}
+static long long jitCameraY(ScriptJit::Frame *f, long long /*acc*/, long long /*bcc*/) {
+    JitValue v;
+    v.f = f->interface->cameraY();
+    return v.i;
+}
+static long long jitCameraZ(ScriptJit::Frame *f, long long /*acc*/, long long /*bcc*/) {
+    JitValue v;
+    v.f = f->interface->cameraZ();
+    return v.i;
+}
+static long long jitEntityX(ScriptJit::Frame *f, long long acc, long long /*bcc*/) {
+    JitValue v;
+    v.f = f->interface->entityX(acc);
+    return v.i;
+}
+static long long jitEntityY(ScriptJit::Frame *f, long long acc, long long /*bcc*/) {
+    JitValue v;
+    v.f = f->interface->entityY(acc);
+    return v.i;
+}
+static long long jitEntityZ(ScriptJit::Frame *f, long long acc, long long /*bcc*/) {
+    JitValue v;
+    v.f = f->interface->entityZ(acc);
+    return v.i;
+}
+static long long jitEntityMoveTowards(ScriptJit::Frame *f, long long acc, long long /*bcc*/) {
+    float x = f->ctx->pop(f->sp).f;
+    float y = f->ctx->pop(f->sp).f;
+    float z = f->ctx->pop(f->sp).f;
+    float speed = f->ctx->pop(f->sp).f;
+    f->interface->entityMoveTowards(acc, x, y, z, speed);
+    return acc;
+}
+static long long jitEntityRotate(ScriptJit::Frame *f, long long acc, long long /*bcc*/) {
+    float r = f->ctx->pop(f->sp).f;
+    f->interface->entityRotate(acc, r);
+    return acc;
+}
+static long long jitEntityTeleport(ScriptJit::Frame *f, long long acc, long long /*bcc*/) {
+    float x = f->ctx->pop(f->sp).f;
+    float y = f->ctx->pop(f->sp).f;
+    float z = f->ctx->pop(f->sp).f;
+    f->interface->entityTeleport(acc, x, y, z);
+    return acc;
+}
+static long long jitCanSeePlayer(ScriptJit::Frame *f, long long acc, long long /*bcc*/) {
+    return f->interface->canSeePlayer(acc);
+}
+static long long jitGetEntityTimer(ScriptJit::Frame *f, long long acc, long long /*bcc*/) {
+    JitValue v;
+    v.f = f->interface->getEntityTimer(acc);
+    return v.i;
+}
+static long long jitSetEntityTimer(ScriptJit::Frame *f, long long acc, long long /*bcc*/) {
+    float v = f->ctx->pop(f->sp).f;
+    f->interface->setEntityTimer(acc, v);
+    return acc;
+}
+static long long jitRandomTeleportEntity(ScriptJit::Frame *f, long long acc, long long /*bcc*/) {
+    float min_dist = f->ctx->pop(f->sp).f;
+    float max_dist = f->ctx->pop(f->sp).f;
+    long long avoid_player = f->ctx->pop(f->sp).i;
+    f->interface->randomTeleportEntity(acc, min_dist, max_dist, avoid_player);
+    return acc;
+}
+static long long jitGetDeltaTime(ScriptJit::Frame *f, long long /*acc*/, long long /*bcc*/) {
+    JitValue v;
+    v.f = f->interface->getDeltaTime();
+    return v.i;
+}
+static long long jitTileFlags(ScriptJit::Frame *f, long long /*acc*/, long long /*bcc*/) {
+    long long x = f->ctx->pop(f->sp).i;
+    long long y = f->ctx->pop(f->sp).i;
+    long long z = f->ctx->pop(f->sp).i;
+    return f->interface->tileFlags(x, y, z);
+}
+static long long jitAreaFlags(ScriptJit::Frame *f, long long /*acc*/, long long /*bcc*/) {
+    long long x = f->ctx->pop(f->sp).i;
+    long long y = f->ctx->pop(f->sp).i;
+    long long z = f->ctx->pop(f->sp).i;
+    long long w = f->ctx->pop(f->sp).i;
+    long long d = f->ctx->pop(f->sp).i;
+    return f->interface->areaFlags(x, y, z, w, d);
+}
+static long long jitAreaCount(ScriptJit::Frame *f, long long /*acc*/, long long /*bcc*/) {
+    long long x = f->ctx->pop(f->sp).i;
+    long long y = f->ctx->pop(f->sp).i;
+    long long z = f->ctx->pop(f->sp).i;
+    long long r = f->ctx->pop(f->sp).i;
+    long long mask = f->ctx->pop(f->sp).i;
+    return f->interface->areaCount(x, y, z, r, mask);
+}
+long long ScriptJit::callInterface(Frame *f, long long fn, long long operands) {
+    ScriptBytecode::i64 out;
+    unsigned int d = operands & 0xFF;
+    if (ScriptBytecode::callInterface(f->interface, fn, &f->ctx->vars[operands >> 8], out) && d != 0) {
+        f->ctx->vars[d] = out;
+    }
+    return 0;
+}
+#pragma endregion
+
+#pragma region Assembler
+/* Just enough of an x86-64 encoder for the script compiler. Writes past the capacity are counted but dropped,
+   so the caller only has to check for overflow once at the end. */
+class JitAssembler {
+    public:
+    enum Register {
+        RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15,
+    };
+    enum Condition {
+        B = 0x2, AE = 0x3, E = 0x4, NE = 0x5, BE = 0x6, A = 0x7, P = 0xA, NP = 0xB, L = 0xC, GE = 0xD, LE = 0xE, G = 0xF,
+    };
+    // opcodes of the "op r/m64, r64" forms
+    enum Alu {
+        ADD = 0x01, OR = 0x09, AND = 0x21, SUB = 0x29, XOR = 0x31, CMP = 0x39, TEST = 0x85, XCHG = 0x87, MOV = 0x89,
+    };
+    unsigned char *buf;
+    size_t cap;
+    size_t pos = 0;
+    JitAssembler(size_t cap) {
+        this->cap = cap;
+        buf = new unsigned char[cap];
+    }
+    ~JitAssembler() {
+        delete [] buf;
+    }
+    bool overflowed() {
+        return pos > cap;
+    }
+    void byte(unsigned int b) {
+        if (pos < cap) {
+            buf[pos] = b;
+        }
+        pos++;
+    }
+    void dword(unsigned int v) {
+        for (int i=0; i<4; i++) {
+            byte(v >> (i*8));
+        }
+    }
+    void qword(unsigned long long v) {
+        for (int i=0; i<8; i++) {
+            byte(v >> (i*8));
+        }
+    }
+    void rex(bool w, int reg, int index, int base) {
+        unsigned char r = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+        if (r != 0x40) {
+            byte(r);
+        }
+    }
+    void modrm(int reg, int rm) {
+        byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+    }
+    // [base + disp32]
+    void mem(int reg, int base, int disp) {
+        byte(0x80 | ((reg & 7) << 3) | (base & 7));
+        if ((base & 7) == RSP) {
+            byte(0x24);
+        }
+        dword(disp);
+    }
+    // [base + index*8 + disp32]
+    void memIndex(int reg, int base, int index, int disp) {
+        byte(0x84 | ((reg & 7) << 3));
+        byte(0xC0 | ((index & 7) << 3) | (base & 7));
+        dword(disp);
+    }
+    void alu(Alu op, int dst, int src) {
+        rex(true, src, 0, dst);
+        byte(op);
+        modrm(src, dst);
+    }
+    // add/or/sub/cmp (extension 0/1/5/7) with an immediate
+    void aluImm(int ext, int dst, int imm) {
+        rex(true, 0, 0, dst);
+        if (imm >= -128 && imm <= 127) {
+            byte(0x83);
+            modrm(ext, dst);
+            byte(imm);
+        } else {
+            byte(0x81);
+            modrm(ext, dst);
+            dword(imm);
+        }
+    }
+    void cmpMemImm(int base, int disp, int imm, bool wide) {
+        rex(wide, 0, 0, base);
+        byte(0x81);
+        mem(7, base, disp);
+        dword(imm);
+    }
+    void load(int dst, int base, int disp) {
+        rex(true, dst, 0, base);
+        byte(0x8B);
+        mem(dst, base, disp);
+    }
+    void store(int base, int disp, int src) {
+        rex(true, src, 0, base);
+        byte(0x89);
+        mem(src, base, disp);
+    }
+    void storeImm(int base, int disp, int imm, bool wide) {
+        rex(wide, 0, 0, base);
+        byte(0xC7);
+        mem(0, base, disp);
+        dword(imm);
+    }
+    void loadIndex(int dst, int base, int index, int disp) {
+        rex(true, dst, index, base);
+        byte(0x8B);
+        memIndex(dst, base, index, disp);
+    }
+    void storeIndex(int base, int index, int disp, int src) {
+        rex(true, src, index, base);
+        byte(0x89);
+        memIndex(src, base, index, disp);
+    }
+    void storeIndexImm(int base, int index, int disp, int imm) {
+        rex(true, 0, index, base);
+        byte(0xC7);
+        memIndex(0, base, index, disp);
+        dword(imm);
+    }
+    // clobbers flags when v is zero
+    void movImm(int dst, long long v) {
+        if (v == 0) {
+            rex(false, dst, 0, dst);
+            byte(XOR);
+            modrm(dst, dst);
+        } else if (v > 0 && v <= 0xFFFFFFFFLL) {
+            rex(false, 0, 0, dst);
+            byte(0xB8 + (dst & 7));
+            dword(v);
+        } else if (v >= INT_MIN && v <= INT_MAX) {
+            rex(true, 0, 0, dst);
+            byte(0xC7);
+            modrm(0, dst);
+            dword(v);
+        } else {
+            rex(true, 0, 0, dst);
+            byte(0xB8 + (dst & 7));
+            qword(v);
+        }
+    }
+    // inc (0), dec (1), call (2) and jmp (4) through 0xFF, or idiv (7) through 0xF7
+    void unary(unsigned char op, int ext, int r) {
+        rex(op != 0xFF || ext < 2, 0, 0, r);
+        byte(op);
+        modrm(ext, r);
+    }
+    void imul(int dst, int src) {
+        rex(true, dst, 0, src);
+        byte(0x0F);
+        byte(0xAF);
+        modrm(dst, src);
+    }
+    void cqo() {
+        byte(0x48);
+        byte(0x99);
+    }
+    void btr(int r, int bit) {
+        rex(true, 0, 0, r);
+        byte(0x0F);
+        byte(0xBA);
+        modrm(6, r);
+        byte(bit);
+    }
+    // set al or cl from a condition
+    void setcc(Condition cc, int r8) {
+        byte(0x0F);
+        byte(0x90 | cc);
+        modrm(0, r8);
+    }
+    // and (0x20) or or (0x08) of two low byte registers
+    void alu8(unsigned char op, int dst, int src) {
+        byte(op);
+        modrm(src, dst);
+    }
+    void movzx8(int dst, int r8) {
+        rex(false, dst, 0, r8);
+        byte(0x0F);
+        byte(0xB6);
+        modrm(dst, r8);
+    }
+    void movqToXmm(int xmm, int r) {
+        byte(0x66);
+        rex(true, xmm, 0, r);
+        byte(0x0F);
+        byte(0x6E);
+        modrm(xmm, r);
+    }
+    void movqFromXmm(int r, int xmm) {
+        byte(0x66);
+        rex(true, xmm, 0, r);
+        byte(0x0F);
+        byte(0x7E);
+        modrm(xmm, r);
+    }
+    // scalar double op between xmm registers: prefix 0xF2 with add/mul/sub/div/sqrt, or 0x66 with ucomisd
+    void sse(unsigned char prefix, unsigned char op, int dst, int src) {
+        byte(prefix);
+        byte(0x0F);
+        byte(op);
+        modrm(dst, src);
+    }
+    void cvtsi2sd(int xmm, int r) {
+        byte(0xF2);
+        rex(true, xmm, 0, r);
+        byte(0x0F);
+        byte(0x2A);
+        modrm(xmm, r);
+    }
+    void cvttsd2si(int r, int xmm) {
+        byte(0xF2);
+        rex(true, r, 0, xmm);
+        byte(0x0F);
+        byte(0x2C);
+        modrm(r, xmm);
+    }
+    void push(int r) {
+        rex(false, 0, 0, r);
+        byte(0x50 + (r & 7));
+    }
+    void pop(int r) {
+        rex(false, 0, 0, r);
+        byte(0x58 + (r & 7));
+    }
+    void ret() {
+        byte(0xC3);
+    }
+    /* Jumps with a 32 bit displacement to be patched. They return the position of the displacement. */
+    size_t jcc(Condition cc) {
+        byte(0x0F);
+        byte(0x80 | cc);
+        dword(0);
+        return pos - 4;
+    }
+    size_t jmp() {
+        byte(0xE9);
+        dword(0);
+        return pos - 4;
+    }
+    void patch(size_t at, size_t target) {
+        int rel = (long long)target - (long long)(at + 4);
+        if (at + 4 <= cap) {
+            memcpy(&buf[at], &rel, 4);
+        }
+    }
+};
+#pragma endregion
+
+#pragma region Compiler
+typedef struct {
+    size_t at;
+    size_t target;
+} JitBranch;
+typedef struct {
+    size_t at;
+    int result; // result to report, or -1 if the helper that failed already set it
+    unsigned int offset;
+} JitStub;
+
+bool ScriptJit::compile(ScriptBytecode& code) {
+    typedef JitAssembler J;
+    // register allocation: script registers stay in callee saved registers across helper calls
+    const int ACC = J::RBX, BCC = J::R14, SP = J::R15, CYCLES = J::R12, FRAME = J::R13, CTX = J::RBP;
+    const int VARS = offsetof(ScriptBytecode::Context, vars);
+    const int STACK = offsetof(ScriptBytecode::Context, stack);
+    const int RESULT = offsetof(ScriptBytecode::Context, result);
+    const int EXECUTED = offsetof(ScriptBytecode::Context, executed);
+    const int STACK_SIZE = ScriptBytecode::STACK_SIZE;
+    if (!code.decoded) {
+        return false;
+    }
+    size_t n = code.ninstructions;
+    for (size_t i=0; i<n; i++) {
+        if (code.code[i].op == ScriptBytecode::OpUnknown) {
+            return false;
+        }
+    }
+    J as(n * 256 + 256);
+    size_t *native = new size_t[n+1];
+    void **targets = new void*[code.len];
+    DynamicArray<JitBranch> branches;
+    DynamicArray<JitStub> stubs;
+    DynamicArray<size_t> exits;
+    unsigned int offset = 0;
+    auto fail = [&](size_t at, int result) {
+        stubs.append({at, result, offset});
+    };
+    auto branch = [&](size_t at, size_t target) {
+        branches.append({at, target});
+    };
+    auto push = [&](int r) {
+        as.alu(J::TEST, SP, SP);
+        fail(as.jcc(J::E), ScriptBytecode::StackOverflow);
+        as.unary(0xFF, 1, SP);
+        as.storeIndex(CTX, SP, STACK, r);
+    };
+    auto pushImm = [&](int imm) {
+        as.alu(J::TEST, SP, SP);
+        fail(as.jcc(J::E), ScriptBytecode::StackOverflow);
+        as.unary(0xFF, 1, SP);
+        as.storeIndexImm(CTX, SP, STACK, imm);
+    };
+    auto pop = [&](int r) {
+        as.aluImm(7, SP, STACK_SIZE);
+        fail(as.jcc(J::E), ScriptBytecode::StackUnderflow);
+        as.loadIndex(r, CTX, SP, STACK);
+        as.unary(0xFF, 0, SP);
+    };
+    // jump to the return address in rax, a bytecode offset like in execute()
+    auto returnTo = [&]() {
+        as.movImm(J::RCX, code.len);
+        as.alu(J::CMP, J::RAX, J::RCX);
+        branch(as.jcc(J::AE), n);
+        as.movImm(J::RCX, (long long)targets);
+        as.loadIndex(J::RAX, J::RCX, J::RAX, 0);
+        as.alu(J::TEST, J::RAX, J::RAX);
+        fail(as.jcc(J::E), ScriptBytecode::OutOfBoundsExec);
+        as.unary(0xFF, 4, J::RAX);
+    };
+    auto loadVar = [&](int r, long long var) {
+        if (var == 0 || var >= (long long)ScriptBytecode::MAX_VARS) {
+            as.movImm(r, 0);
+        } else {
+            as.load(r, CTX, VARS + var*8);
+        }
+    };
+    auto call = [&](JitHelper helper, bool check) {
+        as.store(FRAME, offsetof(Frame, sp), SP);
+        as.alu(J::MOV, J::RDI, FRAME);
+        as.alu(J::MOV, J::RSI, ACC);
+        as.alu(J::MOV, J::RDX, BCC);
+        as.movImm(J::RAX, (long long)helper);
+        as.unary(0xFF, 2, J::RAX);
+        as.alu(J::MOV, ACC, J::RAX);
+        as.load(SP, FRAME, offsetof(Frame, sp));
+        if (check) {
+            as.cmpMemImm(CTX, RESULT, ScriptBytecode::Success, false);
+            fail(as.jcc(J::NE), -1);
+        }
+    };
+    auto compare = [&](J::Condition cc) {
+        as.alu(J::CMP, ACC, BCC);
+        as.setcc(cc, J::RAX);
+        as.movzx8(ACC, J::RAX);
+    };
+    // swapped compares acc < bcc as bcc > acc, so unordered operands fail every ordered compare
+    auto compareF = [&](J::Condition cc, bool swapped) {
+        as.movqToXmm(0, ACC);
+        as.movqToXmm(1, BCC);
+        as.sse(0x66, 0x2E, swapped ? 1 : 0, swapped ? 0 : 1);
+        as.setcc(cc, J::RAX);
+    };
+    auto arithF = [&](unsigned char op) {
+        as.movqToXmm(0, ACC);
+        as.movqToXmm(1, BCC);
+        as.sse(0xF2, op, 0, 1);
+        as.movqFromXmm(ACC, 0);
+    };
+    // V opcodes work on rax and rcx (or xmm0 and xmm1) and leave the script registers alone
+    auto loadVars = [&](long long x, long long y) {
+        loadVar(J::RAX, x);
+        loadVar(J::RCX, y);
+    };
+    auto loadVarsF = [&](long long x, long long y) {
+        loadVars(x, y);
+        as.movqToXmm(0, J::RAX);
+        as.movqToXmm(1, J::RCX);
+    };
+    auto storeV = [&](long long d, int r) {
+        as.store(CTX, VARS + d*8, r);
+    };
+    // helper call with two variables in place of the registers, the result is in rax
+    auto callVars = [&](JitHelper helper, long long x, long long y) {
+        as.alu(J::MOV, J::RDI, FRAME);
+        loadVar(J::RSI, x);
+        loadVar(J::RDX, y);
+        as.movImm(J::RAX, (long long)helper);
+        as.unary(0xFF, 2, J::RAX);
+    };
+
+    // prologue: save the callee saved registers, keeping the stack 16 byte aligned for helper calls
+    as.push(J::RBP);
+    as.push(J::RBX);
+    as.push(J::R12);
+    as.push(J::R13);
+    as.push(J::R14);
+    as.push(J::R15);
+    as.aluImm(5, J::RSP, 8);
+    as.alu(J::MOV, FRAME, J::RDI);
+    as.load(CTX, FRAME, offsetof(Frame, ctx));
+    as.load(CYCLES, FRAME, offsetof(Frame, max_cycles));
+    as.load(SP, FRAME, offsetof(Frame, sp));
+    as.load(ACC, FRAME, offsetof(Frame, acc));
+    as.load(BCC, FRAME, offsetof(Frame, bcc));
+    // a yielded run continues at the instruction after the yield
+    as.load(J::RAX, FRAME, offsetof(Frame, resume));
+    as.alu(J::TEST, J::RAX, J::RAX);
+    size_t fresh = as.jcc(J::E);
+    as.unary(0xFF, 4, J::RAX);
+    as.patch(fresh, as.pos);
+    for (size_t i=0; i<n; i++) {
+        const ScriptBytecode::Instruction& ins = code.code[i];
+        native[i] = as.pos;
+        offset = ins.offset;
+        // the cycle counter counts down, borrowing when the script runs out of cycles
+        as.aluImm(5, CYCLES, 1);
+        fail(as.jcc(J::B), ScriptBytecode::Timeout);
+        long long a = ins.a.i;
+        long long vd = ins.b & 0xFF, vx = (ins.b >> 8) & 0xFF, vy = ins.b >> 16;
+        size_t skip;
+        switch (ins.op) {
+            case ScriptBytecode::OpNop:
+                break;
+            case ScriptBytecode::OpReturn:
+                if (a >= 8) {
+                    fail(as.jmp(), ScriptBytecode::OutOfBoundsWrite);
+                    break;
+                }
+                loadVar(J::RAX, ins.b);
+                as.load(J::RCX, FRAME, offsetof(Frame, retval));
+                as.store(J::RCX, a*8, J::RAX);
+                if (ins.b >= ScriptBytecode::MAX_VARS) {
+                    fail(as.jmp(), ScriptBytecode::OutOfBoundsRead);
+                }
+                break;
+            case ScriptBytecode::OpReturnDoNothing:
+            case ScriptBytecode::OpReturnFail:
+            case ScriptBytecode::OpReturnDestroy:
+            case ScriptBytecode::OpReturnPlace:
+            case ScriptBytecode::OpReturnKeep:
+            case ScriptBytecode::OpReturnUpdate:
+            case ScriptBytecode::OpReturnReverseUpdate:
+                as.load(J::RCX, FRAME, offsetof(Frame, retval));
+                as.storeImm(J::RCX, 0, ins.op - ScriptBytecode::OpReturnDoNothing, true);
+                break;
+            case ScriptBytecode::OpRandom:
+                call(jitRandom, false);
+                break;
+            case ScriptBytecode::OpEnd:
+                exits.append(as.jmp());
+                break;
+            case ScriptBytecode::OpFrameset:
+                as.aluImm(0, SP, a);
+                break;
+            case ScriptBytecode::OpReadArg:
+            case ScriptBytecode::OpPushArg:
+                as.cmpMemImm(FRAME, offsetof(Frame, argc), a, true);
+                fail(as.jcc(J::BE), ScriptBytecode::OutOfBoundsRead);
+                as.load(J::RAX, FRAME, offsetof(Frame, argv));
+                if (ins.op == ScriptBytecode::OpReadArg) {
+                    as.load(ACC, J::RAX, a*8);
+                } else {
+                    as.load(J::RAX, J::RAX, a*8);
+                    push(J::RAX);
+                }
+                break;
+            case ScriptBytecode::OpImmediate64U:
+                as.movImm(ACC, a);
+                break;
+            case ScriptBytecode::OpImmediate64UB:
+                as.movImm(BCC, a);
+                break;
+            case ScriptBytecode::OpYield:
+                as.storeImm(CTX, RESULT, ScriptBytecode::Yielded, false);
+                as.storeImm(FRAME, offsetof(Frame, offset), code.code[i+1].offset, false);
+                exits.append(as.jmp());
+                break;
+            case ScriptBytecode::OpLoadVar:
+                loadVar(BCC, a);
+                if (a >= (long long)ScriptBytecode::MAX_VARS) {
+                    fail(as.jmp(), ScriptBytecode::OutOfBoundsRead);
+                }
+                break;
+            case ScriptBytecode::OpStoreVar:
+                if (a >= (long long)ScriptBytecode::MAX_VARS) {
+                    fail(as.jmp(), ScriptBytecode::OutOfBoundsRead);
+                } else if (a > 0) {
+                    as.store(CTX, VARS + a*8, ACC);
+                }
+                break;
+            case ScriptBytecode::OpPushVar:
+                loadVar(J::RAX, a);
+                push(J::RAX);
+                if (a >= (long long)ScriptBytecode::MAX_VARS) {
+                    fail(as.jmp(), ScriptBytecode::OutOfBoundsRead);
+                }
+                break;
+            case ScriptBytecode::OpExchange:
+                as.alu(J::XCHG, ACC, BCC);
+                break;
+            case ScriptBytecode::OpAdd:
+                as.alu(J::ADD, ACC, BCC);
+                break;
+            case ScriptBytecode::OpSub:
+                as.alu(J::SUB, ACC, BCC);
+                break;
+            case ScriptBytecode::OpMul:
+                as.imul(ACC, BCC);
+                break;
+            case ScriptBytecode::OpDiv:
+            case ScriptBytecode::OpMod:
+                as.alu(J::TEST, BCC, BCC);
+                skip = as.jcc(J::NE);
+                as.movImm(ACC, -1);
+                {
+                    size_t done = as.jmp();
+                    as.patch(skip, as.pos);
+                    as.alu(J::MOV, J::RAX, ACC);
+                    as.cqo();
+                    as.unary(0xF7, 7, BCC);
+                    as.alu(J::MOV, ACC, ins.op == ScriptBytecode::OpDiv ? J::RAX : J::RDX);
+                    as.patch(done, as.pos);
+                }
+                break;
+            case ScriptBytecode::OpAnd:
+                as.alu(J::AND, ACC, BCC);
+                break;
+            case ScriptBytecode::OpOr:
+                as.alu(J::OR, ACC, BCC);
+                break;
+            case ScriptBytecode::OpXor:
+                as.alu(J::XOR, ACC, BCC);
+                break;
+            case ScriptBytecode::OpLor:
+                as.alu(J::MOV, J::RAX, ACC);
+                as.alu(J::OR, J::RAX, BCC);
+                as.setcc(J::NE, J::RAX);
+                as.movzx8(ACC, J::RAX);
+                break;
+            case ScriptBytecode::OpLand:
+                as.alu(J::TEST, ACC, ACC);
+                as.setcc(J::NE, J::RAX);
+                as.alu(J::TEST, BCC, BCC);
+                as.setcc(J::NE, J::RCX);
+                as.alu8(0x20, J::RAX, J::RCX);
+                as.movzx8(ACC, J::RAX);
+                break;
+            case ScriptBytecode::OpInc:
+                as.unary(0xFF, 0, ACC);
+                break;
+            case ScriptBytecode::OpDec:
+                as.unary(0xFF, 1, ACC);
+                break;
+            case ScriptBytecode::OpAddF:
+                arithF(0x58);
+                break;
+            case ScriptBytecode::OpSubF:
+                arithF(0x5C);
+                break;
+            case ScriptBytecode::OpMulF:
+                arithF(0x59);
+                break;
+            case ScriptBytecode::OpDivF:
+                arithF(0x5E);
+                break;
+            case ScriptBytecode::OpModF:
+                call(jitModF, false);
+                break;
+            case ScriptBytecode::OpPowF:
+                call(jitPowF, false);
+                break;
+            case ScriptBytecode::OpNanF:
+                // nothing compares equal to NAN
+                as.movImm(ACC, 0);
+                break;
+            case ScriptBytecode::OpInfF:
+                // positive infinity has a single bit pattern
+                as.movImm(J::RAX, 0x7FF0000000000000LL);
+                as.alu(J::CMP, ACC, J::RAX);
+                as.setcc(J::E, J::RAX);
+                as.movzx8(ACC, J::RAX);
+                break;
+            case ScriptBytecode::OpPush:
+                push(ACC);
+                break;
+            case ScriptBytecode::OpPop:
+                pop(ACC);
+                break;
+            case ScriptBytecode::OpPushB:
+                push(BCC);
+                break;
+            case ScriptBytecode::OpPopB:
+                pop(BCC);
+                break;
+            case ScriptBytecode::OpBA:
+                branch(as.jmp(), ins.b);
+                break;
+            case ScriptBytecode::OpBZ:
+                as.alu(J::TEST, ACC, ACC);
+                branch(as.jcc(J::E), ins.b);
+                break;
+            case ScriptBytecode::OpBNZ:
+                as.alu(J::TEST, ACC, ACC);
+                branch(as.jcc(J::NE), ins.b);
+                break;
+            case ScriptBytecode::OpJSR:
+                pushImm(code.code[i+1].offset);
+                branch(as.jmp(), ins.b);
+                break;
+            case ScriptBytecode::OpJSRZ:
+            case ScriptBytecode::OpJSRNZ:
+                as.alu(J::TEST, ACC, ACC);
+                skip = as.jcc(ins.op == ScriptBytecode::OpJSRZ ? J::NE : J::E);
+                pushImm(code.code[i+1].offset);
+                branch(as.jmp(), ins.b);
+                as.patch(skip, as.pos);
+                break;
+            case ScriptBytecode::OpRTS:
+                pop(J::RAX);
+                returnTo();
+                break;
+            case ScriptBytecode::OpRTSZ:
+            case ScriptBytecode::OpRTSNZ:
+                as.alu(J::TEST, ACC, ACC);
+                skip = as.jcc(ins.op == ScriptBytecode::OpRTSZ ? J::NE : J::E);
+                pop(J::RAX);
+                returnTo();
+                as.patch(skip, as.pos);
+                break;
+            case ScriptBytecode::OpEQ:
+                compare(J::E);
+                break;
+            case ScriptBytecode::OpNEQ:
+                compare(J::NE);
+                break;
+            case ScriptBytecode::OpGT:
+                compare(J::G);
+                break;
+            case ScriptBytecode::OpLT:
+                compare(J::L);
+                break;
+            case ScriptBytecode::OpGTEQ:
+                compare(J::GE);
+                break;
+            case ScriptBytecode::OpLTEQ:
+                compare(J::LE);
+                break;
+            case ScriptBytecode::OpEQF:
+                compareF(J::E, false);
+                as.setcc(J::NP, J::RCX);
+                as.alu8(0x20, J::RAX, J::RCX);
+                as.movzx8(ACC, J::RAX);
+                break;
+            case ScriptBytecode::OpNEQF:
+                compareF(J::NE, false);
+                as.setcc(J::P, J::RCX);
+                as.alu8(0x08, J::RAX, J::RCX);
+                as.movzx8(ACC, J::RAX);
+                break;
+            case ScriptBytecode::OpGTF:
+            case ScriptBytecode::OpLTF:
+                compareF(J::A, ins.op == ScriptBytecode::OpLTF);
+                as.movzx8(ACC, J::RAX);
+                break;
+            case ScriptBytecode::OpGTEQF:
+            case ScriptBytecode::OpLTEQF:
+                compareF(J::AE, ins.op == ScriptBytecode::OpLTEQF);
+                as.movzx8(ACC, J::RAX);
+                break;
+            case ScriptBytecode::OpBZSet32:
+            case ScriptBytecode::OpBNZSet32:
+                as.alu(J::TEST, ACC, ACC);
+                skip = as.jcc(ins.op == ScriptBytecode::OpBZSet32 ? J::NE : J::E);
+                as.movImm(ACC, a);
+                branch(as.jmp(), ins.b);
+                as.patch(skip, as.pos);
+                break;
+            case ScriptBytecode::OpAbs:
+                call(jitAbs, false);
+                break;
+            case ScriptBytecode::OpAbsF:
+                as.btr(ACC, 63);
+                break;
+            case ScriptBytecode::OpSqrt:
+                call(jitSqrt, false);
+                break;
+            case ScriptBytecode::OpSqrtF:
+                as.movqToXmm(0, ACC);
+                as.sse(0xF2, 0x51, 0, 0);
+                as.movqFromXmm(ACC, 0);
+                break;
+            case ScriptBytecode::OpItof:
+                as.cvtsi2sd(0, ACC);
+                as.movqFromXmm(ACC, 0);
+                break;
+            case ScriptBytecode::OpFtoi:
+                as.movqToXmm(0, ACC);
+                as.cvttsd2si(ACC, 0);
+                break;
+            case ScriptBytecode::OpVSet64:
+                as.movImm(J::RAX, a);
+                storeV(vd, J::RAX);
+                break;
+            case ScriptBytecode::OpVMove:
+                loadVar(J::RAX, vx);
+                storeV(vd, J::RAX);
+                break;
+            case ScriptBytecode::OpVArg:
+                as.cmpMemImm(FRAME, offsetof(Frame, argc), a, true);
+                fail(as.jcc(J::BE), ScriptBytecode::OutOfBoundsRead);
+                as.load(J::RAX, FRAME, offsetof(Frame, argv));
+                as.load(J::RAX, J::RAX, a*8);
+                storeV(vd, J::RAX);
+                break;
+            case ScriptBytecode::OpVRandom:
+                callVars(jitRandom, 0, 0);
+                storeV(vd, J::RAX);
+                break;
+            case ScriptBytecode::OpVAdd:
+            case ScriptBytecode::OpVSub:
+            case ScriptBytecode::OpVAnd:
+            case ScriptBytecode::OpVOr:
+            case ScriptBytecode::OpVXor:
+                loadVars(vx, vy);
+                as.alu(ins.op == ScriptBytecode::OpVAdd ? J::ADD : ins.op == ScriptBytecode::OpVSub ? J::SUB :
+                       ins.op == ScriptBytecode::OpVAnd ? J::AND : ins.op == ScriptBytecode::OpVOr ? J::OR : J::XOR,
+                       J::RAX, J::RCX);
+                storeV(vd, J::RAX);
+                break;
+            case ScriptBytecode::OpVMul:
+                loadVars(vx, vy);
+                as.imul(J::RAX, J::RCX);
+                storeV(vd, J::RAX);
+                break;
+            case ScriptBytecode::OpVDiv:
+            case ScriptBytecode::OpVMod:
+                loadVars(vx, vy);
+                as.alu(J::TEST, J::RCX, J::RCX);
+                skip = as.jcc(J::NE);
+                as.movImm(J::RDX, -1);
+                as.movImm(J::RAX, -1);
+                {
+                    size_t done = as.jmp();
+                    as.patch(skip, as.pos);
+                    as.cqo();
+                    as.unary(0xF7, 7, J::RCX);
+                    as.patch(done, as.pos);
+                }
+                storeV(vd, ins.op == ScriptBytecode::OpVDiv ? J::RAX : J::RDX);
+                break;
+            case ScriptBytecode::OpVAddF:
+            case ScriptBytecode::OpVSubF:
+            case ScriptBytecode::OpVMulF:
+            case ScriptBytecode::OpVDivF:
+                loadVarsF(vx, vy);
+                as.sse(0xF2, ins.op == ScriptBytecode::OpVAddF ? 0x58 : ins.op == ScriptBytecode::OpVSubF ? 0x5C :
+                       ins.op == ScriptBytecode::OpVMulF ? 0x59 : 0x5E, 0, 1);
+                as.movqFromXmm(J::RAX, 0);
+                storeV(vd, J::RAX);
+                break;
+            case ScriptBytecode::OpVModF:
+                callVars(jitModF, vx, vy);
+                storeV(vd, J::RAX);
+                break;
+            case ScriptBytecode::OpVEQ:
+            case ScriptBytecode::OpVNEQ:
+            case ScriptBytecode::OpVGT:
+            case ScriptBytecode::OpVLT:
+            case ScriptBytecode::OpVGTEQ:
+            case ScriptBytecode::OpVLTEQ:
+                {
+                    static const J::Condition conditions[] = {J::E, J::NE, J::G, J::L, J::GE, J::LE};
+                    loadVars(vx, vy);
+                    as.alu(J::CMP, J::RAX, J::RCX);
+                    as.setcc(conditions[ins.op - ScriptBytecode::OpVEQ], J::RAX);
+                    as.movzx8(J::RAX, J::RAX);
+                    storeV(vd, J::RAX);
+                }
+                break;
+            case ScriptBytecode::OpVEQF:
+            case ScriptBytecode::OpVNEQF:
+                loadVarsF(vx, vy);
+                as.sse(0x66, 0x2E, 0, 1);
+                if (ins.op == ScriptBytecode::OpVEQF) {
+                    as.setcc(J::E, J::RAX);
+                    as.setcc(J::NP, J::RCX);
+                    as.alu8(0x20, J::RAX, J::RCX);
+                } else {
+                    as.setcc(J::NE, J::RAX);
+                    as.setcc(J::P, J::RCX);
+                    as.alu8(0x08, J::RAX, J::RCX);
+                }
+                as.movzx8(J::RAX, J::RAX);
+                storeV(vd, J::RAX);
+                break;
+            case ScriptBytecode::OpVGTF:
+            case ScriptBytecode::OpVLTF:
+            case ScriptBytecode::OpVGTEQF:
+            case ScriptBytecode::OpVLTEQF:
+                {
+                    // like compareF, x < y is tested as y > x
+                    bool swapped = ins.op == ScriptBytecode::OpVLTF || ins.op == ScriptBytecode::OpVLTEQF;
+                    bool equal = ins.op == ScriptBytecode::OpVGTEQF || ins.op == ScriptBytecode::OpVLTEQF;
+                    loadVarsF(vx, vy);
+                    as.sse(0x66, 0x2E, swapped ? 1 : 0, swapped ? 0 : 1);
+                    as.setcc(equal ? J::AE : J::A, J::RAX);
+                    as.movzx8(J::RAX, J::RAX);
+                    storeV(vd, J::RAX);
+                }
+                break;
+            case ScriptBytecode::OpVAbs:
+                callVars(jitAbs, vx, 0);
+                storeV(vd, J::RAX);
+                break;
+            case ScriptBytecode::OpVAbsF:
+                loadVar(J::RAX, vx);
+                as.btr(J::RAX, 63);
+                storeV(vd, J::RAX);
+                break;
+            case ScriptBytecode::OpVSqrtF:
+                loadVar(J::RAX, vx);
+                as.movqToXmm(0, J::RAX);
+                as.sse(0xF2, 0x51, 0, 0);
+                as.movqFromXmm(J::RAX, 0);
+                storeV(vd, J::RAX);
+                break;
+            case ScriptBytecode::OpVItof:
+                loadVar(J::RAX, vx);
+                as.cvtsi2sd(0, J::RAX);
+                as.movqFromXmm(J::RAX, 0);
+                storeV(vd, J::RAX);
+                break;
+            case ScriptBytecode::OpVFtoi:
+                loadVar(J::RAX, vx);
+                as.movqToXmm(0, J::RAX);
+                as.cvttsd2si(J::RAX, 0);
+                storeV(vd, J::RAX);
+                break;
+            case ScriptBytecode::OpVBZ:
+            case ScriptBytecode::OpVBNZ:
+                as.cmpMemImm(CTX, VARS + a*8, 0, true);
+                branch(as.jcc(ins.op == ScriptBytecode::OpVBZ ? J::E : J::NE), ins.b);
+                break;
+            case ScriptBytecode::OpVCall:
+                as.alu(J::MOV, J::RDI, FRAME);
+                as.movImm(J::RSI, a);
+                as.movImm(J::RDX, ins.b);
+                as.movImm(J::RAX, (long long)&ScriptJit::callInterface);
+                as.unary(0xFF, 2, J::RAX);
+                break;
+            case ScriptBytecode::OpGetTileId:
+                call(jitGetTileId, true);
+                break;
+            case ScriptBytecode::OpGetLightLevel:
+                call(jitGetLightLevel, true);
+                break;
+            case ScriptBytecode::OpTileLightLevel:
+                call(jitTileLightLevel, false);
+                break;
+            case ScriptBytecode::OpTileIsSolid:
+                call(jitTileIsSolid, false);
+                break;
+            case ScriptBytecode::OpTileIsSpawnable:
+                call(jitTileIsSpawnable, false);
+                break;
+            case ScriptBytecode::OpTileIsWall:
+                call(jitTileIsWall, false);
+                break;
+            case ScriptBytecode::OpTileFloor:
+                call(jitTileFloor, false);
+                break;
+            case ScriptBytecode::OpTileCeiling:
+                call(jitTileCeiling, false);
+                break;
+            case ScriptBytecode::OpTileWall:
+                call(jitTileWall, false);
+                break;
+            case ScriptBytecode::OpCameraX:
+                call(jitCameraX, false);
+                break;
+            case ScriptBytecode::OpCameraY:
+                call(jitCameraY, false);
+                break;
+            case ScriptBytecode::OpCameraZ:
+                call(jitCameraZ, false);
+                break;
+            case ScriptBytecode::OpEntityX:
+                call(jitEntityX, false);
+                break;
+            case ScriptBytecode::OpEntityY:
+                call(jitEntityY, false);
+                break;
+            case ScriptBytecode::OpEntityZ:
+                call(jitEntityZ, false);
+                break;
+            case ScriptBytecode::OpEntityMoveTowards:
+                call(jitEntityMoveTowards, true);
+                break;
+            case ScriptBytecode::OpEntityRotate:
+                call(jitEntityRotate, true);
+                break;
+            case ScriptBytecode::OpEntityTeleport:
+                call(jitEntityTeleport, true);
+                break;
+            case ScriptBytecode::OpCanSeePlayer:
+                call(jitCanSeePlayer, false);
+                break;
+            case ScriptBytecode::OpGetEntityTimer:
+                call(jitGetEntityTimer, false);
+                break;
+            case ScriptBytecode::OpSetEntityTimer:
+                call(jitSetEntityTimer, true);
+                break;
+            case ScriptBytecode::OpRandomTeleportEntity:
+                call(jitRandomTeleportEntity, true);
+                break;
+            case ScriptBytecode::OpGetDeltaTime:
+                call(jitGetDeltaTime, false);
+                break;
+            case ScriptBytecode::OpTileFlags:
+                call(jitTileFlags, true);
+                break;
+            case ScriptBytecode::OpAreaFlags:
+                call(jitAreaFlags, true);
+                break;
+            case ScriptBytecode::OpAreaCount:
+                call(jitAreaCount, true);
+                break;
+            default:
+                delete [] native;
+                delete [] targets;
+                return false;
+        }
+    }
+    // running off the end halts without using a cycle, like execute()
+    native[n] = as.pos;
+    exits.append(as.jmp());
+    for (size_t i=0; i<stubs.length(); i++) {
+        JitStub& stub = stubs[i];
+        as.patch(stub.at, as.pos);
+        if (stub.result == ScriptBytecode::Timeout) {
+            // undo the borrow, no cycles are left
+            as.movImm(CYCLES, 0);
+        }
+        if (stub.result >= 0) {
+            as.storeImm(CTX, RESULT, stub.result, false);
+        }
+        as.storeImm(FRAME, offsetof(Frame, offset), stub.offset, false);
+        exits.append(as.jmp());
+    }
+    // epilogue: hand the instruction count and the registers needed for error reports back to run()
+    for (size_t i=0; i<exits.length(); i++) {
+        as.patch(exits[i], as.pos);
+    }
+    as.load(J::RAX, FRAME, offsetof(Frame, max_cycles));
+    as.alu(J::SUB, J::RAX, CYCLES);
+    as.store(CTX, EXECUTED, J::RAX);
+    as.store(FRAME, offsetof(Frame, sp), SP);
+    as.store(FRAME, offsetof(Frame, acc), ACC);
+    as.store(FRAME, offsetof(Frame, bcc), BCC);
+    as.aluImm(0, J::RSP, 8);
+    as.pop(J::R15);
+    as.pop(J::R14);
+    as.pop(J::R13);
+    as.pop(J::R12);
+    as.pop(J::RBX);
+    as.pop(J::RBP);
+    as.ret();
+    for (size_t i=0; i<branches.length(); i++) {
+        as.patch(branches[i].at, native[branches[i].target]);
+    }
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t mapped = (as.pos + page - 1) / page * page;
+    void *memory = as.overflowed() ? MAP_FAILED : mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        delete [] native;
+        delete [] targets;
+        return false;
+    }
+    memcpy(memory, as.buf, as.pos);
+    if (mprotect(memory, mapped, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, mapped);
+        delete [] native;
+        delete [] targets;
+        return false;
+    }
+    for (size_t pc=0; pc<code.len; pc++) {
+        unsigned int index = code.starts[pc];
+        targets[pc] = index == ScriptBytecode::NO_INSTRUCTION ? nullptr : (unsigned char*)memory + native[index];
+    }
+    delete [] native;
+    ScriptJit *jit = new ScriptJit();
+    jit->memory = (unsigned char*)memory;
+    jit->mapped = mapped;
+    jit->codeSize = as.pos;
+    jit->returnTargets = targets;
+    jit->entry = (Entry)memory;
+    code.jit = jit;
+    return true;
+}
+
+ScriptJit::~ScriptJit() {
+    if (memory != nullptr) {
+        munmap(memory, mapped);
+    }
+    delete [] returnTargets;
+}
+#pragma endregion
+#endif
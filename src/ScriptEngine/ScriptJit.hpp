@@ -0,0 +1,54 @@
+#ifndef __SCRIPTJIT_HPP__
+#define __SCRIPTJIT_HPP__
+
+#include "ScriptBytecode.hpp"
+
+// native code generation is only implemented for the System V x86-64 ABI
+#if defined(__linux__) && defined(__x86_64__)
+#define SCRIPT_JIT_SUPPORTED
+#endif
+
+/* Native x86-64 translation of a decoded script. The accumulator, B register, stack pointer and remaining cycle
+   count live in machine registers, variables and the stack stay in the script context, and interface opcodes
+   call straight into ScriptInterface. Runs are indistinguishable from ScriptBytecode::execute(): same results,
+   return values, instruction counts and error reports.
+   Scripts containing opcodes the compiler does not handle are not compiled and keep running interpreted. */
+class ScriptJit {
+    public:
+    // state shared between run() and the generated code
+    typedef struct {
+        ScriptBytecode::Context *ctx;
+        ScriptInterface *interface;
+        long long *argv;
+        size_t argc;
+        long long *retval;
+        size_t max_cycles;
+        size_t sp;
+        long long acc;
+        long long bcc;
+        void *resume; // native address to continue a yielded run at, or null to start from the beginning
+        unsigned int offset; // bytecode offset of the failing instruction, or of the one after a yield
+    } Frame;
+    typedef void (*Entry)(Frame *frame);
+    /* Compile decoded bytecode and attach the native code to it. Returns false if the bytecode was not decoded,
+       uses an unsupported opcode, or native code is not supported on this platform. */
+    static bool compile(ScriptBytecode& code);
+    ~ScriptJit();
+    int run(ScriptBytecode& code, ScriptBytecode::Context& ctx, size_t argc, long long *argv, long long *retval);
+    /* Size of the generated machine code in bytes. */
+    size_t size() {
+        return codeSize;
+    }
+    private:
+    ScriptJit() {}
+    // VCall helper: operands holds the destination variable in the low byte and the first argument above it
+    static long long callInterface(Frame *frame, long long fn, long long operands);
+    unsigned char *memory = nullptr;
+    size_t mapped = 0;
+    size_t codeSize = 0;
+    // native address of each bytecode offset for RTS, or null inside an instruction
+    void **returnTargets = nullptr;
+    Entry entry = nullptr;
+};
+
+#endif
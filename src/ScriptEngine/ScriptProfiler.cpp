@@ -0,0 +1,112 @@
+#include "ScriptProfiler.hpp"
+#include "ScriptBytecode.hpp"
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+bool ScriptProfiler::enabled = false;
+
+static std::mutex profilerLock;
+static DynamicArray<ScriptProfiler::Script*, 64> profiledScripts;
+static DynamicArray<ScriptProfiler::Counters*, 16> threadCounterBlocks;
+static thread_local ScriptProfiler::Counters* localCounters = nullptr;
+
+static const char *opcodeNames[] = {
+    #define SCRIPT_PROFILER_OPCODE_NAME(name) #name,
+    SCRIPT_DECODED_OPCODES(SCRIPT_PROFILER_OPCODE_NAME)
+    #undef SCRIPT_PROFILER_OPCODE_NAME
+};
+static const char *callNames[] = {
+    #define SCRIPT_PROFILER_CALL_NAME(name) #name,
+    SCRIPT_INTERFACE_CALLS(SCRIPT_PROFILER_CALL_NAME)
+    #undef SCRIPT_PROFILER_CALL_NAME
+};
+
+ScriptProfiler::Script* ScriptProfiler::add(const char *name) {
+    Script* script = new Script();
+    script->name = strdup(name);
+    std::lock_guard<std::mutex> guard(profilerLock);
+    profiledScripts.append(script);
+    return script;
+}
+
+size_t ScriptProfiler::scriptCount() {
+    std::lock_guard<std::mutex> guard(profilerLock);
+    return profiledScripts.length();
+}
+
+ScriptProfiler::Script* ScriptProfiler::script(size_t i) {
+    std::lock_guard<std::mutex> guard(profilerLock);
+    return i < profiledScripts.length() ? profiledScripts[i] : nullptr;
+}
+
+ScriptProfiler::Counters* ScriptProfiler::threadCounters() {
+    if (localCounters == nullptr) {
+        localCounters = new Counters();
+        memset(localCounters, 0, sizeof(Counters));
+        std::lock_guard<std::mutex> guard(profilerLock);
+        threadCounterBlocks.append(localCounters);
+    }
+    return localCounters;
+}
+
+void ScriptProfiler::total(Counters& out) {
+    memset(&out, 0, sizeof(Counters));
+    std::lock_guard<std::mutex> guard(profilerLock);
+    for (size_t t=0; t<threadCounterBlocks.length(); t++) {
+        Counters* c = threadCounterBlocks[t];
+        for (size_t i=0; i<MAX_OPCODES; i++) {
+            out.opcodes[i] += c->opcodes[i];
+        }
+        for (size_t i=0; i<NumCalls; i++) {
+            out.calls[i] += c->calls[i];
+            out.callNanoseconds[i] += c->callNanoseconds[i];
+        }
+    }
+}
+
+void ScriptProfiler::reset() {
+    std::lock_guard<std::mutex> guard(profilerLock);
+    for (size_t t=0; t<threadCounterBlocks.length(); t++) {
+        memset(threadCounterBlocks[t], 0, sizeof(Counters));
+    }
+    for (size_t i=0; i<profiledScripts.length(); i++) {
+        profiledScripts[i]->runs = 0;
+        profiledScripts[i]->cycles = 0;
+        profiledScripts[i]->nanoseconds = 0;
+    }
+}
+
+const char* ScriptProfiler::opcodeName(size_t op) {
+    return op < sizeof(opcodeNames) / sizeof(opcodeNames[0]) ? opcodeNames[op] : nullptr;
+}
+
+const char* ScriptProfiler::callName(size_t call) {
+    return call < NumCalls ? callNames[call] : nullptr;
+}
+
+bool ScriptProfiler::dumpCSV(const char *fname) {
+    FILE* fd = fopen(fname, "w");
+    if (fd == nullptr) {
+        return false;
+    }
+    Counters totals;
+    total(totals);
+    fprintf(fd, "kind,name,count,cycles,nanoseconds\n");
+    for (size_t i=0; i<scriptCount(); i++) {
+        Script* s = script(i);
+        fprintf(fd, "script,%s,%llu,%llu,%llu\n", s->name, s->runs.load(), s->cycles.load(), s->nanoseconds.load());
+    }
+    for (size_t i=0; opcodeName(i) != nullptr; i++) {
+        if (totals.opcodes[i] > 0) {
+            fprintf(fd, "opcode,%s,%llu,,\n", opcodeName(i), totals.opcodes[i]);
+        }
+    }
+    for (size_t i=0; i<NumCalls; i++) {
+        if (totals.calls[i] > 0) {
+            fprintf(fd, "call,%s,%llu,,%llu\n", callName(i), totals.calls[i], totals.callNanoseconds[i]);
+        }
+    }
+    fclose(fd);
+    return true;
+}
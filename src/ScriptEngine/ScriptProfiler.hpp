@@ -0,0 +1,90 @@
+#ifndef __SCRIPT_PROFILER_HPP__
+#define __SCRIPT_PROFILER_HPP__
+
+#include <atomic>
+#include <chrono>
+#include "../DynamicArray.hpp"
+
+// interface calls timed by the profiler, in ScriptInterface declaration order
+#define SCRIPT_INTERFACE_CALLS(X) \
+    X(isSolid) X(isSpawnable) X(isWall) X(tileFloor) X(tileCeiling) X(tileWall) X(tileLightLevel) \
+    X(getTileId) X(getLightColor) X(tileFlags) X(areaFlags) X(areaCount) \
+    X(cameraX) X(cameraY) X(cameraZ) X(entityX) X(entityY) X(entityZ) \
+    X(entityMoveTowards) X(entityRotate) X(entityTeleport) X(canSeePlayer) X(getEntityTimer) X(setEntityTimer) \
+    X(randomTeleportEntity) X(getDeltaTime)
+
+/* Script execution profiler. While enabled, every run of a registered script adds its instruction count and
+   wall time to the script's totals, and every ScriptInterface call adds its time to the call's totals.
+   Per-opcode hit counts need a build with SCRIPT_PROFILE_OPCODES defined (the ScriptProfiler CMake option),
+   since counting costs a check on every instruction. Opcodes are only counted by the interpreters, native code
+   runs add to the script totals only.
+   Counters are kept per thread so parallel entity scripts don't contend, and summed when read. Read them
+   between frames, while no scripts are running. */
+class ScriptProfiler {
+    public:
+    enum Call {
+        #define SCRIPT_PROFILER_CALL_ENUM(name) Call_##name,
+        SCRIPT_INTERFACE_CALLS(SCRIPT_PROFILER_CALL_ENUM)
+        #undef SCRIPT_PROFILER_CALL_ENUM
+        NumCalls,
+    };
+    static constexpr const size_t MAX_OPCODES = 256;
+    /* Totals of one registered script, shared by every thread running it. */
+    class Script {
+        public:
+        const char *name;
+        std::atomic<unsigned long long> runs{0};
+        std::atomic<unsigned long long> cycles{0};
+        std::atomic<unsigned long long> nanoseconds{0};
+        void record(size_t executed, std::chrono::steady_clock::time_point start) {
+            unsigned long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            runs.fetch_add(1, std::memory_order_relaxed);
+            cycles.fetch_add(executed, std::memory_order_relaxed);
+            nanoseconds.fetch_add(ns, std::memory_order_relaxed);
+        }
+    };
+    /* Counters of one thread. Opcodes are indexed by decoded handler number. */
+    typedef struct {
+        unsigned long long opcodes[MAX_OPCODES];
+        unsigned long long calls[NumCalls];
+        unsigned long long callNanoseconds[NumCalls];
+    } Counters;
+    /* Times an interface call until the end of the scope. */
+    class Scope {
+        Counters *counters;
+        Call call;
+        std::chrono::steady_clock::time_point start;
+        public:
+        Scope(Call call) {
+            counters = enabled ? threadCounters() : nullptr;
+            if (counters != nullptr) {
+                this->call = call;
+                start = std::chrono::steady_clock::now();
+            }
+        }
+        ~Scope() {
+            if (counters != nullptr) {
+                counters->calls[call]++;
+                counters->callNanoseconds[call] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+            }
+        }
+    };
+    static bool enabled;
+    /* Add a script to the profile. The returned totals live until the program exits. */
+    static Script* add(const char *name);
+    static size_t scriptCount();
+    static Script* script(size_t i);
+    /* This thread's counters, created on first use. */
+    static Counters* threadCounters();
+    /* Sum the counters of every thread. */
+    static void total(Counters& out);
+    static void reset();
+    static const char* opcodeName(size_t op);
+    static const char* callName(size_t call);
+    /* Write the script, opcode and interface call totals as CSV. */
+    static bool dumpCSV(const char *fname);
+};
+
+#endif
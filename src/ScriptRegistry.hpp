@@ -4,14 +4,19 @@
 #include "Helpers.hpp"
 #include "Json.hpp"
 #include "Registry.hpp"
+#include "ScriptCache.hpp"
 #include "ScriptEngine/ScriptAssemblyCompiler.hpp"
 #include "ScriptEngine/ScriptBytecode.hpp"
+#include "ScriptEngine/ScriptExpressionCompiler.hpp"
 #include "ScriptEngine/ScriptInterface.hpp"
+#include "ScriptEngine/ScriptJit.hpp"
 
 class Script {
     public:
     ScriptBytecode code;
     unsigned short id;
+    // cache file the bytecode is mapped from, closed if the script was compiled from source
+    MappedFile cache;
     Script() {
         code.setInterface(GloablScriptInterface);
     }
@@ -23,18 +28,66 @@ class Script {
     }
     void load(const unsigned char* bytecode, size_t len) {
         code = ScriptBytecode(bytecode, len);
+        ScriptJit::compile(code);
     }
+    /* Compile script source to optimized bytecode in *out. ".scr" sources go through the expression compiler
+       first, anything else is assembly. Returns the bytecode length, or 0 if the source has errors. */
+    static size_t compile(const char* fname, const char* source, size_t len, ScriptAssemblyCompiler& compiler,
+        unsigned char** out) {
+        char* assembly = nullptr;
+        *out = nullptr;
+        if (IsFileExtension(fname, ".scr")) {
+            ScriptExpressionCompiler front;
+            len = front.compile(source, len, &assembly);
+            if (len == 0) {
+                return 0;
+            }
+            source = assembly;
+        }
+        unsigned char* binary;
+        size_t binlen = compiler.compile(source, len, &binary);
+        size_t optlen = compiler.optimize(binary, binlen, out);
+        delete [] binary;
+        delete [] assembly;
+        return optlen;
+    }
+    /* Load compiled bytecode from the script's cache file if it is fresh, otherwise compile the source and
+       rewrite the cache. */
     bool load(const char* fname) {
-        std::ifstream fd(fname);
+        std::ifstream fd(fname, std::ios::binary);
         if (fd.is_open()) {
             size_t count = fstreamlen(fd);
             char* datastr = new char[count];
             fd.read(datastr, count);
+            // the cache is keyed on the bytes actually read
+            count = fd.gcount();
             fd.close();
-            ScriptAssemblyCompiler compiler;
-            unsigned char* binary;
-            size_t binlen = compiler.compile(datastr, count, &binary);
-            code = ScriptBytecode(binary, binlen);
+            char* cachename = ScriptCache::path(fname);
+            const unsigned char* cached;
+            size_t cachedlen;
+            if (ScriptCache::load(cachename, datastr, count, cache, &cached, &cachedlen)) {
+                code = ScriptBytecode(cached, cachedlen);
+                if (!code.decoded) {
+                    code.unload();
+                    cache.close();
+                }
+            }
+            if (!cache.isOpen()) {
+                ScriptAssemblyCompiler compiler;
+                unsigned char* optimized;
+                size_t optlen = compile(fname, datastr, count, compiler, &optimized);
+                if (optlen == 0) {
+                    delete [] cachename;
+                    delete [] datastr;
+                    return false;
+                }
+                code = ScriptBytecode(optimized, optlen);
+                if (code.decoded && !ScriptCache::save(cachename, datastr, count, compiler, optimized, optlen)) {
+                    printf("Warning: could not write script cache \"%s\"\n", cachename);
+                }
+            }
+            ScriptJit::compile(code);
+            delete [] cachename;
             delete [] datastr;
             return true;
         }
@@ -79,6 +132,7 @@ class ScriptRegistry : public Registry<Script> {
                             }
                         }
                         script->code.setInterface(interface);
+                        script->code.profile = ScriptProfiler::add(id);
                     }
                 }
             }
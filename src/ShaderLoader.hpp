@@ -1,11 +1,15 @@
 #pragma once
 
 #include "raylib.h"
+#include "rlgl.h"
+#include "external/glad.h"
 #include "Helpers.hpp"
+#include <cstdio>
 #include <cstring>
 #include <fstream>
 
 #define GLVERSIONHEADER "#version 330 core\n"
+#define SHADER_MAX_NAME 64
 
 class ShaderLoader {
     public:
@@ -44,4 +48,178 @@ class ShaderLoader {
         }
         return Shader {0};
     }
+};
+
+/* A shader loaded by ShaderLoader with the locations of all its active uniforms and attributes
+ * looked up once at load time. Uniforms are set through the slots returned by uniform(), and
+ * a value that is the same as the last one set for that slot isn't sent to the driver again.
+ * The cache assumes the program's uniforms are only ever set through this class.
+ */
+class ShaderProgram {
+    struct Uniform {
+        char name[SHADER_MAX_NAME];
+        int location;
+        // number of cached components, or 0 before the first value is set
+        int count;
+        union {
+            float f[16];
+            int i[16];
+        } value;
+    };
+    struct Attribute {
+        char name[SHADER_MAX_NAME];
+        int location;
+    };
+    Uniform* uniforms = nullptr;
+    int nuniforms = 0;
+    Attribute* attributes = nullptr;
+    int nattributes = 0;
+
+    // store the value for slot and return true if it differs from the cached one
+    bool _changed(int slot, const void* v, int count) {
+        if (slot < 0 || slot >= nuniforms) {
+            return false;
+        }
+        Uniform& u = uniforms[slot];
+        if (u.count == count && memcmp(u.value.f, v, count*sizeof(float)) == 0) {
+            skipped++;
+            return false;
+        }
+        memcpy(u.value.f, v, count*sizeof(float));
+        u.count = count;
+        sent++;
+        return true;
+    }
+    // copy a GL variable name, dropping the "[0]" GL adds to arrays
+    static void _name(char* dest, const char* name) {
+        snprintf(dest, SHADER_MAX_NAME, "%s", name);
+        char* bracket = strchr(dest, '[');
+        if (bracket != nullptr) {
+            *bracket = 0;
+        }
+    }
+
+    public:
+    Shader shader = {0};
+    // number of uniform updates sent to the driver and skipped as unchanged
+    size_t sent = 0, skipped = 0;
+
+    ShaderProgram() {}
+    ShaderProgram(const ShaderProgram&) = delete;
+    ShaderProgram& operator=(const ShaderProgram&) = delete;
+    /* Load the shader from filename and look up its uniforms and attributes. Returns false if it failed to load. */
+    bool load(const char* filename) {
+        unload();
+        shader = ShaderLoader::load(filename);
+        if (!ready()) {
+            return false;
+        }
+        GLint n = 0;
+        char name[SHADER_MAX_NAME];
+        GLint size;
+        GLenum type;
+        glGetProgramiv(shader.id, GL_ACTIVE_UNIFORMS, &n);
+        uniforms = new Uniform[n > 0 ? n : 1];
+        for (GLint i=0; i<n; i++) {
+            glGetActiveUniform(shader.id, i, SHADER_MAX_NAME, nullptr, &size, &type, name);
+            Uniform& u = uniforms[nuniforms++];
+            _name(u.name, name);
+            u.location = glGetUniformLocation(shader.id, u.name);
+            u.count = 0;
+        }
+        glGetProgramiv(shader.id, GL_ACTIVE_ATTRIBUTES, &n);
+        attributes = new Attribute[n > 0 ? n : 1];
+        for (GLint i=0; i<n; i++) {
+            glGetActiveAttrib(shader.id, i, SHADER_MAX_NAME, nullptr, &size, &type, name);
+            Attribute& a = attributes[nattributes++];
+            _name(a.name, name);
+            a.location = glGetAttribLocation(shader.id, a.name);
+        }
+        return true;
+    }
+    /* Free the program and the location tables. Needs the GL context, so it isn't done on destruction. */
+    void unload() {
+        if (shader.id != 0) {
+            UnloadShader(shader);
+            shader = {0};
+        }
+        if (uniforms != nullptr) {
+            delete [] uniforms;
+            uniforms = nullptr;
+        }
+        if (attributes != nullptr) {
+            delete [] attributes;
+            attributes = nullptr;
+        }
+        nuniforms = nattributes = 0;
+    }
+    bool ready() {
+        return shader.id != 0 && IsShaderReady(shader);
+    }
+    unsigned int id() {
+        return shader.id;
+    }
+    /* Return the slot of the named uniform, or -1 if the shader doesn't use it. Look slots up
+       once and keep them, since this compares names. */
+    int uniform(const char* name) {
+        for (int i=0; i<nuniforms; i++) {
+            if (!strcmp(uniforms[i].name, name)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+    /* Return the location of the named vertex attribute, or -1 if the shader doesn't use it. */
+    int attribute(const char* name) {
+        for (int i=0; i<nattributes; i++) {
+            if (!strcmp(attributes[i].name, name)) {
+                return attributes[i].location;
+            }
+        }
+        return -1;
+    }
+    /* Make this the current program. The setters below only work while it is current. */
+    void use() {
+        glUseProgram(shader.id);
+    }
+    void set(int slot, int v) {
+        if (_changed(slot, &v, 1)) {
+            glUniform1i(uniforms[slot].location, v);
+        }
+    }
+    void set(int slot, float v) {
+        if (_changed(slot, &v, 1)) {
+            glUniform1f(uniforms[slot].location, v);
+        }
+    }
+    void set(int slot, float x, float y) {
+        float v[2] = {x, y};
+        if (_changed(slot, v, 2)) {
+            glUniform2f(uniforms[slot].location, x, y);
+        }
+    }
+    void set(int slot, float x, float y, float z) {
+        float v[3] = {x, y, z};
+        if (_changed(slot, v, 3)) {
+            glUniform3f(uniforms[slot].location, x, y, z);
+        }
+    }
+    void set(int slot, float x, float y, float z, float w) {
+        float v[4] = {x, y, z, w};
+        if (_changed(slot, v, 4)) {
+            glUniform4f(uniforms[slot].location, x, y, z, w);
+        }
+    }
+    void set(int slot, Matrix m) {
+        // column major, as the shaders expect
+        float v[16] = {
+            m.m0, m.m1, m.m2, m.m3,
+            m.m4, m.m5, m.m6, m.m7,
+            m.m8, m.m9, m.m10, m.m11,
+            m.m12, m.m13, m.m14, m.m15,
+        };
+        if (_changed(slot, v, 16)) {
+            glUniformMatrix4fv(uniforms[slot].location, 1, GL_FALSE, v);
+        }
+    }
 };
\ No newline at end of file
@@ -7,6 +7,14 @@
 #include <fstream>
 
 #pragma region MapTile
+// bits of MapTile::flags
+#define TILE_FLAG_SOLID 1
+#define TILE_FLAG_WALL 2
+#define TILE_FLAG_SPAWNABLE 4
+#define TILE_FLAG_BLOCKS_LIGHT 8
+#define TILE_FLAG_SOLID_FLOOR 16
+#define TILE_FLAG_SOLID_CEILING 32
+
 class MapTile {
     public:
     unsigned short id;
@@ -253,3 +261,49 @@ class MapTileRegistry : public Registry<MapTile> {
     }
 };
 #pragma endregion
+
+#pragma region TileTable
+/* Flat read-only copy of the tile registry, indexed by tile id, for lookups that run often (script queries).
+   Flags are kept in their own byte array so scans over many tiles touch as little memory as possible.
+   Ids past the end read as tile 0 would without its flags: not solid, no textures. */
+class TileTable {
+    MapTile* tiles = nullptr;
+    unsigned char* flags = nullptr;
+    size_t count = 0;
+    public:
+    ~TileTable() {
+        clear();
+    }
+    /* Copy every tile of the registry, replacing the previous contents. */
+    void build(MapTileRegistry* reg) {
+        clear();
+        while (reg->has(count)) {
+            count++;
+        }
+        tiles = new MapTile[count];
+        flags = new unsigned char[count];
+        for (size_t i=0; i<count; i++) {
+            tiles[i] = *reg->of(i);
+            flags[i] = tiles[i].flags;
+        }
+    }
+    void clear() {
+        delete [] tiles;
+        delete [] flags;
+        tiles = nullptr;
+        flags = nullptr;
+        count = 0;
+    }
+    size_t length() {
+        return count;
+    }
+    /* TILE_FLAG_* bits of a tile. */
+    inline unsigned char flagsOf(unsigned short id) {
+        return id < count ? flags[id] : 0;
+    }
+    /* The tile, or null if id is not registered. */
+    inline const MapTile* of(unsigned short id) {
+        return id < count ? &tiles[id] : nullptr;
+    }
+};
+#pragma endregion
@@ -1,11 +1,14 @@
 
 #include "Engine.hpp"
+#include "Benchmark.hpp"
+#include "LevelFormat.hpp"
 #include "raylib.h"
 #include "rcamera.h"
 #include "Helpers.hpp"
+#include <cstring>
 
 #pragma region main()
-int main(void)
+int main(int argc, char** argv)
 {
 	BR92Engine engine;
 	SetTraceLogCallback(_logprint);
@@ -18,6 +21,20 @@ int main(void)
 	}
 	engine.LoadConfigs();
 	engine.LoadData();
+	if (argc > 1 && !strcmp(argv[1], "--benchmark")) {
+		bool success = Benchmark::Run(argc > 2 ? argv[2] : nullptr);
+		CloseLog();
+		return success ? 0 : 1;
+	}
+	if (argc > 3 && !strcmp(argv[1], "--convert-level")) {
+		// rewrite a level in the v2 format
+		bool success = LevelFormat::convert(GlobalMapData, argv[2], argv[3]);
+		if (!success) {
+			printf("Failed to convert level \"%s\"\n", argv[2]);
+		}
+		CloseLog();
+		return success ? 0 : 1;
+	}
 	engine.OpenWindow((char*)"BR92Engine");
 	engine.InitMesher();
 	engine.InitCamera();
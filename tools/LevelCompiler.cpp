@@ -0,0 +1,451 @@
+/* Level compiler.
+ * Builds the levels listed in a manifest (assets/levelsrc/levels.txt by default) from their Tiled sources, one
+ * level per job. It does what assets/mklevel.py does for each layer, but writes the sections with MapData's and
+ * LevelFormat's own code, and can bake the light maps into the levels and write them in the v2 format.
+ *
+ *     LevelCompiler [-m manifest] [-o dir] [-c chunksize] [-j workers] [--v2] [--bake] [-v] [level ...]
+ */
+#include "../src/AssetPath.hpp"
+#include "../src/Engine.hpp"
+#include "../src/Helpers.hpp"
+#include "../src/JobSystem.hpp"
+#include "../src/LevelFormat.hpp"
+#include "../src/MapData.hpp"
+#include "../src/Registries.hpp"
+#include "raylib.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define LEVEL_MANIFEST_FILE "assets/levelsrc/levels.txt"
+#define LEVEL_CHUNK_SIZE 10
+// tile IDs in the sources are offset by 2 from the tile registry; anything below is void
+#define LEVEL_SOURCE_TILE_OFFSET 2
+// Tiled keeps the flip and rotation flags in the top bits of a GID
+#define TMX_GID_MASK 0x1FFFFFFF
+
+#pragma region LevelLayer
+/* One source grid of a level, and the sections that follow its tiles. */
+struct LevelLayer {
+    std::string source;
+    int x = 0, y = 0, z = 0;
+    std::string sections;
+};
+#pragma endregion
+
+#pragma region LevelSource
+struct LevelSource {
+    std::string name;
+    std::vector<LevelLayer> layers;
+    // results
+    bool ok = false;
+    std::string error;
+    size_t chunks = 0, bytes = 0;
+    double ms = 0;
+};
+#pragma endregion
+
+#pragma region Options
+struct Options {
+    const char* manifest = LEVEL_MANIFEST_FILE;
+    std::string out = assetPathLevels;
+    int chunkSize = LEVEL_CHUNK_SIZE;
+    size_t workers = 0;
+    bool v2 = false;
+    bool bake = false;
+    bool verbose = false;
+    std::vector<std::string> levels;
+};
+#pragma endregion
+
+// raylib's GetTime() needs a window
+static double _msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+#pragma region _readFile()
+static bool _readFile(const std::string& path, std::string& out) {
+    std::ifstream fd(path, std::ios::binary|std::ios::in);
+    if (!fd.is_open()) {
+        return false;
+    }
+    std::ostringstream buf;
+    buf << fd.rdbuf();
+    out = buf.str();
+    return true;
+}
+#pragma endregion
+
+#pragma region _parseOption()
+/* Append the section for a layer option to sections, in the formats mklevel.py writes them. */
+static bool _parseOption(const char* opt, const char* arg, std::string& sections, std::string& error) {
+    std::ostringstream out(std::ios::binary|std::ios::out);
+    if (!strcmp(opt, "--fog")) {
+        unsigned int rgba;
+        float data[2];
+        if (sscanf(arg, "0x%8x,%f,%f", &rgba, &data[0], &data[1]) != 3) {
+            error = "fog must be a hex color 0xRRGGBBAA and two floats min,max";
+            return false;
+        }
+        unsigned char payload[12] = {(unsigned char)(rgba >> 24), (unsigned char)(rgba >> 16), (unsigned char)(rgba >> 8),
+            (unsigned char)rgba};
+        memcpy(&payload[4], data, 8);
+        LevelFormat::writeSection(out, FOG_MAGIC_NUMBER_STR, payload, sizeof(payload));
+    } else if (!strcmp(opt, "--light")) {
+        float level;
+        if (sscanf(arg, "%f", &level) != 1) {
+            error = "light level must be a float";
+            return false;
+        }
+        LevelFormat::writeSection(out, LIGHT_MULTIPLIER_MAGIC_NUMBER_STR, &level, 4);
+    } else if (!strcmp(opt, "--entity")) {
+        unsigned int type;
+        float data[4];
+        if (sscanf(arg, "%u,%f,%f,%f,%f", &type, &data[0], &data[1], &data[2], &data[3]) != 5 || type > 0xFFFF) {
+            error = "entity must be a type followed by four floats x,y,z,rotation";
+            return false;
+        }
+        unsigned char payload[18];
+        unsigned short t = type;
+        memcpy(&payload[0], &t, 2);
+        memcpy(&payload[2], data, 16);
+        LevelFormat::writeSection(out, ENTITY_MAGIC_NUMBER_STR, payload, sizeof(payload));
+    } else {
+        error = std::string("unknown option ") + opt;
+        return false;
+    }
+    sections += out.str();
+    return true;
+}
+#pragma endregion
+
+#pragma region _loadManifest()
+static bool _loadManifest(const char* fname, std::vector<LevelSource>& levels) {
+    std::string text;
+    if (!_readFile(fname, text)) {
+        printf("Failed to read level manifest \"%s\"\n", fname);
+        return false;
+    }
+    // sources are relative to the manifest
+    std::string dir = fname;
+    size_t slash = dir.find_last_of("/\\");
+    dir = slash == std::string::npos ? "" : dir.substr(0, slash + 1);
+    std::istringstream lines(text);
+    std::string line;
+    for (size_t lineno=1; std::getline(lines, line); lineno++) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        std::istringstream words(line);
+        std::vector<std::string> tokens;
+        for (std::string word; words >> word;) {
+            tokens.push_back(word);
+        }
+        if (tokens.empty() || tokens[0][0] == '#') {
+            continue;
+        }
+        LevelSource level;
+        level.name = tokens[0];
+        for (size_t i=1; i<tokens.size(); i++) {
+            std::string& token = tokens[i];
+            std::string error;
+            if (token.size() > 2 && token[0] == '-' && token[1] == '-') {
+                if (level.layers.empty() || i + 1 >= tokens.size()) {
+                    error = token + " needs a layer before it and an argument after it";
+                } else {
+                    _parseOption(token.c_str(), tokens[i+1].c_str(), level.layers.back().sections, error);
+                    i++;
+                }
+            } else {
+                LevelLayer layer;
+                size_t at = token.find('@');
+                if (at == std::string::npos || sscanf(token.c_str() + at + 1, "%d,%d,%d", &layer.x, &layer.y, &layer.z) != 3) {
+                    error = "layer " + token + " must be written as source@x,y,z";
+                } else {
+                    layer.source = dir + token.substr(0, at);
+                    level.layers.push_back(layer);
+                }
+            }
+            if (!error.empty()) {
+                printf("%s:%llu: %s\n", fname, (unsigned long long)lineno, error.c_str());
+                return false;
+            }
+        }
+        levels.push_back(level);
+    }
+    return true;
+}
+#pragma endregion
+
+#pragma region _readGrid()
+/* Read the tile grid of a .csv export or a .tmx map with a CSV encoded layer, as the values of the .csv. */
+static bool _readGrid(const std::string& path, std::vector<std::vector<int>>& rows, std::string& error) {
+    std::string text;
+    if (!_readFile(path, text)) {
+        error = "can't read " + path;
+        return false;
+    }
+    int offset = 0;
+    size_t start = 0, end = text.size();
+    if (path.size() > 4 && !path.compare(path.size() - 4, 4, ".tmx")) {
+        // GIDs count from the tileset's firstgid, where the .csv export counts from 0
+        size_t tileset = text.find("<tileset");
+        size_t firstgid = text.find("firstgid=\"", tileset);
+        start = text.find("<data encoding=\"csv\">");
+        if (tileset == std::string::npos || firstgid == std::string::npos || start == std::string::npos) {
+            error = path + " must have a tileset and a CSV encoded layer";
+            return false;
+        }
+        offset = atoi(text.c_str() + firstgid + 10);
+        start = text.find('>', start) + 1;
+        end = text.find("</data>", start);
+        if (end == std::string::npos) {
+            error = path + " has an unterminated layer";
+            return false;
+        }
+    }
+    std::vector<int> row;
+    const char* p = text.c_str() + start;
+    const char* e = text.c_str() + end;
+    while (p < e) {
+        if (*p == '\n') {
+            if (!row.empty()) {
+                rows.push_back(row);
+                row.clear();
+            }
+            p++;
+        } else if ((*p >= '0' && *p <= '9') || *p == '-') {
+            char* next;
+            long v = strtol(p, &next, 10);
+            if (offset > 0) {
+                v = (v & TMX_GID_MASK) - offset;
+            }
+            row.push_back((int)v);
+            p = next;
+        } else {
+            p++;
+        }
+    }
+    if (!row.empty()) {
+        rows.push_back(row);
+    }
+    if (rows.empty()) {
+        error = path + " has no tiles";
+        return false;
+    }
+    for (auto& r : rows) {
+        if (r.size() != rows[0].size()) {
+            error = path + " has rows of different lengths";
+            return false;
+        }
+    }
+    return true;
+}
+#pragma endregion
+
+#pragma region _compileLayer()
+/* Write the TILE sections of a layer, one per chunkSize square that isn't all void. The first row of the source is
+   the far edge of the level, as in mklevel.py. */
+static bool _compileLayer(MapData* map, LevelLayer& layer, int chunkSize, std::ostream& out, size_t& chunks,
+    std::string& error) {
+    std::vector<std::vector<int>> rows;
+    if (!_readGrid(layer.source, rows, error)) {
+        return false;
+    }
+    int height = rows.size();
+    int width = rows[0].size();
+    TileArray arr;
+    for (int zz=0; zz<height; zz+=chunkSize) {
+        for (int xx=0; xx<width; xx+=chunkSize) {
+            int w = width - xx < chunkSize ? width - xx : chunkSize;
+            int h = height - zz < chunkSize ? height - zz : chunkSize;
+            if (arr.width() != w || arr.height() != h) {
+                arr.resize(w, h);
+            }
+            bool empty = true;
+            for (int z=0; z<h; z++) {
+                std::vector<int>& row = rows[height - 1 - (zz + z)];
+                for (int x=0; x<w; x++) {
+                    int v = row[xx + x] - LEVEL_SOURCE_TILE_OFFSET;
+                    if (v < 0) {
+                        v = 0;
+                    }
+                    empty = empty && v == 0;
+                    arr[{x, z}] = v;
+                }
+            }
+            if (!empty) {
+                map->SaveMapTile(out, &arr, {layer.x + xx, layer.y, layer.z + zz});
+                chunks++;
+            }
+        }
+    }
+    out << layer.sections;
+    return true;
+}
+#pragma endregion
+
+#pragma region _compileLevel()
+static void _compileLevel(LevelSource& level, const Options& opts) {
+    auto start = std::chrono::steady_clock::now();
+    MapData map;
+    map.SetTileRegistry(GlobalMapTileRegistry);
+    map.deferEntities = true;
+    std::ostringstream out(std::ios::binary|std::ios::out);
+    for (auto& layer : level.layers) {
+        if (!_compileLayer(&map, layer, opts.chunkSize, out, level.chunks, level.error)) {
+            return;
+        }
+    }
+    std::string bytes = out.str();
+    if (opts.bake || opts.v2) {
+        // parse the level back with the engine's loader to light it and repack it
+        RBuffer data((unsigned char*)bytes.data(), bytes.size());
+        if (!map.LoadMap(data)) {
+            level.error = "compiled level doesn't load";
+            return;
+        }
+        if (opts.bake) {
+            map.BuildLighting();
+        }
+        std::ostringstream packed(std::ios::binary|std::ios::out);
+        if (opts.v2) {
+            std::string sections;
+            data.seek(0);
+            LevelFormat::copySections(data, sections);
+            map.SaveMapV2(packed, sections, opts.bake);
+        } else {
+            packed << bytes;
+            for (size_t i=0; i<map.chunkCount(); i++) {
+                map.SaveLightMap(packed, i);
+            }
+        }
+        map.ClearMap();
+        bytes = packed.str();
+    }
+    std::string fname = opts.out + level.name + ".dat";
+    std::ofstream fd(fname, std::ios::binary|std::ios::out);
+    if (!fd.is_open()) {
+        level.error = "can't write " + fname;
+        return;
+    }
+    fd.write(bytes.data(), bytes.size());
+    fd.close();
+    if (!fd.good()) {
+        level.error = "can't write " + fname;
+        return;
+    }
+    level.bytes = bytes.size();
+    level.ms = _msSince(start);
+    level.ok = true;
+}
+#pragma endregion
+
+#pragma region _usage()
+static void _usage(const char* exe) {
+    printf("Usage: %s [-m manifest] [-o dir] [-c chunksize] [-j workers] [--v2] [--bake] [-v] [level ...]\n"
+        "Builds the levels in the manifest (default " LEVEL_MANIFEST_FILE "), or only those named.\n"
+        "  -o dir        output folder (default %s)\n"
+        "  -c chunksize  tiles per chunk side, up to 255 (default %d)\n"
+        "  -j workers    levels built at once (default one per hardware thread)\n"
+        "  --v2          write the compressed v2 format\n"
+        "  --bake        bake the light maps into the levels\n"
+        "  -v            log what the engine logs\n",
+        exe, assetPathLevels, LEVEL_CHUNK_SIZE);
+}
+#pragma endregion
+
+#pragma region main()
+int main(int argc, char** argv) {
+    Options opts;
+    for (int i=1; i<argc; i++) {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(arg, "-m") && hasValue) {
+            opts.manifest = argv[++i];
+        } else if (!strcmp(arg, "-o") && hasValue) {
+            opts.out = argv[++i];
+            if (!opts.out.empty() && opts.out.back() != '/' && opts.out.back() != '\\') {
+                opts.out += '/';
+            }
+        } else if (!strcmp(arg, "-c") && hasValue) {
+            opts.chunkSize = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-j") && hasValue) {
+            opts.workers = atoi(argv[++i]);
+        } else if (!strcmp(arg, "--v2")) {
+            opts.v2 = true;
+        } else if (!strcmp(arg, "--bake")) {
+            opts.bake = true;
+        } else if (!strcmp(arg, "-v")) {
+            opts.verbose = true;
+        } else if (arg[0] == '-') {
+            _usage(argv[0]);
+            return arg[1] == 'h' || !strcmp(arg, "--help") ? 0 : 1;
+        } else {
+            opts.levels.push_back(arg);
+        }
+    }
+    if (opts.chunkSize < 1 || opts.chunkSize > 255) {
+        printf("Chunk size must be between 1 and 255\n");
+        return 1;
+    }
+
+    std::vector<LevelSource> all, levels;
+    if (!_loadManifest(opts.manifest, all)) {
+        return 1;
+    }
+    for (auto& level : all) {
+        bool wanted = opts.levels.empty();
+        for (auto& name : opts.levels) {
+            wanted = wanted || name == level.name;
+        }
+        if (wanted) {
+            levels.push_back(level);
+        }
+    }
+    if (levels.size() < (opts.levels.empty() ? all.size() : opts.levels.size())) {
+        printf("Some of the named levels aren't in %s\n", opts.manifest);
+        return 1;
+    }
+
+    SetTraceLogCallback(_logprint);
+    SetTraceLogLevel(opts.verbose ? LOG_INFO : LOG_WARNING);
+    // the tile registry is needed to read levels back and light them
+    BR92Engine engine;
+    engine.Init();
+    if (opts.workers > 0) {
+        delete GlobalJobSystem;
+        GlobalJobSystem = new JobSystem(opts.workers);
+    }
+    if (!engine.LoadRegistries()) {
+        printf("Failed to load the registries\n");
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    GlobalJobSystem->parallelFor(levels.size(), [&](size_t i) {
+        _compileLevel(levels[i], opts);
+    });
+    double ms = _msSince(start);
+
+    bool success = true;
+    for (auto& level : levels) {
+        if (level.ok) {
+            printf("%s: %llu chunks, %llu bytes in %.2f ms\n", level.name.c_str(), (unsigned long long)level.chunks,
+                (unsigned long long)level.bytes, level.ms);
+        } else {
+            printf("%s: %s\n", level.name.c_str(), level.error.c_str());
+            success = false;
+        }
+    }
+    printf("Built %llu levels in %.2f ms\n", (unsigned long long)levels.size(), ms);
+    CloseLog();
+    return success ? 0 : 1;
+}
+#pragma endregion